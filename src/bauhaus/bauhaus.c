@@ -2275,6 +2275,7 @@ static gboolean dt_bauhaus_slider_button_press(GtkWidget *widget, GdkEventButton
       dt_bauhaus_slider_set_normalized(w, (event->x / tmp.width - l) / (r - l));
       dt_bauhaus_slider_data_t *d = &w->data.slider;
       d->is_dragging = 1;
+      if(w->module) dt_dev_set_interacting(darktable.develop, TRUE);
       int delay = CLAMP(darktable.develop->average_delay * 3 / 2, DT_BAUHAUS_SLIDER_VALUE_CHANGED_DELAY_MIN,
                         DT_BAUHAUS_SLIDER_VALUE_CHANGED_DELAY_MAX);
       // timeout_handle should always be zero here, but check just in case
@@ -2297,6 +2298,7 @@ static gboolean dt_bauhaus_slider_button_release(GtkWidget *widget, GdkEventButt
     GtkAllocation tmp;
     gtk_widget_get_allocation(GTK_WIDGET(w), &tmp);
     d->is_dragging = 0;
+    if(w->module) dt_dev_set_interacting(darktable.develop, FALSE);
     if(d->timeout_handle) g_source_remove(d->timeout_handle);
     d->timeout_handle = 0;
     const float l = 4.0f / tmp.width;
@@ -25,9 +25,11 @@
  *  - profit
  */
 
+#include "cli/server.h"
 #include "common/collection.h"
 #include "common/darktable.h"
 #include "common/debug.h"
+#include "common/dtpthread.h"
 #include "common/exif.h"
 #include "common/film.h"
 #include "common/history.h"
@@ -40,6 +42,7 @@
 #include "control/conf.h"
 #include "develop/imageop.h"
 
+#include <glib/gstdio.h>
 #include <inttypes.h>
 #include <libintl.h>
 #include <sys/time.h>
@@ -55,8 +58,352 @@ static void usage(const char *progname)
 {
   fprintf(stderr, "usage: %s <input file> [<xmp file>] <output file> [--width <max width>,--height <max "
                   "height>,--bpp <bpp>,--hq <0|1|true|false>,--upscale <0|1|true|false>,--style <style name>, --overwrite,"
-                  "--verbose] [--core <darktable options>]\n",
-          progname);
+                  "--verbose] [--core <darktable options>]\n"
+                  "       %s --batch <manifest file|-> [--jobs <N>] [--timing-log <file|->] [options] "
+                  "[--core <darktable options>]\n"
+                  "       %s --serve <socket path> [--jobs <N>] [--queue <N>] [--hq <0|1|true|false>,"
+                  "--upscale <0|1|true|false>] [--core <darktable options>]\n",
+          progname, progname, progname);
+}
+
+// clamp the requested size to what storage and format support and apply the style settings
+static void _set_format_params(dt_imageio_module_storage_t *storage, dt_imageio_module_data_t *sdata,
+                               dt_imageio_module_format_t *format, dt_imageio_module_data_t *fdata,
+                               const int width, const int height, const char *style, const int overwrite)
+{
+  uint32_t w, h, fw, fh, sw, sh;
+  fw = fh = sw = sh = 0;
+  storage->dimension(storage, sdata, &sw, &sh);
+  format->dimension(format, fdata, &fw, &fh);
+
+  if(sw == 0 || fw == 0)
+    w = sw > fw ? sw : fw;
+  else
+    w = sw < fw ? sw : fw;
+
+  if(sh == 0 || fh == 0)
+    h = sh > fh ? sh : fh;
+  else
+    h = sh < fh ? sh : fh;
+
+  fdata->max_width = width;
+  fdata->max_height = height;
+  fdata->max_width = (w != 0 && fdata->max_width > w) ? w : fdata->max_width;
+  fdata->max_height = (h != 0 && fdata->max_height > h) ? h : fdata->max_height;
+  fdata->style[0] = '\0';
+  fdata->style_append = 1; // make append the default and override with --overwrite
+
+  if(style)
+  {
+    g_strlcpy((char *)fdata->style, style, DT_MAX_STYLE_NAME_LENGTH);
+    fdata->style[127] = '\0';
+    if(overwrite)
+      fdata->style_append = 0;
+  }
+}
+
+/** one line of a batch manifest: an input file or folder, an optional xmp and the output file */
+typedef struct dt_cli_job_t
+{
+  gchar *input;
+  gchar *xmp;
+  gchar *output; // output filename without the extension, as the disk storage wants it
+  dt_imageio_module_format_t *format;
+  int total;     // number of images the input expanded to
+} dt_cli_job_t;
+
+/** one image to export, several of them belong to the same job when the input is a folder */
+typedef struct dt_cli_task_t
+{
+  dt_cli_job_t *job;
+  int imgid;
+  int num;
+} dt_cli_task_t;
+
+typedef struct dt_cli_batch_t
+{
+  dt_pthread_mutex_t lock;
+  GArray *tasks;
+  guint next; // next task to be picked up by a worker
+  dt_imageio_module_storage_t *storage;
+  int width, height, overwrite;
+  const char *style;
+  gboolean high_quality, upscale;
+  FILE *timing_log;
+  int exported, failed;
+  double start;
+  int omp_threads; // openmp threads for the parallel loops of each export pipeline
+} dt_cli_batch_t;
+
+static void _job_free(gpointer data)
+{
+  dt_cli_job_t *job = (dt_cli_job_t *)data;
+  g_free(job->input);
+  g_free(job->xmp);
+  g_free(job->output);
+  g_free(job);
+}
+
+// split the output filename into the pattern for the storage and the format given by the extension
+static int _job_set_output(dt_cli_job_t *job, const char *output)
+{
+  job->output = g_strdup(output);
+  char *ext = job->output + strlen(job->output);
+  while(ext > job->output && *ext != '.') ext--;
+  if(ext == job->output) return 1;
+  *ext = '\0';
+  ext++;
+
+  if(!strcmp(ext, "jpg")) ext = "jpeg";
+
+  if(!strcmp(ext, "tif")) ext = "tiff";
+
+  job->format = dt_imageio_get_format_by_name(ext);
+  return job->format == NULL;
+}
+
+/** read a manifest with one job per line: <input> [TAB <xmp file>] TAB <output file>.
+ *  empty lines and lines starting with # are ignored. returns the number of broken lines. */
+static int _batch_read_manifest(const char *filename, GPtrArray *jobs)
+{
+  FILE *f = strcmp(filename, "-") ? g_fopen(filename, "rb") : stdin;
+  if(!f)
+  {
+    fprintf(stderr, _("error: can't open manifest %s"), filename);
+    fprintf(stderr, "\n");
+    return 1;
+  }
+
+  int errors = 0, line_number = 0;
+  char line[3 * PATH_MAX];
+  while(fgets(line, sizeof(line), f))
+  {
+    line_number++;
+    g_strchomp(line);
+    if(line[0] == '\0' || line[0] == '#') continue;
+
+    gchar **fields = g_strsplit(line, "\t", -1);
+    const guint count = g_strv_length(fields);
+    dt_cli_job_t *job = g_malloc0(sizeof(dt_cli_job_t));
+    int broken = count < 2 || count > 3;
+    if(!broken)
+    {
+      job->input = g_strdup(fields[0]);
+      if(count == 3 && *fields[1]) job->xmp = g_strdup(fields[1]);
+      broken = _job_set_output(job, fields[count - 1]);
+    }
+    g_strfreev(fields);
+
+    if(broken)
+    {
+      fprintf(stderr, _("error: can't parse line %d of manifest %s"), line_number, filename);
+      fprintf(stderr, "\n");
+      _job_free(job);
+      errors++;
+      continue;
+    }
+    g_ptr_array_add(jobs, job);
+  }
+
+  if(f != stdin) fclose(f);
+  return errors;
+}
+
+// import the input of a job and attach its xmp, returns the image ids to export
+static GList *_job_import(dt_cli_job_t *job, GHashTable *used_ids)
+{
+  GList *id_list = NULL;
+
+  if(g_file_test(job->input, G_FILE_TEST_IS_DIR))
+  {
+    const int filmid = dt_film_import(job->input);
+    if(filmid) id_list = dt_film_get_image_ids(filmid);
+  }
+  else
+  {
+    dt_film_t film;
+    gchar *directory = g_path_get_dirname(job->input);
+    const int filmid = dt_film_new(&film, directory);
+    g_free(directory);
+    int id = filmid ? dt_image_import(filmid, job->input, TRUE) : 0;
+    // the same file listed again with another xmp needs an image of its own to carry that history
+    if(id && job->xmp && g_hash_table_contains(used_ids, GINT_TO_POINTER(id))) id = dt_image_duplicate(id);
+    if(id > 0) id_list = g_list_append(id_list, GINT_TO_POINTER(id));
+  }
+
+  for(GList *iter = id_list; iter; iter = g_list_next(iter))
+  {
+    const int id = GPOINTER_TO_INT(iter->data);
+    g_hash_table_add(used_ids, GINT_TO_POINTER(id));
+    if(!job->xmp) continue;
+
+    dt_image_t *image = dt_image_cache_get(darktable.image_cache, id, 'w');
+    const int failed = dt_exif_xmp_read(image, job->xmp, 1) != 0;
+    // don't write new xmp:
+    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+    if(failed)
+    {
+      fprintf(stderr, _("error: can't open xmp file %s"), job->xmp);
+      fprintf(stderr, "\n");
+      g_list_free(id_list);
+      return NULL;
+    }
+  }
+
+  return id_list;
+}
+
+static void *_batch_worker(void *data)
+{
+  dt_cli_batch_t *b = (dt_cli_batch_t *)data;
+  dt_imageio_module_storage_t *storage = b->storage;
+
+#ifdef _OPENMP
+  // the pipelines share the cores instead of each of them starting a full team
+  omp_set_num_threads(b->omp_threads);
+#endif
+
+  // TODO: do we want to use the settings from conf?
+  // TODO: expose these via command line arguments
+  const dt_colorspaces_color_profile_type_t icc_type = DT_COLORSPACE_NONE;
+  const gchar *icc_filename = NULL;
+  const dt_iop_color_intent_t icc_intent = DT_INTENT_LAST;
+
+  while(TRUE)
+  {
+    dt_pthread_mutex_lock(&b->lock);
+    const guint i = b->next;
+    if(i < b->tasks->len) b->next++;
+    dt_pthread_mutex_unlock(&b->lock);
+    if(i >= b->tasks->len) break;
+
+    const dt_cli_task_t *task = &g_array_index(b->tasks, dt_cli_task_t, i);
+    const dt_cli_job_t *job = task->job;
+    dt_imageio_module_format_t *format = job->format;
+    const double start = dt_get_wtime();
+
+    // every export gets parameters of its own, formats keep their encoder state in there
+    dt_imageio_module_data_t *sdata = storage->get_params(storage);
+    dt_imageio_module_data_t *fdata = format->get_params(format);
+    const char *ext = "";
+    int failed = 1;
+    if(sdata && fdata)
+    {
+      // same hack as for a single image, the disk storage params start with the filename
+      g_strlcpy((char *)sdata, job->output, DT_MAX_PATH_FOR_PARAMS);
+      _set_format_params(storage, sdata, format, fdata, b->width, b->height, b->style, b->overwrite);
+      ext = format->extension(fdata);
+      failed = storage->store(storage, sdata, task->imgid, format, fdata, task->num, job->total,
+                              b->high_quality, b->upscale, icc_type, icc_filename, icc_intent);
+    }
+    if(sdata) storage->free_params(storage, sdata);
+    if(fdata) format->free_params(format, fdata);
+
+    const double end = dt_get_wtime();
+    dt_pthread_mutex_lock(&b->lock);
+    if(failed)
+      b->failed++;
+    else
+      b->exported++;
+    if(b->timing_log)
+    {
+      fprintf(b->timing_log, "%s\t%d\t%s.%s\t%s\t%.3f\t%.3f\n", job->input, task->imgid, job->output, ext,
+              failed ? "failed" : "ok", start - b->start, end - start);
+      fflush(b->timing_log);
+    }
+    dt_pthread_mutex_unlock(&b->lock);
+  }
+
+  return NULL;
+}
+
+/** export everything listed in a manifest from one darktable instance, running several export
+ *  pipelines in parallel. their openmp teams split the cores between them. returns the number of
+ *  images or manifest lines that failed. */
+static int _batch_export(const char *manifest, const int jobs, const char *timing_log, const int width,
+                         const int height, const char *style, const int overwrite, const gboolean high_quality,
+                         const gboolean upscale)
+{
+  dt_cli_batch_t b = { 0 };
+  b.width = width;
+  b.height = height;
+  b.style = style;
+  b.overwrite = overwrite;
+  b.high_quality = high_quality;
+  b.upscale = upscale;
+
+  b.storage = dt_imageio_get_storage_by_name("disk"); // only exporting to disk makes sense
+  if(b.storage == NULL)
+  {
+    fprintf(
+        stderr, "%s\n",
+        _("cannot find disk storage module. please check your installation, something seems to be broken."));
+    return 1;
+  }
+
+  GPtrArray *job_list = g_ptr_array_new_with_free_func(_job_free);
+  int errors = _batch_read_manifest(manifest, job_list);
+
+  // imports go through the library one after the other, only the exports run in parallel
+  b.tasks = g_array_new(FALSE, FALSE, sizeof(dt_cli_task_t));
+  GHashTable *used_ids = g_hash_table_new(NULL, NULL);
+  for(guint k = 0; k < job_list->len; k++)
+  {
+    dt_cli_job_t *job = g_ptr_array_index(job_list, k);
+    GList *id_list = _job_import(job, used_ids);
+    job->total = g_list_length(id_list);
+    if(job->total == 0)
+    {
+      fprintf(stderr, _("error: can't open file %s"), job->input);
+      fprintf(stderr, "\n");
+      errors++;
+    }
+    int num = 1;
+    for(GList *iter = id_list; iter; iter = g_list_next(iter), num++)
+    {
+      const dt_cli_task_t task = { job, GPOINTER_TO_INT(iter->data), num };
+      g_array_append_val(b.tasks, task);
+    }
+    g_list_free(id_list);
+  }
+  g_hash_table_destroy(used_ids);
+
+  if(timing_log)
+  {
+    b.timing_log = strcmp(timing_log, "-") ? g_fopen(timing_log, "wb") : stdout;
+    if(b.timing_log)
+      fprintf(b.timing_log, "# input\timgid\toutput\tstatus\tstart\tseconds\n");
+    else
+    {
+      fprintf(stderr, _("error: can't open timing log %s"), timing_log);
+      fprintf(stderr, "\n");
+    }
+  }
+
+  const int nthreads = MAX(1, MIN(jobs, (int)MAX(b.tasks->len, 1)));
+  b.omp_threads = MAX(1, darktable.num_openmp_threads / nthreads);
+  pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+  dt_pthread_mutex_init(&b.lock, NULL);
+  b.start = dt_get_wtime();
+
+  int started = 0;
+  for(; started < nthreads; started++)
+    if(dt_pthread_create(&threads[started], _batch_worker, &b)) break;
+  // could not start a single thread? do the work ourselves.
+  if(!started) _batch_worker(&b);
+  for(int k = 0; k < started; k++) pthread_join(threads[k], NULL);
+
+  const double elapsed = dt_get_wtime() - b.start;
+  fprintf(stderr, _("%d images exported, %d failed, in %.02f s (%.02f images/s)\n"), b.exported, b.failed,
+          elapsed, elapsed > 0.0 ? b.exported / elapsed : 0.0);
+
+  if(b.timing_log && b.timing_log != stdout) fclose(b.timing_log);
+  dt_pthread_mutex_destroy(&b.lock);
+  free(threads);
+  g_array_free(b.tasks, TRUE);
+  g_ptr_array_free(job_list, TRUE);
+
+  return errors + b.failed;
 }
 
 int main(int argc, char *arg[])
@@ -72,7 +419,10 @@ int main(int argc, char *arg[])
   char *xmp_filename = NULL;
   char *output_filename = NULL;
   char *style = NULL;
-  int file_counter = 0;
+  char *batch_filename = NULL;
+  char *timing_log = NULL;
+  char *socket_path = NULL;
+  int file_counter = 0, jobs = 1, queue_size = 16;
   int width = 0, height = 0, bpp = 0, overwrite = 0;
   gboolean verbose = FALSE, high_quality = TRUE, upscale = FALSE;
 
@@ -150,6 +500,31 @@ int main(int argc, char *arg[])
       {
         overwrite = 1;
       }
+      else if(!strcmp(arg[k], "--batch") && argc > k + 1)
+      {
+        k++;
+        batch_filename = arg[k];
+      }
+      else if(!strcmp(arg[k], "--jobs") && argc > k + 1)
+      {
+        k++;
+        jobs = MIN(MAX(atoi(arg[k]), 1), 64);
+      }
+      else if(!strcmp(arg[k], "--serve") && argc > k + 1)
+      {
+        k++;
+        socket_path = arg[k];
+      }
+      else if(!strcmp(arg[k], "--queue") && argc > k + 1)
+      {
+        k++;
+        queue_size = MIN(MAX(atoi(arg[k]), 1), 1024);
+      }
+      else if(!strcmp(arg[k], "--timing-log") && argc > k + 1)
+      {
+        k++;
+        timing_log = arg[k];
+      }
       else if(!strcmp(arg[k], "-v") || !strcmp(arg[k], "--verbose"))
       {
         verbose = TRUE;
@@ -183,6 +558,55 @@ int main(int argc, char *arg[])
   for(; k < argc; k++) m_arg[m_argc++] = arg[k];
   m_arg[m_argc] = NULL;
 
+  if(socket_path)
+  {
+    if(file_counter != 0 || batch_filename)
+    {
+      usage(arg[0]);
+      free(m_arg);
+      exit(1);
+    }
+
+    // init dt without gui and without data.db, then keep it warm for all requests:
+    if(dt_init(m_argc, m_arg, FALSE, TRUE, NULL))
+    {
+      free(m_arg);
+      exit(1);
+    }
+
+    const int failed = dt_cli_serve(socket_path, jobs, queue_size, high_quality, upscale);
+
+    dt_cleanup();
+
+    free(m_arg);
+    exit(failed ? 1 : 0);
+  }
+
+  if(batch_filename)
+  {
+    if(file_counter != 0)
+    {
+      usage(arg[0]);
+      free(m_arg);
+      exit(1);
+    }
+
+    // init dt without gui and without data.db:
+    if(dt_init(m_argc, m_arg, FALSE, TRUE, NULL))
+    {
+      free(m_arg);
+      exit(1);
+    }
+
+    const int failed = _batch_export(batch_filename, jobs, timing_log, width, height, style, overwrite,
+                                     high_quality, upscale);
+
+    dt_cleanup();
+
+    free(m_arg);
+    exit(failed ? 1 : 0);
+  }
+
   if(file_counter < 2 || file_counter > 3)
   {
     usage(arg[0]);
@@ -346,35 +770,7 @@ int main(int argc, char *arg[])
     exit(1);
   }
 
-  uint32_t w, h, fw, fh, sw, sh;
-  fw = fh = sw = sh = 0;
-  storage->dimension(storage, sdata, &sw, &sh);
-  format->dimension(format, fdata, &fw, &fh);
-
-  if(sw == 0 || fw == 0)
-    w = sw > fw ? sw : fw;
-  else
-    w = sw < fw ? sw : fw;
-
-  if(sh == 0 || fh == 0)
-    h = sh > fh ? sh : fh;
-  else
-    h = sh < fh ? sh : fh;
-
-  fdata->max_width = width;
-  fdata->max_height = height;
-  fdata->max_width = (w != 0 && fdata->max_width > w) ? w : fdata->max_width;
-  fdata->max_height = (h != 0 && fdata->max_height > h) ? h : fdata->max_height;
-  fdata->style[0] = '\0';
-  fdata->style_append = 1; // make append the default and override with --overwrite
-
-  if(style) 
-  {
-    g_strlcpy((char *)fdata->style, style, DT_MAX_STYLE_NAME_LENGTH);
-    fdata->style[127] = '\0';
-    if(overwrite)
-      fdata->style_append = 0;
-  }
+  _set_format_params(storage, sdata, format, fdata, width, height, style, overwrite);
 
   if(storage->initialize_store)
   {
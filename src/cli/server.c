@@ -0,0 +1,503 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cli/server.h"
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
+#include "common/dtpthread.h"
+#include "common/exif.h"
+#include "common/film.h"
+#include "common/image.h"
+#include "common/image_cache.h"
+#include "common/imageio.h"
+#include "common/imageio_jpeg.h"
+#include "common/imageio_module.h"
+#include "common/mipmap_cache.h"
+#include "control/conf.h"
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#define DT_CLI_SERVER_MAX_STYLE_NAME_LENGTH 128
+// seconds a connection may sit idle before its worker goes back to the queue
+#define DT_CLI_SERVER_IDLE_TIMEOUT 10
+
+#ifdef _WIN32
+
+int dt_cli_serve(const char *socket_path, const int jobs, const int queue_size, const gboolean high_quality,
+                 const gboolean upscale)
+{
+  fprintf(stderr, "%s\n", _("error: --serve needs unix domain sockets, which are not available on this platform"));
+  return 1;
+}
+
+#else
+
+static volatile sig_atomic_t _stop = 0;
+
+static void _stop_handler(int sig)
+{
+  _stop = 1;
+  // a second ^C terminates right away
+  signal(sig, SIG_DFL);
+}
+
+typedef struct dt_cli_server_t
+{
+  dt_pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  // bounded queue of accepted connections waiting for a worker
+  int *queue;
+  int queue_size, queue_head, queue_count;
+
+  // connection each worker is busy with, so a stop request can wake them up
+  int *active;
+
+  // importing and attaching xmps goes through the library, one at a time
+  dt_pthread_mutex_t import_lock;
+
+  gboolean high_quality, upscale;
+
+  // latency metrics, protected by lock
+  uint64_t requests, failed, rejected;
+  double total_ms, max_ms;
+} dt_cli_server_t;
+
+typedef struct dt_cli_request_t
+{
+  int imgid;
+  const char *path, *xmp, *style, *format, *output;
+  int width, height;
+} dt_cli_request_t;
+
+static void _reply(const int fd, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void _reply(const int fd, const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  gchar *msg = g_strdup_vprintf(fmt, ap);
+  va_end(ap);
+
+  size_t len = strlen(msg), off = 0;
+  while(off < len)
+  {
+    const ssize_t written = write(fd, msg + off, len - off);
+    if(written < 0 && errno == EINTR) continue;
+    if(written <= 0) break;
+    off += written;
+  }
+  g_free(msg);
+}
+
+// find the image to work on, importing it into the library first if it was given by path.
+// with an xmp a duplicate is created to carry that history, *temporary tells to remove it again.
+static int _request_image(dt_cli_server_t *s, const dt_cli_request_t *r, int *temporary)
+{
+  *temporary = 0;
+  int imgid = r->imgid;
+
+  dt_pthread_mutex_lock(&s->import_lock);
+  if(r->path)
+  {
+    dt_film_t film;
+    gchar *directory = g_path_get_dirname(r->path);
+    const int filmid = dt_film_new(&film, directory);
+    g_free(directory);
+    imgid = filmid ? dt_image_import(filmid, r->path, TRUE) : 0;
+  }
+  else if(imgid > 0)
+  {
+    // the image cache hands out an empty entry for any id, so ask the library whether it exists
+    sqlite3_stmt *stmt;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT id FROM main.images WHERE id = ?1", -1,
+                                &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+    if(sqlite3_step(stmt) != SQLITE_ROW) imgid = 0;
+    sqlite3_finalize(stmt);
+  }
+
+  if(imgid > 0 && r->xmp)
+  {
+    imgid = dt_image_duplicate(imgid);
+    if(imgid > 0)
+    {
+      *temporary = 1;
+      dt_image_t *image = dt_image_cache_get(darktable.image_cache, imgid, 'w');
+      const int failed = dt_exif_xmp_read(image, r->xmp, 1) != 0;
+      // don't write new xmp:
+      dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+      if(failed)
+      {
+        dt_image_remove(imgid);
+        *temporary = 0;
+        imgid = 0;
+      }
+    }
+  }
+  dt_pthread_mutex_unlock(&s->import_lock);
+
+  return imgid > 0 ? imgid : 0;
+}
+
+// thumbnails come straight out of the (warm) mipmap cache
+static int _serve_thumbnail(const dt_cli_request_t *r, const int imgid)
+{
+  const dt_mipmap_size_t mip = (r->width > 0 || r->height > 0)
+                                   ? dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, r->width, r->height)
+                                   : DT_MIPMAP_2;
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, mip, DT_MIPMAP_BLOCKING, 'r');
+  int res = 1;
+  // don't write skulls:
+  if(buf.buf && buf.width > 8 && buf.height > 8)
+  {
+    const int quality = dt_conf_get_int("database_cache_quality");
+    res = dt_imageio_jpeg_write(r->output, buf.buf, buf.width, buf.height, MIN(100, MAX(10, quality)), NULL, 0);
+  }
+  dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  return res;
+}
+
+// full renders go through the regular export pipeline
+static int _serve_render(const dt_cli_server_t *s, const dt_cli_request_t *r, const int imgid)
+{
+  const char *name = r->format;
+  if(!name)
+  {
+    name = strrchr(r->output, '.');
+    if(!name) return 1;
+    name++;
+  }
+  if(!strcmp(name, "jpg")) name = "jpeg";
+  if(!strcmp(name, "tif")) name = "tiff";
+
+  dt_imageio_module_format_t *format = dt_imageio_get_format_by_name(name);
+  if(!format) return 1;
+
+  // every export gets parameters of its own, formats keep their encoder state in there
+  dt_imageio_module_data_t *fdata = format->get_params(format);
+  if(!fdata) return 1;
+
+  uint32_t fw = 0, fh = 0;
+  format->dimension(format, fdata, &fw, &fh);
+  fdata->max_width = MAX(r->width, 0);
+  fdata->max_height = MAX(r->height, 0);
+  fdata->max_width = (fw != 0 && fdata->max_width > fw) ? fw : fdata->max_width;
+  fdata->max_height = (fh != 0 && fdata->max_height > fh) ? fh : fdata->max_height;
+  fdata->style[0] = '\0';
+  fdata->style_append = 1;
+  if(r->style) g_strlcpy(fdata->style, r->style, DT_CLI_SERVER_MAX_STYLE_NAME_LENGTH);
+
+  const int res = dt_imageio_export(imgid, r->output, format, fdata, s->high_quality, s->upscale, TRUE,
+                                    DT_COLORSPACE_NONE, NULL, DT_INTENT_LAST, NULL, NULL, 1, 1);
+  format->free_params(format, fdata);
+  return res;
+}
+
+static void _serve_stats(dt_cli_server_t *s, const int fd)
+{
+  dt_pthread_mutex_lock(&s->lock);
+  const uint64_t done = s->requests - s->failed;
+  _reply(fd, "ok\trequests=%" PRIu64 "\tfailed=%" PRIu64 "\trejected=%" PRIu64 "\tqueued=%d\tmean_ms=%.1f"
+             "\tmax_ms=%.1f\n",
+         s->requests, s->failed, s->rejected, s->queue_count, done ? s->total_ms / done : 0.0, s->max_ms);
+  dt_pthread_mutex_unlock(&s->lock);
+}
+
+static void _serve_request(dt_cli_server_t *s, const int fd, char *line)
+{
+  const double start = dt_get_wtime();
+
+  gchar **fields = g_strsplit(line, "\t", -1);
+  const char *command = fields[0];
+  dt_cli_request_t r = { 0 };
+  for(int k = 1; fields[k]; k++)
+  {
+    char *value = strchr(fields[k], '=');
+    if(!value) continue;
+    *value++ = '\0';
+    if(!strcmp(fields[k], "imgid")) r.imgid = atoi(value);
+    else if(!strcmp(fields[k], "path")) r.path = value;
+    else if(!strcmp(fields[k], "xmp")) r.xmp = value;
+    else if(!strcmp(fields[k], "style")) r.style = value;
+    else if(!strcmp(fields[k], "format")) r.format = value;
+    else if(!strcmp(fields[k], "output")) r.output = value;
+    else if(!strcmp(fields[k], "width")) r.width = atoi(value);
+    else if(!strcmp(fields[k], "height")) r.height = atoi(value);
+  }
+
+  const gboolean thumbnail = !g_strcmp0(command, "thumbnail");
+  if(!g_strcmp0(command, "stats"))
+  {
+    _serve_stats(s, fd);
+    g_strfreev(fields);
+    return;
+  }
+
+  const char *error = NULL;
+  if(!thumbnail && g_strcmp0(command, "render"))
+    error = "unknown request";
+  else if(!r.output)
+    error = "missing output";
+  else
+  {
+    int temporary = 0;
+    const int imgid = _request_image(s, &r, &temporary);
+    if(!imgid)
+      error = "no such image";
+    else if(thumbnail ? _serve_thumbnail(&r, imgid) : _serve_render(s, &r, imgid))
+      error = "export failed";
+    if(temporary)
+    {
+      dt_pthread_mutex_lock(&s->import_lock);
+      dt_image_remove(imgid);
+      dt_pthread_mutex_unlock(&s->import_lock);
+    }
+  }
+
+  const double ms = 1000.0 * (dt_get_wtime() - start);
+  dt_pthread_mutex_lock(&s->lock);
+  s->requests++;
+  if(error)
+    s->failed++;
+  else
+  {
+    s->total_ms += ms;
+    s->max_ms = MAX(s->max_ms, ms);
+  }
+  dt_pthread_mutex_unlock(&s->lock);
+
+  if(error)
+    _reply(fd, "error\t%s\n", error);
+  else
+    _reply(fd, "ok\t%s\t%.1f\n", r.output, ms);
+  dt_print(DT_DEBUG_PERF, "[cli server] %s %s: %.1f ms%s%s\n", command, r.output ? r.output : "-", ms,
+           error ? ", " : "", error ? error : "");
+
+  g_strfreev(fields);
+}
+
+typedef struct dt_cli_worker_t
+{
+  dt_cli_server_t *server;
+  int slot;
+} dt_cli_worker_t;
+
+static void *_server_worker(void *data)
+{
+  const dt_cli_worker_t *w = (dt_cli_worker_t *)data;
+  dt_cli_server_t *s = w->server;
+
+  while(TRUE)
+  {
+    dt_pthread_mutex_lock(&s->lock);
+    while(!_stop && s->queue_count == 0) dt_pthread_cond_wait(&s->cond, &s->lock);
+    if(_stop)
+    {
+      dt_pthread_mutex_unlock(&s->lock);
+      break;
+    }
+    const int fd = s->queue[s->queue_head];
+    s->queue_head = (s->queue_head + 1) % s->queue_size;
+    s->queue_count--;
+    s->active[w->slot] = fd;
+    dt_pthread_mutex_unlock(&s->lock);
+
+    // a client may send any number of requests over its connection
+    FILE *in = fdopen(fd, "r");
+    if(in)
+    {
+      char line[3 * PATH_MAX];
+      while(!_stop && fgets(line, sizeof(line), in))
+      {
+        // the idle timeout hit in the middle of a line, that's no request
+        if(ferror(in)) break;
+        g_strchomp(line);
+        if(line[0] == '\0') continue;
+        _serve_request(s, fd, line);
+      }
+    }
+
+    dt_pthread_mutex_lock(&s->lock);
+    s->active[w->slot] = -1;
+    dt_pthread_mutex_unlock(&s->lock);
+    if(in)
+      fclose(in);
+    else
+      close(fd);
+  }
+
+  return NULL;
+}
+
+static int _server_socket(const char *socket_path)
+{
+  struct sockaddr_un addr = { 0 };
+  if(strlen(socket_path) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, _("error: socket path %s is too long"), socket_path);
+    fprintf(stderr, "\n");
+    return -1;
+  }
+  addr.sun_family = AF_UNIX;
+  g_strlcpy(addr.sun_path, socket_path, sizeof(addr.sun_path));
+
+  // a socket left behind by a previous instance would make bind() fail, but never remove anything else
+  struct stat st;
+  if(!lstat(socket_path, &st) && S_ISSOCK(st.st_mode)) unlink(socket_path);
+
+  // anyone who can connect can read and overwrite files as us, so only the owner may. the umask covers the
+  // time between bind() creating the socket file and the chmod(), listen() only comes after that.
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  const mode_t mask = umask(S_IRWXG | S_IRWXO);
+  const int bound = fd >= 0 && !bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+  umask(mask);
+  if(!bound || chmod(socket_path, S_IRUSR | S_IWUSR) || listen(fd, 16))
+  {
+    fprintf(stderr, _("error: can't listen on %s: %s"), socket_path, strerror(errno));
+    fprintf(stderr, "\n");
+    if(fd >= 0) close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int dt_cli_serve(const char *socket_path, const int jobs, const int queue_size, const gboolean high_quality,
+                 const gboolean upscale)
+{
+  const int listen_fd = _server_socket(socket_path);
+  if(listen_fd < 0) return 1;
+
+  dt_cli_server_t s = { 0 };
+  s.high_quality = high_quality;
+  s.upscale = upscale;
+  s.queue_size = MAX(queue_size, 1);
+  s.queue = calloc(s.queue_size, sizeof(int));
+  dt_pthread_mutex_init(&s.lock, NULL);
+  dt_pthread_mutex_init(&s.import_lock, NULL);
+  pthread_cond_init(&s.cond, NULL);
+
+  _stop = 0;
+  signal(SIGINT, _stop_handler);
+  signal(SIGTERM, _stop_handler);
+  // clients going away must not take us down
+  signal(SIGPIPE, SIG_IGN);
+
+  const int nthreads = MAX(jobs, 1);
+  pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+  dt_cli_worker_t *workers = calloc(nthreads, sizeof(dt_cli_worker_t));
+  s.active = calloc(nthreads, sizeof(int));
+  int started = 0;
+  for(; started < nthreads; started++)
+  {
+    s.active[started] = -1;
+    workers[started].server = &s;
+    workers[started].slot = started;
+    if(dt_pthread_create(&threads[started], _server_worker, &workers[started])) break;
+  }
+  if(!started)
+  {
+    fprintf(stderr, "%s\n", _("error: can't start server threads"));
+    _stop = 1;
+  }
+  else
+    fprintf(stderr, _("serving on %s with %d workers\n"), socket_path, started);
+
+  while(!_stop)
+  {
+    // wake up regularly to notice the stop request
+    struct pollfd pfd = { listen_fd, POLLIN, 0 };
+    if(poll(&pfd, 1, 250) <= 0) continue;
+
+    const int fd = accept(listen_fd, NULL, NULL);
+    if(fd < 0) continue;
+
+    // reads time out on idle connections, which frees the worker for the clients waiting in the queue
+    const struct timeval timeout = { DT_CLI_SERVER_IDLE_TIMEOUT, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    dt_pthread_mutex_lock(&s.lock);
+    const int full = s.queue_count == s.queue_size;
+    if(full)
+      s.rejected++;
+    else
+    {
+      s.queue[(s.queue_head + s.queue_count) % s.queue_size] = fd;
+      s.queue_count++;
+      pthread_cond_signal(&s.cond);
+    }
+    dt_pthread_mutex_unlock(&s.lock);
+
+    if(full)
+    {
+      _reply(fd, "error\tbusy\n");
+      close(fd);
+    }
+  }
+
+  // wake up idle workers and the ones waiting for their client to send something
+  dt_pthread_mutex_lock(&s.lock);
+  pthread_cond_broadcast(&s.cond);
+  for(int k = 0; k < started; k++)
+    if(s.active[k] >= 0) shutdown(s.active[k], SHUT_RD);
+  dt_pthread_mutex_unlock(&s.lock);
+  for(int k = 0; k < started; k++) pthread_join(threads[k], NULL);
+
+  for(int k = 0; k < s.queue_count; k++) close(s.queue[(s.queue_head + k) % s.queue_size]);
+  close(listen_fd);
+  unlink(socket_path);
+
+  fprintf(stderr, _("%" PRIu64 " requests served, %" PRIu64 " failed, %" PRIu64 " rejected, mean %.1f ms, "
+                    "max %.1f ms\n"),
+          s.requests, s.failed, s.rejected, s.requests > s.failed ? s.total_ms / (s.requests - s.failed) : 0.0,
+          s.max_ms);
+
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  pthread_cond_destroy(&s.cond);
+  dt_pthread_mutex_destroy(&s.import_lock);
+  dt_pthread_mutex_destroy(&s.lock);
+  free(threads);
+  free(workers);
+  free(s.active);
+  free(s.queue);
+
+  return started ? 0 : 1;
+}
+
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
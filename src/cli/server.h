@@ -0,0 +1,41 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+/** keep darktable running and answer render requests on a local unix domain socket until
+ *  SIGINT/SIGTERM is received. requests are read one per line, tab separated:
+ *
+ *    render     [imgid=<id>|path=<file>] [xmp=<file>] [style=<name>] [width=<px>] [height=<px>]
+ *               [format=<name>] output=<file>
+ *    thumbnail  [imgid=<id>|path=<file>] [width=<px>] [height=<px>] output=<file>
+ *    stats
+ *
+ *  every request is answered with one line, "ok\t<output>\t<milliseconds>" or "error\t<reason>".
+ *  connections beyond what the workers and the queue can take are turned away with "error\tbusy".
+ *  connections that send nothing for 10 seconds are closed, clients have to reconnect after that.
+ *  the socket is created with mode 0600, only the user running darktable can connect.
+ *  returns non-zero if the server could not be set up. */
+int dt_cli_serve(const char *socket_path, const int jobs, const int queue_size, const gboolean high_quality,
+                 const gboolean upscale);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -17,11 +17,17 @@
 */
 
 #include "common/bilateral.h"
-#include "common/darktable.h" // for CLAMPS, dt_alloc_align, dt_free_align
+#include "common/darktable.h" // for CLAMPS, dt_alloc_align, dt_free_align, dt_cancelled
 #include <glib.h>             // for MIN, MAX
 #include <math.h>             // for roundf
 #include <stdlib.h>           // for size_t, free, malloc, NULL
 #include <string.h>           // for memset
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#ifdef HAVE_TARGET_AVX2
+#include <immintrin.h>
+#endif
 
 // these clamp away insane memory requirements.
 // they should reasonably faithfully represent the
@@ -29,6 +35,8 @@
 // and export will look the same as darkroom mode (only 1mpix there).
 #define DT_COMMON_BILATERAL_MAX_RES_S 6000
 #define DT_COMMON_BILATERAL_MAX_RES_R 50
+// upper bound for the per-thread copies of small grids used while splatting
+#define DT_COMMON_BILATERAL_MAX_PARTIAL (64 << 20)
 
 #ifndef HAVE_OPENCL
 // function definition on opencl path takes precedence
@@ -120,123 +128,259 @@ dt_bilateral_t *dt_bilateral_init(const int width,     // width of input image
   return b;
 }
 
-void dt_bilateral_splat(dt_bilateral_t *b, const float *const in)
+// splat one image line into the grid buf
+static inline void splat_line(const dt_bilateral_t *const b, const float *const in, float *const buf, const int j)
 {
   const int ox = 1;
   const int oy = b->size_x;
   const int oz = b->size_y * b->size_x;
-// splat into downsampled grid
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(b)
-#endif
-  for(int j = 0; j < b->height; j++)
+  const float norm = 100.0f / (b->sigma_s * b->sigma_s);
+  size_t index = (size_t)4 * j * b->width;
+  for(int i = 0; i < b->width; i++)
   {
-    size_t index = 4 * j * b->width;
-    for(int i = 0; i < b->width; i++)
+    float x, y, z;
+    const float L = in[index];
+    image_to_grid(b, i, j, L, &x, &y, &z);
+    const int xi = MIN((int)x, b->size_x - 2);
+    const int yi = MIN((int)y, b->size_y - 2);
+    const int zi = MIN((int)z, b->size_z - 2);
+    const float xf = x - xi;
+    const float yf = y - yi;
+    const float zf = z - zi;
+    // nearest neighbour splatting:
+    const size_t grid_index = xi + b->size_x * (yi + b->size_y * zi);
+    // sum up payload here, doesn't have to be same as edge stopping data
+    // for cross bilateral applications.
+    // also note that this is not clipped (as L->z is), so potentially hdr/out of gamut
+    // should not cause clipping here.
+    for(int k = 0; k < 8; k++)
     {
-      float x, y, z;
-      const float L = in[index];
-      image_to_grid(b, i, j, L, &x, &y, &z);
-      const int xi = MIN((int)x, b->size_x - 2);
-      const int yi = MIN((int)y, b->size_y - 2);
-      const int zi = MIN((int)z, b->size_z - 2);
-      const float xf = x - xi;
-      const float yf = y - yi;
-      const float zf = z - zi;
-      // nearest neighbour splatting:
-      const size_t grid_index = xi + b->size_x * (yi + b->size_y * zi);
-      // sum up payload here, doesn't have to be same as edge stopping data
-      // for cross bilateral applications.
-      // also note that this is not clipped (as L->z is), so potentially hdr/out of gamut
-      // should not cause clipping here.
-      for(int k = 0; k < 8; k++)
-      {
-        const size_t ii = grid_index + ((k & 1) ? ox : 0) + ((k & 2) ? oy : 0) + ((k & 4) ? oz : 0);
-        const float contrib = ((k & 1) ? xf : (1.0f - xf)) * ((k & 2) ? yf : (1.0f - yf))
-                              * ((k & 4) ? zf : (1.0f - zf)) * 100.0f / (b->sigma_s * b->sigma_s);
+      const size_t ii = grid_index + ((k & 1) ? ox : 0) + ((k & 2) ? oy : 0) + ((k & 4) ? oz : 0);
+      const float contrib = ((k & 1) ? xf : (1.0f - xf)) * ((k & 2) ? yf : (1.0f - yf))
+                            * ((k & 4) ? zf : (1.0f - zf)) * norm;
+      buf[ii] += contrib;
+    }
+    index += 4;
+  }
+}
+
+void dt_bilateral_splat(dt_bilateral_t *b, const float *const in)
+{
+  // as many threads as may run here, which can be fewer than cores (batch exports)
+  const int nthreads = omp_get_max_threads();
+  const size_t grid_size = b->size_x * b->size_y * b->size_z;
+  // an image line with grid row yi only ever touches grid rows yi and yi + 1
+  const int slices = b->size_y - 1;
+
+  if(nthreads > 1 && slices < 2 * nthreads && grid_size * nthreads * sizeof(float) <= DT_COMMON_BILATERAL_MAX_PARTIAL)
+  {
+    // too few grid rows to keep all threads busy, but the grid is small:
+    // splat into one private grid per thread and sum them up afterwards.
+    float *partial = dt_alloc_align(64, grid_size * nthreads * sizeof(float));
+    if(partial)
+    {
+      memset(partial, 0, grid_size * nthreads * sizeof(float));
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(b, partial) schedule(static) num_threads(nthreads)
+#endif
+      for(int j = 0; j < b->height; j++) splat_line(b, in, partial + grid_size * dt_get_thread_num(), j);
+
 #ifdef _OPENMP
-#pragma omp atomic
+#pragma omp parallel for default(none) shared(b, partial) schedule(static)
 #endif
-        b->buf[ii] += contrib;
+      for(size_t k = 0; k < grid_size; k++)
+      {
+        float sum = b->buf[k];
+        for(int t = 0; t < nthreads; t++) sum += partial[grid_size * t + k];
+        b->buf[k] = sum;
       }
-      index += 4;
+      dt_free_align(partial);
+      return;
     }
   }
+
+  // first image line of every grid row (lines are assigned to grid rows monotonically)
+  int *start = malloc(sizeof(int) * (slices + 1));
+  if(!start) return;
+  for(int yi = 0, j = 0; yi <= slices; yi++)
+  {
+    while(j < b->height && MIN((int)CLAMPS(j / b->sigma_s, 0, b->size_y - 1), b->size_y - 2) < yi) j++;
+    start[yi] = j;
+  }
+  start[slices] = b->height;
+
+  // all lines of a grid row are splatted by the same thread, and even and odd
+  // grid rows are done in two sweeps. so no two threads ever write the same cell.
+  for(int parity = 0; parity < 2; parity++)
+  {
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(b, start, parity) schedule(dynamic, 1)
+#endif
+    for(int yi = parity; yi < slices; yi += 2)
+      for(int j = start[yi]; j < start[yi + 1]; j++) splat_line(b, in, b->buf, j);
+  }
+  free(start);
 }
 
+/* The blurs run a short recursion along lines of the grid. If neighbouring lines lie next to
+ * each other in memory (offset2 == 1), several of them are run at once in a SIMD register. */
+
+#define BLUR_Z_STEP(V, ADD, SUB, MUL, SET1)                                                                   \
+  {                                                                                                          \
+    const V w1 = SET1(4.f / 16.f);                                                                           \
+    const V w2 = SET1(2.f / 16.f);                                                                           \
+    V tmp1 = LOAD(buf + index);                                                                              \
+    STORE(buf + index, ADD(MUL(w1, LOAD(buf + index + offset3)), MUL(w2, LOAD(buf + index + 2 * offset3)))); \
+    index += offset3;                                                                                        \
+    V tmp2 = LOAD(buf + index);                                                                              \
+    STORE(buf + index, ADD(MUL(w1, SUB(LOAD(buf + index + offset3), tmp1)),                                  \
+                           MUL(w2, LOAD(buf + index + 2 * offset3))));                                       \
+    index += offset3;                                                                                        \
+    for(int i = 2; i < size3 - 2; i++)                                                                       \
+    {                                                                                                        \
+      const V tmp3 = LOAD(buf + index);                                                                      \
+      STORE(buf + index, ADD(MUL(w1, SUB(LOAD(buf + index + offset3), tmp2)),                                \
+                             MUL(w2, SUB(LOAD(buf + index + 2 * offset3), tmp1))));                          \
+      index += offset3;                                                                                      \
+      tmp1 = tmp2;                                                                                           \
+      tmp2 = tmp3;                                                                                           \
+    }                                                                                                        \
+    const V tmp3 = LOAD(buf + index);                                                                        \
+    STORE(buf + index, SUB(MUL(w1, SUB(LOAD(buf + index + offset3), tmp2)), MUL(w2, tmp1)));                 \
+    index += offset3;                                                                                        \
+    STORE(buf + index, SUB(SUB(SET1(0.0f), MUL(w1, tmp3)), MUL(w2, tmp2)));                                  \
+  }
+
+#define BLUR_STEP(V, ADD, SUB, MUL, SET1)                                                                     \
+  {                                                                                                          \
+    const V w0 = SET1(6.f / 16.f);                                                                           \
+    const V w1 = SET1(4.f / 16.f);                                                                           \
+    const V w2 = SET1(1.f / 16.f);                                                                           \
+    V tmp1 = LOAD(buf + index);                                                                              \
+    STORE(buf + index, ADD(ADD(MUL(LOAD(buf + index), w0), MUL(w1, LOAD(buf + index + offset3))),            \
+                           MUL(w2, LOAD(buf + index + 2 * offset3))));                                       \
+    index += offset3;                                                                                        \
+    V tmp2 = LOAD(buf + index);                                                                              \
+    STORE(buf + index, ADD(ADD(MUL(LOAD(buf + index), w0), MUL(w1, ADD(LOAD(buf + index + offset3), tmp1))), \
+                           MUL(w2, LOAD(buf + index + 2 * offset3))));                                       \
+    index += offset3;                                                                                        \
+    for(int i = 2; i < size3 - 2; i++)                                                                       \
+    {                                                                                                        \
+      const V tmp3 = LOAD(buf + index);                                                                      \
+      STORE(buf + index, ADD(ADD(MUL(tmp3, w0), MUL(w1, ADD(LOAD(buf + index + offset3), tmp2))),            \
+                             MUL(w2, ADD(LOAD(buf + index + 2 * offset3), tmp1))));                          \
+      index += offset3;                                                                                      \
+      tmp1 = tmp2;                                                                                           \
+      tmp2 = tmp3;                                                                                           \
+    }                                                                                                        \
+    const V tmp3 = LOAD(buf + index);                                                                        \
+    STORE(buf + index, ADD(ADD(MUL(tmp3, w0), MUL(w1, ADD(LOAD(buf + index + offset3), tmp2))), MUL(w2, tmp1))); \
+    index += offset3;                                                                                        \
+    STORE(buf + index, ADD(ADD(MUL(LOAD(buf + index), w0), MUL(w1, tmp3)), MUL(w2, tmp2)));                  \
+  }
+
+#define SCALAR_ADD(a, b) ((a) + (b))
+#define SCALAR_SUB(a, b) ((a) - (b))
+#define SCALAR_MUL(a, b) ((a) * (b))
+#define SCALAR_SET1(a) (a)
+
+#define LOAD(p) (*(p))
+#define STORE(p, v) (*(p) = (v))
+static inline void blur_line_z_1(float *const buf, size_t index, const int offset3, const int size3)
+  BLUR_Z_STEP(float, SCALAR_ADD, SCALAR_SUB, SCALAR_MUL, SCALAR_SET1)
+static inline void blur_line_1(float *const buf, size_t index, const int offset3, const int size3)
+  BLUR_STEP(float, SCALAR_ADD, SCALAR_SUB, SCALAR_MUL, SCALAR_SET1)
+#undef LOAD
+#undef STORE
+
+#if defined(__SSE2__)
+#define LOAD(p) _mm_loadu_ps(p)
+#define STORE(p, v) _mm_storeu_ps((p), (v))
+static inline void blur_line_z_4(float *const buf, size_t index, const int offset3, const int size3)
+  BLUR_Z_STEP(__m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps)
+static inline void blur_line_4(float *const buf, size_t index, const int offset3, const int size3)
+  BLUR_STEP(__m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps)
+#undef LOAD
+#undef STORE
+#endif
+
+#ifdef HAVE_TARGET_AVX2
+#define LOAD(p) _mm256_loadu_ps(p)
+#define STORE(p, v) _mm256_storeu_ps((p), (v))
+__attribute__((target("avx2,fma")))
+static void blur_line_z_8(float *const buf, size_t index, const int offset3, const int size3)
+  BLUR_Z_STEP(__m256, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_set1_ps)
+__attribute__((target("avx2,fma")))
+static void blur_line_8(float *const buf, size_t index, const int offset3, const int size3)
+  BLUR_STEP(__m256, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_set1_ps)
+#undef LOAD
+#undef STORE
+#endif
+
+#undef SCALAR_ADD
+#undef SCALAR_SUB
+#undef SCALAR_MUL
+#undef SCALAR_SET1
+#undef BLUR_STEP
+#undef BLUR_Z_STEP
+
 static void blur_line_z(float *buf, const int offset1, const int offset2, const int offset3, const int size1,
                         const int size2, const int size3)
 {
-  const float w1 = 4.f / 16.f;
-  const float w2 = 2.f / 16.f;
+#ifdef HAVE_TARGET_AVX2
+  const int avx2 = darktable.codepath.AVX2;
+#endif
+#if defined(__SSE2__)
+  const int sse2 = darktable.codepath.SSE2;
+#endif
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(buf)
 #endif
   for(int k = 0; k < size1; k++)
   {
-    size_t index = (size_t)k * offset1;
-    for(int j = 0; j < size2; j++)
+    int j = 0;
+    if(offset2 == 1)
     {
-      float tmp1 = buf[index];
-      buf[index] = w1 * buf[index + offset3] + w2 * buf[index + 2 * offset3];
-      index += offset3;
-      float tmp2 = buf[index];
-      buf[index] = w1 * (buf[index + offset3] - tmp1) + w2 * buf[index + 2 * offset3];
-      index += offset3;
-      for(int i = 2; i < size3 - 2; i++)
-      {
-        const float tmp3 = buf[index];
-        buf[index] = +w1 * (buf[index + offset3] - tmp2) + w2 * (buf[index + 2 * offset3] - tmp1);
-        index += offset3;
-        tmp1 = tmp2;
-        tmp2 = tmp3;
-      }
-      const float tmp3 = buf[index];
-      buf[index] = w1 * (buf[index + offset3] - tmp2) - w2 * tmp1;
-      index += offset3;
-      buf[index] = -w1 * tmp3 - w2 * tmp2;
-      index += offset3;
-      index += offset2 - offset3 * size3;
+#ifdef HAVE_TARGET_AVX2
+      if(avx2)
+        for(; j + 8 <= size2; j += 8) blur_line_z_8(buf, (size_t)k * offset1 + j, offset3, size3);
+#endif
+#if defined(__SSE2__)
+      if(sse2)
+        for(; j + 4 <= size2; j += 4) blur_line_z_4(buf, (size_t)k * offset1 + j, offset3, size3);
+#endif
     }
+    for(; j < size2; j++) blur_line_z_1(buf, (size_t)k * offset1 + (size_t)j * offset2, offset3, size3);
   }
 }
 
 static void blur_line(float *buf, const int offset1, const int offset2, const int offset3, const int size1,
                       const int size2, const int size3)
 {
-  const float w0 = 6.f / 16.f;
-  const float w1 = 4.f / 16.f;
-  const float w2 = 1.f / 16.f;
+#ifdef HAVE_TARGET_AVX2
+  const int avx2 = darktable.codepath.AVX2;
+#endif
+#if defined(__SSE2__)
+  const int sse2 = darktable.codepath.SSE2;
+#endif
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(buf)
 #endif
   for(int k = 0; k < size1; k++)
   {
-    size_t index = (size_t)k * offset1;
-    for(int j = 0; j < size2; j++)
+    int j = 0;
+    if(offset2 == 1)
     {
-      float tmp1 = buf[index];
-      buf[index] = buf[index] * w0 + w1 * buf[index + offset3] + w2 * buf[index + 2 * offset3];
-      index += offset3;
-      float tmp2 = buf[index];
-      buf[index] = buf[index] * w0 + w1 * (buf[index + offset3] + tmp1) + w2 * buf[index + 2 * offset3];
-      index += offset3;
-      for(int i = 2; i < size3 - 2; i++)
-      {
-        const float tmp3 = buf[index];
-        buf[index]
-            = buf[index] * w0 + w1 * (buf[index + offset3] + tmp2) + w2 * (buf[index + 2 * offset3] + tmp1);
-        index += offset3;
-        tmp1 = tmp2;
-        tmp2 = tmp3;
-      }
-      const float tmp3 = buf[index];
-      buf[index] = buf[index] * w0 + w1 * (buf[index + offset3] + tmp2) + w2 * tmp1;
-      index += offset3;
-      buf[index] = buf[index] * w0 + w1 * tmp3 + w2 * tmp2;
-      index += offset3;
-      index += offset2 - offset3 * size3;
+#ifdef HAVE_TARGET_AVX2
+      if(avx2)
+        for(; j + 8 <= size2; j += 8) blur_line_8(buf, (size_t)k * offset1 + j, offset3, size3);
+#endif
+#if defined(__SSE2__)
+      if(sse2)
+        for(; j + 4 <= size2; j += 4) blur_line_4(buf, (size_t)k * offset1 + j, offset3, size3);
+#endif
     }
+    for(; j < size2; j++) blur_line_1(buf, (size_t)k * offset1 + (size_t)j * offset2, offset3, size3);
   }
 }
 
@@ -245,48 +389,96 @@ void dt_bilateral_blur(dt_bilateral_t *b)
 {
   // gaussian up to 3 sigma
   blur_line(b->buf, b->size_x * b->size_y, b->size_x, 1, b->size_z, b->size_y, b->size_x);
+  if(dt_cancelled()) return;
   // gaussian up to 3 sigma
   blur_line(b->buf, b->size_x * b->size_y, 1, b->size_x, b->size_z, b->size_x, b->size_y);
+  if(dt_cancelled()) return;
   // -2 derivative of the gaussian up to 3 sigma: x*exp(-x*x)
-  blur_line_z(b->buf, 1, b->size_x, b->size_x * b->size_y, b->size_x, b->size_y, b->size_z);
+  // (lines ordered such that neighbouring ones are next to each other in memory)
+  blur_line_z(b->buf, b->size_x, 1, b->size_x * b->size_y, b->size_y, b->size_x, b->size_z);
 }
 
 
-void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, float *out, const float detail)
+// trilinear lookup of the blurred grid at image position (i, j) with luma L
+static inline float slice_lookup(const dt_bilateral_t *const b, const int i, const int j, const float L)
 {
-  // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
-  const float norm = -detail * b->sigma_r * 0.04f;
   const int ox = 1;
   const int oy = b->size_x;
   const int oz = b->size_y * b->size_x;
+  float x, y, z;
+  image_to_grid(b, i, j, L, &x, &y, &z);
+  const int xi = MIN((int)x, b->size_x - 2);
+  const int yi = MIN((int)y, b->size_y - 2);
+  const int zi = MIN((int)z, b->size_z - 2);
+  const float xf = x - xi;
+  const float yf = y - yi;
+  const float zf = z - zi;
+  const size_t gi = xi + b->size_x * (yi + b->size_y * zi);
+  return b->buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf) + b->buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
+         + b->buf[gi + oy] * (1.0f - xf) * (yf) * (1.0f - zf) + b->buf[gi + ox + oy] * (xf) * (yf) * (1.0f - zf)
+         + b->buf[gi + oz] * (1.0f - xf) * (1.0f - yf) * (zf) + b->buf[gi + ox + oz] * (xf) * (1.0f - yf) * (zf)
+         + b->buf[gi + oy + oz] * (1.0f - xf) * (yf) * (zf) + b->buf[gi + ox + oy + oz] * (xf) * (yf) * (zf);
+}
+
+#if defined(__SSE2__)
+// same as above, the two x neighbours are always adjacent so the 2x2 cells of
+// both z planes are fetched with two 64-bit loads each.
+static inline float slice_lookup_sse(const dt_bilateral_t *const b, const int i, const int j, const float L)
+{
+  const int oy = b->size_x;
+  const int oz = b->size_y * b->size_x;
+  float x, y, z;
+  image_to_grid(b, i, j, L, &x, &y, &z);
+  const int xi = MIN((int)x, b->size_x - 2);
+  const int yi = MIN((int)y, b->size_y - 2);
+  const int zi = MIN((int)z, b->size_z - 2);
+  const float xf = x - xi;
+  const float yf = y - yi;
+  const float zf = z - zi;
+  const float *const g = b->buf + xi + b->size_x * (yi + b->size_y * zi);
+  const __m128 lo = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)g), (const __m64 *)(g + oy));
+  const __m128 hi
+      = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)(g + oz)), (const __m64 *)(g + oy + oz));
+  const __m128 wxy = _mm_mul_ps(_mm_set_ps(xf, 1.0f - xf, xf, 1.0f - xf), _mm_set_ps(yf, yf, 1.0f - yf, 1.0f - yf));
+  const __m128 v
+      = _mm_mul_ps(wxy, _mm_add_ps(_mm_mul_ps(lo, _mm_set1_ps(1.0f - zf)), _mm_mul_ps(hi, _mm_set1_ps(zf))));
+  const __m128 s = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1))));
+}
+#endif
+
+void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, float *out, const float detail)
+{
+  // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
+  const float norm = -detail * b->sigma_r * 0.04f;
+#if defined(__SSE2__)
+  const int use_sse = darktable.codepath.SSE2;
+#endif
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(out)
 #endif
   for(int j = 0; j < b->height; j++)
   {
-    size_t index = 4 * j * b->width;
+    size_t index = (size_t)4 * j * b->width;
+#if defined(__SSE2__)
+    if(use_sse)
+    {
+      for(int i = 0; i < b->width; i++)
+      {
+        // copy color and mask, then replace L (in and out may alias)
+        const __m128 pin = _mm_loadu_ps(in + index);
+        const float L = _mm_cvtss_f32(pin);
+        const float Lout = L + norm * slice_lookup_sse(b, i, j, L);
+        _mm_storeu_ps(out + index, _mm_move_ss(pin, _mm_set_ss(Lout)));
+        index += 4;
+      }
+      continue;
+    }
+#endif
     for(int i = 0; i < b->width; i++)
     {
-      float x, y, z;
       const float L = in[index];
-      image_to_grid(b, i, j, L, &x, &y, &z);
-      // trilinear lookup:
-      const int xi = MIN((int)x, b->size_x - 2);
-      const int yi = MIN((int)y, b->size_y - 2);
-      const int zi = MIN((int)z, b->size_z - 2);
-      const float xf = x - xi;
-      const float yf = y - yi;
-      const float zf = z - zi;
-      const size_t gi = xi + b->size_x * (yi + b->size_y * zi);
-      const float Lout = L
-                         + norm * (b->buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf)
-                                   + b->buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
-                                   + b->buf[gi + oy] * (1.0f - xf) * (yf) * (1.0f - zf)
-                                   + b->buf[gi + ox + oy] * (xf) * (yf) * (1.0f - zf)
-                                   + b->buf[gi + oz] * (1.0f - xf) * (1.0f - yf) * (zf)
-                                   + b->buf[gi + ox + oz] * (xf) * (1.0f - yf) * (zf)
-                                   + b->buf[gi + oy + oz] * (1.0f - xf) * (yf) * (zf)
-                                   + b->buf[gi + ox + oy + oz] * (xf) * (yf) * (zf));
+      const float Lout = L + norm * slice_lookup(b, i, j, L);
       out[index] = Lout;
       // and copy color and mask
       out[index + 1] = in[index + 1];
@@ -302,36 +494,23 @@ void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *co
 {
   // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
   const float norm = -detail * b->sigma_r * 0.04f;
-  const int ox = 1;
-  const int oy = b->size_x;
-  const int oz = b->size_y * b->size_x;
+#if defined(__SSE2__)
+  const int use_sse = darktable.codepath.SSE2;
+#endif
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(out)
 #endif
   for(int j = 0; j < b->height; j++)
   {
-    size_t index = 4 * j * b->width;
+    size_t index = (size_t)4 * j * b->width;
     for(int i = 0; i < b->width; i++)
     {
-      float x, y, z;
       const float L = in[index];
-      image_to_grid(b, i, j, L, &x, &y, &z);
-      // trilinear lookup:
-      const int xi = MIN((int)x, b->size_x - 2);
-      const int yi = MIN((int)y, b->size_y - 2);
-      const int zi = MIN((int)z, b->size_z - 2);
-      const float xf = x - xi;
-      const float yf = y - yi;
-      const float zf = z - zi;
-      const size_t gi = xi + b->size_x * (yi + b->size_y * zi);
-      const float Lout = norm * (b->buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf)
-                                 + b->buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
-                                 + b->buf[gi + oy] * (1.0f - xf) * (yf) * (1.0f - zf)
-                                 + b->buf[gi + ox + oy] * (xf) * (yf) * (1.0f - zf)
-                                 + b->buf[gi + oz] * (1.0f - xf) * (1.0f - yf) * (zf)
-                                 + b->buf[gi + ox + oz] * (xf) * (1.0f - yf) * (zf)
-                                 + b->buf[gi + oy + oz] * (1.0f - xf) * (yf) * (zf)
-                                 + b->buf[gi + ox + oy + oz] * (xf) * (yf) * (zf));
+#if defined(__SSE2__)
+      const float Lout = norm * (use_sse ? slice_lookup_sse(b, i, j, L) : slice_lookup(b, i, j, L));
+#else
+      const float Lout = norm * slice_lookup(b, i, j, L);
+#endif
       out[index] = MAX(0.0f, out[index] + Lout);
       index += 4;
     }
@@ -347,6 +526,7 @@ void dt_bilateral_free(dt_bilateral_t *b)
 
 #undef DT_COMMON_BILATERAL_MAX_RES_S
 #undef DT_COMMON_BILATERAL_MAX_RES_R
+#undef DT_COMMON_BILATERAL_MAX_PARTIAL
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
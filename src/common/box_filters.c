@@ -0,0 +1,266 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/box_filters.h"
+#include "common/darktable.h"
+#include <math.h>
+#include <string.h>
+
+/*
+ * all filters are separable and work on BOX_LANES rows or columns at once: a slab of them is copied
+ * into a scratch buffer with the lanes interleaved, [sample][lane], so the 1d filter runs along the
+ * slab with every step being one vector operation over all lanes. for columns that copy is a plain
+ * row-by-row memcpy, for rows it is a transpose, which avoids running the filter down a column with
+ * the stride of a whole image row. the running mean down the columns doesn't need the slabs at all,
+ * it keeps whole rows as its vectors.
+ */
+
+#define BOX_LANES 16
+
+// copy BOX_LANES rows starting at y0, transposed, to s + offset * BOX_LANES
+static inline void _gather_rows(const float *const buf, float *const s, const int width, const int y0,
+                                const int lanes, const int offset)
+{
+  for(int x = 0; x < width; x++)
+    for(int r = 0; r < lanes; r++) s[(size_t)(x + offset) * BOX_LANES + r] = buf[(size_t)(y0 + r) * width + x];
+}
+
+static inline void _scatter_rows(float *const buf, const float *const s, const int width, const int y0,
+                                 const int lanes)
+{
+  for(int x = 0; x < width; x++)
+    for(int r = 0; r < lanes; r++) buf[(size_t)(y0 + r) * width + x] = s[(size_t)x * BOX_LANES + r];
+}
+
+// copy BOX_LANES columns starting at x0 to s + offset * BOX_LANES
+static inline void _gather_columns(const float *const buf, float *const s, const int width, const int height,
+                                   const int x0, const int lanes, const int offset)
+{
+  for(int y = 0; y < height; y++)
+    memcpy(s + (size_t)(y + offset) * BOX_LANES, buf + (size_t)y * width + x0, sizeof(float) * lanes);
+}
+
+static inline void _scatter_columns(float *const buf, const float *const s, const int width, const int height,
+                                    const int x0, const int lanes)
+{
+  for(int y = 0; y < height; y++)
+    memcpy(buf + (size_t)y * width + x0, s + (size_t)y * BOX_LANES, sizeof(float) * lanes);
+}
+
+// van Herk/Gil-Werman: v holds n samples padded by w neutral elements on both sides.  g is the running
+// minimum (maximum) from the start of each block of 2*w+1 samples, h the one from the end, so every
+// window covers the end of one block and the start of the next: out[i] = op(h[i], g[i + 2*w]).
+// the result goes to the first n samples of v.
+static inline void _box_minmax_lanes(float *const v, float *const g, float *const h, const int n, const int w,
+                                     const int is_max)
+{
+  const int k = 2 * w + 1;
+  const int m = n + 2 * w;
+
+  for(int p = 0; p < m; p++)
+  {
+    const float *const vp = v + (size_t)p * BOX_LANES;
+    float *const gp = g + (size_t)p * BOX_LANES;
+    if(p % k == 0)
+      memcpy(gp, vp, sizeof(float) * BOX_LANES);
+    else
+    {
+      const float *const gq = gp - BOX_LANES;
+#if defined(_OPENMP) && defined(OPENMP_SIMD_)
+#pragma omp SIMD()
+#endif
+      for(int c = 0; c < BOX_LANES; c++) gp[c] = is_max ? fmaxf(gq[c], vp[c]) : fminf(gq[c], vp[c]);
+    }
+  }
+
+  for(int p = m - 1; p >= 0; p--)
+  {
+    const float *const vp = v + (size_t)p * BOX_LANES;
+    float *const hp = h + (size_t)p * BOX_LANES;
+    if(p == m - 1 || p % k == k - 1)
+      memcpy(hp, vp, sizeof(float) * BOX_LANES);
+    else
+    {
+      const float *const hq = hp + BOX_LANES;
+#if defined(_OPENMP) && defined(OPENMP_SIMD_)
+#pragma omp SIMD()
+#endif
+      for(int c = 0; c < BOX_LANES; c++) hp[c] = is_max ? fmaxf(hq[c], vp[c]) : fminf(hq[c], vp[c]);
+    }
+  }
+
+  for(int i = 0; i < n; i++)
+  {
+    float *const out = v + (size_t)i * BOX_LANES;
+    const float *const hi = h + (size_t)i * BOX_LANES;
+    const float *const gi = g + (size_t)(i + 2 * w) * BOX_LANES;
+#if defined(_OPENMP) && defined(OPENMP_SIMD_)
+#pragma omp SIMD()
+#endif
+    for(int c = 0; c < BOX_LANES; c++) out[c] = is_max ? fmaxf(hi[c], gi[c]) : fminf(hi[c], gi[c]);
+  }
+}
+
+// fill the w samples in front of and behind the n samples of a slab with the neutral element
+static inline void _pad_lanes(float *const v, const int n, const int w, const float neutral)
+{
+  for(size_t k = 0; k < (size_t)w * BOX_LANES; k++)
+  {
+    v[k] = neutral;
+    v[(size_t)(n + w) * BOX_LANES + k] = neutral;
+  }
+}
+
+static inline void _box_minmax(float *const buf, const int width, const int height, const int w,
+                               const int is_max)
+{
+  const float neutral = is_max ? -INFINITY : INFINITY;
+  const size_t scratch = (size_t)(MAX(width, height) + 2 * w) * BOX_LANES;
+
+#ifdef _OPENMP
+#pragma omp parallel default(none)
+#endif
+  {
+    float *const v = dt_alloc_align(64, sizeof(float) * 3 * scratch);
+    // lanes beyond the image edge are computed but never written back, just keep them well defined
+    memset(v, 0, sizeof(float) * 3 * scratch);
+    float *const g = v + scratch;
+    float *const h = g + scratch;
+
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for(int y0 = 0; y0 < height; y0 += BOX_LANES)
+    {
+      const int lanes = MIN(BOX_LANES, height - y0);
+      _pad_lanes(v, width, w, neutral);
+      _gather_rows(buf, v, width, y0, lanes, w);
+      _box_minmax_lanes(v, g, h, width, w, is_max);
+      _scatter_rows(buf, v, width, y0, lanes);
+    }
+
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for(int x0 = 0; x0 < width; x0 += BOX_LANES)
+    {
+      const int lanes = MIN(BOX_LANES, width - x0);
+      _pad_lanes(v, height, w, neutral);
+      _gather_columns(buf, v, width, height, x0, lanes, w);
+      _box_minmax_lanes(v, g, h, height, w, is_max);
+      _scatter_columns(buf, v, width, height, x0, lanes);
+    }
+
+    dt_free_align(v);
+  }
+}
+
+void dt_box_min(float *const buf, const int width, const int height, const int w)
+{
+  _box_minmax(buf, width, height, w, 0);
+}
+
+void dt_box_max(float *const buf, const int width, const int height, const int w)
+{
+  _box_minmax(buf, width, height, w, 1);
+}
+
+// running sum over a window of 2*w+1 samples, clipped to the n samples of the slab
+static inline void _box_mean_lanes(const float *const in, float *const out, const int n, const int w)
+{
+  float m[BOX_LANES] = { 0.0f };
+  float n_box = 0.0f;
+  for(int i = 0, i_end = MIN(w + 1, n); i < i_end; i++)
+  {
+    const float *const x = in + (size_t)i * BOX_LANES;
+    for(int c = 0; c < BOX_LANES; c++) m[c] += x[c];
+    n_box++;
+  }
+
+  for(int i = 0; i < n; i++)
+  {
+    float *const y = out + (size_t)i * BOX_LANES;
+    const float norm = 1.0f / n_box;
+    for(int c = 0; c < BOX_LANES; c++) y[c] = m[c] * norm;
+    if(i - w >= 0)
+    {
+      const float *const x = in + (size_t)(i - w) * BOX_LANES;
+      for(int c = 0; c < BOX_LANES; c++) m[c] -= x[c];
+      n_box--;
+    }
+    if(i + w + 1 < n)
+    {
+      const float *const x = in + (size_t)(i + w + 1) * BOX_LANES;
+      for(int c = 0; c < BOX_LANES; c++) m[c] += x[c];
+      n_box++;
+    }
+  }
+}
+
+void dt_box_mean(float *const buf, const int width, const int height, const int w)
+{
+  const size_t scratch = (size_t)width * BOX_LANES;
+  float *const in = dt_alloc_align(64, sizeof(float) * 2 * scratch);
+  memset(in, 0, sizeof(float) * 2 * scratch);
+  float *const out = in + scratch;
+  for(int y0 = 0; y0 < height; y0 += BOX_LANES)
+  {
+    const int lanes = MIN(BOX_LANES, height - y0);
+    _gather_rows(buf, in, width, y0, lanes, 0);
+    _box_mean_lanes(in, out, width, w);
+    _scatter_rows(buf, out, width, y0, lanes);
+  }
+  dt_free_align(in);
+
+  // columns: whole rows are the vectors. the input rows still needed after they have been
+  // overwritten are kept in a ring of w + 1 rows.
+  float *const m = dt_alloc_align(64, sizeof(float) * (size_t)width * (w + 2));
+  float *const ring = m + width;
+  memset(m, 0, sizeof(float) * width);
+  float n_box = 0.0f;
+  for(int y = 0, y_end = MIN(w + 1, height); y < y_end; y++)
+  {
+    const float *const row = buf + (size_t)y * width;
+    for(int x = 0; x < width; x++) m[x] += row[x];
+    n_box++;
+  }
+  for(int y = 0; y < height; y++)
+  {
+    float *const row = buf + (size_t)y * width;
+    memcpy(ring + (size_t)(y % (w + 1)) * width, row, sizeof(float) * width);
+    const float norm = 1.0f / n_box;
+    for(int x = 0; x < width; x++) row[x] = m[x] * norm;
+    if(y - w >= 0)
+    {
+      const float *const old = ring + (size_t)((y - w) % (w + 1)) * width;
+      for(int x = 0; x < width; x++) m[x] -= old[x];
+      n_box--;
+    }
+    if(y + w + 1 < height)
+    {
+      const float *const next = buf + (size_t)(y + w + 1) * width;
+      for(int x = 0; x < width; x++) m[x] += next[x];
+      n_box++;
+    }
+  }
+  dt_free_align(m);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
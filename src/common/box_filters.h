@@ -0,0 +1,36 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+/** box filters over a (2*w+1) x (2*w+1) window on a single-channel float image, in-place.
+ *  the window is clipped at the image borders, i.e. only pixels inside the image are taken into account. */
+
+/** minimum over the box, van Herk/Gil-Werman so the cost doesn't depend on w. uses OpenMP. */
+void dt_box_min(float *const buf, const int width, const int height, const int w);
+
+/** maximum over the box, see dt_box_min(). */
+void dt_box_max(float *const buf, const int width, const int height, const int w);
+
+/** mean over the box, normalized by the number of pixels inside the image.
+ *  single threaded as it is meant to be called on tiles from within an OpenMP parallel region. */
+void dt_box_mean(float *const buf, const int width, const int height, const int w);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
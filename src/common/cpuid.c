@@ -35,11 +35,13 @@
 #ifdef __x86_64__
 #define R_AX "rax"
 #define R_BX "rbx"
+#define R_SI "rsi"
 #define R_CX "rcx"
 #define R_DX "rdx"
 #else
 #define R_AX "eax"
 #define R_BX "ebx"
+#define R_SI "esi"
 #define R_CX "ecx"
 #define R_DX "edx"
 #endif
@@ -53,10 +55,19 @@ dt_cpu_flags_t dt_detect_cpu_features()
                  : "=a"(ax), "=c"(cx), "=d"(dx)                                                              \
                  : "0"(cmd))
 
+// same as above, but also returns ebx (needed for the extended feature flags of leaf 7)
+#define cpuid_count(cmd, sub) \
+  __asm volatile("push %%" R_BX "\n"                                                                         \
+                 "cpuid\n"                                                                                   \
+                 "mov %%" R_BX ", %%" R_SI "\n"                                                              \
+                 "pop %%" R_BX "\n"                                                                          \
+                 : "=a"(ax), "=S"(bx), "=c"(cx), "=d"(dx)                                                    \
+                 : "0"(cmd), "2"(sub))
+
 #ifdef __x86_64__
-  guint64 ax, cx, dx, tmp;
+  guint64 ax, bx, cx, dx, tmp, max_std;
 #else
-  guint32 ax, cx, dx, tmp;
+  guint32 ax, bx, cx, dx, tmp, max_std;
 #endif
 
   static dt_cpu_flags_t cpuflags = -1;
@@ -85,6 +96,7 @@ dt_cpu_flags_t dt_detect_cpu_features()
     {
       /* Get the standard level */
       cpuid(0x00000000);
+      max_std = ax;
 
       if(ax)
       {
@@ -100,6 +112,26 @@ dt_cpu_flags_t dt_detect_cpu_features()
         if(cx & 0x00000200) cpuflags |= CPU_FLAG_SSSE3;
         if(cx & 0x00040000) cpuflags |= CPU_FLAG_SSE4_1;
         if(cx & 0x00080000) cpuflags |= CPU_FLAG_SSE4_2;
+
+        /* AVX needs the OS to save the ymm registers on context switch (OSXSAVE + XCR0) */
+        if((cx & 0x08000000) && (cx & 0x10000000))
+        {
+          guint32 xcr0_lo, xcr0_hi;
+          __asm volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+          if((xcr0_lo & 0x6) == 0x6)
+          {
+            cpuflags |= CPU_FLAG_AVX;
+            if(cx & 0x00001000) cpuflags |= CPU_FLAG_FMA;
+            if(cx & 0x20000000) cpuflags |= CPU_FLAG_F16C;
+          }
+        }
+
+        /* Extended features: AVX2 lives in leaf 7, subleaf 0, ebx bit 5 */
+        if(max_std >= 7 && (cpuflags & CPU_FLAG_AVX))
+        {
+          cpuid_count(0x00000007, 0);
+          if(bx & 0x00000020) cpuflags |= CPU_FLAG_AVX2;
+        }
       }
 
       /* Are there extensions? */
@@ -134,12 +166,16 @@ dt_cpu_flags_t dt_detect_cpu_features()
     report("SSE4.1", CPU_FLAG_SSE4_1);
     report("SSE4.2", CPU_FLAG_SSE4_2);
     report("AVX", CPU_FLAG_AVX);
+    report("FMA", CPU_FLAG_FMA);
+    report("F16C", CPU_FLAG_F16C);
+    report("AVX2", CPU_FLAG_AVX2);
 #undef report
   }
 #endif
 
   return cpuflags;
 
+#undef cpuid_count
 #undef cpuid
 }
 #else
@@ -40,11 +40,13 @@
 #endif
 #include "bauhaus/bauhaus.h"
 #include "common/cpuid.h"
+#include "common/file_cache.h"
 #include "common/film.h"
 #include "common/grealpath.h"
 #include "common/image.h"
 #include "common/image_cache.h"
 #include "common/imageio_module.h"
+#include "common/interpolation.h"
 #include "common/l10n.h"
 #include "common/mipmap_cache.h"
 #include "common/noiseprofiles.h"
@@ -295,15 +297,25 @@ static void dt_codepaths_init()
   {
 #ifdef HAVE_BUILTIN_CPU_SUPPORTS
     darktable.codepath.SSE2 = (__builtin_cpu_supports("sse") && __builtin_cpu_supports("sse2"));
+#ifdef HAVE_TARGET_AVX2
+    darktable.codepath.AVX2 = (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"));
+#endif
 #else
     dt_cpu_flags_t flags = dt_detect_cpu_features();
     darktable.codepath.SSE2 = ((flags & (CPU_FLAG_SSE)) && (flags & (CPU_FLAG_SSE2)));
+#ifdef HAVE_TARGET_AVX2
+    darktable.codepath.AVX2 = ((flags & (CPU_FLAG_AVX2)) && (flags & (CPU_FLAG_FMA)));
+#endif
 #endif
   }
 
   // second, apply overrides from conf
   // NOTE: all intrinsics sets can only be overridden to OFF
   if(!dt_conf_get_bool("codepaths/sse2")) darktable.codepath.SSE2 = 0;
+  if(!dt_conf_get_bool("codepaths/avx2")) darktable.codepath.AVX2 = 0;
+
+  // the AVX2 codepaths are an addition to the SSE2 ones, never a replacement
+  if(!darktable.codepath.SSE2) darktable.codepath.AVX2 = 0;
 
   // last: do we have any intrinsics sets enabled?
   darktable.codepath._no_intrinsics = !(darktable.codepath.SSE2);
@@ -498,6 +510,11 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 #else
                "  SSE2 optimized codepath disabled\n"
 #endif
+#ifdef HAVE_TARGET_AVX2
+               "  AVX2 optimized codepath enabled\n"
+#else
+               "  AVX2 optimized codepath disabled\n"
+#endif
 #ifdef _OPENMP
                "  OpenMP support enabled\n"
 #else
@@ -894,6 +911,10 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 
   darktable.noiseprofile_parser = dt_noiseprofile_init(noiseprofiles_from_command);
 
+  // before the caches, the image loaders read their files through it
+  darktable.file_cache = (dt_file_cache_t *)calloc(1, sizeof(dt_file_cache_t));
+  dt_file_cache_init(darktable.file_cache);
+
   // must come before mipmap_cache, because that one will need to access
   // image dimensions stored in here:
   darktable.image_cache = (dt_image_cache_t *)calloc(1, sizeof(dt_image_cache_t));
@@ -1075,6 +1096,9 @@ void dt_cleanup()
   free(darktable.image_cache);
   dt_mipmap_cache_cleanup(darktable.mipmap_cache);
   free(darktable.mipmap_cache);
+  dt_file_cache_cleanup(darktable.file_cache);
+  free(darktable.file_cache);
+  darktable.file_cache = NULL;
   if(init_gui)
   {
     dt_control_cleanup(darktable.control);
@@ -1087,6 +1111,7 @@ void dt_cleanup()
   dt_points_cleanup(darktable.points);
   free(darktable.points);
   dt_iop_unload_modules_so();
+  dt_interpolation_cleanup();
   dt_opencl_cleanup(darktable.opencl);
   free(darktable.opencl);
 #ifdef HAVE_GPHOTO2
@@ -1162,6 +1187,20 @@ void dt_free_align(void *mem)
 }
 #endif
 
+static __thread const dt_cancel_token_t *_cancel_token = NULL;
+
+const dt_cancel_token_t *dt_cancel_token_set(const dt_cancel_token_t *token)
+{
+  const dt_cancel_token_t *previous = _cancel_token;
+  _cancel_token = token;
+  return previous;
+}
+
+const dt_cancel_token_t *dt_cancel_token_get(void)
+{
+  return _cancel_token;
+}
+
 void dt_show_times(const dt_times_t *start, const char *prefix, const char *suffix, ...)
 {
   dt_times_t end;
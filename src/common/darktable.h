@@ -157,6 +157,7 @@ struct dt_control_t;
 struct dt_develop_t;
 struct dt_mipmap_cache_t;
 struct dt_image_cache_t;
+struct dt_file_cache_t;
 struct dt_lib_t;
 struct dt_conf_t;
 struct dt_points_t;
@@ -190,6 +191,7 @@ typedef enum dt_debug_thread_t
 typedef struct dt_codepath_t
 {
   unsigned int SSE2 : 1;
+  unsigned int AVX2 : 1; // AVX2 + FMA, only ever set if SSE2 is set as well
   unsigned int _no_intrinsics : 1;
   unsigned int OPENMP_SIMD : 1; // always stays the last one
 } dt_codepath_t;
@@ -212,6 +214,7 @@ typedef struct darktable_t
   struct dt_gui_gtk_t *gui;
   struct dt_mipmap_cache_t *mipmap_cache;
   struct dt_image_cache_t *image_cache;
+  struct dt_file_cache_t *file_cache;
   struct dt_bauhaus_t *bauhaus;
   const struct dt_database_t *db;
   const struct dt_pwstorage_t *pwstorage;
@@ -266,6 +269,30 @@ static inline gboolean dt_is_aligned(const void *pointer, size_t byte_count)
     return (uintptr_t)pointer % byte_count == 0;
 }
 
+/** cooperative cancellation: whoever starts a long running job (the pixelpipe) installs a token
+ *  for the calling thread, the heavy helpers poll it between their stages and bail out early. */
+typedef struct dt_cancel_token_t
+{
+  int (*cancelled)(const void *data);
+  const void *data;
+} dt_cancel_token_t;
+
+/** install the token for the calling thread, returns the previous one to be restored afterwards. */
+const dt_cancel_token_t *dt_cancel_token_set(const dt_cancel_token_t *token);
+/** the token of the calling thread, to hand over to worker threads. */
+const dt_cancel_token_t *dt_cancel_token_get(void);
+
+static inline int dt_cancel_token_cancelled(const dt_cancel_token_t *token)
+{
+  return token && token->cancelled && token->cancelled(token->data);
+}
+
+/** true if the job running in the calling thread has been cancelled. */
+static inline int dt_cancelled(void)
+{
+  return dt_cancel_token_cancelled(dt_cancel_token_get());
+}
+
 int dt_capabilities_check(char *capability);
 void dt_capabilities_add(char *capability);
 void dt_capabilities_remove(char *capability);
@@ -328,6 +328,9 @@ static void dwt_wavelet_decompose(float *img, dwt_params_t *const p, _dwt_layer_
   hpass = 0;
   for(unsigned int lev = 0; lev < p->scales && bcontinue; lev++)
   {
+    // the pipe may have been cancelled while we were busy with the previous scale
+    if(dt_cancelled()) goto cleanup;
+
     lpass = (1 - (lev & 1));
 
     for(int row = 0; row < p->height; row++)
@@ -58,6 +58,7 @@ extern "C" {
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/exif.h"
+#include "common/file_cache.h"
 #include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/imageio_jpeg.h"
@@ -79,6 +80,25 @@ public:
   ~Lock() { dt_pthread_mutex_unlock(&darktable.exiv2_threadsafe); }
 };
 
+// exiv2 reads from the file cache where possible, so exif, thumbnail and pixels of an image come from the
+// same mapping. the file has to stay mapped for as long as the Exiv2::Image is around, so declare this first.
+class MappedFile
+{
+public:
+  MappedFile(const char *path)
+      : path(path), file(dt_file_cache_get(darktable.file_cache, path, DT_FILE_CACHE_RANDOM)) {}
+  ~MappedFile() { dt_file_cache_release(darktable.file_cache, file); }
+  Exiv2::Image::AutoPtr open()
+  {
+    if(file) return Exiv2::ImageFactory::open(file->data, file->size);
+    return Exiv2::ImageFactory::open(WIDEN(path));
+  }
+
+private:
+  const char *path;
+  const dt_mapped_file_t *file;
+};
+
 #define read_metadata_threadsafe(image)                       \
 {                                                             \
   Lock lock;                                                  \
@@ -985,7 +1005,8 @@ int dt_exif_get_thumbnail(const char *path, uint8_t **buffer, size_t *size, char
 {
   try
   {
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
+    MappedFile mapped(path);
+    std::unique_ptr<Exiv2::Image> image(mapped.open());
     assert(image.get() != 0);
     read_metadata_threadsafe(image);
 
@@ -1046,7 +1067,8 @@ int dt_exif_read(dt_image_t *img, const char *path)
 
   try
   {
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
+    MappedFile mapped(path);
+    std::unique_ptr<Exiv2::Image> image(mapped.open());
     assert(image.get() != 0);
     read_metadata_threadsafe(image);
     bool res = true;
@@ -1149,7 +1171,8 @@ int dt_exif_read_blob(uint8_t **buf, const char *path, const int imgid, const in
   *buf = NULL;
   try
   {
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
+    MappedFile mapped(path);
+    std::unique_ptr<Exiv2::Image> image(mapped.open());
     assert(image.get() != 0);
     read_metadata_threadsafe(image);
     Exiv2::ExifData &exifData = image->exifData();
@@ -0,0 +1,190 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/file_cache.h"
+#include "common/darktable.h"
+
+#include <glib/gstdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+// enough for the exif, thumbnail and pixel steps of a few images being loaded at the same time
+#define DT_FILE_CACHE_UNUSED 4
+
+typedef struct dt_file_cache_entry_t
+{
+  dt_mapped_file_t file; // has to come first, this is what the callers get
+  GMappedFile *mapping;
+  gchar *filename;
+  goffset size;
+  time_t mtime;
+  int users;
+  gboolean stale; // the file changed on disk, drop the mapping once the last user is gone
+} dt_file_cache_entry_t;
+
+static void _entry_free(dt_file_cache_entry_t *entry)
+{
+  g_mapped_file_unref(entry->mapping);
+  g_free(entry->filename);
+  free(entry);
+}
+
+static void _advise(const dt_file_cache_entry_t *entry, const dt_file_cache_access_t access)
+{
+#ifndef _WIN32
+  // mappings start at a page boundary, as posix_madvise() wants it
+  posix_madvise((void *)entry->file.data, entry->file.size,
+                access == DT_FILE_CACHE_SEQUENTIAL ? POSIX_MADV_SEQUENTIAL : POSIX_MADV_RANDOM);
+  if(access == DT_FILE_CACHE_SEQUENTIAL)
+    posix_madvise((void *)entry->file.data, entry->file.size, POSIX_MADV_WILLNEED);
+#endif
+}
+
+// drop released files beyond the ones we keep around. needs the lock.
+static void _trim(dt_file_cache_t *cache)
+{
+  int unused = 0;
+  GList *iter = cache->files;
+  while(iter)
+  {
+    GList *next = g_list_next(iter);
+    dt_file_cache_entry_t *entry = (dt_file_cache_entry_t *)iter->data;
+    if(entry->users == 0 && (entry->stale || ++unused > cache->max_unused))
+    {
+      cache->files = g_list_delete_link(cache->files, iter);
+      _entry_free(entry);
+    }
+    iter = next;
+  }
+}
+
+void dt_file_cache_init(dt_file_cache_t *cache)
+{
+  dt_pthread_mutex_init(&cache->lock, NULL);
+  cache->files = NULL;
+  cache->max_unused = DT_FILE_CACHE_UNUSED;
+  cache->maps = cache->hits = cache->bytes = 0;
+}
+
+void dt_file_cache_cleanup(dt_file_cache_t *cache)
+{
+  dt_file_cache_print(cache);
+  for(GList *iter = cache->files; iter; iter = g_list_next(iter))
+  {
+    dt_file_cache_entry_t *entry = (dt_file_cache_entry_t *)iter->data;
+    if(entry->users) fprintf(stderr, "[file_cache] `%s' is still in use\n", entry->filename);
+    _entry_free(entry);
+  }
+  g_list_free(cache->files);
+  cache->files = NULL;
+  dt_pthread_mutex_destroy(&cache->lock);
+}
+
+const dt_mapped_file_t *dt_file_cache_get(dt_file_cache_t *cache, const char *filename,
+                                          const dt_file_cache_access_t access)
+{
+  if(!cache || !filename || !*filename) return NULL;
+
+  GStatBuf st;
+  // empty files can't be mapped
+  if(g_stat(filename, &st) || !S_ISREG(st.st_mode) || st.st_size == 0) return NULL;
+
+  dt_pthread_mutex_lock(&cache->lock);
+  for(GList *iter = cache->files; iter; iter = g_list_next(iter))
+  {
+    dt_file_cache_entry_t *entry = (dt_file_cache_entry_t *)iter->data;
+    if(entry->stale || strcmp(entry->filename, filename)) continue;
+
+    if(entry->size == st.st_size && entry->mtime == st.st_mtime)
+    {
+      entry->users++;
+      cache->hits++;
+      cache->files = g_list_remove_link(cache->files, iter);
+      cache->files = g_list_concat(iter, cache->files);
+      _advise(entry, access);
+      dt_pthread_mutex_unlock(&cache->lock);
+      dt_print(DT_DEBUG_CACHE, "[file_cache] reusing `%s'\n", filename);
+      return &entry->file;
+    }
+
+    entry->stale = TRUE;
+    _trim(cache);
+    break;
+  }
+  dt_pthread_mutex_unlock(&cache->lock);
+
+  // map outside of the lock, other threads may go on with files they have already
+  GError *error = NULL;
+  GMappedFile *mapping = g_mapped_file_new(filename, FALSE, &error);
+  if(!mapping)
+  {
+    dt_print(DT_DEBUG_CACHE, "[file_cache] can't map `%s': %s\n", filename, error->message);
+    g_error_free(error);
+    return NULL;
+  }
+
+  dt_file_cache_entry_t *entry = (dt_file_cache_entry_t *)calloc(1, sizeof(dt_file_cache_entry_t));
+  entry->mapping = mapping;
+  entry->filename = g_strdup(filename);
+  entry->file.data = (const uint8_t *)g_mapped_file_get_contents(mapping);
+  entry->file.size = g_mapped_file_get_length(mapping);
+  entry->size = st.st_size;
+  entry->mtime = st.st_mtime;
+  entry->users = 1;
+  _advise(entry, access);
+
+  dt_pthread_mutex_lock(&cache->lock);
+  cache->maps++;
+  cache->bytes += entry->file.size;
+  cache->files = g_list_prepend(cache->files, entry);
+  _trim(cache);
+  dt_pthread_mutex_unlock(&cache->lock);
+
+  dt_print(DT_DEBUG_CACHE, "[file_cache] mapped `%s', %zu bytes\n", filename, entry->file.size);
+  return &entry->file;
+}
+
+void dt_file_cache_release(dt_file_cache_t *cache, const dt_mapped_file_t *file)
+{
+  if(!cache || !file) return;
+
+  dt_pthread_mutex_lock(&cache->lock);
+  dt_file_cache_entry_t *entry = (dt_file_cache_entry_t *)file;
+  entry->users--;
+  _trim(cache);
+  dt_pthread_mutex_unlock(&cache->lock);
+}
+
+void dt_file_cache_print(dt_file_cache_t *cache)
+{
+  dt_pthread_mutex_lock(&cache->lock);
+  dt_print(DT_DEBUG_PERF, "[file_cache] %" PRIu64 " files read from storage (%.1f MB), %" PRIu64
+                          " requests served by files read before\n",
+           cache->maps, cache->bytes / (1024.0 * 1024.0), cache->hits);
+  dt_pthread_mutex_unlock(&cache->lock);
+}
+
+#undef DT_FILE_CACHE_UNUSED
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,80 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/dtpthread.h"
+
+#include <glib.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** read only memory mappings of input files, shared between everything reading the same file:
+ *  exif parsing, thumbnail extraction and the pixel loaders. the last few released files stay mapped,
+ *  so the steps of one import or image load read the file from storage only once. */
+
+/** how the file is going to be read, passed on to the kernel as madvise() hint */
+typedef enum dt_file_cache_access_t
+{
+  DT_FILE_CACHE_RANDOM = 0,     // jumping around in the file, e.g. parsing the tiff structure for exif
+  DT_FILE_CACHE_SEQUENTIAL = 1  // reading most of the file front to back, e.g. decoding pixels
+} dt_file_cache_access_t;
+
+typedef struct dt_mapped_file_t
+{
+  const uint8_t *data;
+  size_t size;
+} dt_mapped_file_t;
+
+typedef struct dt_file_cache_t
+{
+  dt_pthread_mutex_t lock;
+  GList *files; // most recently used first
+  int max_unused; // number of released files to keep mapped
+
+  // i/o counters, see dt_file_cache_print()
+  uint64_t maps;      // files mapped from storage
+  uint64_t hits;      // requests served by a file that was mapped already
+  uint64_t bytes;     // size of all files mapped from storage
+} dt_file_cache_t;
+
+void dt_file_cache_init(dt_file_cache_t *cache);
+void dt_file_cache_cleanup(dt_file_cache_t *cache);
+
+/** map filename, or get the existing mapping if the file hasn't changed since. returns NULL if the file
+ *  can't be mapped, the caller should then read it the usual way. cache may be NULL, for code running
+ *  outside of darktable's init/cleanup. */
+const dt_mapped_file_t *dt_file_cache_get(dt_file_cache_t *cache, const char *filename,
+                                          const dt_file_cache_access_t access);
+
+/** hand back a file returned by dt_file_cache_get(), file may be NULL. */
+void dt_file_cache_release(dt_file_cache_t *cache, const dt_mapped_file_t *file);
+
+/** print the i/o counters, with -d perf. */
+void dt_file_cache_print(dt_file_cache_t *cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
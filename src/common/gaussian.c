@@ -22,6 +22,10 @@
 #if defined(__SSE__)
 #include <xmmintrin.h>
 #endif
+#ifdef HAVE_TARGET_AVX2
+#include <immintrin.h>
+#endif
+#include "common/darktable.h"
 #include "common/gaussian.h"
 #include "common/opencl.h"
 
@@ -33,6 +37,11 @@
 
 #define BLOCKSIZE (1 << 6)
 
+// number of floats (and so neighbouring columns) run through the vertical recursion together.
+// reading a whole strip per row turns the column walk into a stream of full cache lines.
+#define GAUSS_STRIP 16
+#define GAUSS_STRIP_4C (GAUSS_STRIP / 4)
+
 static void compute_gauss_params(const float sigma, dt_gaussian_order_t order, float *a0, float *a1,
                                  float *a2, float *a3, float *b1, float *b2, float *coefp, float *coefn)
 {
@@ -155,6 +164,82 @@ error:
 }
 
 
+// vertical recursion of a strip of n <= GAUSS_STRIP floats of neighbouring columns starting at column i0
+static inline void gaussian_vertical_strip(const float *const in, float *const temp, const int width,
+                                           const int height, const int ch, const int i0, const int n,
+                                           const float *const Labmin, const float *const Labmax, const float a0,
+                                           const float a1, const float a2, const float a3, const float b1,
+                                           const float b2, const float coefp, const float coefn)
+{
+  float xp[GAUSS_STRIP];
+  float yb[GAUSS_STRIP];
+  float yp[GAUSS_STRIP];
+  float xn[GAUSS_STRIP];
+  float xa[GAUSS_STRIP];
+  float yn[GAUSS_STRIP];
+  float ya[GAUSS_STRIP];
+  float mn[GAUSS_STRIP];
+  float mx[GAUSS_STRIP];
+
+  for(int k = 0; k < n; k++)
+  {
+    mn[k] = Labmin[k % ch];
+    mx[k] = Labmax[k % ch];
+  }
+
+  // forward filter
+  for(int k = 0; k < n; k++)
+  {
+    xp[k] = CLAMPF(in[(size_t)i0 * ch + k], mn[k], mx[k]);
+    yb[k] = xp[k] * coefp;
+    yp[k] = yb[k];
+  }
+
+  for(int j = 0; j < height; j++)
+  {
+    const size_t offset = ((size_t)j * width + i0) * ch;
+
+    for(int k = 0; k < n; k++)
+    {
+      const float xc = CLAMPF(in[offset + k], mn[k], mx[k]);
+      const float yc = (a0 * xc) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
+
+      temp[offset + k] = yc;
+
+      xp[k] = xc;
+      yb[k] = yp[k];
+      yp[k] = yc;
+    }
+  }
+
+  // backward filter
+  for(int k = 0; k < n; k++)
+  {
+    xn[k] = CLAMPF(in[((size_t)(height - 1) * width + i0) * ch + k], mn[k], mx[k]);
+    xa[k] = xn[k];
+    yn[k] = xn[k] * coefn;
+    ya[k] = yn[k];
+  }
+
+  for(int j = height - 1; j > -1; j--)
+  {
+    const size_t offset = ((size_t)j * width + i0) * ch;
+
+    for(int k = 0; k < n; k++)
+    {
+      const float xc = CLAMPF(in[offset + k], mn[k], mx[k]);
+      const float yc = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
+
+      xa[k] = xn[k];
+      xn[k] = xc;
+      ya[k] = yn[k];
+      yn[k] = yc;
+
+      temp[offset + k] += yc;
+    }
+  }
+}
+
 void dt_gaussian_blur(dt_gaussian_t *g, const float *const in, float *const out)
 {
 
@@ -171,78 +256,29 @@ void dt_gaussian_blur(dt_gaussian_t *g, const float *const in, float *const out)
   float *Labmax = g->max;
   float *Labmin = g->min;
 
-// vertical blur column by column
+  const int strip = GAUSS_STRIP / ch;
+
+// vertical blur, a strip of neighbouring columns at a time
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(temp, Labmin, Labmax, a0, a1, a2, a3, b1, b2, coefp,           \
                                               coefn) schedule(static)
 #endif
-  for(int i = 0; i < width; i++)
+  for(int i0 = 0; i0 < width; i0 += strip)
   {
-    float xp[4] = {0.0f};
-    float yb[4] = {0.0f};
-    float yp[4] = {0.0f};
-    float xc[4] = {0.0f};
-    float yc[4] = {0.0f};
-    float xn[4] = {0.0f};
-    float xa[4] = {0.0f};
-    float yn[4] = {0.0f};
-    float ya[4] = {0.0f};
-
-    // forward filter
-    for(int k = 0; k < ch; k++)
-    {
-      xp[k] = CLAMPF(in[(size_t)i * ch + k], Labmin[k], Labmax[k]);
-      yb[k] = xp[k] * coefp;
-      yp[k] = yb[k];
-      xc[k] = yc[k] = xn[k] = xa[k] = yn[k] = ya[k] = 0.0f;
-    }
-
-    for(int j = 0; j < height; j++)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      for(int k = 0; k < ch; k++)
-      {
-        xc[k] = CLAMPF(in[offset + k], Labmin[k], Labmax[k]);
-        yc[k] = (a0 * xc[k]) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
-
-        temp[offset + k] = yc[k];
-
-        xp[k] = xc[k];
-        yb[k] = yp[k];
-        yp[k] = yc[k];
-      }
-    }
-
-    // backward filter
-    for(int k = 0; k < ch; k++)
-    {
-      xn[k] = CLAMPF(in[((size_t)(height - 1) * width + i) * ch + k], Labmin[k], Labmax[k]);
-      xa[k] = xn[k];
-      yn[k] = xn[k] * coefn;
-      ya[k] = yn[k];
-    }
-
-    for(int j = height - 1; j > -1; j--)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      for(int k = 0; k < ch; k++)
-      {
-        xc[k] = CLAMPF(in[offset + k], Labmin[k], Labmax[k]);
-
-        yc[k] = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
-
-        xa[k] = xn[k];
-        xn[k] = xc[k];
-        ya[k] = yn[k];
-        yn[k] = yc[k];
-
-        temp[offset + k] += yc[k];
-      }
-    }
+    // number of floats of the strip in every row
+    const int n = MIN(strip, width - i0) * ch;
+    // a constant trip count lets the compiler keep the whole recursion state in registers
+    if(n == GAUSS_STRIP)
+      gaussian_vertical_strip(in, temp, width, height, ch, i0, GAUSS_STRIP, Labmin, Labmax, a0, a1, a2, a3, b1,
+                              b2, coefp, coefn);
+    else
+      gaussian_vertical_strip(in, temp, width, height, ch, i0, n, Labmin, Labmax, a0, a1, a2, a3, b1, b2, coefp,
+                              coefn);
   }
 
+  // the output of a cancelled pipe is discarded anyway, skip the second pass
+  if(dt_cancelled()) return;
+
 // horizontal blur line by line
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(temp, Labmin, Labmax, a0, a1, a2, a3, b1, b2, coefp,           \
@@ -319,6 +355,79 @@ void dt_gaussian_blur(dt_gaussian_t *g, const float *const in, float *const out)
 
 
 #if defined(__SSE__)
+// vertical recursion of n <= GAUSS_STRIP_4C neighbouring 4 channel columns starting at i0
+static inline void gaussian_vertical_4c_sse(const float *const in, float *const temp, const int width,
+                                            const int height, const int i0, const int n, const __m128 Labmin,
+                                            const __m128 Labmax, const float a0, const float a1, const float a2,
+                                            const float a3, const float b1, const float b2, const float coefp,
+                                            const float coefn)
+{
+  __m128 xp[GAUSS_STRIP_4C];
+  __m128 yb[GAUSS_STRIP_4C];
+  __m128 yp[GAUSS_STRIP_4C];
+
+  // forward filter
+  for(int c = 0; c < n; c++)
+  {
+    xp[c] = MMCLAMPPS(_mm_load_ps(in + (size_t)(i0 + c) * 4), Labmin, Labmax);
+    yb[c] = _mm_mul_ps(_mm_set_ps1(coefp), xp[c]);
+    yp[c] = yb[c];
+  }
+
+  for(int j = 0; j < height; j++)
+  {
+    const size_t offset = ((size_t)j * width + i0) * 4;
+
+    for(int c = 0; c < n; c++)
+    {
+      const __m128 xc = MMCLAMPPS(_mm_load_ps(in + offset + 4 * c), Labmin, Labmax);
+
+      const __m128 yc = _mm_add_ps(
+          _mm_mul_ps(xc, _mm_set_ps1(a0)),
+          _mm_sub_ps(_mm_mul_ps(xp[c], _mm_set_ps1(a1)),
+                     _mm_add_ps(_mm_mul_ps(yp[c], _mm_set_ps1(b1)), _mm_mul_ps(yb[c], _mm_set_ps1(b2)))));
+
+      _mm_store_ps(temp + offset + 4 * c, yc);
+
+      xp[c] = xc;
+      yb[c] = yp[c];
+      yp[c] = yc;
+    }
+  }
+
+  // backward filter, reusing the registers: xp, yp, yb become xn, yn, ya
+  __m128 xa[GAUSS_STRIP_4C];
+  for(int c = 0; c < n; c++)
+  {
+    xp[c] = MMCLAMPPS(_mm_load_ps(in + ((size_t)(height - 1) * width + i0 + c) * 4), Labmin, Labmax);
+    xa[c] = xp[c];
+    yp[c] = _mm_mul_ps(_mm_set_ps1(coefn), xp[c]);
+    yb[c] = yp[c];
+  }
+
+  for(int j = height - 1; j > -1; j--)
+  {
+    const size_t offset = ((size_t)j * width + i0) * 4;
+
+    for(int c = 0; c < n; c++)
+    {
+      const __m128 xc = MMCLAMPPS(_mm_load_ps(in + offset + 4 * c), Labmin, Labmax);
+
+      const __m128 yc = _mm_add_ps(
+          _mm_mul_ps(xp[c], _mm_set_ps1(a2)),
+          _mm_sub_ps(_mm_mul_ps(xa[c], _mm_set_ps1(a3)),
+                     _mm_add_ps(_mm_mul_ps(yp[c], _mm_set_ps1(b1)), _mm_mul_ps(yb[c], _mm_set_ps1(b2)))));
+
+      xa[c] = xp[c];
+      xp[c] = xc;
+      yb[c] = yp[c];
+      yp[c] = yc;
+
+      _mm_store_ps(temp + offset + 4 * c, _mm_add_ps(_mm_load_ps(temp + offset + 4 * c), yc));
+    }
+  }
+}
+
 static void dt_gaussian_blur_4c_sse(dt_gaussian_t *g, const float *const in, float *const out)
 {
 
@@ -338,11 +447,28 @@ static void dt_gaussian_blur_4c_sse(dt_gaussian_t *g, const float *const in, flo
   float *temp = g->buf;
 
 
-// vertical blur column by column
+// vertical blur, GAUSS_STRIP_4C columns at a time
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(temp, a0, a1, a2, a3, b1, b2, coefp, coefn) schedule(static)
+#endif
+  for(int i0 = 0; i0 < width; i0 += GAUSS_STRIP_4C)
+  {
+    const int n = MIN(GAUSS_STRIP_4C, width - i0);
+    if(n == GAUSS_STRIP_4C)
+      gaussian_vertical_4c_sse(in, temp, width, height, i0, GAUSS_STRIP_4C, Labmin, Labmax, a0, a1, a2, a3, b1,
+                               b2, coefp, coefn);
+    else
+      gaussian_vertical_4c_sse(in, temp, width, height, i0, n, Labmin, Labmax, a0, a1, a2, a3, b1, b2, coefp,
+                               coefn);
+  }
+
+  if(dt_cancelled()) return;
+
+// horizontal blur line by line
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(temp, a0, a1, a2, a3, b1, b2, coefp, coefn) schedule(static)
 #endif
-  for(int i = 0; i < width; i++)
+  for(size_t j = 0; j < height; j++)
   {
     __m128 xp = _mm_setzero_ps();
     __m128 yb = _mm_setzero_ps();
@@ -355,24 +481,23 @@ static void dt_gaussian_blur_4c_sse(dt_gaussian_t *g, const float *const in, flo
     __m128 ya = _mm_setzero_ps();
 
     // forward filter
-    xp = MMCLAMPPS(_mm_load_ps(in + i * ch), Labmin, Labmax);
+    xp = MMCLAMPPS(_mm_load_ps(temp + j * width * ch), Labmin, Labmax);
     yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
     yp = yb;
 
 
-    for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
     {
       size_t offset = ((size_t)j * width + i) * ch;
 
-      xc = MMCLAMPPS(_mm_load_ps(in + offset), Labmin, Labmax);
-
+      xc = MMCLAMPPS(_mm_load_ps(temp + offset), Labmin, Labmax);
 
       yc = _mm_add_ps(
           _mm_mul_ps(xc, _mm_set_ps1(a0)),
           _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
                      _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
 
-      _mm_store_ps(temp + offset, yc);
+      _mm_store_ps(out + offset, yc);
 
       xp = xc;
       yb = yp;
@@ -380,16 +505,17 @@ static void dt_gaussian_blur_4c_sse(dt_gaussian_t *g, const float *const in, flo
     }
 
     // backward filter
-    xn = MMCLAMPPS(_mm_load_ps(in + ((size_t)(height - 1) * width + i) * ch), Labmin, Labmax);
+    xn = MMCLAMPPS(_mm_load_ps(temp + ((size_t)(j + 1) * width - 1) * ch), Labmin, Labmax);
     xa = xn;
     yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
     ya = yn;
 
-    for(int j = height - 1; j > -1; j--)
+
+    for(int i = width - 1; i > -1; i--)
     {
       size_t offset = ((size_t)j * width + i) * ch;
 
-      xc = MMCLAMPPS(_mm_load_ps(in + offset), Labmin, Labmax);
+      xc = MMCLAMPPS(_mm_load_ps(temp + offset), Labmin, Labmax);
 
       yc = _mm_add_ps(
           _mm_mul_ps(xn, _mm_set_ps1(a2)),
@@ -402,83 +528,169 @@ static void dt_gaussian_blur_4c_sse(dt_gaussian_t *g, const float *const in, flo
       ya = yn;
       yn = yc;
 
-      _mm_store_ps(temp + offset, _mm_add_ps(_mm_load_ps(temp + offset), yc));
+      _mm_store_ps(out + offset, _mm_add_ps(_mm_load_ps(out + offset), yc));
     }
   }
+}
+#endif
 
-// horizontal blur line by line
+#ifdef HAVE_TARGET_AVX2
+// one recursion step on two 4 channel pixels at once: y = a * x + b * xx - c * y1 - d * y2
+#define GAUSS_STEP_AVX2(x, xx, y1, y2, A, B, C, D)                                                           \
+  _mm256_fnmadd_ps((y2), (D), _mm256_fnmadd_ps((y1), (C), _mm256_fmadd_ps((xx), (B), _mm256_mul_ps((x), (A)))))
+
+__attribute__((target("avx2,fma")))
+static void dt_gaussian_blur_4c_avx2(dt_gaussian_t *g, const float *const in, float *const out)
+{
+  const int width = g->width;
+  const int height = g->height;
+
+  assert(g->channels == 4);
+
+  float a0, a1, a2, a3, b1, b2, coefp, coefn;
+
+  compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
+
+  const __m256 Labmax = _mm256_setr_ps(g->max[0], g->max[1], g->max[2], g->max[3], g->max[0], g->max[1],
+                                       g->max[2], g->max[3]);
+  const __m256 Labmin = _mm256_setr_ps(g->min[0], g->min[1], g->min[2], g->min[3], g->min[0], g->min[1],
+                                       g->min[2], g->min[3]);
+
+  float *temp = g->buf;
+
+// vertical blur, GAUSS_STRIP_4C columns at a time as two pairs of neighbouring pixels
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(temp, a0, a1, a2, a3, b1, b2, coefp, coefn) schedule(static)
 #endif
-  for(size_t j = 0; j < height; j++)
+  for(int i0 = 0; i0 < width; i0 += GAUSS_STRIP_4C)
   {
-    __m128 xp = _mm_setzero_ps();
-    __m128 yb = _mm_setzero_ps();
-    __m128 yp = _mm_setzero_ps();
-    __m128 xc = _mm_setzero_ps();
-    __m128 yc = _mm_setzero_ps();
-    __m128 xn = _mm_setzero_ps();
-    __m128 xa = _mm_setzero_ps();
-    __m128 yn = _mm_setzero_ps();
-    __m128 ya = _mm_setzero_ps();
+    if(width - i0 < GAUSS_STRIP_4C)
+    {
+      // narrow rest of the image
+      const __m128 min4 = _mm256_castps256_ps128(Labmin), max4 = _mm256_castps256_ps128(Labmax);
+      gaussian_vertical_4c_sse(in, temp, width, height, i0, width - i0, min4, max4, a0, a1, a2, a3, b1, b2,
+                               coefp, coefn);
+      continue;
+    }
+
+    const __m256 A0 = _mm256_set1_ps(a0), A1 = _mm256_set1_ps(a1), A2 = _mm256_set1_ps(a2),
+                 A3 = _mm256_set1_ps(a3), B1 = _mm256_set1_ps(b1), B2 = _mm256_set1_ps(b2);
+    __m256 xp[2], yb[2], yp[2], xa[2];
 
     // forward filter
-    xp = MMCLAMPPS(_mm_load_ps(temp + j * width * ch), Labmin, Labmax);
-    yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
-    yp = yb;
+    for(int c = 0; c < 2; c++)
+    {
+      xp[c] = _mm256_min_ps(Labmax, _mm256_max_ps(_mm256_loadu_ps(in + (size_t)(i0 + 2 * c) * 4), Labmin));
+      yb[c] = _mm256_mul_ps(_mm256_set1_ps(coefp), xp[c]);
+      yp[c] = yb[c];
+    }
 
+    for(int j = 0; j < height; j++)
+    {
+      const size_t offset = ((size_t)j * width + i0) * 4;
+      for(int c = 0; c < 2; c++)
+      {
+        const __m256 xc = _mm256_min_ps(Labmax, _mm256_max_ps(_mm256_loadu_ps(in + offset + 8 * c), Labmin));
+        const __m256 yc = GAUSS_STEP_AVX2(xc, xp[c], yp[c], yb[c], A0, A1, B1, B2);
+        _mm256_storeu_ps(temp + offset + 8 * c, yc);
+        xp[c] = xc;
+        yb[c] = yp[c];
+        yp[c] = yc;
+      }
+    }
 
-    for(int i = 0; i < width; i++)
+    // backward filter, xp, yp, yb now hold xn, yn, ya
+    for(int c = 0; c < 2; c++)
     {
-      size_t offset = ((size_t)j * width + i) * ch;
+      xp[c] = _mm256_min_ps(
+          Labmax, _mm256_max_ps(_mm256_loadu_ps(in + ((size_t)(height - 1) * width + i0 + 2 * c) * 4), Labmin));
+      xa[c] = xp[c];
+      yp[c] = _mm256_mul_ps(_mm256_set1_ps(coefn), xp[c]);
+      yb[c] = yp[c];
+    }
 
-      xc = MMCLAMPPS(_mm_load_ps(temp + offset), Labmin, Labmax);
+    for(int j = height - 1; j > -1; j--)
+    {
+      const size_t offset = ((size_t)j * width + i0) * 4;
+      for(int c = 0; c < 2; c++)
+      {
+        const __m256 xc = _mm256_min_ps(Labmax, _mm256_max_ps(_mm256_loadu_ps(in + offset + 8 * c), Labmin));
+        const __m256 yc = GAUSS_STEP_AVX2(xp[c], xa[c], yp[c], yb[c], A2, A3, B1, B2);
+        xa[c] = xp[c];
+        xp[c] = xc;
+        yb[c] = yp[c];
+        yp[c] = yc;
+        _mm256_storeu_ps(temp + offset + 8 * c, _mm256_add_ps(_mm256_loadu_ps(temp + offset + 8 * c), yc));
+      }
+    }
+  }
 
-      yc = _mm_add_ps(
-          _mm_mul_ps(xc, _mm_set_ps1(a0)),
-          _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
-                     _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
+  if(dt_cancelled()) return;
 
-      _mm_store_ps(out + offset, yc);
+// horizontal blur, two lines at a time: the lower lane runs along line j, the upper one along line j + 1
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(temp, a0, a1, a2, a3, b1, b2, coefp, coefn) schedule(static)
+#endif
+  for(int j = 0; j < height; j += 2)
+  {
+    const __m256 A0 = _mm256_set1_ps(a0), A1 = _mm256_set1_ps(a1), A2 = _mm256_set1_ps(a2),
+                 A3 = _mm256_set1_ps(a3), B1 = _mm256_set1_ps(b1), B2 = _mm256_set1_ps(b2);
+    // the last line of an odd height image is simply done twice
+    const size_t line0 = (size_t)j * width * 4;
+    const size_t line1 = (size_t)MIN(j + 1, height - 1) * width * 4;
+
+#define LOAD2(o) _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(temp + line0 + (o))),                 \
+                                      _mm_load_ps(temp + line1 + (o)), 1)
+
+    // forward filter
+    __m256 xp = _mm256_min_ps(Labmax, _mm256_max_ps(LOAD2(0), Labmin));
+    __m256 yb = _mm256_mul_ps(_mm256_set1_ps(coefp), xp);
+    __m256 yp = yb;
 
+    for(int i = 0; i < width; i++)
+    {
+      const size_t o = (size_t)i * 4;
+      const __m256 xc = _mm256_min_ps(Labmax, _mm256_max_ps(LOAD2(o), Labmin));
+      const __m256 yc = GAUSS_STEP_AVX2(xc, xp, yp, yb, A0, A1, B1, B2);
+      _mm_store_ps(out + line0 + o, _mm256_castps256_ps128(yc));
+      _mm_store_ps(out + line1 + o, _mm256_extractf128_ps(yc, 1));
       xp = xc;
       yb = yp;
       yp = yc;
     }
 
     // backward filter
-    xn = MMCLAMPPS(_mm_load_ps(temp + ((size_t)(j + 1) * width - 1) * ch), Labmin, Labmax);
-    xa = xn;
-    yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
-    ya = yn;
-
+    __m256 xn = _mm256_min_ps(Labmax, _mm256_max_ps(LOAD2((size_t)(width - 1) * 4), Labmin));
+    __m256 xa = xn;
+    __m256 yn = _mm256_mul_ps(_mm256_set1_ps(coefn), xn);
+    __m256 ya = yn;
 
     for(int i = width - 1; i > -1; i--)
     {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(temp + offset), Labmin, Labmax);
-
-      yc = _mm_add_ps(
-          _mm_mul_ps(xn, _mm_set_ps1(a2)),
-          _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
-                     _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
-
-
+      const size_t o = (size_t)i * 4;
+      const __m256 xc = _mm256_min_ps(Labmax, _mm256_max_ps(LOAD2(o), Labmin));
+      const __m256 yc = GAUSS_STEP_AVX2(xn, xa, yn, ya, A2, A3, B1, B2);
       xa = xn;
       xn = xc;
       ya = yn;
       yn = yc;
-
-      _mm_store_ps(out + offset, _mm_add_ps(_mm_load_ps(out + offset), yc));
+      _mm_store_ps(out + line0 + o, _mm_add_ps(_mm_load_ps(out + line0 + o), _mm256_castps256_ps128(yc)));
+      if(line1 != line0)
+        _mm_store_ps(out + line1 + o, _mm_add_ps(_mm_load_ps(out + line1 + o), _mm256_extractf128_ps(yc, 1)));
     }
+#undef LOAD2
   }
 }
+#undef GAUSS_STEP_AVX2
 #endif
 
 void dt_gaussian_blur_4c(dt_gaussian_t *g, const float *const in, float *const out)
 {
   if(darktable.codepath.OPENMP_SIMD) return dt_gaussian_blur(g, in, out);
+#ifdef HAVE_TARGET_AVX2
+  else if(darktable.codepath.AVX2)
+    return dt_gaussian_blur_4c_avx2(g, in, out);
+#endif
 #if defined(__SSE__)
   else if(darktable.codepath.SSE2)
     return dt_gaussian_blur_4c_sse(g, in, out);
@@ -29,6 +29,7 @@
 */
 
 #include "common/guided_filter.h"
+#include "common/box_filters.h"
 #include "common/darktable.h"
 #include <assert.h>
 #include <stdlib.h>
@@ -82,89 +83,6 @@ static inline int max_i(int a, int b)
   return a > b ? a : b;
 }
 
-// calculate the one-dimensional moving average over a window of size 2*w+1
-// input array x has stride 1, output array y has stride stride_y
-static inline void box_mean_1d(int N, const float *x, float *y, size_t stride_y, int w)
-{
-  float m = 0.f, n_box = 0.f;
-  if(N > 2 * w)
-  {
-    for(int i = 0, i_end = w + 1; i < i_end; i++)
-    {
-      m += x[i];
-      n_box++;
-    }
-    for(int i = 0, i_end = w; i < i_end; i++)
-    {
-      y[i * stride_y] = m / n_box;
-      m += x[i + w + 1];
-      n_box++;
-    }
-    for(int i = w, i_end = N - w - 1; i < i_end; i++)
-    {
-      y[i * stride_y] = m / n_box;
-      m += x[i + w + 1] - x[i - w];
-    }
-    for(int i = N - w -1, i_end = N; i < i_end; i++)
-    {
-      y[i * stride_y] = m / n_box;
-      m -= x[i - w];
-      n_box--;
-    }
-  }
-  else
-  {
-    for(int i = 0, i_end = min_i(w + 1, N); i < i_end; i++)
-    {
-      m += x[i];
-      n_box++;
-    }
-    for(int i = 0; i < N; i++)
-    {
-      y[i * stride_y] = m / n_box;
-      if(i - w >= 0)
-      {
-        m -= x[i - w];
-        n_box--;
-      }
-      if(i + w + 1 < N)
-      {
-        m += x[i + w + 1];
-        n_box++;
-      }
-    }
-  }
-}
-
-// calculate the two-dimensional moving average over a box of size (2*w+1) x (2*w+1)
-// does the calculation in-place if input and ouput images are identical
-// this function is always called from a OpenMP thread, thus no parallelization
-static void box_mean(gray_image img1, gray_image img2, int w)
-{
-  gray_image img2_bak;
-  if(img1.data == img2.data)
-  {
-    img2_bak = new_gray_image(max_i(img2.width, img2.height), 1);
-    for(int i1 = 0; i1 < img2.height; i1++)
-    {
-      memcpy(img2_bak.data, img2.data + (size_t)i1 * img2.width, sizeof(float) * img2.width);
-      box_mean_1d(img2.width, img2_bak.data, img2.data + (size_t)i1 * img2.width, 1, w);
-    }
-  }
-  else
-  {
-    for(int i1 = 0; i1 < img1.height; i1++)
-      box_mean_1d(img1.width, img1.data + (size_t)i1 * img1.width, img2.data + (size_t)i1 * img2.width, 1, w);
-    img2_bak = new_gray_image(1, img2.height);
-  }
-  for(int i0 = 0; i0 < img1.width; i0++)
-  {
-    for(int i1 = 0; i1 < img1.height; i1++) img2_bak.data[i1] = img2.data[i0 + (size_t)i1 * img2.width];
-    box_mean_1d(img1.height, img2_bak.data, img2.data + i0, img1.width, w);
-  }
-  free_gray_image(&img2_bak);
-}
-
 // apply guided filter to single-component image img using the 3-components
 // image imgg as a guide
 static void guided_filter_tiling(color_image imgg, gray_image img, gray_image img_out, tile target, const int w,
@@ -193,10 +111,10 @@ static void guided_filter_tiling(color_image imgg, gray_image img, gray_image im
       img_mean.data[k] = img.data[i_imgg + (size_t)j_imgg * img.width];
     }
   }
-  box_mean(imgg_mean_r, imgg_mean_r, w);
-  box_mean(imgg_mean_g, imgg_mean_g, w);
-  box_mean(imgg_mean_b, imgg_mean_b, w);
-  box_mean(img_mean, img_mean, w);
+  dt_box_mean(imgg_mean_r.data, imgg_mean_r.width, imgg_mean_r.height, w);
+  dt_box_mean(imgg_mean_g.data, imgg_mean_g.width, imgg_mean_g.height, w);
+  dt_box_mean(imgg_mean_b.data, imgg_mean_b.width, imgg_mean_b.height, w);
+  dt_box_mean(img_mean.data, img_mean.width, img_mean.height, w);
   gray_image cov_imgg_img_r = new_gray_image(width, height);
   gray_image cov_imgg_img_g = new_gray_image(width, height);
   gray_image cov_imgg_img_b = new_gray_image(width, height);
@@ -226,15 +144,15 @@ static void guided_filter_tiling(color_image imgg, gray_image img, gray_image im
       var_imgg_bb.data[k] = pixel[2] * pixel[2];
     }
   }
-  box_mean(cov_imgg_img_r, cov_imgg_img_r, w);
-  box_mean(cov_imgg_img_g, cov_imgg_img_g, w);
-  box_mean(cov_imgg_img_b, cov_imgg_img_b, w);
-  box_mean(var_imgg_rr, var_imgg_rr, w);
-  box_mean(var_imgg_rg, var_imgg_rg, w);
-  box_mean(var_imgg_rb, var_imgg_rb, w);
-  box_mean(var_imgg_gg, var_imgg_gg, w);
-  box_mean(var_imgg_gb, var_imgg_gb, w);
-  box_mean(var_imgg_bb, var_imgg_bb, w);
+  dt_box_mean(cov_imgg_img_r.data, cov_imgg_img_r.width, cov_imgg_img_r.height, w);
+  dt_box_mean(cov_imgg_img_g.data, cov_imgg_img_g.width, cov_imgg_img_g.height, w);
+  dt_box_mean(cov_imgg_img_b.data, cov_imgg_img_b.width, cov_imgg_img_b.height, w);
+  dt_box_mean(var_imgg_rr.data, var_imgg_rr.width, var_imgg_rr.height, w);
+  dt_box_mean(var_imgg_rg.data, var_imgg_rg.width, var_imgg_rg.height, w);
+  dt_box_mean(var_imgg_rb.data, var_imgg_rb.width, var_imgg_rb.height, w);
+  dt_box_mean(var_imgg_gg.data, var_imgg_gg.width, var_imgg_gg.height, w);
+  dt_box_mean(var_imgg_gb.data, var_imgg_gb.width, var_imgg_gb.height, w);
+  dt_box_mean(var_imgg_bb.data, var_imgg_bb.width, var_imgg_bb.height, w);
   for(size_t i = 0; i < size; i++)
   {
     cov_imgg_img_r.data[i] -= imgg_mean_r.data[i] * img_mean.data[i];
@@ -297,10 +215,10 @@ static void guided_filter_tiling(color_image imgg, gray_image img, gray_image im
       ++i;
     }
   }
-  box_mean(a_r, a_r, w);
-  box_mean(a_g, a_g, w);
-  box_mean(a_b, a_b, w);
-  box_mean(b, b, w);
+  dt_box_mean(a_r.data, a_r.width, a_r.height, w);
+  dt_box_mean(a_g.data, a_g.width, a_g.height, w);
+  dt_box_mean(a_b.data, a_b.width, a_b.height, w);
+  dt_box_mean(b.data, b.width, b.height, w);
   for(int j_imgg = target.lower; j_imgg < target.upper; j_imgg++)
   {
     // index of the left most target pixel in the current row
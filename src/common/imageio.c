@@ -577,6 +577,238 @@ int dt_imageio_export(const uint32_t imgid, const char *filename, dt_imageio_mod
                                         storage_params, num, total);
 }
 
+// converts processed float pixels in place to the precision the format asked for
+static void _export_convert_from_float(void *buf, const size_t npixels, const int bpp, const int display_byteorder)
+{
+  if(bpp == 8)
+  {
+    // ldr output: char, in bgr order for display
+    const float *const inbuf = (float *)buf;
+    uint8_t *const outbuf = (uint8_t *)buf;
+    const int r = display_byteorder ? 2 : 0;
+    const int b = 2 - r;
+    for(size_t k = 0; k < npixels; k++)
+    {
+      // convert in place, this is unfortunately very serial..
+      const uint8_t cr = CLAMP(inbuf[4 * k + r] * 0xff, 0, 0xff);
+      const uint8_t cg = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
+      const uint8_t cb = CLAMP(inbuf[4 * k + b] * 0xff, 0, 0xff);
+      outbuf[4 * k + 0] = cr;
+      outbuf[4 * k + 1] = cg;
+      outbuf[4 * k + 2] = cb;
+    }
+  }
+  else if(bpp == 16)
+  {
+    // uint16_t per color channel
+    const float *const inbuf = (float *)buf;
+    uint16_t *const buf16 = (uint16_t *)buf;
+    for(size_t k = 0; k < npixels; k++)
+    {
+      // convert in place
+      for(int i = 0; i < 3; i++) buf16[4 * k + i] = CLAMP(inbuf[4 * k + i] * 0x10000, 0, 0xffff);
+    }
+  }
+  // else output float, no further harm done to the pixels :)
+}
+
+// returns the number of rows to process at a time if keeping the full processed frame around would exceed
+// host_memory_limit, or 0 if it fits or some module needs to see the whole image.
+static int _export_strip_height(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const int width, const int height,
+                                const float scale, int *overlap)
+{
+  const float limit = dt_conf_get_float("host_memory_limit") * 1024.0f * 1024.0f;
+  if(limit <= 0.0f) return 0;
+
+  size_t row_size = 0;
+  *overlap = dt_dev_pixelpipe_get_strip_overlap(pipe, dev, width, height, scale, &row_size);
+  if(*overlap < 0 || (float)row_size * height <= limit) return 0;
+
+  // the padding gets processed once more for every strip, don't let it dominate
+  const int rows = MAX((int)(limit / row_size) - 2 * *overlap, MAX(2 * *overlap, 64));
+  return rows < height ? rows : 0;
+}
+
+// flips the byte order of 8-bit pixels coming out of the pipe for display
+static void _export_flip_byteorder(uint8_t *const buf8, const size_t npixels)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(size_t k = 0; k < npixels; k++)
+  {
+    uint8_t tmp = buf8[4 * k + 0];
+    buf8[4 * k + 0] = buf8[4 * k + 2];
+    buf8[4 * k + 2] = tmp;
+  }
+}
+
+// encodes the strips on a thread of its own while the pipe works on the next one
+typedef struct dt_imageio_strip_writer_t
+{
+  dt_pthread_mutex_t lock;
+  pthread_cond_t cond;
+  dt_imageio_module_format_t *format;
+  dt_imageio_module_data_t *format_params;
+  void *handle;
+  uint8_t *buf; // converted rows waiting to be encoded
+  int row, num_rows;
+  gboolean pending, done;
+  int res;
+} dt_imageio_strip_writer_t;
+
+static void *_export_strip_writer(void *data)
+{
+  dt_imageio_strip_writer_t *w = (dt_imageio_strip_writer_t *)data;
+  dt_pthread_mutex_lock(&w->lock);
+  while(TRUE)
+  {
+    while(!w->pending && !w->done) dt_pthread_cond_wait(&w->cond, &w->lock);
+    if(!w->pending) break;
+    const int row = w->row, num_rows = w->num_rows;
+    dt_pthread_mutex_unlock(&w->lock);
+    const int res = w->format->write_image_rows(w->format_params, w->handle, w->buf, row, num_rows);
+    dt_pthread_mutex_lock(&w->lock);
+    w->res |= res;
+    w->pending = FALSE;
+    pthread_cond_broadcast(&w->cond);
+  }
+  dt_pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+// processes the image in horizontal strips, each padded by overlap rows, and hands them to the format as they
+// come out. only a strip's worth of pixels is ever kept in memory, plus a copy of the converted rows the
+// writer thread is still encoding. 8-bit output goes through gamma like a full frame does.
+static int _export_strips(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_imageio_module_format_t *format,
+                          dt_imageio_module_data_t *format_params, const char *filename,
+                          dt_colorspaces_color_profile_type_t icc_type, const gchar *icc_filename, void *exif,
+                          const int exif_len, const uint32_t imgid, const int num, const int total,
+                          const float scale, const int rows, const int overlap, const int bpp,
+                          const gboolean out_8bit, const int display_byteorder)
+{
+  const int width = format_params->width;
+  const int height = format_params->height;
+
+  dt_print(DT_DEBUG_DEV, "[export] processing %dx%d in strips of %d rows, %d rows overlap\n", width, height,
+           rows, overlap);
+
+  void *handle = format->write_image_begin(format_params, filename, icc_type, icc_filename, exif, exif_len,
+                                           imgid, num, total);
+  if(!handle) return 1;
+
+  // 4 channels of bpp bits each once converted
+  const size_t row_bytes = (size_t)width * 4 * (bpp / 8);
+  dt_imageio_strip_writer_t w = { 0 };
+  w.format = format;
+  w.format_params = format_params;
+  w.handle = handle;
+  w.buf = dt_alloc_align(64, row_bytes * MIN(rows, height));
+  dt_pthread_mutex_init(&w.lock, NULL);
+  pthread_cond_init(&w.cond, NULL);
+  pthread_t writer;
+  // without a writer thread the strips are simply encoded in between
+  const gboolean threaded = w.buf && !dt_pthread_create(&writer, _export_strip_writer, &w);
+
+  int res = 0;
+  for(int y = 0; y < height && !res; y += rows)
+  {
+    const int num_rows = MIN(rows, height - y);
+    const int y0 = MAX(y - overlap, 0);
+    const int y1 = MIN(y + num_rows + overlap, height);
+
+    if(out_8bit ? dt_dev_pixelpipe_process(pipe, dev, 0, y0, width, y1 - y0, scale)
+                : dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, y0, width, y1 - y0, scale))
+    {
+      res = 1;
+      break;
+    }
+
+    // drop the padding and convert what's left in place, 8-bit output only might need its byte order fixed
+    uint8_t *strip = (uint8_t *)pipe->backbuf + (size_t)4 * width * (y - y0) * (out_8bit ? 1 : sizeof(float));
+    if(out_8bit)
+    {
+      if(!display_byteorder) _export_flip_byteorder(strip, (size_t)width * num_rows);
+    }
+    else
+      _export_convert_from_float(strip, (size_t)width * num_rows, bpp, display_byteorder);
+
+    if(!threaded)
+    {
+      res = format->write_image_rows(format_params, handle, strip, y, num_rows);
+      continue;
+    }
+
+    // the pipe reuses its buffers for the next strip, hand a copy to the writer once it is done with the last one
+    dt_pthread_mutex_lock(&w.lock);
+    while(w.pending) dt_pthread_cond_wait(&w.cond, &w.lock);
+    res = w.res;
+    if(!res)
+    {
+      memcpy(w.buf, strip, row_bytes * num_rows);
+      w.row = y;
+      w.num_rows = num_rows;
+      w.pending = TRUE;
+      pthread_cond_broadcast(&w.cond);
+    }
+    dt_pthread_mutex_unlock(&w.lock);
+  }
+
+  if(threaded)
+  {
+    dt_pthread_mutex_lock(&w.lock);
+    w.done = TRUE;
+    pthread_cond_broadcast(&w.cond);
+    dt_pthread_mutex_unlock(&w.lock);
+    pthread_join(writer, NULL);
+    res |= w.res;
+  }
+  pthread_cond_destroy(&w.cond);
+  dt_pthread_mutex_destroy(&w.lock);
+  dt_free_align(w.buf);
+
+  const int finish = format->write_image_finish(format_params, handle);
+  return res || finish;
+}
+
+// hands a fully processed frame to a format which can be written strip by strip. every block of rows is
+// converted right before it gets encoded, while it is still in cache, instead of converting the whole frame
+// first.
+static int _export_rows(dt_imageio_module_format_t *format, dt_imageio_module_data_t *format_params,
+                        const char *filename, dt_colorspaces_color_profile_type_t icc_type,
+                        const gchar *icc_filename, void *exif, const int exif_len, const uint32_t imgid,
+                        const int num, const int total, void *backbuf, const int bpp, const gboolean out_8bit,
+                        const int display_byteorder)
+{
+  const int width = format_params->width;
+  const int height = format_params->height;
+  // processing output is either 8-bit already or 4 floats per pixel, converted in place
+  const size_t row_bytes = (size_t)width * 4 * (out_8bit ? sizeof(uint8_t) : sizeof(float));
+  const int block = 64;
+
+  void *handle = format->write_image_begin(format_params, filename, icc_type, icc_filename, exif, exif_len,
+                                           imgid, num, total);
+  if(!handle) return 1;
+
+  int res = 0;
+  for(int y = 0; y < height && !res; y += block)
+  {
+    const int num_rows = MIN(block, height - y);
+    uint8_t *rows = (uint8_t *)backbuf + row_bytes * y;
+    if(out_8bit)
+    {
+      // processing output was 8-bit already, only the byte order might need fixing
+      if(!display_byteorder) _export_flip_byteorder(rows, (size_t)width * num_rows);
+    }
+    else
+      _export_convert_from_float(rows, (size_t)width * num_rows, bpp, display_byteorder);
+    res = format->write_image_rows(format_params, handle, rows, y, num_rows);
+  }
+
+  const int finish = format->write_image_finish(format_params, handle);
+  return res || finish;
+}
+
 // internal function: to avoid exif blob reading + 8-bit byteorder flag + high-quality override
 int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
                                  dt_imageio_module_format_t *format, dt_imageio_module_data_t *format_params,
@@ -619,8 +851,14 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
   dt_times_t start;
   dt_get_times(&start);
   dt_dev_pixelpipe_t pipe;
+  // formats which can be written strip by strip allow for a pipe processing strips of the image when the full
+  // frame would take too much memory. whether it comes to that is only known once the pipe is set up, so the
+  // buffers are allocated below.
+  const gboolean try_strips = !thumbnail_export && format->write_image_begin
+                              && dt_conf_get_bool("plugins/imageio/export/strips");
   res = thumbnail_export ? dt_dev_pixelpipe_init_thumbnail(&pipe, wd, ht)
-                         : dt_dev_pixelpipe_init_export(&pipe, wd, ht, format->levels(format_params));
+                         : dt_dev_pixelpipe_init_export(&pipe, try_strips ? 0 : wd, try_strips ? 0 : ht,
+                                                        format->levels(format_params));
   if(!res)
   {
     dt_control_log(
@@ -779,147 +1017,110 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
 
   const int bpp = format->bpp(format_params);
 
-  dt_get_times(&start);
-  if(high_quality_processing)
+  // find the finalscale module
+  dt_dev_pixelpipe_iop_t *finalscale = NULL;
   {
-    /*
-     * if high quality processing was requested, downsampling will be done
-     * at the very end of the pipe (just before border and watermark)
-     */
-    dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-  }
-  else
-  {
-    // else, downsampling will be right after demosaic
-
-    // so we need to turn temporarily disable in-pipe late downsampling iop.
-
-    // find the finalscale module
-    dt_dev_pixelpipe_iop_t *finalscale = NULL;
+    GList *nodes = g_list_last(pipe.nodes);
+    while(nodes)
     {
-      GList *nodes = g_list_last(pipe.nodes);
-      while(nodes)
+      dt_dev_pixelpipe_iop_t *node = (dt_dev_pixelpipe_iop_t *)(nodes->data);
+      if(!strcmp(node->module->op, "finalscale"))
       {
-        dt_dev_pixelpipe_iop_t *node = (dt_dev_pixelpipe_iop_t *)(nodes->data);
-        if(!strcmp(node->module->op, "finalscale"))
-        {
-          finalscale = node;
-          break;
-        }
-        nodes = g_list_previous(nodes);
+        finalscale = node;
+        break;
       }
+      nodes = g_list_previous(nodes);
     }
-
-    if(finalscale) finalscale->enabled = 0;
-
-    // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
-    if(bpp == 8)
-      dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-    else
-      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-
-    if(finalscale) finalscale->enabled = 1;
   }
-  dt_show_times(&start, thumbnail_export ? "[dev_process_thumbnail] pixel pipeline processing"
-                                         : "[dev_process_export] pixel pipeline processing",
-                NULL);
-
-  uint8_t *outbuf = pipe.backbuf;
 
-  // downconversion to low-precision formats:
-  if(bpp == 8)
+  /*
+   * if high quality processing was requested, downsampling will be done
+   * at the very end of the pipe (just before border and watermark).
+   * else, downsampling will be right after demosaic, so we need to
+   * temporarily disable in-pipe late downsampling iop.
+   */
+  if(finalscale && !high_quality_processing) finalscale->enabled = 0;
+
+  int strip_overlap = 0;
+  const int strip_height
+      = try_strips ? _export_strip_height(&pipe, &dev, processed_width, processed_height, scale, &strip_overlap)
+                   : 0;
+
+  // the whole frame gets processed after all, allocate its buffers now like for any other export
+  if(try_strips && strip_height == 0)
   {
-    if(display_byteorder)
+    pipe.backbuf_size = 4 * sizeof(float) * wd * ht;
+    if(!dt_dev_pixelpipe_cache_reserve(&pipe.cache, pipe.backbuf_size))
     {
-      if(high_quality_processing)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
-          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
-          const uint8_t b = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
-      // else processing output was 8-bit already, and no need to swap order
-    }
-    else // need to flip
-    {
-      // ldr output: char
-      if(high_quality_processing)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
-          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
-          const uint8_t b = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
-      else
-      { // !display_byteorder, need to swap:
-        uint8_t *const buf8 = pipe.backbuf;
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static)
-#endif
-        // just flip byte order
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          uint8_t tmp = buf8[4 * k + 0];
-          buf8[4 * k + 0] = buf8[4 * k + 2];
-          buf8[4 * k + 2] = tmp;
-        }
-      }
+      dt_control_log(
+          _("failed to allocate memory for %s, please lower the threads used for export or buy more memory."),
+          C_("noun", "export"));
+      goto error;
     }
   }
-  else if(bpp == 16)
-  {
-    // uint16_t per color channel
-    float *buff = (float *)outbuf;
-    uint16_t *buf16 = (uint16_t *)outbuf;
-    for(int y = 0; y < processed_height; y++)
-      for(int x = 0; x < processed_width; x++)
-      {
-        // convert in place
-        const size_t k = (size_t)processed_width * y + x;
-        for(int i = 0; i < 3; i++) buf16[4 * k + i] = CLAMP(buff[4 * k + i] * 0x10000, 0, 0xffff);
-      }
-  }
-  // else output float, no further harm done to the pixels :)
 
   format_params->width = processed_width;
   format_params->height = processed_height;
 
+  int length = 0;
+  uint8_t *exif_profile = NULL; // Exif data should be 65536 bytes max, but if original size is close to that,
+                                // adding new tags could make it go over that... so let it be and see what
+                                // happens when we write the image
   if(!ignore_exif)
   {
-    int length;
-    uint8_t *exif_profile = NULL; // Exif data should be 65536 bytes max, but if original size is close to that,
-                                  // adding new tags could make it go over that... so let it be and see what
-                                  // happens when we write the image
     char pathname[PATH_MAX] = { 0 };
     gboolean from_cache = TRUE;
     dt_image_full_path(imgid, pathname, sizeof(pathname), &from_cache);
     // last param is dng mode, it's false here
     length = dt_exif_read_blob(&exif_profile, pathname, imgid, sRGB, processed_width, processed_height, 0);
+  }
 
-    res = format->write_image(format_params, filename, outbuf, icc_type, icc_filename, exif_profile, length, imgid,
-                              num, total);
-
-    free(exif_profile);
+  dt_get_times(&start);
+  if(strip_height > 0)
+  {
+    res = _export_strips(&pipe, &dev, format, format_params, filename, icc_type, icc_filename, exif_profile,
+                         length, imgid, num, total, scale, strip_height, strip_overlap, bpp,
+                         bpp == 8 && !high_quality_processing, display_byteorder);
+    if(finalscale) finalscale->enabled = 1;
+    dt_show_times(&start, "[dev_process_export] pixel pipeline processing and writing in strips", NULL);
   }
   else
   {
-    res = format->write_image(format_params, filename, outbuf, icc_type, icc_filename, NULL, 0, imgid, num, total);
+    // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
+    if(bpp == 8 && !high_quality_processing)
+      dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+    else
+      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+
+    if(finalscale) finalscale->enabled = 1;
+    dt_show_times(&start, thumbnail_export ? "[dev_process_thumbnail] pixel pipeline processing"
+                                           : "[dev_process_export] pixel pipeline processing",
+                  NULL);
+
+    uint8_t *outbuf = pipe.backbuf;
+    const gboolean out_8bit = bpp == 8 && !high_quality_processing;
+
+    if(format->write_image_begin && !thumbnail_export)
+      res = _export_rows(format, format_params, filename, icc_type, icc_filename, exif_profile, length, imgid,
+                         num, total, outbuf, bpp, out_8bit, display_byteorder);
+    else
+    {
+      // downconversion to low-precision formats:
+      if(out_8bit)
+      {
+        // processing output was 8-bit already, only the byte order might need fixing
+        if(!display_byteorder) _export_flip_byteorder(outbuf, (size_t)processed_width * processed_height);
+      }
+      else
+        _export_convert_from_float(outbuf, (size_t)processed_width * processed_height, bpp, display_byteorder);
+
+      res = format->write_image(format_params, filename, outbuf, icc_type, icc_filename, exif_profile, length,
+                                imgid, num, total);
+    }
   }
 
+  free(exif_profile);
+
   dt_dev_pixelpipe_cleanup(&pipe);
   dt_dev_cleanup(&dev);
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
@@ -22,7 +22,9 @@
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
+#include "common/darktable.h"
 #include "common/exif.h"
+#include "common/file_cache.h"
 #include "common/imageio.h"
 #include "common/imageio_jpeg.h"
 #include <setjmp.h>
@@ -734,13 +736,23 @@ dt_imageio_retval_t dt_imageio_open_jpeg(dt_image_t *img, const char *filename,
 
   if(!img->exif_inited) (void)dt_exif_read(img, filename);
 
+  // decode from the mapping the exif data was just read from, if there is one
+  const dt_mapped_file_t *mapped = dt_file_cache_get(darktable.file_cache, filename, DT_FILE_CACHE_SEQUENTIAL);
+
   dt_imageio_jpeg_t jpg;
-  if(dt_imageio_jpeg_read_header(filename, &jpg)) return DT_IMAGEIO_FILE_CORRUPTED;
+  if(mapped ? dt_imageio_jpeg_decompress_header(mapped->data, mapped->size, &jpg)
+            : dt_imageio_jpeg_read_header(filename, &jpg))
+  {
+    dt_file_cache_release(darktable.file_cache, mapped);
+    return DT_IMAGEIO_FILE_CORRUPTED;
+  }
   img->width = jpg.width;
   img->height = jpg.height;
 
   uint8_t *tmp = (uint8_t *)malloc(sizeof(uint8_t) * jpg.width * jpg.height * 4);
-  if(dt_imageio_jpeg_read(&jpg, tmp))
+  const int failed = mapped ? dt_imageio_jpeg_decompress(&jpg, tmp) : dt_imageio_jpeg_read(&jpg, tmp);
+  dt_file_cache_release(darktable.file_cache, mapped);
+  if(failed)
   {
     free(tmp);
     return DT_IMAGEIO_FILE_CORRUPTED;
@@ -118,6 +118,14 @@ typedef struct dt_imageio_module_format_t
   int (*write_image)(dt_imageio_module_data_t *data, const char *filename, const void *in,
                      dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
                      void *exif, int exif_len, int imgid, int num, int total);
+  /* optional: write the image in horizontal strips. begin returns a handle or NULL on failure, rows are
+   * passed top to bottom in the same layout write_image expects, finish returns != 0 on failure.
+   * exif has to stay valid until finish. */
+  void *(*write_image_begin)(dt_imageio_module_data_t *data, const char *filename,
+                             dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                             void *exif, int exif_len, int imgid, int num, int total);
+  int (*write_image_rows)(dt_imageio_module_data_t *data, void *handle, const void *in, int row, int num_rows);
+  int (*write_image_finish)(dt_imageio_module_data_t *data, void *handle);
   /* flag that describes the available precision/levels of output format. mainly used for dithering. */
   int (*levels)(dt_imageio_module_data_t *data);
 
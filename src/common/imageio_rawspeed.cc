@@ -30,6 +30,7 @@ extern "C" {
 #include "common/colorspaces.h"
 #include "common/darktable.h"
 #include "common/exif.h"
+#include "common/file_cache.h"
 #include "common/file_location.h"
 #include "common/imageio_rawspeed.h"
 #include "imageio.h"
@@ -109,6 +110,18 @@ uint32_t dt_rawspeed_crop_dcraw_filters(uint32_t filters, uint32_t crop_x, uint3
   return ColorFilterArray::shiftDcrawFilter(filters, crop_x, crop_y);
 }
 
+// load latency per camera and file format, with -d perf
+static void _print_load_times(const dt_image_t *img, const char *filename, const double start,
+                              const double read_done, const double decode_done)
+{
+  if(!(darktable.unmuted & DT_DEBUG_PERF)) return;
+  const double end = dt_get_wtime();
+  const char *ext = strrchr(filename, '.');
+  dt_print(DT_DEBUG_PERF, "[rawspeed] %s %s (%s) %dx%d loaded in %.3f secs: read %.3f, decode %.3f, copy %.3f\n",
+           img->camera_maker, img->camera_model, ext ? ext + 1 : "", img->width, img->height, end - start,
+           read_done - start, decode_done - read_done, end - decode_done);
+}
+
 dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filename,
                                              dt_mipmap_buffer_t *mbuf)
 {
@@ -118,6 +131,12 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
   snprintf(filen, sizeof(filen), "%s", filename);
   FileReader f(filen);
 
+  // the file is mapped already if the exif data has just been read, rawspeed can work on that mapping
+  // instead of reading the whole file into memory once more. it has to outlive m.
+  std::unique_ptr<const dt_mapped_file_t, void (*)(const dt_mapped_file_t *)> mapped(
+      dt_file_cache_get(darktable.file_cache, filename, DT_FILE_CACHE_SEQUENTIAL),
+      [](const dt_mapped_file_t *file) { dt_file_cache_release(darktable.file_cache, file); });
+
   std::unique_ptr<RawDecoder> d;
   std::unique_ptr<const Buffer> m;
 
@@ -125,7 +144,12 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
   {
     dt_rawspeed_load_meta();
 
-    m = f.readFile();
+    const double start = dt_get_wtime();
+    if(mapped)
+      m = std::unique_ptr<const Buffer>(new Buffer(mapped->data, mapped->size));
+    else
+      m = f.readFile();
+    const double read_done = dt_get_wtime();
 
     RawParser t(m.get());
     d = t.getDecoder(meta);
@@ -137,6 +161,7 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
     d->decodeRaw();
     d->decodeMetaData(meta);
     RawImage r = d->mRaw;
+    const double decode_done = dt_get_wtime();
 
     const auto errors = r->getErrors();
     for(const auto &error : errors) fprintf(stderr, "[rawspeed] (%s) %s\n", img->filename, error.c_str());
@@ -217,9 +242,11 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
      *   ???
      */
 
-    /* free auto pointers on spot */
+    /* free auto pointers on spot, the file buffer must not be around any more when the mipmap buffer is
+     * allocated below. otherwise peak memory would be file + rawspeed image + mipmap buffer. */
     d.reset();
     m.reset();
+    mapped.reset();
 
     // Grab the WB
     for(int i = 0; i < 4; i++) img->wb_coeffs[i] = r->metadata.wbCoeffs[i];
@@ -228,6 +255,7 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
     if(!r->isCFA && !dt_image_is_monochrome(img))
     {
       dt_imageio_retval_t ret = dt_imageio_open_rawspeed_sraw(img, r, mbuf);
+      _print_load_times(img, filename, start, read_done, decode_done);
       return ret;
     }
 
@@ -317,24 +345,16 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
     if(!buf) return DT_IMAGEIO_CACHE_FULL;
 
     /*
-     * since we do not want to crop black borders at this stage,
-     * and we do not want to rotate image, we can just use memcpy,
-     * as it is faster than dt_imageio_flip_buffers, but only if
-     * buffer sizes are equal,
-     * (from Klaus: r->pitch may differ from DT pitch (line to line spacing))
-     * else fallback to generic dt_imageio_flip_buffers()
+     * since we do not want to crop black borders at this stage, and we do not want to rotate the image,
+     * this is a plain copy of the rows. dt_imageio_flip_buffers() does that in parallel, which beats a
+     * single memcpy() of the whole buffer, and takes care of r->pitch differing from our pitch.
+     * rawspeed allocates the image itself and can't decode into the mipmap buffer, so this copy can't
+     * be avoided. r is the last reference to the rawspeed image, it is freed right after.
      */
-    const size_t bufSize_mipmap = (size_t)img->width * img->height * r->getBpp();
-    const size_t bufSize_rawspeed = (size_t)r->pitch * dimUncropped.y;
-    if(bufSize_mipmap == bufSize_rawspeed)
-    {
-      memcpy(buf, r->getDataUncropped(0, 0), bufSize_mipmap);
-    }
-    else
-    {
-      dt_imageio_flip_buffers((char *)buf, (char *)r->getDataUncropped(0, 0), r->getBpp(), dimUncropped.x,
-                              dimUncropped.y, dimUncropped.x, dimUncropped.y, r->pitch, ORIENTATION_NONE);
-    }
+    dt_imageio_flip_buffers((char *)buf, (char *)r->getDataUncropped(0, 0), r->getBpp(), dimUncropped.x,
+                            dimUncropped.y, dimUncropped.x, dimUncropped.y, r->pitch, ORIENTATION_NONE);
+
+    _print_load_times(img, filename, start, read_done, decode_done);
   }
   catch(const std::exception &exc)
   {
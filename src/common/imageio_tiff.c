@@ -20,6 +20,7 @@
 #include "common/colorspaces.h"
 #include "common/darktable.h"
 #include "common/exif.h"
+#include "common/file_cache.h"
 #include "control/conf.h"
 #include "develop/develop.h"
 #include "imageio.h"
@@ -30,9 +31,17 @@
 #include <strings.h>
 #include <tiffio.h>
 
+// libtiff reading from a file of the file cache
+typedef struct tiff_mem_t
+{
+  const dt_mapped_file_t *file;
+  toff_t pos;
+} tiff_mem_t;
+
 typedef struct tiff_t
 {
   TIFF *tiff;
+  tiff_mem_t mem;
   uint32_t width;
   uint32_t height;
   uint16_t bpp;
@@ -155,6 +164,82 @@ static void _error_handler(const char* module, const char* fmt, va_list ap)
   _warning_error_handler("error", module, fmt, ap);
 }
 
+static tmsize_t _mem_read(thandle_t handle, void *buf, tmsize_t size)
+{
+  tiff_mem_t *mem = (tiff_mem_t *)handle;
+  if(mem->pos >= mem->file->size) return 0;
+  const size_t n = MIN((size_t)size, mem->file->size - mem->pos);
+  memcpy(buf, mem->file->data + mem->pos, n);
+  mem->pos += n;
+  return n;
+}
+
+static tmsize_t _mem_write(thandle_t handle, void *buf, tmsize_t size)
+{
+  return 0;
+}
+
+static toff_t _mem_seek(thandle_t handle, toff_t offset, int whence)
+{
+  tiff_mem_t *mem = (tiff_mem_t *)handle;
+  if(whence == SEEK_CUR)
+    offset += mem->pos;
+  else if(whence == SEEK_END)
+    offset += mem->file->size;
+  mem->pos = offset;
+  return mem->pos;
+}
+
+static int _mem_close(thandle_t handle)
+{
+  tiff_mem_t *mem = (tiff_mem_t *)handle;
+  dt_file_cache_release(darktable.file_cache, mem->file);
+  mem->file = NULL;
+  return 0;
+}
+
+static toff_t _mem_size(thandle_t handle)
+{
+  return ((tiff_mem_t *)handle)->file->size;
+}
+
+// strips are read straight from the mapping, no need to copy them
+static int _mem_map(thandle_t handle, void **base, toff_t *size)
+{
+  tiff_mem_t *mem = (tiff_mem_t *)handle;
+  *base = (void *)mem->file->data;
+  *size = mem->file->size;
+  return 1;
+}
+
+static void _mem_unmap(thandle_t handle, void *base, toff_t size)
+{
+}
+
+// open filename through the file cache, or directly if it can't be mapped. TIFFClose() releases the file.
+static TIFF *_open_tiff(const char *filename, tiff_mem_t *mem)
+{
+  mem->pos = 0;
+  mem->file = dt_file_cache_get(darktable.file_cache, filename, DT_FILE_CACHE_SEQUENTIAL);
+  if(mem->file)
+  {
+    TIFF *tiff = TIFFClientOpen(filename, "r", (thandle_t)mem, _mem_read, _mem_write, _mem_seek, _mem_close,
+                                _mem_size, _mem_map, _mem_unmap);
+    // the close callback only gets called for files that could be opened
+    if(!tiff) _mem_close((thandle_t)mem);
+    return tiff;
+  }
+
+#ifdef _WIN32
+  wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
+  TIFF *tiff = TIFFOpenW(wfilename, "rb");
+  g_free(wfilename);
+  return tiff;
+#else
+  return TIFFOpen(filename, "rb");
+#endif
+}
+
 dt_imageio_retval_t dt_imageio_open_tiff(dt_image_t *img, const char *filename, dt_mipmap_buffer_t *mbuf)
 {
   // doing this once would be enough, but our imageio reading code is
@@ -174,13 +259,7 @@ dt_imageio_retval_t dt_imageio_open_tiff(dt_image_t *img, const char *filename,
 
   t.image = img;
 
-#ifdef _WIN32
-  wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
-  t.tiff = TIFFOpenW(wfilename, "rb");
-  g_free(wfilename);
-#else
-  t.tiff = TIFFOpen(filename, "rb");
-#endif
+  t.tiff = _open_tiff(filename, &t.mem);
 
   if(t.tiff == NULL) return DT_IMAGEIO_FILE_CORRUPTED;
 
@@ -191,7 +270,11 @@ dt_imageio_retval_t dt_imageio_open_tiff(dt_image_t *img, const char *filename,
   TIFFGetFieldDefaulted(t.tiff, TIFFTAG_SAMPLEFORMAT, &t.sampleformat);
   TIFFGetField(t.tiff, TIFFTAG_PLANARCONFIG, &config);
 
-  if(TIFFRasterScanlineSize(t.tiff) != TIFFScanlineSize(t.tiff)) return DT_IMAGEIO_FILE_CORRUPTED;
+  if(TIFFRasterScanlineSize(t.tiff) != TIFFScanlineSize(t.tiff))
+  {
+    TIFFClose(t.tiff);
+    return DT_IMAGEIO_FILE_CORRUPTED;
+  }
 
   t.scanlinesize = TIFFScanlineSize(t.tiff);
 
@@ -263,18 +346,13 @@ dt_imageio_retval_t dt_imageio_open_tiff(dt_image_t *img, const char *filename,
 int dt_imageio_tiff_read_profile(const char *filename, uint8_t **out)
 {
   TIFF *tiff = NULL;
+  tiff_mem_t mem;
   uint32_t profile_len = 0;
   uint8_t *profile = NULL;
 
   if(!(filename && *filename && out)) return 0;
 
-#ifdef _WIN32
-  wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
-  tiff = TIFFOpenW(wfilename, "rb");
-  g_free(wfilename);
-#else
-  tiff = TIFFOpen(filename, "rb");
-#endif
+  tiff = _open_tiff(filename, &mem);
 
   if(tiff == NULL) return 0;
 
@@ -23,10 +23,15 @@
 #include <assert.h>
 #include <glib.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <math.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#ifdef HAVE_TARGET_AVX2
+#include <immintrin.h>
+#endif
+
 /** Border extrapolation modes */
 enum border_mode
 {
@@ -1350,20 +1355,155 @@ static int prepare_resampling_plan(const struct dt_interpolation *itor, int in,
   return 0;
 }
 
+/* --------------------------------------------------------------------------
+ * Resampling plan cache
+ * ------------------------------------------------------------------------*/
+
+/* finalscale, clipping and the zoomed darkroom views keep asking for the very
+ * same resamplings, so the 1D plans are kept around instead of being rebuilt
+ * on every call. A plan only depends on the interpolator, the input and output
+ * sizes, the output offset and the scale. */
+
+// Number of 1D plans kept (one resampling uses two of them)
+#define RESAMPLING_PLAN_CACHE_SIZE 16
+
+typedef struct dt_interpolation_plan_t
+{
+  enum dt_interpolation_type itor;
+  int in;
+  int out;
+  int out_x0;
+  float scale;
+
+  int *length;
+  float *kernel;
+  int *index;
+  int *meta;
+
+  int users;      // number of resamplings currently using the plan
+  uint64_t stamp; // last use, for LRU eviction
+  int cached;     // 0 if the plan is owned by its only user
+} dt_interpolation_plan_t;
+
+static struct
+{
+  GMutex lock;
+  uint64_t clock;
+  dt_interpolation_plan_t *plan[RESAMPLING_PLAN_CACHE_SIZE];
+} _plan_cache;
+
+static inline int _plan_matches(const dt_interpolation_plan_t *plan, const struct dt_interpolation *itor,
+                                const int in, const int out, const int out_x0, const float scale)
+{
+  return plan && plan->itor == itor->id && plan->in == in && plan->out == out && plan->out_x0 == out_x0
+         && plan->scale == scale;
+}
+
+static void _plan_free(dt_interpolation_plan_t *plan)
+{
+  if(!plan) return;
+  // the length array is the start of the plan's only allocation
+  dt_free_align(plan->length);
+  free(plan);
+}
+
+/** Get a 1D resampling plan, from the cache if possible.
+ * Must be returned with release_resampling_plan(). Returns NULL if out of memory. */
+static dt_interpolation_plan_t *get_resampling_plan(const struct dt_interpolation *itor, const int in,
+                                                    const int in_x0, const int out, const int out_x0,
+                                                    const float scale)
+{
+  g_mutex_lock(&_plan_cache.lock);
+  for(int k = 0; k < RESAMPLING_PLAN_CACHE_SIZE; k++)
+  {
+    dt_interpolation_plan_t *plan = _plan_cache.plan[k];
+    if(_plan_matches(plan, itor, in, out, out_x0, scale))
+    {
+      plan->users++;
+      plan->stamp = ++_plan_cache.clock;
+      g_mutex_unlock(&_plan_cache.lock);
+      return plan;
+    }
+  }
+  g_mutex_unlock(&_plan_cache.lock);
+
+  // build it outside of the lock, this is the expensive part
+  dt_interpolation_plan_t *plan = (dt_interpolation_plan_t *)calloc(1, sizeof(dt_interpolation_plan_t));
+  if(!plan) return NULL;
+  plan->itor = itor->id;
+  plan->in = in;
+  plan->out = out;
+  plan->out_x0 = out_x0;
+  plan->scale = scale;
+  plan->users = 1;
+  if(prepare_resampling_plan(itor, in, in_x0, out, out_x0, scale, &plan->length, &plan->kernel, &plan->index,
+                             &plan->meta))
+  {
+    free(plan);
+    return NULL;
+  }
+
+  g_mutex_lock(&_plan_cache.lock);
+  int victim = -1;
+  for(int k = 0; k < RESAMPLING_PLAN_CACHE_SIZE; k++)
+  {
+    dt_interpolation_plan_t *other = _plan_cache.plan[k];
+    if(_plan_matches(other, itor, in, out, out_x0, scale))
+    {
+      // somebody else has been faster, use theirs
+      other->users++;
+      other->stamp = ++_plan_cache.clock;
+      g_mutex_unlock(&_plan_cache.lock);
+      _plan_free(plan);
+      return other;
+    }
+    if(!other)
+      victim = k;
+    else if(other->users == 0 && (victim < 0 || (_plan_cache.plan[victim]
+                                                  && other->stamp < _plan_cache.plan[victim]->stamp)))
+      victim = k;
+  }
+  if(victim >= 0)
+  {
+    _plan_free(_plan_cache.plan[victim]);
+    plan->cached = 1;
+    plan->stamp = ++_plan_cache.clock;
+    _plan_cache.plan[victim] = plan;
+  }
+  g_mutex_unlock(&_plan_cache.lock);
+
+  // if all slots are busy, the plan simply stays private to the caller
+  return plan;
+}
+
+static void release_resampling_plan(dt_interpolation_plan_t *plan)
+{
+  if(!plan) return;
+  g_mutex_lock(&_plan_cache.lock);
+  plan->users--;
+  const int owned = !plan->cached;
+  g_mutex_unlock(&_plan_cache.lock);
+  if(owned) _plan_free(plan);
+}
+
+void dt_interpolation_cleanup(void)
+{
+  g_mutex_lock(&_plan_cache.lock);
+  for(int k = 0; k < RESAMPLING_PLAN_CACHE_SIZE; k++)
+  {
+    _plan_free(_plan_cache.plan[k]);
+    _plan_cache.plan[k] = NULL;
+  }
+  g_mutex_unlock(&_plan_cache.lock);
+}
+
 static void dt_interpolation_resample_plain(const struct dt_interpolation *itor, float *out,
                                             const dt_iop_roi_t *const roi_out, const int32_t out_stride,
                                             const float *const in, const dt_iop_roi_t *const roi_in,
                                             const int32_t in_stride)
 {
-  int *hindex = NULL;
-  int *hlength = NULL;
-  float *hkernel = NULL;
-  int *vindex = NULL;
-  int *vlength = NULL;
-  float *vkernel = NULL;
-  int *vmeta = NULL;
-
-  int r;
+  dt_interpolation_plan_t *hplan = NULL;
+  dt_interpolation_plan_t *vplan = NULL;
 
   debug_info("resampling %p (%dx%d@%dx%d scale %f) -> %p (%dx%d@%dx%d scale %f)\n", in, roi_in->width,
              roi_in->height, roi_in->x, roi_in->y, roi_in->scale, out, roi_out->width, roi_out->height,
@@ -1399,20 +1539,21 @@ static void dt_interpolation_resample_plain(const struct dt_interpolation *itor,
   int64_t ts_plan = getts();
 #endif
 
-  // Prepare resampling plans once and for all
-  r = prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale,
-                              &hlength, &hkernel, &hindex, NULL);
-  if(r)
+  // Get the resampling plans, most of the time they are cached already
+  hplan = get_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale);
+  vplan = get_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale);
+  if(!hplan || !vplan)
   {
     goto exit;
   }
 
-  r = prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale,
-                              &vlength, &vkernel, &vindex, &vmeta);
-  if(r)
-  {
-    goto exit;
-  }
+  const int *hindex = hplan->index;
+  const int *hlength = hplan->length;
+  const float *hkernel = hplan->kernel;
+  const int *vindex = vplan->index;
+  const int *vlength = vplan->length;
+  const float *vkernel = vplan->kernel;
+  const int *vmeta = vplan->meta;
 
 #if DEBUG_RESAMPLING_TIMING
   ts_plan = getts() - ts_plan;
@@ -1500,28 +1641,143 @@ static void dt_interpolation_resample_plain(const struct dt_interpolation *itor,
 #endif
 
 exit:
-  /* Free the resampling plans. It's nasty to optimize allocs like that, but
-   * it simplifies the code :-D. The length array is in fact the only memory
-   * allocated. */
-  dt_free_align(hlength);
-  dt_free_align(vlength);
+  release_resampling_plan(hplan);
+  release_resampling_plan(vplan);
 }
 
 #if defined(__SSE2__)
-static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, float *out,
-                                          const dt_iop_roi_t *const roi_out, const int32_t out_stride,
-                                          const float *const in, const dt_iop_roi_t *const roi_in,
-                                          const int32_t in_stride)
+/* --------------------------------------------------------------------------
+ * Separable 4 channel resampling
+ * ------------------------------------------------------------------------*/
+
+/* The vectorized codepaths resample separably: the input lines a band of
+ * output lines depends on are first resampled horizontally into a per thread
+ * scratch buffer, then the output lines are built from these by a plain
+ * weighted sum of whole lines. Per output pixel, this costs about
+ * hl/scale + vl taps instead of hl * vl. */
+
+// Number of output lines processed as a unit, this bounds the redundant
+// horizontal work at band borders
+#define RESAMPLING_BAND_HEIGHT 32
+
+/** Horizontally resample one input line into width 4 channel pixels */
+typedef void (*resample_hline_t)(float *const out, const float *const in, const int width,
+                                 const int *const hlength, const float *const hkernel, const int *const hindex);
+
+/** Build one output line of width pixels from vl horizontally resampled lines of buf */
+typedef void (*resample_vline_t)(float *const out, const float *const buf, const size_t buf_stride,
+                                 const int *const vindex, const int vfirst, const float *const vkernel,
+                                 const int vl, const int width);
+
+static void resample_hline_sse(float *const out, const float *const in, const int width,
+                               const int *const hlength, const float *const hkernel, const int *const hindex)
 {
-  int *hindex = NULL;
-  int *hlength = NULL;
-  float *hkernel = NULL;
-  int *vindex = NULL;
-  int *vlength = NULL;
-  float *vkernel = NULL;
-  int *vmeta = NULL;
+  int hkidx = 0;
+  for(int ox = 0; ox < width; ox++)
+  {
+    const int hl = hlength[ox];
+    __m128 vhs = _mm_setzero_ps();
+    for(int ix = 0; ix < hl; ix++, hkidx++)
+      vhs = _mm_add_ps(vhs, _mm_mul_ps(_mm_load_ps(in + (size_t)4 * hindex[hkidx]), _mm_set1_ps(hkernel[hkidx])));
+    _mm_store_ps(out + (size_t)4 * ox, vhs);
+  }
+}
 
-  int r;
+static void resample_vline_sse(float *const out, const float *const buf, const size_t buf_stride,
+                               const int *const vindex, const int vfirst, const float *const vkernel,
+                               const int vl, const int width)
+{
+  for(int ox = 0; ox < width; ox++)
+  {
+    __m128 vs = _mm_setzero_ps();
+    for(int iy = 0; iy < vl; iy++)
+      vs = _mm_add_ps(vs, _mm_mul_ps(_mm_load_ps(buf + (vindex[iy] - vfirst) * buf_stride + (size_t)4 * ox),
+                                     _mm_set1_ps(vkernel[iy])));
+    _mm_stream_ps(out + (size_t)4 * ox, vs);
+  }
+}
+
+#ifdef HAVE_TARGET_AVX2
+__attribute__((target("avx2,fma")))
+static void resample_hline_avx2(float *const out, const float *const in, const int width,
+                                const int *const hlength, const float *const hkernel, const int *const hindex)
+{
+  int hkidx = 0;
+  for(int ox = 0; ox < width; ox++)
+  {
+    const int hl = hlength[ox];
+    // two taps a time, one per 128 bit lane
+    __m256 acc = _mm256_setzero_ps();
+    int ix = 0;
+    for(; ix + 2 <= hl; ix += 2, hkidx += 2)
+    {
+      const __m256 px = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(in + (size_t)4 * hindex[hkidx])),
+                                             _mm_load_ps(in + (size_t)4 * hindex[hkidx + 1]), 1);
+      const __m256 tap = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(hkernel[hkidx])),
+                                              _mm_set1_ps(hkernel[hkidx + 1]), 1);
+      acc = _mm256_fmadd_ps(px, tap, acc);
+    }
+    __m128 vhs = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    for(; ix < hl; ix++, hkidx++)
+      vhs = _mm_fmadd_ps(_mm_load_ps(in + (size_t)4 * hindex[hkidx]), _mm_set1_ps(hkernel[hkidx]), vhs);
+    _mm_store_ps(out + (size_t)4 * ox, vhs);
+  }
+}
+
+__attribute__((target("avx2,fma")))
+static void resample_vline_avx2(float *const out, const float *const buf, const size_t buf_stride,
+                                const int *const vindex, const int vfirst, const float *const vkernel,
+                                const int vl, const int width)
+{
+  // two pixels a time
+  int ox = 0;
+  for(; ox + 2 <= width; ox += 2)
+  {
+    __m256 vs = _mm256_setzero_ps();
+    for(int iy = 0; iy < vl; iy++)
+      vs = _mm256_fmadd_ps(_mm256_loadu_ps(buf + (vindex[iy] - vfirst) * buf_stride + (size_t)4 * ox),
+                           _mm256_set1_ps(vkernel[iy]), vs);
+    _mm256_storeu_ps(out + (size_t)4 * ox, vs);
+  }
+  for(; ox < width; ox++)
+  {
+    __m128 vs = _mm_setzero_ps();
+    for(int iy = 0; iy < vl; iy++)
+      vs = _mm_fmadd_ps(_mm_load_ps(buf + (vindex[iy] - vfirst) * buf_stride + (size_t)4 * ox),
+                        _mm_set1_ps(vkernel[iy]), vs);
+    _mm_store_ps(out + (size_t)4 * ox, vs);
+  }
+}
+#endif
+
+/** Range of input lines needed by output lines [oy0, oy1) */
+static inline void band_input_lines(const dt_interpolation_plan_t *const vplan, const int oy0, const int oy1,
+                                    int *first, int *last)
+{
+  int lo = INT_MAX, hi = INT_MIN;
+  for(int oy = oy0; oy < oy1; oy++)
+  {
+    const int *const meta = vplan->meta + 3 * oy;
+    const int vl = vplan->length[meta[0]];
+    for(int iy = 0; iy < vl; iy++)
+    {
+      lo = MIN(lo, vplan->index[meta[2] + iy]);
+      hi = MAX(hi, vplan->index[meta[2] + iy]);
+    }
+  }
+  *first = lo;
+  *last = hi;
+}
+
+static void dt_interpolation_resample_separable(const struct dt_interpolation *itor, float *out,
+                                                const dt_iop_roi_t *const roi_out, const int32_t out_stride,
+                                                const float *const in, const dt_iop_roi_t *const roi_in,
+                                                const int32_t in_stride, const resample_hline_t hline,
+                                                const resample_vline_t vline)
+{
+  dt_interpolation_plan_t *hplan = NULL;
+  dt_interpolation_plan_t *vplan = NULL;
+  float *buffers = NULL;
 
   debug_info("resampling %p (%dx%d@%dx%d scale %f) -> %p (%dx%d@%dx%d scale %f)\n", in, roi_in->width,
              roi_in->height, roi_in->x, roi_in->y, roi_in->scale, out, roi_out->width, roi_out->height,
@@ -1552,106 +1808,64 @@ static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, f
     return;
   }
 
-// Generic non 1:1 case... much more complicated :D
 #if DEBUG_RESAMPLING_TIMING
   int64_t ts_plan = getts();
 #endif
 
-  // Prepare resampling plans once and for all
-  r = prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale,
-                              &hlength, &hkernel, &hindex, NULL);
-  if(r)
+  // Get the resampling plans, most of the time they are cached already
+  hplan = get_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale);
+  vplan = get_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale);
+  if(!hplan || !vplan)
   {
     goto exit;
   }
 
-  r = prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale,
-                              &vlength, &vkernel, &vindex, &vmeta);
-  if(r)
+  // Size the scratch buffers for the band needing the most input lines
+  const int bands = (roi_out->height + RESAMPLING_BAND_HEIGHT - 1) / RESAMPLING_BAND_HEIGHT;
+  int max_lines = 0;
+  for(int b = 0; b < bands; b++)
+  {
+    int first, last;
+    band_input_lines(vplan, b * RESAMPLING_BAND_HEIGHT,
+                     MIN((b + 1) * RESAMPLING_BAND_HEIGHT, roi_out->height), &first, &last);
+    max_lines = MAX(max_lines, last - first + 1);
+  }
+  const size_t buf_stride = (size_t)4 * roi_out->width;
+  const size_t buf_size = buf_stride * max_lines;
+  buffers = (float *)dt_alloc_align(64, sizeof(float) * buf_size * dt_get_num_threads());
+  if(!buffers)
   {
     goto exit;
   }
 
 #if DEBUG_RESAMPLING_TIMING
   ts_plan = getts() - ts_plan;
-#endif
-
-#if DEBUG_RESAMPLING_TIMING
   int64_t ts_resampling = getts();
 #endif
 
-// Process each output line
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta)
+#pragma omp parallel for default(none) shared(out, hplan, vplan, buffers) schedule(static)
 #endif
-  for(int oy = 0; oy < roi_out->height; oy++)
+  for(int b = 0; b < bands; b++)
   {
-    // Initialize column resampling indexes
-    int vlidx = vmeta[3 * oy + 0]; // V(ertical) L(ength) I(n)d(e)x
-    int vkidx = vmeta[3 * oy + 1]; // V(ertical) K(ernel) I(n)d(e)x
-    int viidx = vmeta[3 * oy + 2]; // V(ertical) I(ndex) I(n)d(e)x
-
-    // Initialize row resampling indexes
-    int hlidx = 0; // H(orizontal) L(ength) I(n)d(e)x
-    int hkidx = 0; // H(orizontal) K(ernel) I(n)d(e)x
-    int hiidx = 0; // H(orizontal) I(ndex) I(n)d(e)x
-
-    // Number of lines contributing to the output line
-    int vl = vlength[vlidx++]; // V(ertical) L(ength)
-
-    // Process each output column
-    for(int ox = 0; ox < roi_out->width; ox++)
+    float *const buf = buffers + buf_size * dt_get_thread_num();
+    const int oy0 = b * RESAMPLING_BAND_HEIGHT;
+    const int oy1 = MIN(oy0 + RESAMPLING_BAND_HEIGHT, roi_out->height);
+    int first, last;
+    band_input_lines(vplan, oy0, oy1, &first, &last);
+
+    // horizontal pass over all the input lines of this band
+    for(int iy = first; iy <= last; iy++)
+      hline(buf + (iy - first) * buf_stride, (const float *)((const char *)in + (size_t)in_stride * iy),
+            roi_out->width, hplan->length, hplan->kernel, hplan->index);
+
+    // vertical pass, whole lines at once
+    for(int oy = oy0; oy < oy1; oy++)
     {
-      debug_extra("output %p [% 4d % 4d]\n", out, ox, oy);
-
-      // This will hold the resulting pixel
-      __m128 vs = _mm_setzero_ps();
-
-      // Number of horizontal samples contributing to the output
-      int hl = hlength[hlidx++]; // H(orizontal) L(ength)
-
-      for(int iy = 0; iy < vl; iy++)
-      {
-        // This is our input line
-        const float *i = (float *)((char *)in + (size_t)in_stride * vindex[viidx++]);
-
-        __m128 vhs = _mm_setzero_ps();
-
-        for(int ix = 0; ix < hl; ix++)
-        {
-          // Apply the precomputed filter kernel
-          size_t baseidx = (size_t)hindex[hiidx++] * 4;
-          float htap = hkernel[hkidx++];
-          __m128 vhtap = _mm_set_ps1(htap);
-          vhs = _mm_add_ps(vhs, _mm_mul_ps(*(__m128 *)&i[baseidx], vhtap));
-        }
-
-        // Accumulate contribution from this line
-        float vtap = vkernel[vkidx++];
-        __m128 vvtap = _mm_set_ps1(vtap);
-        vs = _mm_add_ps(vs, _mm_mul_ps(vhs, vvtap));
-
-        // Reset horizontal resampling context
-        hkidx -= hl;
-        hiidx -= hl;
-      }
-
-      // Output pixel is ready
-      float *o = (float *)((char *)out + (size_t)oy * out_stride + (size_t)ox * 4 * sizeof(float));
-      _mm_stream_ps(o, vs);
-
-      // Reset vertical resampling context
-      viidx -= vl;
-      vkidx -= vl;
-
-      // Progress in horizontal context
-      hiidx += hl;
-      hkidx += hl;
+      const int *const meta = vplan->meta + 3 * oy;
+      vline((float *)((char *)out + (size_t)oy * out_stride), buf, buf_stride, vplan->index + meta[2], first,
+            vplan->kernel + meta[1], vplan->length[meta[0]], roi_out->width);
     }
-
-    // Progress in vertical context
-//     viidx += vl;
-//     vkidx += vl;
   }
 
   _mm_sfence();
@@ -1662,12 +1876,30 @@ static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, f
 #endif
 
 exit:
-  /* Free the resampling plans. It's nasty to optimize allocs like that, but
-   * it simplifies the code :-D. The length array is in fact the only memory
-   * allocated. */
-  dt_free_align(hlength);
-  dt_free_align(vlength);
+  dt_free_align(buffers);
+  release_resampling_plan(hplan);
+  release_resampling_plan(vplan);
 }
+
+static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, float *out,
+                                          const dt_iop_roi_t *const roi_out, const int32_t out_stride,
+                                          const float *const in, const dt_iop_roi_t *const roi_in,
+                                          const int32_t in_stride)
+{
+  dt_interpolation_resample_separable(itor, out, roi_out, out_stride, in, roi_in, in_stride,
+                                      resample_hline_sse, resample_vline_sse);
+}
+
+#ifdef HAVE_TARGET_AVX2
+static void dt_interpolation_resample_avx2(const struct dt_interpolation *itor, float *out,
+                                           const dt_iop_roi_t *const roi_out, const int32_t out_stride,
+                                           const float *const in, const dt_iop_roi_t *const roi_in,
+                                           const int32_t in_stride)
+{
+  dt_interpolation_resample_separable(itor, out, roi_out, out_stride, in, roi_in, in_stride,
+                                      resample_hline_avx2, resample_vline_avx2);
+}
+#endif
 #endif
 
 /** Applies resampling (re-scaling) on *full* input and output buffers.
@@ -1680,6 +1912,10 @@ void dt_interpolation_resample(const struct dt_interpolation *itor, float *out,
 {
   if(darktable.codepath.OPENMP_SIMD)
     return dt_interpolation_resample_plain(itor, out, roi_out, out_stride, in, roi_in, in_stride);
+#ifdef HAVE_TARGET_AVX2
+  else if(darktable.codepath.AVX2)
+    return dt_interpolation_resample_avx2(itor, out, roi_out, out_stride, in, roi_in, in_stride);
+#endif
 #if defined(__SSE2__)
   else if(darktable.codepath.SSE2)
     return dt_interpolation_resample_sse(itor, out, roi_out, out_stride, in, roi_in, in_stride);
@@ -28,6 +28,9 @@
 #if defined(__SSE2__)
 #include <xmmintrin.h>
 #endif
+#ifdef HAVE_TARGET_AVX2
+#include <immintrin.h>
+#endif
 
 // downsample width/height to given level
 static inline int dl(int size, const int level)
@@ -37,50 +40,6 @@ static inline int dl(int size, const int level)
   return size;
 }
 
-// needs a boundary of 1 or 2px around i,j or else it will crash.
-// (translates to a 1px boundary around the corresponding pixel in the coarse buffer)
-// more precisely, 1<=i<wd-1 for even wd and
-//                 1<=i<wd-2 for odd wd (j likewise with ht)
-static inline float ll_expand_gaussian(
-    const float *const coarse,
-    const int i,
-    const int j,
-    const int wd,
-    const int ht)
-{
-  assert(i > 0);
-  assert(i < wd-1);
-  assert(j > 0);
-  assert(j < ht-1);
-  assert(j/2 + 1 < (ht-1)/2+1);
-  assert(i/2 + 1 < (wd-1)/2+1);
-  const int cw = (wd-1)/2+1;
-  const int ind = (j/2)*cw+i/2;
-  // case 0:     case 1:     case 2:     case 3:
-  //  x . x . x   x . x . x   x . x . x   x . x . x
-  //  . . . . .   . . . . .   . .[.]. .   .[.]. . .
-  //  x .[x]. x   x[.]x . x   x . x . x   x . x . x
-  //  . . . . .   . . . . .   . . . . .   . . . . .
-  //  x . x . x   x . x . x   x . x . x   x . x . x
-  switch((i&1) + 2*(j&1))
-  {
-    case 0: // both are even, 3x3 stencil
-      return 4./256. * (
-          6.0f*(coarse[ind-cw] + coarse[ind-1] + 6.0f*coarse[ind] + coarse[ind+1] + coarse[ind+cw])
-          + coarse[ind-cw-1] + coarse[ind-cw+1] + coarse[ind+cw-1] + coarse[ind+cw+1]);
-    case 1: // i is odd, 2x3 stencil
-      return 4./256. * (
-          24.0*(coarse[ind] + coarse[ind+1]) +
-          4.0*(coarse[ind-cw] + coarse[ind-cw+1] + coarse[ind+cw] + coarse[ind+cw+1]));
-    case 2: // j is odd, 3x2 stencil
-      return 4./256. * (
-          24.0*(coarse[ind] + coarse[ind+cw]) +
-          4.0*(coarse[ind-1] + coarse[ind+1] + coarse[ind+cw-1] + coarse[ind+cw+1]));
-    default: // case 3: // both are odd, 2x2 stencil
-      return .25f * (coarse[ind] + coarse[ind+1] + coarse[ind+cw] + coarse[ind+cw+1]);
-  }
-}
-
 // helper to fill in one pixel boundary by copying it
 static inline void ll_fill_boundary1(
     float *const input,
@@ -107,20 +66,107 @@ static inline void ll_fill_boundary2(
   memcpy(input+wd*(ht-1), input+wd*(ht-2), sizeof(float)*wd);
 }
 
+// the expansion kernel is separable: 1 6 1 / 8 on fine pixels that coincide
+// with a coarse sample (even coordinate) and 4 4 / 8 in between (odd coordinate).
+// filter the coarse rows vertically into one coarse row per fine row and
+// expand that horizontally.
+// computes 1<=i<wd-1 for odd wd and 1<=i<wd-2 for even wd (j likewise with ht),
+// the rest of the boundary is filled by copying.
 static inline void gauss_expand(
     const float *const input, // coarse input
     float *const fine,        // upsampled, blurry output
     const int wd,             // fine res
     const int ht)
 {
+  const int cw = (wd-1)/2+1;
+  const int iend = (wd-1)&~1, jend = (ht-1)&~1;
+  const int stride = (cw+15)&~15;
+  float *const tmpbuf = dt_alloc_align(64, sizeof(float)*stride*dt_get_num_threads());
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j=1;j<jend;j++)  // even ht: two px boundary. odd ht: one px.
+  {
+    float *const tmp = tmpbuf + stride*dt_get_thread_num();
+    const float *const c0 = input + (j/2)*cw;
+    if(j&1)
+      for(int ic=0;ic<cw;ic++) tmp[ic] = 0.5f*(c0[ic] + c0[ic+cw]);
+    else
+      for(int ic=0;ic<cw;ic++) tmp[ic] = (1.0f/8.0f)*(c0[ic-cw] + 6.0f*c0[ic] + c0[ic+cw]);
+    float *const out = fine + j*wd;
+    for(int i=1;i<iend;i++)
+    {
+      const int k = i/2;
+      out[i] = (i&1) ? 0.5f*(tmp[k] + tmp[k+1]) : (1.0f/8.0f)*(tmp[k-1] + 6.0f*tmp[k] + tmp[k+1]);
+    }
+  }
+  dt_free_align(tmpbuf);
+  ll_fill_boundary2(fine, wd, ht);
+}
+
+#ifdef HAVE_TARGET_AVX2
+// same as above, 16 fine pixels at a time.
+__attribute__((target("avx2,fma")))
+static void gauss_expand_avx2(
+    const float *const input, // coarse input
+    float *const fine,        // upsampled, blurry output
+    const int wd,             // fine res
+    const int ht)
+{
+  const int cw = (wd-1)/2+1;
+  const int iend = (wd-1)&~1, jend = (ht-1)&~1;
+  const int stride = (cw+15)&~15;
+  float *const tmpbuf = dt_alloc_align(64, sizeof(float)*stride*dt_get_num_threads());
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) collapse(2)
+#pragma omp parallel for default(none) schedule(static)
 #endif
-  for(int j=1;j<((ht-1)&~1);j++)  // even ht: two px boundary. odd ht: one px.
-    for(int i=1;i<((wd-1)&~1);i++)
-      fine[j*wd+i] = ll_expand_gaussian(input, i, j, wd, ht);
+  for(int j=1;j<jend;j++)
+  {
+    float *const tmp = tmpbuf + stride*dt_get_thread_num();
+    const float *const c0 = input + (j/2)*cw;
+    int ic = 0;
+    if(j&1)
+    {
+      const float *const c1 = c0 + cw;
+      const __m256 half = _mm256_set1_ps(0.5f);
+      for(;ic+8<=cw;ic+=8)
+        _mm256_store_ps(tmp+ic, _mm256_mul_ps(half, _mm256_add_ps(_mm256_loadu_ps(c0+ic), _mm256_loadu_ps(c1+ic))));
+      for(;ic<cw;ic++) tmp[ic] = 0.5f*(c0[ic] + c1[ic]);
+    }
+    else
+    {
+      const float *const cm = c0 - cw, *const cp = c0 + cw;
+      const __m256 six = _mm256_set1_ps(6.0f), eighth = _mm256_set1_ps(1.0f/8.0f);
+      for(;ic+8<=cw;ic+=8)
+        _mm256_store_ps(tmp+ic, _mm256_mul_ps(eighth, _mm256_fmadd_ps(six, _mm256_loadu_ps(c0+ic),
+                _mm256_add_ps(_mm256_loadu_ps(cm+ic), _mm256_loadu_ps(cp+ic)))));
+      for(;ic<cw;ic++) tmp[ic] = (1.0f/8.0f)*(cm[ic] + 6.0f*c0[ic] + cp[ic]);
+    }
+
+    float *const out = fine + j*wd;
+    out[1] = 0.5f*(tmp[0] + tmp[1]);
+    int i = 2;
+    const __m256 six = _mm256_set1_ps(6.0f), eighth = _mm256_set1_ps(1.0f/8.0f), half = _mm256_set1_ps(0.5f);
+    for(;i+16<=iend;i+=16)
+    {
+      const float *const t = tmp + i/2;
+      const __m256 tc = _mm256_loadu_ps(t), tp = _mm256_loadu_ps(t+1);
+      const __m256 even = _mm256_mul_ps(eighth, _mm256_fmadd_ps(six, tc, _mm256_add_ps(_mm256_loadu_ps(t-1), tp)));
+      const __m256 odd = _mm256_mul_ps(half, _mm256_add_ps(tc, tp));
+      const __m256 lo = _mm256_unpacklo_ps(even, odd), hi = _mm256_unpackhi_ps(even, odd);
+      _mm256_storeu_ps(out+i,   _mm256_permute2f128_ps(lo, hi, 0x20));
+      _mm256_storeu_ps(out+i+8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+    for(;i<iend;i++)
+    {
+      const int k = i/2;
+      out[i] = (i&1) ? 0.5f*(tmp[k] + tmp[k+1]) : (1.0f/8.0f)*(tmp[k-1] + 6.0f*tmp[k] + tmp[k+1]);
+    }
+  }
+  dt_free_align(tmpbuf);
   ll_fill_boundary2(fine, wd, ht);
 }
+#endif
 
 #if defined(__SSE2__)
 static inline void gauss_reduce_sse2(
@@ -209,6 +255,87 @@ static inline void gauss_reduce_sse2(
 }
 #endif
 
+#ifdef HAVE_TARGET_AVX2
+// 1 4 6 4 1 along x, decimated: 8 coarse pixels from 16 + 4 fine ones.
+__attribute__((target("avx2,fma")))
+static inline __m256 reduce_row_avx2(const float *const in)
+{
+  // in points to the fine pixel left of the first coarse centre, minus one
+  const __m256 a = _mm256_loadu_ps(in), b = _mm256_loadu_ps(in+8);
+  const __m256 c = _mm256_loadu_ps(in+2), d = _mm256_loadu_ps(in+10);
+  const __m256 e = _mm256_loadu_ps(in+4), f = _mm256_loadu_ps(in+12);
+  // deinterleave into even and odd fine pixels
+  const __m256 em = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(a, b, 0x88)), 0xd8));
+  const __m256 om = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(a, b, 0xdd)), 0xd8));
+  const __m256 e0 = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(c, d, 0x88)), 0xd8));
+  const __m256 o0 = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(c, d, 0xdd)), 0xd8));
+  const __m256 ep = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(e, f, 0x88)), 0xd8));
+  return _mm256_fmadd_ps(_mm256_set1_ps(6.0f), e0,
+      _mm256_fmadd_ps(_mm256_set1_ps(4.0f), _mm256_add_ps(om, o0), _mm256_add_ps(em, ep)));
+}
+
+// same as the sse2 version, but the coarse rows are split into bands which are
+// processed in parallel, each with its own ring buffer.
+__attribute__((target("avx2,fma")))
+static void gauss_reduce_avx2(
+    const float *const input, // fine input buffer
+    float *const coarse,      // coarse scale, blurred input buf
+    const int wd,             // fine res
+    const int ht)
+{
+  const int cw = (wd-1)/2+1, ch = (ht-1)/2+1;
+  const int stride = (cw+15)&~15;
+  const int band = 32;
+  const int num_bands = (ch-2 + band-1)/band;
+  float *const ringbuf = dt_alloc_align(64, sizeof(float)*stride*5*dt_get_num_threads());
+  // last coarse pixel for which the vector horizontal pass stays inside the row
+  const int hend = MIN(cw-1, (wd-18)/2+1);
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(dynamic, 1)
+#endif
+  for(int bi=0;bi<num_bands;bi++)
+  {
+    float *const ring = ringbuf + stride*5*dt_get_thread_num();
+    const int j0 = 1 + bi*band, j1 = MIN(ch-1, j0+band);
+    int rowj = 2*j0-2;
+    for(int j=j0;j<j1;j++)
+    {
+      // horizontal pass, convolve with 1 4 6 4 1 kernel and decimate
+      for(;rowj<=2*j+2;rowj++)
+      {
+        float *const row = ring + (rowj % 5)*stride;
+        const float *const in = input + rowj*wd;
+        int i = 1;
+        for(;i+8<=hend;i+=8)
+          _mm256_store_ps(row+i-1, reduce_row_avx2(in+2*i-2));
+        for(;i<cw-1;i++)
+          row[i-1] = 6*in[2*i] + 4*(in[2*i-1]+in[2*i+1]) + in[2*i-2] + in[2*i+2];
+      }
+      // vertical pass. rows are stored shifted by one coarse pixel to keep the
+      // stores above aligned.
+      const float *const row0 = ring + ((2*j-2)%5)*stride, *const row1 = ring + ((2*j-1)%5)*stride,
+                  *const row2 = ring + ((2*j  )%5)*stride, *const row3 = ring + ((2*j+1)%5)*stride,
+                  *const row4 = ring + ((2*j+2)%5)*stride;
+      float *const out = coarse + j*cw + 1;
+      const __m256 four = _mm256_set1_ps(4.f), six = _mm256_set1_ps(6.f), scale = _mm256_set1_ps(1.f/256.f);
+      int i = 0;
+      for(;i+8<=cw-2;i+=8)
+      {
+        const __m256 r = _mm256_fmadd_ps(six, _mm256_load_ps(row2+i),
+            _mm256_fmadd_ps(four, _mm256_add_ps(_mm256_load_ps(row1+i), _mm256_load_ps(row3+i)),
+                            _mm256_add_ps(_mm256_load_ps(row0+i), _mm256_load_ps(row4+i))));
+        _mm256_storeu_ps(out+i, _mm256_mul_ps(r, scale));
+      }
+      for(;i<cw-2;i++)
+        out[i] = (6*row2[i] + 4*(row1[i] + row3[i]) + row0[i] + row4[i])*(1.0f/256.0f);
+    }
+  }
+  dt_free_align(ringbuf);
+  ll_fill_boundary1(coarse, cw, ch);
+}
+#endif
+
 static inline void gauss_reduce(
     const float *const input, // fine input buffer
     float *const coarse,      // coarse scale, blurred input buf
@@ -337,19 +464,6 @@ static inline float *ll_pad_input(
   return out;
 }
 
-static inline float ll_laplacian(
-    const float *const coarse,   // coarse res gaussian
-    const float *const fine,     // fine res gaussian
-    const int i,                 // fine index
-    const int j,
-    const int wd,                // fine width
-    const int ht)                // fine height
-{
-  const float c = ll_expand_gaussian(coarse,
-      CLAMPS(i, 1, ((wd-1)&~1)-1), CLAMPS(j, 1, ((ht-1)&~1)-1), wd, ht);
-  return fine[j*wd+i] - c;
-}
-
 static inline float curve_scalar(
     const float x,
     const float g,
@@ -524,6 +638,42 @@ void apply_curve(
   for(int j=h-padding;j<h;j++) memcpy(out + w*j, out+w*(h-padding-1), sizeof(float)*w);
 }
 
+// pick the fastest available pyramid kernels
+static inline void ll_gauss_reduce(
+    const float *const input,
+    float *const coarse,
+    const int wd,
+    const int ht,
+    const int use_sse2)
+{
+#ifdef HAVE_TARGET_AVX2
+  if(use_sse2 && darktable.codepath.AVX2)
+    gauss_reduce_avx2(input, coarse, wd, ht);
+  else
+#endif
+#if defined(__SSE2__)
+  if(use_sse2)
+    gauss_reduce_sse2(input, coarse, wd, ht);
+  else
+#endif
+    gauss_reduce(input, coarse, wd, ht);
+}
+
+static inline void ll_gauss_expand(
+    const float *const input,
+    float *const fine,
+    const int wd,
+    const int ht,
+    const int use_sse2)
+{
+#ifdef HAVE_TARGET_AVX2
+  if(use_sse2 && darktable.codepath.AVX2)
+    gauss_expand_avx2(input, fine, wd, ht);
+  else
+#endif
+    gauss_expand(input, fine, wd, ht);
+}
+
 void local_laplacian_internal(
     const float *const input,   // input buffer in some Labx or yuvx format
     float *const out,           // output buffer with colour
@@ -533,6 +683,7 @@ void local_laplacian_internal(
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
     const float clarity,        // user param: increase clarity/local contrast
+    const int fast,             // approximate for preview: finest level not remapped
     const int use_sse2,         // flag whether to use SSE version
     local_laplacian_boundary_t *b)
 {
@@ -544,6 +695,11 @@ void local_laplacian_internal(
   if(b && b->mode == 2) // higher number here makes it less prone to aliasing and slower.
     last_level = num_levels > 4 ? 4 : num_levels-1;
   const int max_supp = 1<<last_level;
+  // in fast mode the curves are only applied from the second level on, the
+  // finest laplacian is taken straight from the input. all gamma samples are
+  // kept, so the coarser levels are exact and can be handed to the full pipe.
+  const int first_level = (fast && last_level > 1) ? 1 : 0;
+  const int ng = num_gamma;
   int w, h;
   float *padded[max_levels] = {0};
   if(b && b->mode == 2)
@@ -553,59 +709,87 @@ void local_laplacian_internal(
 
   // allocate pyramid pointers for padded input
   for(int l=1;l<=last_level;l++)
-    padded[l] = dt_alloc_align(16, sizeof(float)*dl(w,l)*dl(h,l));
+    padded[l] = dt_alloc_align(64, sizeof(float)*dl(w,l)*dl(h,l));
 
   // allocate pyramid pointers for output
   float *output[max_levels] = {0};
   for(int l=0;l<=last_level;l++)
-    output[l] = dt_alloc_align(16, sizeof(float)*dl(w,l)*dl(h,l));
+    output[l] = dt_alloc_align(64, sizeof(float)*dl(w,l)*dl(h,l));
 
   // create gauss pyramid of padded input, write coarse directly to output
-#if defined(__SSE2__)
-  if(use_sse2)
-  {
-    for(int l=1;l<last_level;l++)
-      gauss_reduce_sse2(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1));
-    gauss_reduce_sse2(padded[last_level-1], output[last_level], dl(w,last_level-1), dl(h,last_level-1));
-  }
-  else
-#endif
-  {
-    for(int l=1;l<last_level;l++)
-      gauss_reduce(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1));
-    gauss_reduce(padded[last_level-1], output[last_level], dl(w,last_level-1), dl(h,last_level-1));
-  }
+  for(int l=1;l<last_level;l++)
+    ll_gauss_reduce(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1), use_sse2);
+  ll_gauss_reduce(padded[last_level-1], output[last_level], dl(w,last_level-1), dl(h,last_level-1), use_sse2);
 
   // evenly sample brightness [0,1]:
   float gamma[num_gamma] = {0.0f};
-  for(int k=0;k<num_gamma;k++) gamma[k] = (k+.5f)/(float)num_gamma;
+  for(int k=0;k<ng;k++) gamma[k] = (k+.5f)/(float)ng;
   // for(int k=0;k<num_gamma;k++) gamma[k] = k/(num_gamma-1.0f);
 
-  // allocate memory for intermediate laplacian pyramids
-  float *buf[num_gamma][max_levels] = {{0}};
-  for(int k=0;k<num_gamma;k++) for(int l=0;l<=last_level;l++)
-    buf[k][l] = dt_alloc_align(16, sizeof(float)*dl(w,l)*dl(h,l));
+  // only one remapped pyramid is kept at a time: the laplacian coefficients
+  // of every gamma sample are weighted and accumulated in output[l] (l < last_level)
+  // right away, and the pyramid is collapsed once all samples are in.
+  float *buf[max_levels] = {0};
+  for(int l=first_level;l<=last_level;l++)
+    buf[l] = dt_alloc_align(64, sizeof(float)*dl(w,l)*dl(h,l));
+  // expanded coarse level
+  float *const scratch = dt_alloc_align(64, sizeof(float)*w*h);
+  for(int l=0;l<last_level;l++)
+    memset(output[l], 0, sizeof(float)*dl(w,l)*dl(h,l));
 
   // the paper says remapping only level 3 not 0 does the trick, too
   // (but i really like the additional octave of sharpness we get,
   // willing to pay the cost).
-  for(int k=0;k<num_gamma;k++)
+  int cancelled = 0;
+  for(int k=0;k<ng;k++)
   { // process images
+    // every gamma sample costs a full pyramid, check if the pipe still wants the result
+    if(dt_cancelled())
+    {
+      cancelled = 1;
+      goto cleanup;
+    }
+    const int pw0 = dl(w,first_level), ph0 = dl(h,first_level);
 #if defined(__SSE2__)
     if(use_sse2)
-      apply_curve_sse2(buf[k][0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);
+      apply_curve_sse2(buf[first_level], padded[first_level], pw0, ph0, max_supp>>first_level, gamma[k], sigma, shadows, highlights, clarity);
     else // brackets in next line needed for silly gcc warning:
 #endif
-    {apply_curve(buf[k][0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);}
+    {apply_curve(buf[first_level], padded[first_level], pw0, ph0, max_supp>>first_level, gamma[k], sigma, shadows, highlights, clarity);}
 
     // create gaussian pyramids
-    for(int l=1;l<=last_level;l++)
-#if defined(__SSE2__)
-      if(use_sse2)
-        gauss_reduce_sse2(buf[k][l-1], buf[k][l], dl(w,l-1), dl(h,l-1));
-      else
+    for(int l=first_level+1;l<=last_level;l++)
+      ll_gauss_reduce(buf[l-1], buf[l], dl(w,l-1), dl(h,l-1), use_sse2);
+
+    // add the weighted laplacian coefficients of this gamma sample
+    for(int l=first_level;l<last_level;l++)
+    {
+      const int pw = dl(w,l), ph = dl(h,l);
+      ll_gauss_expand(buf[l+1], scratch, pw, ph, use_sse2);
+      const float g = gamma[k];
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static) shared(buf,output,l,padded,k)
+#endif
+      for(size_t i=0;i<(size_t)pw*ph;i++)
+      {
+        // linear interpolation between the two closest gamma samples, the
+        // outermost ones also take everything beyond.
+        const float v = padded[l][i];
+        float a = MAX(0.0f, 1.0f - fabsf(v - g) * ng);
+        if((k == 0 && v <= g) || (k == ng-1 && v >= g)) a = 1.0f;
+        output[l][i] += a * (buf[l][i] - scratch[i]);
+      }
+    }
+  }
+  if(first_level)
+  { // use finest scale from input, no remapping
+    const int pw = dl(w,0), ph = dl(h,0);
+    ll_gauss_expand(padded[1], scratch, pw, ph, use_sse2);
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static) shared(output,padded)
 #endif
-        gauss_reduce(buf[k][l-1], buf[k][l], dl(w,l-1), dl(h,l-1));
+    for(size_t i=0;i<(size_t)pw*ph;i++)
+      output[0][i] = padded[0][i] - scratch[i];
   }
 
   // resample output[last_level] from preview
@@ -616,7 +800,8 @@ void local_laplacian_internal(
     const float isize = powf(2.0f, last_level) / b->roi->scale; // pixel size of coarsest level in image space
     const float psize = isize / b->buf->width * b->wd; // pixel footprint rescaled to preview buffer
     const float pl = log2f(psize); // mip level in preview buffer
-    const int pl0 = CLAMP((int)pl, 0, b->num_levels-1), pl1 = CLAMP((int)(pl+1), 0, b->num_levels-1);
+    // levels below first_level of a fast preview are approximations, don't read them
+    const int pl0 = CLAMP((int)pl, b->first_level, b->num_levels-1), pl1 = CLAMP((int)(pl+1), b->first_level, b->num_levels-1);
     const float weight = CLAMP(pl-pl0, 0, 1); // weight between mip levels
     const float mul0 = 1.0/powf(2.0f, pl0);
     const float mul1 = 1.0/powf(2.0f, pl1);
@@ -696,32 +881,16 @@ void local_laplacian_internal(
 #endif
   }
 
-  // assemble output pyramid coarse to fine
+  // collapse output pyramid coarse to fine
   for(int l=last_level-1;l >= 0; l--)
   {
     const int pw = dl(w,l), ph = dl(h,l);
-
-    gauss_expand(output[l+1], output[l], pw, ph);
-    // go through all coefficients in the upsampled gauss buffer:
+    ll_gauss_expand(output[l+1], scratch, pw, ph, use_sse2);
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) collapse(2) shared(w,h,buf,output,l,gamma,padded)
+#pragma omp parallel for default(none) schedule(static) shared(output,l)
 #endif
-    for(int j=0;j<ph;j++) for(int i=0;i<pw;i++)
-    {
-      const float v = padded[l][j*pw+i];
-      int hi = 1;
-      for(;hi<num_gamma-1 && gamma[hi] <= v;hi++);
-      int lo = hi-1;
-      const float a = CLAMPS((v - gamma[lo])/(gamma[hi]-gamma[lo]), 0.0f, 1.0f);
-      const float l0 = ll_laplacian(buf[lo][l+1], buf[lo][l], i, j, pw, ph);
-      const float l1 = ll_laplacian(buf[hi][l+1], buf[hi][l], i, j, pw, ph);
-      output[l][j*pw+i] += l0 * (1.0f-a) + l1 * a;
-      // we could do this to save on memory (no need for finest buf[][]).
-      // unfortunately it results in a quite noticeable loss of sharpness, i think
-      // the extra level is worth it.
-      // else if(l == 0) // use finest scale from input to not amplify noise (and use less memory)
-      //   output[l][j*pw+i] += ll_laplacian(padded[l+1], padded[l], i, j, pw, ph);
-    }
+    for(size_t k=0;k<(size_t)pw*ph;k++)
+      output[l][k] += scratch[k];
   }
 #ifdef _OPENMP
 #pragma omp parallel for default(none) schedule(dynamic) collapse(2) shared(w,output,buf)
@@ -740,15 +909,18 @@ void local_laplacian_internal(
     b->pwd = w;
     b->pht = h;
     b->num_levels = num_levels;
+    b->first_level = first_level;
     for(int l=0;l<num_levels;l++) b->output[l] = output[l];
   }
+cleanup:
   // free all buffers except the ones passed out for preview rendering
   for(int l=0;l<max_levels;l++)
   {
-    if(!b || b->mode != 1 || l)   dt_free_align(padded[l]);
-    if(!b || b->mode != 1)        dt_free_align(output[l]);
-    for(int k=0; k<num_gamma;k++) dt_free_align(buf[k][l]);
+    if(!b || b->mode != 1 || cancelled || l) dt_free_align(padded[l]);
+    if(!b || b->mode != 1 || cancelled)      dt_free_align(output[l]);
+    dt_free_align(buf[l]);
   }
+  dt_free_align(scratch);
 #undef num_levels
 #undef num_gamma
 }
@@ -766,8 +938,11 @@ size_t local_laplacian_memory_use(const int width,     // width of input image
 
   size_t memory_use = 0;
 
+  // padded input, output and one remapped pyramid (independent of num_gamma)
   for(int l=0;l<num_levels;l++)
-    memory_use += (size_t)(2 + num_gamma) * dl(paddwd, l) * dl(paddht, l) * sizeof(float);
+    memory_use += (size_t)3 * dl(paddwd, l) * dl(paddht, l) * sizeof(float);
+  // scratch buffer for the expanded levels
+  memory_use += (size_t)paddwd * paddht * sizeof(float);
 
   return memory_use;
 #undef num_levels
@@ -34,6 +34,7 @@ typedef struct local_laplacian_boundary_t
   const dt_iop_roi_t *buf; // dimensions of full buffer
   float *output[30];       // output pyramid of preview pass (allocated via dt_alloc_align)
   int num_levels;          // number of levels in preview output pyramid
+  int first_level;         // finest level of the preview pyramid which is exact, finer ones are approximated
 }
 local_laplacian_boundary_t;
 
@@ -54,6 +55,7 @@ void local_laplacian_internal(
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
     const float clarity,        // user param: increase clarity/local contrast
+    const int fast,             // approximate for preview: finest level not remapped
     const int use_sse2,         // switch on sse optimised version, if available
     // the following is just needed for clipped roi with boundary conditions from coarse buffer (can be 0)
     local_laplacian_boundary_t *b);
@@ -67,9 +69,10 @@ void local_laplacian(
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
     const float clarity,        // user param: increase clarity/local contrast
+    const int fast,             // approximate for preview: finest level not remapped
     local_laplacian_boundary_t *b) // can be 0
 {
-  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, 0, b);
+  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, fast, 0, b);
 }
 
 size_t local_laplacian_memory_use(const int width,      // width of input image
@@ -90,8 +93,9 @@ void local_laplacian_sse2(
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
     const float clarity,        // user param: increase clarity/local contrast
+    const int fast,             // approximate for preview: finest level not remapped
     local_laplacian_boundary_t *b) // can be 0
 {
-  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, 1, b);
+  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, fast, 1, b);
 }
 #endif
@@ -25,6 +25,10 @@
 #include "develop/masks.h"
 #include "develop/tiling.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define CLAMP_RANGE(x, y, z) (CLAMP(x, y, z))
 
 typedef struct _blend_buffer_desc_t
@@ -434,6 +438,32 @@ static void _blend_make_mask(const _blend_buffer_desc_t *bd, const unsigned int
   }
 }
 
+/* contrast and brightness curve of the mask, values are relative to the global opacity */
+static inline void _blend_mask_tone_curve(float *mask, const size_t n, const float e, const float brightness,
+                                          const float opacity)
+{
+  for(size_t k = 0; k < n; k++)
+  {
+    float x = mask[k] / opacity;
+    x = 2.f * x - 1.f;
+    if (1.f - brightness <= 0.f)
+      x = mask[k] <= FLT_EPSILON ? -1.f : 1.f;
+    else if (1.f + brightness <= 0.f)
+      x = mask[k] >= 1.f - FLT_EPSILON ? 1.f : -1.f;
+    else if (brightness > 0.f)
+    {
+      x = (x + brightness) / (1.f - brightness);
+      x = fminf(x, 1.f);
+    }
+    else
+    {
+      x = (x + brightness) / (1.f + brightness);
+      x = fmaxf(x, -1.f);
+    }
+    mask[k] = ((x * e / (1.f + (e - 1.f) * fabsf(x))) / 2.f + 0.5f) * opacity;
+  }
+}
+
 /* normal blend with clamping */
 static void _blend_normal_bounded(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
                                   int flag)
@@ -2707,10 +2737,213 @@ static void display_channel(const _blend_buffer_desc_t *bd, const float *a, floa
 }
 
 
+#if defined(__SSE2__)
+/* sse2 row kernels for the blend modes working on every channel on its own. colour spaces and
+   buffer layouts which are not covered here are handed to the plain kernels. */
+static inline __m128 _blend_channel_op_sse2(const unsigned int blend_mode, const __m128 a, const __m128 b)
+{
+  const __m128 one = _mm_set1_ps(1.0f);
+  switch(blend_mode)
+  {
+    case DEVELOP_BLEND_LIGHTEN:
+      return _mm_max_ps(a, b);
+    case DEVELOP_BLEND_DARKEN:
+      return _mm_min_ps(a, b);
+    case DEVELOP_BLEND_MULTIPLY:
+      return _mm_mul_ps(a, b);
+    case DEVELOP_BLEND_AVERAGE:
+      return _mm_mul_ps(_mm_add_ps(a, b), _mm_set1_ps(0.5f));
+    case DEVELOP_BLEND_ADD:
+      return _mm_add_ps(a, b);
+    case DEVELOP_BLEND_SUBSTRACT:
+      return _mm_sub_ps(_mm_add_ps(a, b), one);
+    case DEVELOP_BLEND_DIFFERENCE:
+      return _mm_andnot_ps(_mm_set1_ps(-0.0f), _mm_sub_ps(a, b));
+    case DEVELOP_BLEND_SCREEN:
+      // a has already been clamped by the caller
+      return _mm_sub_ps(one, _mm_mul_ps(_mm_sub_ps(one, a),
+                                        _mm_sub_ps(one, _mm_min_ps(_mm_max_ps(b, _mm_setzero_ps()), one))));
+    default:
+      return b;
+  }
+}
+
+static inline __m128 _blend_channel_mix_sse2(const unsigned int blend_mode, const int bounded, __m128 a,
+                                             const __m128 b, const __m128 opacity)
+{
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  if(blend_mode == DEVELOP_BLEND_SCREEN) a = _mm_min_ps(_mm_max_ps(a, zero), one);
+  const __m128 o = _blend_channel_op_sse2(blend_mode, a, b);
+  const __m128 res = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(o, a), opacity));
+  return bounded ? _mm_min_ps(_mm_max_ps(res, zero), one) : res;
+}
+
+static inline void _blend_channels_sse2(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                        const float *mask, const int flag, const unsigned int blend_mode,
+                                        const int bounded, _blend_row_func *const plain)
+{
+  if(bd->cst == iop_cs_rgb && bd->ch == 4)
+  {
+    const __m128 color = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    for(size_t i = 0, j = 0; j < bd->stride; i++, j += 4)
+    {
+      const __m128 opacity = _mm_set1_ps(mask[i]);
+      const __m128 res = _blend_channel_mix_sse2(blend_mode, bounded, _mm_loadu_ps(a + j), _mm_loadu_ps(b + j),
+                                                 opacity);
+      // alpha carries the opacity
+      _mm_storeu_ps(b + j, _mm_or_ps(_mm_and_ps(color, res), _mm_andnot_ps(color, opacity)));
+    }
+  }
+  else if(bd->cst == iop_cs_RAW && bd->ch == 1)
+  {
+    // four mosaic pixels at a time, the plain kernel does the rest of the row
+    const size_t stride = bd->stride & ~(size_t)3;
+    for(size_t j = 0; j < stride; j += 4)
+      _mm_storeu_ps(b + j, _blend_channel_mix_sse2(blend_mode, bounded, _mm_loadu_ps(a + j),
+                                                   _mm_loadu_ps(b + j), _mm_loadu_ps(mask + j)));
+    if(stride < bd->stride)
+    {
+      const _blend_buffer_desc_t tail
+          = { .cst = bd->cst, .stride = bd->stride - stride, .ch = bd->ch, .bch = bd->bch };
+      plain(&tail, a + stride, b + stride, mask + stride, flag);
+    }
+  }
+  else
+    plain(bd, a, b, mask, flag);
+}
+
+/* normal blend in Lab, all channels blend linearly so the scaling to 0..1 is only needed for the bounds */
+static inline void _blend_Lab_normal_sse2(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                          const float *mask, const int flag, const int bounded)
+{
+  const __m128 min = _mm_set_ps(0.0f, -128.0f, -128.0f, 0.0f);
+  const __m128 max = _mm_set_ps(0.0f, 128.0f, 128.0f, 100.0f);
+  const __m128 lightness = _mm_castsi128_ps(_mm_set_epi32(0, 0, 0, -1));
+  const __m128 color = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+  // with flag set only lightness is blended, a and b are taken from the input
+  const __m128 blended = flag ? lightness : color;
+  for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
+  {
+    const __m128 opacity = _mm_set1_ps(mask[i]);
+    const __m128 va = _mm_loadu_ps(a + j);
+    __m128 res = _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b + j), va), opacity));
+    if(bounded) res = _mm_min_ps(_mm_max_ps(res, min), max);
+    res = _mm_or_ps(_mm_and_ps(blended, res), _mm_andnot_ps(blended, va));
+    _mm_storeu_ps(b + j, _mm_or_ps(_mm_and_ps(color, res), _mm_andnot_ps(color, opacity)));
+  }
+}
+
+static void _blend_normal_bounded_sse2(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                       const float *mask, int flag)
+{
+  if(bd->cst == iop_cs_Lab && bd->ch == 4)
+    _blend_Lab_normal_sse2(bd, a, b, mask, flag, 1);
+  else
+    _blend_channels_sse2(bd, a, b, mask, flag, DEVELOP_BLEND_NORMAL, 1, _blend_normal_bounded);
+}
+
+static void _blend_normal_unbounded_sse2(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                         const float *mask, int flag)
+{
+  if(bd->cst == iop_cs_Lab && bd->ch == 4)
+    _blend_Lab_normal_sse2(bd, a, b, mask, flag, 0);
+  else
+    _blend_channels_sse2(bd, a, b, mask, flag, DEVELOP_BLEND_NORMAL, 0, _blend_normal_unbounded);
+}
+
+static void _blend_lighten_sse2(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                int flag)
+{
+  _blend_channels_sse2(bd, a, b, mask, flag, DEVELOP_BLEND_LIGHTEN, 1, _blend_lighten);
+}
+
+static void _blend_darken_sse2(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                               int flag)
+{
+  _blend_channels_sse2(bd, a, b, mask, flag, DEVELOP_BLEND_DARKEN, 1, _blend_darken);
+}
+
+static void _blend_multiply_sse2(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                 int flag)
+{
+  _blend_channels_sse2(bd, a, b, mask, flag, DEVELOP_BLEND_MULTIPLY, 1, _blend_multiply);
+}
+
+static void _blend_average_sse2(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                int flag)
+{
+  _blend_channels_sse2(bd, a, b, mask, flag, DEVELOP_BLEND_AVERAGE, 1, _blend_average);
+}
+
+static void _blend_add_sse2(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                            int flag)
+{
+  _blend_channels_sse2(bd, a, b, mask, flag, DEVELOP_BLEND_ADD, 1, _blend_add);
+}
+
+static void _blend_substract_sse2(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                  int flag)
+{
+  _blend_channels_sse2(bd, a, b, mask, flag, DEVELOP_BLEND_SUBSTRACT, 1, _blend_substract);
+}
+
+static void _blend_difference_sse2(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                   int flag)
+{
+  _blend_channels_sse2(bd, a, b, mask, flag, DEVELOP_BLEND_DIFFERENCE, 1, _blend_difference);
+}
+
+static void _blend_screen_sse2(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                               int flag)
+{
+  _blend_channels_sse2(bd, a, b, mask, flag, DEVELOP_BLEND_SCREEN, 1, _blend_screen);
+}
+
+static _blend_row_func *_blend_choose_func_sse2(const unsigned int blend_mode)
+{
+  switch(blend_mode)
+  {
+    case DEVELOP_BLEND_LIGHTEN:
+      return _blend_lighten_sse2;
+    case DEVELOP_BLEND_DARKEN:
+      return _blend_darken_sse2;
+    case DEVELOP_BLEND_MULTIPLY:
+      return _blend_multiply_sse2;
+    case DEVELOP_BLEND_AVERAGE:
+      return _blend_average_sse2;
+    case DEVELOP_BLEND_ADD:
+      return _blend_add_sse2;
+    case DEVELOP_BLEND_SUBSTRACT:
+      return _blend_substract_sse2;
+    case DEVELOP_BLEND_DIFFERENCE:
+      return _blend_difference_sse2;
+    case DEVELOP_BLEND_SCREEN:
+      return _blend_screen_sse2;
+    case DEVELOP_BLEND_NORMAL:
+    case DEVELOP_BLEND_BOUNDED:
+      return _blend_normal_bounded_sse2;
+    case DEVELOP_BLEND_NORMAL2:
+    case DEVELOP_BLEND_UNBOUNDED:
+      return _blend_normal_unbounded_sse2;
+    default:
+      return NULL;
+  }
+}
+#endif
+
 _blend_row_func *dt_develop_choose_blend_func(const unsigned int blend_mode)
 {
   _blend_row_func *blend = NULL;
 
+#if defined(__SSE2__)
+  if(darktable.codepath.SSE2)
+  {
+    blend = _blend_choose_func_sse2(blend_mode);
+    if(blend) return blend;
+  }
+#endif
+
   /* select the blend operator */
   switch(blend_mode)
   {
@@ -2821,6 +3054,19 @@ _blend_row_func *dt_develop_choose_blend_func(const unsigned int blend_mode)
   return blend;
 }
 
+void dt_develop_blend_rows(const unsigned int blend_mode, const dt_iop_colorspace_type_t cst, const float *const a,
+                           float *const b, const float *const mask, const int width, const int height,
+                           const int flag)
+{
+  const size_t ch = (cst == iop_cs_RAW) ? 1 : 4;
+  const size_t bch = (ch == 1) ? 1 : ch - 1;
+  const _blend_buffer_desc_t bd = { .cst = cst, .stride = (size_t)width * ch, .ch = ch, .bch = bch };
+  _blend_row_func *const blend = dt_develop_choose_blend_func(blend_mode);
+#ifdef _OPENMP
+#pragma omp parallel for default(none)
+#endif
+  for(size_t y = 0; y < height; y++) blend(&bd, a + y * bd.stride, b + y * bd.stride, mask + y * width, flag);
+}
 
 void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                               const void *const ivoid, void *const ovoid, const struct dt_iop_roi_t *const roi_in,
@@ -2886,6 +3132,14 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
 
   // get the clipped opacity value  0 - 1
   const float opacity = fminf(fmaxf(0.0f, (d->opacity / 100.0f)), 1.0f);
+  const _Bool apply_tone_curve = mask_tone_curve && opacity > 1e-4f;
+  const float e = expf(3.f * d->contrast);
+  const float brightness = d->brightness;
+
+  // without feathering or blurring every mask value only depends on its own pixel, so the parametric
+  // mask is computed row by row right before blending instead of in separate passes over the buffer
+  const _Bool uniform_mask = mask_mode == DEVELOP_MASK_ENABLED || suppress_mask;
+  const _Bool fuse_mask = !uniform_mask && !mask_feather && !mask_blur;
 
   // allocate space for blend mask
   float *_mask = dt_alloc_align(64, buffsize * sizeof(float));
@@ -2896,7 +3150,7 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
   }
   float *const mask = _mask;
 
-  if(mask_mode == DEVELOP_MASK_ENABLED || suppress_mask)
+  if(uniform_mask)
   {
     // blend uniformly (no drawn or parametric mask)
 
@@ -2946,18 +3200,22 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
     }
 
     // get parametric mask (if any) and apply global opacity
+    if(!fuse_mask)
+    {
 #ifdef _OPENMP
 #pragma omp parallel for default(none)
 #endif
-    for(size_t y = 0; y < oheight; y++)
-    {
-      size_t iindex = ((y + yoffs) * iwidth + xoffs) * ch;
-      size_t oindex = y * owidth * ch;
-      _blend_buffer_desc_t bd = { .cst = cst, .stride = (size_t)owidth * ch, .ch = ch, .bch = bch };
-      float *in = (float *)ivoid + iindex;
-      float *out = (float *)ovoid + oindex;
-      float *m = mask + y * owidth;
-      _blend_make_mask(&bd, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out, m);
+      for(size_t y = 0; y < oheight; y++)
+      {
+        size_t iindex = ((y + yoffs) * iwidth + xoffs) * ch;
+        size_t oindex = y * owidth * ch;
+        _blend_buffer_desc_t bd = { .cst = cst, .stride = (size_t)owidth * ch, .ch = ch, .bch = bch };
+        float *in = (float *)ivoid + iindex;
+        float *out = (float *)ovoid + oindex;
+        float *m = mask + y * owidth;
+        _blend_make_mask(&bd, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out,
+                         m);
+      }
     }
 
     if(mask_feather)
@@ -3013,33 +3271,12 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
       }
     }
 
-    if(mask_tone_curve && opacity > 1e-4f)
+    if(apply_tone_curve && !fuse_mask)
     {
-      const float e = expf(3.f * d->contrast);
-      const float brightness = d->brightness;
 #ifdef _OPENMP
 #pragma omp parallel for default(none)
 #endif
-      for(size_t k = 0; k < buffsize; k++)
-      {
-        float x = mask[k] / opacity;
-        x = 2.f * x - 1.f;
-        if (1.f - brightness <= 0.f)
-          x = mask[k] <= FLT_EPSILON ? -1.f : 1.f;
-        else if (1.f + brightness <= 0.f)
-          x = mask[k] >= 1.f - FLT_EPSILON ? 1.f : -1.f;
-        else if (brightness > 0.f)
-        {
-          x = (x + brightness) / (1.f - brightness);
-          x = fminf(x, 1.f);
-        }
-        else
-        {
-          x = (x + brightness) / (1.f + brightness);
-          x = fmaxf(x, -1.f);
-        }
-        mask[k] = ((x * e / (1.f + (e - 1.f) * fabsf(x))) / 2.f + 0.5f) * opacity;
-      }
+      for(size_t y = 0; y < oheight; y++) _blend_mask_tone_curve(mask + y * owidth, owidth, e, brightness, opacity);
     }
   }
 
@@ -3058,6 +3295,12 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
     float *out = (float *)ovoid + oindex;
     float *m = mask + y * owidth;
 
+    if(fuse_mask)
+    {
+      _blend_make_mask(&bd, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out, m);
+      if(apply_tone_curve) _blend_mask_tone_curve(m, owidth, e, brightness, opacity);
+    }
+
     if(request_mask_display & DT_DEV_PIXELPIPE_DISPLAY_ANY)
       display_channel(&bd, in, out, m, request_mask_display);
     else
@@ -407,6 +407,12 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
                               const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
                               const struct dt_iop_roi_t *const roi_out);
 
+/** blend a onto b with one opacity per pixel in mask, using the row kernel dt_develop_blend_process() picks
+ *  for blend_mode and the current codepath. a and b are width x height pixels of 1 (raw) or 4 channels. */
+void dt_develop_blend_rows(const unsigned int blend_mode, const dt_iop_colorspace_type_t cst, const float *const a,
+                           float *const b, const float *const mask, const int width, const int height,
+                           const int flag);
+
 /** get blend version */
 int dt_develop_blend_version(void);
 
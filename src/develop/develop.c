@@ -46,6 +46,10 @@
 #define DT_DEV_AVERAGE_DELAY_START 250
 #define DT_DEV_PREVIEW_AVERAGE_DELAY_START 50
 #define DT_DEV_AVERAGE_DELAY_COUNT 5
+// progressive rendering: coarse passes render at 1/DT_DEV_COARSE_FACTOR of the resolution, and are only
+// done if the full pass takes longer than DT_DEV_COARSE_MIN_DELAY ms.
+#define DT_DEV_COARSE_FACTOR 4
+#define DT_DEV_COARSE_MIN_DELAY 150
 
 const gchar *dt_dev_histogram_type_names[DT_DEV_HISTOGRAM_N] = { "logarithmic", "linear", "waveform" };
 
@@ -58,6 +62,8 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
   dev->timestamp = 0;
   dev->average_delay = DT_DEV_AVERAGE_DELAY_START;
   dev->preview_average_delay = DT_DEV_PREVIEW_AVERAGE_DELAY_START;
+  dev->coarse_average_delay = DT_DEV_PREVIEW_AVERAGE_DELAY_START;
+  dev->interacting = 0;
   dev->gui_leaving = 0;
   dev->gui_synch = 0;
   dt_pthread_mutex_init(&dev->history_mutex, NULL);
@@ -94,6 +100,8 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
   dev->form_visible = NULL;
   dev->form_gui = NULL;
   dev->allforms = NULL;
+  dev->masks_cache = dt_masks_cache_init();
+  dev->raw_stage = dt_dev_raw_stage_init();
 
   if(dev->gui_attached)
   {
@@ -169,6 +177,8 @@ void dt_dev_cleanup(dt_develop_t *dev)
 
   g_list_free(dev->forms);
   g_list_free_full(dev->allforms, (void (*)(void *))dt_masks_free_form);
+  dt_masks_cache_cleanup(dev->masks_cache);
+  dt_dev_raw_stage_cleanup(dev->raw_stage);
 
   g_list_free_full(dev->proxy.exposure, g_free);
 
@@ -401,6 +411,44 @@ restart:
   x = MAX(0, scale * dev->pipe->processed_width  * (.5 + zoom_x) - wd / 2);
   y = MAX(0, scale * dev->pipe->processed_height * (.5 + zoom_y) - ht / 2);
 
+  // progressive rendering: show a quick pass at lower resolution first, if the full one takes long enough and
+  // the coarse one is likely to win the race by far. while the user is dragging something, stop there.
+  if(dev->gui_attached && !dev->image_loading && dev->average_delay > DT_DEV_COARSE_MIN_DELAY
+     && 2 * dev->coarse_average_delay < dev->average_delay)
+  {
+    dt_get_times(&start);
+    if(dt_dev_pixelpipe_process_coarse(dev->pipe, dev, x, y, wd, ht, scale, DT_DEV_COARSE_FACTOR))
+    {
+      if(dev->image_force_reload)
+      {
+        dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+        dt_control_log_busy_leave();
+        dev->image_status = DT_DEV_PIXELPIPE_INVALID;
+        dt_pthread_mutex_unlock(&dev->pipe_mutex);
+        return;
+      }
+      else
+        goto restart;
+    }
+    dt_show_times(&start, "[dev_process_image] coarse pixel pipeline processing", NULL);
+    dt_dev_average_delay_update(&start, &dev->coarse_average_delay);
+
+    if(dev->pipe->changed != DT_DEV_PIPE_UNCHANGED) goto restart;
+
+    // drawn like a valid result, but the full pass is still pending
+    dev->image_status = DT_DEV_PIXELPIPE_COARSE;
+    dt_control_queue_redraw_center();
+
+    // dt_dev_set_interacting() asks for the full pass once the user lets go
+    if(dev->interacting)
+    {
+      dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+      dt_control_log_busy_leave();
+      dt_pthread_mutex_unlock(&dev->pipe_mutex);
+      return;
+    }
+  }
+
   dt_get_times(&start);
   if(dt_dev_pixelpipe_process(dev->pipe, dev, x, y, wd, ht, scale))
   {
@@ -453,6 +501,7 @@ static inline void _dt_dev_load_raw(dt_develop_t *dev, const uint32_t imgid)
 void dt_dev_reload_image(dt_develop_t *dev, const uint32_t imgid)
 {
   _dt_dev_load_raw(dev, imgid);
+  dt_dev_raw_stage_flush(dev->raw_stage);
   dev->image_force_reload = dev->image_loading = dev->preview_loading = 1;
 
   dev->pipe->changed |= DT_DEV_PIPE_SYNCH;
@@ -492,6 +541,7 @@ float dt_dev_get_zoom_scale(dt_develop_t *dev, dt_dev_zoom_t zoom, int closeup_f
 void dt_dev_load_image(dt_develop_t *dev, const uint32_t imgid)
 {
   _dt_dev_load_raw(dev, imgid);
+  dt_dev_raw_stage_flush(dev->raw_stage);
 
   if(dev->pipe)
   {
@@ -1547,6 +1597,15 @@ void dt_dev_average_delay_update(const dt_times_t *start, uint32_t *average_dela
                      - *average_delay / DT_DEV_AVERAGE_DELAY_COUNT);
 }
 
+void dt_dev_set_interacting(dt_develop_t *dev, const gboolean interacting)
+{
+  dev->interacting = interacting;
+  if(!interacting && dev->image_status == DT_DEV_PIXELPIPE_COARSE && dev->gui_attached)
+  {
+    dev->image_status = DT_DEV_PIXELPIPE_DIRTY;
+    dt_control_queue_redraw_center();
+  }
+}
 
 /** duplicate a existent module */
 dt_iop_module_t *dt_dev_module_duplicate(dt_develop_t *dev, dt_iop_module_t *base, int priority)
@@ -76,7 +76,8 @@ typedef enum dt_dev_pixelpipe_status_t
   DT_DEV_PIXELPIPE_DIRTY = 0,   // history stack changed or image new
   DT_DEV_PIXELPIPE_RUNNING = 1, // pixelpipe is running
   DT_DEV_PIXELPIPE_VALID = 2,   // pixelpipe has finished; valid result
-  DT_DEV_PIXELPIPE_INVALID = 3  // pixelpipe has finished; invalid result
+  DT_DEV_PIXELPIPE_INVALID = 3, // pixelpipe has finished; invalid result
+  DT_DEV_PIXELPIPE_COARSE = 4   // coarse pass of progressive rendering has finished; full one still to come
 } dt_dev_pixelpipe_status_t;
 
 typedef enum dt_dev_pixelpipe_display_mask_t
@@ -125,6 +126,9 @@ typedef struct dt_develop_t
   uint32_t timestamp;
   uint32_t average_delay;
   uint32_t preview_average_delay;
+  uint32_t coarse_average_delay;
+  // progressive rendering: set while the user drags a slider or in the center view.
+  int32_t interacting;
   struct dt_iop_module_t *gui_module; // this module claims gui expose/event callbacks.
   float preview_downsampling;         // < 1.0: optionally downsample preview
 
@@ -170,6 +174,10 @@ typedef struct dt_develop_t
   struct dt_masks_form_gui_t *form_gui;
   // all forms to be linked here for cleanup:
   GList *allforms;
+  // rasterised masks and distorted point sets of the darkroom pipes
+  struct dt_masks_cache_t *masks_cache;
+  // raw stage of the whole image, computed by one darkroom pipe and resampled by the other
+  struct dt_dev_raw_stage_t *raw_stage;
 
   //full preview stuff
   int full_preview;
@@ -340,6 +348,8 @@ void dt_dev_snapshot_request(dt_develop_t *dev, const char *filename);
 
 /** update gliding average for pixelpipe delay */
 void dt_dev_average_delay_update(const dt_times_t *start, uint32_t *average_delay);
+// while interacting, the center view is only rendered coarsely. ending the interaction asks for a full render.
+void dt_dev_set_interacting(dt_develop_t *dev, const gboolean interacting);
 
 /*
  * masks plugin hooks
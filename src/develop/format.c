@@ -19,6 +19,13 @@
 #include "develop/format.h"
 #include "develop/imageop.h"
 
+#ifdef HAVE_TARGET_AVX2
+#include <immintrin.h>
+#endif
+
+// values converted per thread and block
+#define DT_HALF_BLOCK 16384
+
 size_t dt_iop_buffer_dsc_to_bpp(const struct dt_iop_buffer_dsc_t *dsc)
 {
   size_t bpp = dsc->channels;
@@ -29,6 +36,7 @@ size_t dt_iop_buffer_dsc_to_bpp(const struct dt_iop_buffer_dsc_t *dsc)
       bpp *= sizeof(float);
       break;
     case TYPE_UINT16:
+    case TYPE_HALF:
       bpp *= sizeof(uint16_t);
       break;
     default:
@@ -39,6 +47,115 @@ size_t dt_iop_buffer_dsc_to_bpp(const struct dt_iop_buffer_dsc_t *dsc)
   return bpp;
 }
 
+static inline float _half_to_float(const uint16_t h)
+{
+  union {
+    uint32_t i;
+    float f;
+  } u;
+  const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  const uint32_t exponent = (h >> 10) & 0x1f;
+  const uint32_t mantissa = h & 0x3ff;
+  if(exponent == 0x1f) // inf and nan
+    u.i = sign | 0x7f800000 | (mantissa << 13);
+  else if(exponent) // normal
+    u.i = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  else // denormal and zero
+  {
+    u.f = mantissa * (1.0f / 16777216.0f);
+    u.i |= sign;
+  }
+  return u.f;
+}
+
+static inline uint16_t _float_to_half(const float f)
+{
+  union {
+    uint32_t i;
+    float f;
+  } u = { .f = f };
+  const uint16_t sign = (u.i >> 16) & 0x8000;
+  uint32_t a = u.i & 0x7fffffff;
+  if(a >= 0x7f800000) return sign | 0x7c00 | (a > 0x7f800000 ? 0x200 : 0); // inf and nan
+  if(a >= 0x477ff000) return sign | 0x7c00;                                 // rounds to more than 65504
+  if(a < 0x38800000)                                                        // denormal and zero
+  {
+    u.i = a;
+    return sign | (uint16_t)lrintf(u.f * 16777216.0f);
+  }
+  // rebias the exponent and round to nearest even
+  a += 0xc8000fffu + ((a >> 13) & 1);
+  return sign | (uint16_t)(a >> 13);
+}
+
+#ifdef HAVE_TARGET_AVX2
+// every cpu with avx2 has f16c as well
+__attribute__((target("avx2,f16c")))
+static void _half_to_float_f16c(float *const out, const uint16_t *const in, const size_t n)
+{
+  const size_t nblocks = (n + DT_HALF_BLOCK - 1) / DT_HALF_BLOCK;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none)
+#endif
+  for(size_t b = 0; b < nblocks; b++)
+  {
+    const size_t end = MIN(n, (b + 1) * DT_HALF_BLOCK);
+    size_t k = b * DT_HALF_BLOCK;
+    for(; k + 8 <= end; k += 8)
+      _mm256_storeu_ps(out + k, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(in + k))));
+    for(; k < end; k++) out[k] = _half_to_float(in[k]);
+  }
+}
+
+__attribute__((target("avx2,f16c")))
+static void _float_to_half_f16c(uint16_t *const out, const float *const in, const size_t n)
+{
+  const size_t nblocks = (n + DT_HALF_BLOCK - 1) / DT_HALF_BLOCK;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none)
+#endif
+  for(size_t b = 0; b < nblocks; b++)
+  {
+    const size_t end = MIN(n, (b + 1) * DT_HALF_BLOCK);
+    size_t k = b * DT_HALF_BLOCK;
+    for(; k + 8 <= end; k += 8)
+      _mm_storeu_si128((__m128i *)(out + k), _mm256_cvtps_ph(_mm256_loadu_ps(in + k), _MM_FROUND_TO_NEAREST_INT));
+    for(; k < end; k++) out[k] = _float_to_half(in[k]);
+  }
+}
+#endif
+
+void dt_iop_buffer_half_to_float(float *const out, const uint16_t *const in, const size_t n)
+{
+#ifdef HAVE_TARGET_AVX2
+  if(darktable.codepath.AVX2) return _half_to_float_f16c(out, in, n);
+#endif
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none)
+#endif
+  for(size_t k = 0; k < n; k++) out[k] = _half_to_float(in[k]);
+}
+
+void dt_iop_buffer_float_to_half(uint16_t *const out, const float *const in, const size_t n)
+{
+#ifdef HAVE_TARGET_AVX2
+  if(darktable.codepath.AVX2) return _float_to_half_f16c(out, in, n);
+#endif
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none)
+#endif
+  for(size_t k = 0; k < n; k++) out[k] = _float_to_half(in[k]);
+}
+
+int dt_iop_processed_output_format(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece,
+                                   dt_iop_buffer_dsc_t *dsc)
+{
+  self->output_format(self, pipe, piece, dsc);
+  if(dsc->datatype != TYPE_HALF) return 0;
+  dsc->datatype = TYPE_FLOAT;
+  return 1;
+}
+
 static int _iop_module_rawprepare = 0, _iop_module_demosaic = 0;
 static inline void _get_iop_priorities(const dt_iop_module_t *module)
 {
@@ -84,7 +201,12 @@ void default_output_format(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_d
   dsc->channels = 4;
   dsc->datatype = TYPE_FLOAT;
 
-  if(self->priority >= _iop_module_demosaic) return;
+  if(self->priority >= _iop_module_demosaic)
+  {
+    // gamma puts 8-bit pixels into its float buffer, and is the one buffer the gui reads
+    if(pipe->half_buffers && strcmp(self->op, "gamma")) dsc->datatype = TYPE_HALF;
+    return;
+  }
 
   if(pipe->image.flags & DT_IMAGE_RAW) dsc->channels = 1;
 
@@ -29,6 +29,7 @@ typedef enum dt_iop_buffer_type_t {
   TYPE_UNKNOWN,
   TYPE_FLOAT,
   TYPE_UINT16,
+  TYPE_HALF, // storage only: modules get floats, the pixelpipe converts from/to half floats in its cache
 } dt_iop_buffer_type_t;
 
 typedef struct dt_iop_buffer_dsc_t
@@ -60,6 +61,15 @@ typedef struct dt_iop_buffer_dsc_t
 
 size_t dt_iop_buffer_dsc_to_bpp(const struct dt_iop_buffer_dsc_t *dsc);
 
+/** convert n values between floats and IEEE half floats (round to nearest even) */
+void dt_iop_buffer_half_to_float(float *const out, const uint16_t *const in, const size_t n);
+void dt_iop_buffer_float_to_half(uint16_t *const out, const float *const in, const size_t n);
+
+/** the format a module's process() writes: module->output_format(), but with half floats being processed as
+ * floats. returns 1 if the output is to be stored as half floats. */
+int dt_iop_processed_output_format(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_t *pipe,
+                                   struct dt_dev_pixelpipe_iop_t *piece, struct dt_iop_buffer_dsc_t *dsc);
+
 void default_input_format(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_t *pipe,
                           struct dt_dev_pixelpipe_iop_t *piece, struct dt_iop_buffer_dsc_t *dsc);
 
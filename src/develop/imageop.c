@@ -308,6 +308,11 @@ int dt_iop_load_module_so(void *m, const char *libname, const char *op)
 
   if(!g_module_symbol(module->module, "process", (gpointer) & (module->process_plain))) goto error;
 
+  if(!g_module_symbol(module->module, "process_pixels", (gpointer) & (module->process_pixels)))
+    module->process_pixels = NULL;
+  if(!g_module_symbol(module->module, "process_pixels_prepare", (gpointer) & (module->process_pixels_prepare)))
+    module->process_pixels_prepare = NULL;
+
   if(!darktable.opencl->inited
      || !g_module_symbol(module->module, "process_cl", (gpointer) & (module->process_cl)))
     module->process_cl = NULL;
@@ -428,6 +433,8 @@ int dt_iop_load_module_by_so(dt_iop_module_t *module, dt_iop_module_so_t *so, dt
   module->process_tiling = so->process_tiling;
   module->process_plain = so->process_plain;
   module->process_sse2 = so->process_sse2;
+  module->process_pixels = so->process_pixels;
+  module->process_pixels_prepare = so->process_pixels_prepare;
   module->process_cl = so->process_cl;
   module->process_tiling_cl = so->process_tiling_cl;
   module->distort_transform = so->distort_transform;
@@ -91,7 +91,9 @@ typedef enum dt_iop_flags_t
   IOP_FLAGS_PREVIEW_NON_OPENCL
   = 1 << 8, // Preview pixelpipe of this module must not run on GPU but always on CPU
   IOP_FLAGS_NO_HISTORY_STACK = 1 << 9, // This iop will never show up in the history stack
-  IOP_FLAGS_NO_MASKS = 1 << 10         // The module doesn't support masks (used with SUPPORT_BLENDING)
+  IOP_FLAGS_NO_MASKS = 1 << 10,        // The module doesn't support masks (used with SUPPORT_BLENDING)
+  IOP_FLAGS_PARALLEL_TILING = 1 << 11  // process() is reentrant and leaves pipe state alone, so tiles may be
+                                       // processed concurrently (only useful if process() is mostly serial)
 } dt_iop_flags_t;
 
 /** status of a module*/
@@ -221,6 +223,10 @@ typedef struct dt_iop_module_so_t
   void (*process_sse2)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                        const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
                        const struct dt_iop_roi_t *const roi_out);
+  void (*process_pixels)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                         const float *const in, float *const out, const size_t npixels);
+  void (*process_pixels_prepare)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                                 const struct dt_iop_roi_t *const roi_in, const struct dt_iop_roi_t *const roi_out);
   int (*process_cl)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
                     void *const o, const struct dt_iop_roi_t *const roi_in,
                     const struct dt_iop_roi_t *const roi_out);
@@ -427,6 +433,13 @@ typedef struct dt_iop_module_t
   void (*process_sse2)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                        const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
                        const struct dt_iop_roi_t *const roi_out);
+  /** optional pixelwise variant of process() on float4 pixels, may be run fused with neighbouring pixelwise
+   *  modules. only for modules which come after demosaic. */
+  void (*process_pixels)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                         const float *const in, float *const out, const size_t npixels);
+  /** optional setup called once before each fused pass over process_pixels(). */
+  void (*process_pixels_prepare)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                                 const struct dt_iop_roi_t *const roi_in, const struct dt_iop_roi_t *const roi_out);
   /** the opencl equivalent of process(). */
   int (*process_cl)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
                     void *const o, const struct dt_iop_roi_t *const roi_in,
@@ -253,6 +253,19 @@ int dt_masks_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt
                       float **buffer, int *width, int *height, int *posx, int *posy);
 int dt_masks_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
                           const dt_iop_roi_t *roi, float *buffer);
+/** cache of rasterised masks and distorted point sets of the darkroom pipes, one per develop. entries are keyed
+ * by the form's points, the distortions of the pipe up to the module and the region of interest. */
+struct dt_masks_cache_t *dt_masks_cache_init(void);
+void dt_masks_cache_cleanup(struct dt_masks_cache_t *cache);
+/** key for the point set of a form distorted up to prio_max, 0 if it is not to be cached. flags tell which
+ * outputs and which variant the caller wants. */
+uint64_t dt_masks_points_hash(dt_develop_t *dev, dt_dev_pixelpipe_t *pipe, dt_masks_form_t *form, int prio_max,
+                              int flags);
+/** get returns copies of the cached point sets, to be freed by the caller */
+int dt_masks_points_cache_get(dt_develop_t *dev, uint64_t hash, float **points, int *points_count, float **border,
+                              int *border_count, float **payload, int *payload_count);
+void dt_masks_points_cache_put(dt_develop_t *dev, uint64_t hash, const float *points, int points_count,
+                               const float *border, int border_count, const float *payload, int payload_count);
 int dt_masks_group_render(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
                           float **buffer, int *roi, float scale);
 int dt_masks_group_render_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
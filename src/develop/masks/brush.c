@@ -536,10 +536,10 @@ static inline int _brush_cyclic_cursor(int n, int nb)
 
 /** get all points of the brush and the border */
 /** this takes care of gaps and iop distortions */
-static int _brush_get_points_border(dt_develop_t *dev, dt_masks_form_t *form, int prio_max,
-                                    dt_dev_pixelpipe_t *pipe, float **points, int *points_count,
-                                    float **border, int *border_count, float **payload, int *payload_count,
-                                    int source)
+static int _brush_get_points_border_uncached(dt_develop_t *dev, dt_masks_form_t *form, int prio_max,
+                                             dt_dev_pixelpipe_t *pipe, float **points, int *points_count,
+                                             float **border, int *border_count, float **payload, int *payload_count,
+                                             int source)
 {
   double start2 = dt_get_wtime();
 
@@ -872,6 +872,24 @@ static int _brush_get_points_border(dt_develop_t *dev, dt_masks_form_t *form, in
   return 0;
 }
 
+// distorted point sets are cached for the darkroom pipes, see dt_masks_points_hash()
+static int _brush_get_points_border(dt_develop_t *dev, dt_masks_form_t *form, int prio_max,
+                                    dt_dev_pixelpipe_t *pipe, float **points, int *points_count,
+                                    float **border, int *border_count, float **payload, int *payload_count,
+                                    int source)
+{
+  const uint64_t hash = dt_masks_points_hash(dev, pipe, form, prio_max,
+                                             (border ? 1 : 0) | (payload ? 2 : 0) | (source ? 4 : 0));
+  if(dt_masks_points_cache_get(dev, hash, points, points_count, border, border_count, payload, payload_count))
+    return 1;
+  if(!_brush_get_points_border_uncached(dev, form, prio_max, pipe, points, points_count, border, border_count, payload,
+                                        payload_count, source))
+    return 0;
+  dt_masks_points_cache_put(dev, hash, *points, *points_count, border ? *border : NULL,
+                            border ? *border_count : 0, payload ? *payload : NULL, payload ? *payload_count : 0);
+  return 1;
+}
+
 /** get the distance between point (x,y) and the brush */
 static void dt_brush_get_distance(float x, int y, float as, dt_masks_form_gui_t *gui, int index,
                                   int corner_count, int *inside, int *inside_border, int *near,
@@ -2612,32 +2630,28 @@ static int dt_brush_get_area(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pi
   return 1;
 }
 
-/** we write a falloff segment */
-static void _brush_falloff(float **buffer, int *p0, int *p1, int posx, int posy, int bw, float hardness,
-                           float density)
+/** collect the falloff seeds of the brush: every stroke point with its border distance, hardness and density */
+static dt_masks_raster_seed_t *_brush_falloff_seeds(const float *points, const float *border, const float *payload,
+                                                    const int start, const int border_count, const float offx,
+                                                    const float offy, int *seeds_count)
 {
-  // segment length
-  const int l = sqrt((p1[0] - p0[0]) * (p1[0] - p0[0]) + (p1[1] - p0[1]) * (p1[1] - p0[1])) + 1;
-  const int solid = (int)l * hardness;
-  const int soft = l - solid;
-
-  const float lx = p1[0] - p0[0];
-  const float ly = p1[1] - p0[1];
-
-  for(int i = 0; i < l; i++)
-  {
-    // position
-    const int x = (int)((float)i * lx / (float)l) + p0[0] - posx;
-    const int y = (int)((float)i * ly / (float)l) + p0[1] - posy;
-    const float op = density * ((i <= solid) ? 1.0f : 1.0 - (float)(i - solid) / (float)soft);
-    (*buffer)[y * bw + x] = fmaxf((*buffer)[y * bw + x], op);
-    if(x > 0)
-      (*buffer)[y * bw + x - 1]
-          = fmaxf((*buffer)[y * bw + x - 1], op); // this one is to avoid gap due to int rounding
-    if(y > 0)
-      (*buffer)[(y - 1) * bw + x]
-          = fmaxf((*buffer)[(y - 1) * bw + x], op); // this one is to avoid gap due to int rounding
-  }
+  *seeds_count = 0;
+  if(border_count <= start) return NULL;
+  dt_masks_raster_seed_t *seeds = malloc(sizeof(dt_masks_raster_seed_t) * (border_count - start));
+  if(seeds == NULL) return NULL;
+
+  for(int i = start; i < border_count; i++)
+  {
+    const float dx = border[i * 2] - points[i * 2];
+    const float dy = border[i * 2 + 1] - points[i * 2 + 1];
+    dt_masks_raster_seed_t *seed = seeds + (*seeds_count)++;
+    seed->x = points[i * 2] + offx;
+    seed->y = points[i * 2 + 1] + offy;
+    seed->feather = fmaxf(1.0f, sqrtf(dx * dx + dy * dy));
+    seed->hardness = payload[i * 2];
+    seed->density = payload[i * 2 + 1];
+  }
+  return seeds;
 }
 
 static int dt_brush_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
@@ -2703,22 +2717,24 @@ static int dt_brush_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pi
   *buffer = calloc((size_t)(*width) * (*height), sizeof(float));
 
   // now we fill the falloff
-  int p0[2], p1[2];
-
-  for(int i = nb_corner * 3; i < border_count; i++)
-  {
-    p0[0] = points[i * 2];
-    p0[1] = points[i * 2 + 1];
-    p1[0] = border[i * 2];
-    p1[1] = border[i * 2 + 1];
-
-    _brush_falloff(buffer, p0, p1, *posx, *posy, *width, payload[i * 2], payload[i * 2 + 1]);
-  }
+  int seeds_count = 0;
+  dt_masks_raster_seed_t *seeds = _brush_falloff_seeds(points, border, payload, nb_corner * 3, border_count,
+                                                       -(*posx), -(*posy), &seeds_count);
+  const int falloff_ok
+      = *buffer != NULL && _masks_raster_falloff(*buffer, *width, *height, seeds, seeds_count);
 
+  free(seeds);
   free(points);
   free(border);
   free(payload);
 
+  if(!falloff_ok)
+  {
+    free(*buffer);
+    *buffer = NULL;
+    return 0;
+  }
+
   if(darktable.unmuted & DT_DEBUG_PERF)
     dt_print(DT_DEBUG_MASKS, "[masks %s] brush fill buffer took %0.04f sec\n", form->name,
              dt_get_wtime() - start);
@@ -2726,49 +2742,6 @@ static int dt_brush_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pi
   return 1;
 }
 
-/** we write a falloff segment respecting limits of buffer */
-static inline void _brush_falloff_roi(float *buffer, int *p0, int *p1, int bw, int bh, float hardness,
-                                      float density)
-{
-  // segment length (increase by 1 to avoid division-by-zero special case handling)
-  const int l = sqrt((p1[0] - p0[0]) * (p1[0] - p0[0]) + (p1[1] - p0[1]) * (p1[1] - p0[1])) + 1;
-  const int solid = hardness * l;
-
-  const float lx = (float)(p1[0] - p0[0]) / (float)l;
-  const float ly = (float)(p1[1] - p0[1]) / (float)l;
-
-  const int dx = lx <= 0 ? -1 : 1;
-  const int dy = ly <= 0 ? -1 : 1;
-  const int dpx = dx;
-  const int dpy = dy * bw;
-
-  float fx = p0[0];
-  float fy = p0[1];
-
-  float op = density;
-  float dop = density / (float)(l - solid);
-
-  for(int i = 0; i < l; i++)
-  {
-    const int x = fx;
-    const int y = fy;
-
-    fx += lx;
-    fy += ly;
-    if(i > solid) op -= dop;
-
-    if(x < 0 || x >= bw || y < 0 || y >= bh) continue;
-
-    float *buf = buffer + (size_t)y * bw + x;
-
-    *buf = fmaxf(*buf, op);
-    if(x + dx >= 0 && x + dx < bw)
-      buf[dpx] = fmaxf(buf[dpx], op); // this one is to avoid gaps due to int rounding
-    if(y + dy >= 0 && y + dy < bh)
-      buf[dpy] = fmaxf(buf[dpy], op); // this one is to avoid gaps due to int rounding
-  }
-}
-
 static int dt_brush_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece,
                                  dt_masks_form_t *form, const dt_iop_roi_t *roi, float *buffer)
 {
@@ -2861,26 +2834,19 @@ static int dt_brush_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
     return 1;
   }
 
-  // now we fill the falloff
-  int p0[2], p1[2];
-  for(int i = nb_corner * 3; i < border_count; i++)
-  {
-    p0[0] = points[i * 2];
-    p0[1] = points[i * 2 + 1];
-    p1[0] = border[i * 2];
-    p1[1] = border[i * 2 + 1];
-
-    if(MAX(p0[0], p1[0]) < 0 || MIN(p0[0], p1[0]) >= width || MAX(p0[1], p1[1]) < 0
-       || MIN(p0[1], p1[1]) >= height)
-      continue;
-
-    _brush_falloff_roi(buffer, p0, p1, width, height, payload[i * 2], payload[i * 2 + 1]);
-  }
+  // now we fill the falloff, seeds outside of the roi are taken care of by the rasteriser
+  int seeds_count = 0;
+  dt_masks_raster_seed_t *seeds
+      = _brush_falloff_seeds(points, border, payload, nb_corner * 3, border_count, 0.0f, 0.0f, &seeds_count);
+  const int falloff_ok = _masks_raster_falloff(buffer, width, height, seeds, seeds_count);
 
+  free(seeds);
   free(points);
   free(border);
   free(payload);
 
+  if(!falloff_ok) return 0;
+
   if(darktable.unmuted & DT_DEBUG_PERF)
     dt_print(DT_DEBUG_MASKS, "[masks %s] brush fill buffer took %0.04f sec\n", form->name,
              dt_get_wtime() - start);
@@ -28,6 +28,7 @@
 #pragma GCC diagnostic ignored "-Wshadow"
 
 // clang-format off
+#include "develop/masks/raster.c"
 #include "develop/masks/circle.c"
 #include "develop/masks/path.c"
 #include "develop/masks/brush.c"
@@ -637,8 +638,263 @@ int dt_masks_get_source_area(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pi
   return 0;
 }
 
-int dt_masks_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
-                      float **buffer, int *width, int *height, int *posx, int *posy)
+// the cache of rasterised masks and distorted point sets. a handful of large entries, so a plain array with
+// lru replacement does.
+#define DT_MASKS_CACHE_ENTRIES 64
+
+typedef enum dt_masks_cache_kind_t
+{
+  DT_MASKS_CACHE_POINTS = 1,
+  DT_MASKS_CACHE_MASK = 2,
+  DT_MASKS_CACHE_MASK_ROI = 3
+} dt_masks_cache_kind_t;
+
+typedef struct dt_masks_cache_entry_t
+{
+  uint64_t hash;
+  uint64_t used; // lru clock, 0 for free entries
+  size_t size;   // bytes held
+  // raster and its area
+  float *buffer;
+  int width, height, posx, posy;
+  // distorted point sets
+  float *points, *border, *payload;
+  int points_count, border_count, payload_count;
+} dt_masks_cache_entry_t;
+
+typedef struct dt_masks_cache_t
+{
+  dt_pthread_mutex_t lock;
+  uint64_t clock;
+  size_t size, max_size;
+  dt_masks_cache_entry_t entry[DT_MASKS_CACHE_ENTRIES];
+} dt_masks_cache_t;
+
+dt_masks_cache_t *dt_masks_cache_init(void)
+{
+  dt_masks_cache_t *cache = (dt_masks_cache_t *)calloc(1, sizeof(dt_masks_cache_t));
+  if(!cache) return NULL;
+  dt_pthread_mutex_init(&cache->lock, NULL);
+  // a quarter of the host memory limit, at least 64MB
+  const size_t limit = MAX(dt_conf_get_int("host_memory_limit"), 0);
+  cache->max_size = (limit ? MAX(limit / 4, (size_t)64) : (size_t)256) << 20;
+  return cache;
+}
+
+static void _masks_cache_entry_free(dt_masks_cache_t *cache, dt_masks_cache_entry_t *e)
+{
+  free(e->buffer);
+  free(e->points);
+  free(e->border);
+  free(e->payload);
+  cache->size -= e->size;
+  memset(e, 0, sizeof(dt_masks_cache_entry_t));
+}
+
+void dt_masks_cache_cleanup(dt_masks_cache_t *cache)
+{
+  if(!cache) return;
+  for(int k = 0; k < DT_MASKS_CACHE_ENTRIES; k++) _masks_cache_entry_free(cache, &cache->entry[k]);
+  dt_pthread_mutex_destroy(&cache->lock);
+  free(cache);
+}
+
+// call with the lock held
+static dt_masks_cache_entry_t *_masks_cache_find(dt_masks_cache_t *cache, const uint64_t hash)
+{
+  for(int k = 0; k < DT_MASKS_CACHE_ENTRIES; k++)
+  {
+    dt_masks_cache_entry_t *e = &cache->entry[k];
+    if(e->used && e->hash == hash)
+    {
+      e->used = ++cache->clock;
+      return e;
+    }
+  }
+  return NULL;
+}
+
+// evicts least recently used entries until size bytes fit, and returns an empty entry for hash. NULL if the
+// data is too large to be cached. call with the lock held.
+static dt_masks_cache_entry_t *_masks_cache_reserve(dt_masks_cache_t *cache, const uint64_t hash, const size_t size)
+{
+  if(size > cache->max_size / 4) return NULL;
+  dt_masks_cache_entry_t *e = _masks_cache_find(cache, hash);
+  if(e) _masks_cache_entry_free(cache, e);
+  while(TRUE)
+  {
+    dt_masks_cache_entry_t *empty = NULL, *lru = NULL;
+    for(int k = 0; k < DT_MASKS_CACHE_ENTRIES; k++)
+    {
+      e = &cache->entry[k];
+      if(!e->used)
+      {
+        if(!empty) empty = e;
+      }
+      else if(!lru || e->used < lru->used)
+        lru = e;
+    }
+    if(empty && cache->size + size <= cache->max_size)
+    {
+      empty->hash = hash;
+      empty->used = ++cache->clock;
+      empty->size = size;
+      cache->size += size;
+      return empty;
+    }
+    if(!lru) return NULL;
+    _masks_cache_entry_free(cache, lru);
+  }
+}
+
+static inline uint64_t _masks_hash(uint64_t hash, const void *data, const size_t size)
+{
+  const unsigned char *str = (const unsigned char *)data;
+  for(size_t i = 0; i < size; i++) hash = ((hash << 5) + hash) ^ str[i];
+  return hash;
+}
+
+static size_t _masks_point_size(const dt_masks_form_t *form)
+{
+  if(form->type & DT_MASKS_CIRCLE) return sizeof(dt_masks_point_circle_t);
+  if(form->type & DT_MASKS_PATH) return sizeof(dt_masks_point_path_t);
+  if(form->type & DT_MASKS_GRADIENT) return sizeof(dt_masks_point_gradient_t);
+  if(form->type & DT_MASKS_ELLIPSE) return sizeof(dt_masks_point_ellipse_t);
+  if(form->type & DT_MASKS_BRUSH) return sizeof(dt_masks_point_brush_t);
+  // groups only combine cached shapes
+  return 0;
+}
+
+// hash of everything the distorted form depends on: its points, the input of the pipe and the distorting
+// modules up to prio_max. 0 for forms and pipes which are not cached.
+static uint64_t _masks_form_hash(dt_develop_t *dev, dt_dev_pixelpipe_t *pipe, dt_masks_form_t *form,
+                                 const int prio_max, const int kind)
+{
+  if(!dev || !dev->masks_cache || !(pipe->type & (DT_DEV_PIXELPIPE_FULL | DT_DEV_PIXELPIPE_PREVIEW))) return 0;
+  const size_t point_size = _masks_point_size(form);
+  if(!point_size) return 0;
+
+  uint64_t hash = 5381;
+  hash = _masks_hash(hash, &kind, sizeof(kind));
+  hash = _masks_hash(hash, &form->type, sizeof(form->type));
+  hash = _masks_hash(hash, &form->version, sizeof(form->version));
+  hash = _masks_hash(hash, form->source, sizeof(form->source));
+  for(GList *l = form->points; l; l = g_list_next(l)) hash = _masks_hash(hash, l->data, point_size);
+
+  hash = _masks_hash(hash, &pipe->image.id, sizeof(pipe->image.id));
+  hash = _masks_hash(hash, &pipe->iwidth, sizeof(pipe->iwidth));
+  hash = _masks_hash(hash, &pipe->iheight, sizeof(pipe->iheight));
+  hash = _masks_hash(hash, &pipe->iscale, sizeof(pipe->iscale));
+
+  // same modules as dt_dev_distort_backtransform_plus() walks
+  dt_pthread_mutex_lock(&dev->history_mutex);
+  GList *pieces = pipe->nodes;
+  for(GList *modules = pipe->iop; modules && pieces; modules = g_list_next(modules), pieces = g_list_next(pieces))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(piece->enabled && module->priority <= prio_max && (module->operation_tags() & IOP_TAG_DISTORT)
+       && !(dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags()))
+    {
+      hash = _masks_hash(hash, &module->priority, sizeof(module->priority));
+      hash = _masks_hash(hash, &piece->hash, sizeof(piece->hash));
+    }
+  }
+  dt_pthread_mutex_unlock(&dev->history_mutex);
+
+  return hash ? hash : 1;
+}
+
+uint64_t dt_masks_points_hash(dt_develop_t *dev, dt_dev_pixelpipe_t *pipe, dt_masks_form_t *form, int prio_max,
+                              int flags)
+{
+  const uint64_t hash = _masks_form_hash(dev, pipe, form, prio_max, DT_MASKS_CACHE_POINTS);
+  return hash ? _masks_hash(hash, &flags, sizeof(flags)) : 0;
+}
+
+static float *_masks_copy_points(const float *points, const int count)
+{
+  float *copy = malloc(sizeof(float) * 2 * MAX(count, 1));
+  if(copy && count) memcpy(copy, points, sizeof(float) * 2 * count);
+  return copy;
+}
+
+int dt_masks_points_cache_get(dt_develop_t *dev, uint64_t hash, float **points, int *points_count, float **border,
+                              int *border_count, float **payload, int *payload_count)
+{
+  if(!hash) return 0;
+  dt_masks_cache_t *cache = dev->masks_cache;
+  dt_pthread_mutex_lock(&cache->lock);
+  dt_masks_cache_entry_t *e = _masks_cache_find(cache, hash);
+  if(!e || !e->points)
+  {
+    dt_pthread_mutex_unlock(&cache->lock);
+    return 0;
+  }
+  *points = _masks_copy_points(e->points, e->points_count);
+  *points_count = e->points_count;
+  if(border)
+  {
+    *border = _masks_copy_points(e->border, e->border_count);
+    *border_count = e->border_count;
+  }
+  if(payload)
+  {
+    *payload = _masks_copy_points(e->payload, e->payload_count);
+    *payload_count = e->payload_count;
+  }
+  dt_pthread_mutex_unlock(&cache->lock);
+
+  if(!*points || (border && !*border) || (payload && !*payload))
+  {
+    free(*points);
+    *points = NULL;
+    if(border)
+    {
+      free(*border);
+      *border = NULL;
+    }
+    if(payload)
+    {
+      free(*payload);
+      *payload = NULL;
+    }
+    return 0;
+  }
+  return 1;
+}
+
+void dt_masks_points_cache_put(dt_develop_t *dev, uint64_t hash, const float *points, int points_count,
+                               const float *border, int border_count, const float *payload, int payload_count)
+{
+  if(!hash) return;
+  if(!border) border_count = 0;
+  if(!payload) payload_count = 0;
+  dt_masks_cache_t *cache = dev->masks_cache;
+  dt_pthread_mutex_lock(&cache->lock);
+  dt_masks_cache_entry_t *e = _masks_cache_reserve(
+      cache, hash, sizeof(float) * 2 * ((size_t)points_count + border_count + payload_count));
+  if(e)
+  {
+    e->points = _masks_copy_points(points, points_count);
+    e->points_count = points_count;
+    if(border)
+    {
+      e->border = _masks_copy_points(border, border_count);
+      e->border_count = border_count;
+    }
+    if(payload)
+    {
+      e->payload = _masks_copy_points(payload, payload_count);
+      e->payload_count = payload_count;
+    }
+    if(!e->points || (border && !e->border) || (payload && !e->payload)) _masks_cache_entry_free(cache, e);
+  }
+  dt_pthread_mutex_unlock(&cache->lock);
+}
+
+static int _masks_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
+                           float **buffer, int *width, int *height, int *posx, int *posy)
 {
   if(form->type & DT_MASKS_CIRCLE)
   {
@@ -667,8 +923,8 @@ int dt_masks_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt
   return 0;
 }
 
-int dt_masks_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
-                          const dt_iop_roi_t *roi, float *buffer)
+static int _masks_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
+                               const dt_iop_roi_t *roi, float *buffer)
 {
   if(form->type & DT_MASKS_CIRCLE)
   {
@@ -697,6 +953,94 @@ int dt_masks_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece
   return 0;
 }
 
+int dt_masks_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
+                      float **buffer, int *width, int *height, int *posx, int *posy)
+{
+  const uint64_t hash
+      = module ? _masks_form_hash(module->dev, piece->pipe, form, module->priority, DT_MASKS_CACHE_MASK) : 0;
+  if(hash)
+  {
+    dt_masks_cache_t *cache = module->dev->masks_cache;
+    dt_pthread_mutex_lock(&cache->lock);
+    dt_masks_cache_entry_t *e = _masks_cache_find(cache, hash);
+    if(e && e->buffer)
+    {
+      const size_t size = sizeof(float) * e->width * e->height;
+      *buffer = malloc(size);
+      if(*buffer)
+      {
+        memcpy(*buffer, e->buffer, size);
+        *width = e->width;
+        *height = e->height;
+        *posx = e->posx;
+        *posy = e->posy;
+        dt_pthread_mutex_unlock(&cache->lock);
+        return 1;
+      }
+    }
+    dt_pthread_mutex_unlock(&cache->lock);
+  }
+
+  const int ok = _masks_get_mask(module, piece, form, buffer, width, height, posx, posy);
+
+  if(ok && hash && *buffer)
+  {
+    const size_t size = sizeof(float) * *width * *height;
+    dt_masks_cache_t *cache = module->dev->masks_cache;
+    dt_pthread_mutex_lock(&cache->lock);
+    dt_masks_cache_entry_t *e = _masks_cache_reserve(cache, hash, size);
+    if(e && (e->buffer = malloc(size)))
+    {
+      memcpy(e->buffer, *buffer, size);
+      e->width = *width;
+      e->height = *height;
+      e->posx = *posx;
+      e->posy = *posy;
+    }
+    else if(e)
+      _masks_cache_entry_free(cache, e);
+    dt_pthread_mutex_unlock(&cache->lock);
+  }
+  return ok;
+}
+
+int dt_masks_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
+                          const dt_iop_roi_t *roi, float *buffer)
+{
+  uint64_t hash
+      = module ? _masks_form_hash(module->dev, piece->pipe, form, module->priority, DT_MASKS_CACHE_MASK_ROI) : 0;
+  if(hash) hash = _masks_hash(hash, roi, sizeof(dt_iop_roi_t));
+  const size_t size = sizeof(float) * roi->width * roi->height;
+  if(hash)
+  {
+    dt_masks_cache_t *cache = module->dev->masks_cache;
+    dt_pthread_mutex_lock(&cache->lock);
+    dt_masks_cache_entry_t *e = _masks_cache_find(cache, hash);
+    if(e && e->buffer)
+    {
+      memcpy(buffer, e->buffer, size);
+      dt_pthread_mutex_unlock(&cache->lock);
+      return 1;
+    }
+    dt_pthread_mutex_unlock(&cache->lock);
+  }
+
+  const int ok = _masks_get_mask_roi(module, piece, form, roi, buffer);
+
+  if(ok && hash)
+  {
+    dt_masks_cache_t *cache = module->dev->masks_cache;
+    dt_pthread_mutex_lock(&cache->lock);
+    dt_masks_cache_entry_t *e = _masks_cache_reserve(cache, hash, size);
+    if(e && (e->buffer = malloc(size)))
+      memcpy(e->buffer, buffer, size);
+    else if(e)
+      _masks_cache_entry_free(cache, e);
+    dt_pthread_mutex_unlock(&cache->lock);
+  }
+  return ok;
+}
+
 int dt_masks_version(void)
 {
   return DEVELOP_MASKS_VERSION;
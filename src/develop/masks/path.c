@@ -499,9 +499,9 @@ static int _path_find_self_intersection(dt_masks_dynbuf_t *inter, int nb_corners
 
 /** get all points of the path and the border */
 /** this take care of gaps and self-intersection and iop distortions */
-static int _path_get_points_border(dt_develop_t *dev, dt_masks_form_t *form, int prio_max,
-                                   dt_dev_pixelpipe_t *pipe, float **points, int *points_count,
-                                   float **border, int *border_count, int source)
+static int _path_get_points_border_uncached(dt_develop_t *dev, dt_masks_form_t *form, int prio_max,
+                                            dt_dev_pixelpipe_t *pipe, float **points, int *points_count,
+                                            float **border, int *border_count, int source)
 {
   double start2 = dt_get_wtime();
 
@@ -752,6 +752,20 @@ static int _path_get_points_border(dt_develop_t *dev, dt_masks_form_t *form, int
   return 0;
 }
 
+// distorted point sets are cached for the darkroom pipes, see dt_masks_points_hash()
+static int _path_get_points_border(dt_develop_t *dev, dt_masks_form_t *form, int prio_max,
+                                   dt_dev_pixelpipe_t *pipe, float **points, int *points_count,
+                                   float **border, int *border_count, int source)
+{
+  const uint64_t hash = dt_masks_points_hash(dev, pipe, form, prio_max, (border ? 1 : 0) | (source ? 4 : 0));
+  if(dt_masks_points_cache_get(dev, hash, points, points_count, border, border_count, NULL, NULL)) return 1;
+  if(!_path_get_points_border_uncached(dev, form, prio_max, pipe, points, points_count, border, border_count, source))
+    return 0;
+  dt_masks_points_cache_put(dev, hash, *points, *points_count, border ? *border : NULL, border ? *border_count : 0,
+                            NULL, 0);
+  return 1;
+}
+
 /** get the distance between point (x,y) and the path */
 static void dt_path_get_distance(float x, int y, float as, dt_masks_form_gui_t *gui, int index,
                                  int corner_count, int *inside, int *inside_border, int *near,
@@ -2129,29 +2143,46 @@ static int dt_path_get_area(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pie
   return 1;
 }
 
-/** we write a falloff segment */
-static void _path_falloff(float **buffer, int *p0, int *p1, int posx, int posy, int bw)
+/** collect the falloff seeds of the path: every path point with the distance to its border point */
+static dt_masks_raster_seed_t *_path_falloff_seeds(const float *points, const float *border, const int start,
+                                                   const int border_count, const float offx, const float offy,
+                                                   int *seeds_count)
 {
-  // segment length
-  int l = sqrt((p1[0] - p0[0]) * (p1[0] - p0[0]) + (p1[1] - p0[1]) * (p1[1] - p0[1])) + 1;
-
-  float lx = p1[0] - p0[0];
-  float ly = p1[1] - p0[1];
-
-  for(int i = 0; i < l; i++)
-  {
-    // position
-    int x = (int)((float)i * lx / (float)l) + p0[0] - posx;
-    int y = (int)((float)i * ly / (float)l) + p0[1] - posy;
-    float op = 1.0 - (float)i / (float)l;
-    (*buffer)[y * bw + x] = fmaxf((*buffer)[y * bw + x], op);
-    if(x > 0)
-      (*buffer)[y * bw + x - 1]
-          = fmaxf((*buffer)[y * bw + x - 1], op); // this one is to avoid gap due to int rounding
-    if(y > 0)
-      (*buffer)[(y - 1) * bw + x]
-          = fmaxf((*buffer)[(y - 1) * bw + x], op); // this one is to avoid gap due to int rounding
+  *seeds_count = 0;
+  if(border_count <= start) return NULL;
+  dt_masks_raster_seed_t *seeds = malloc(sizeof(dt_masks_raster_seed_t) * (border_count - start));
+  if(seeds == NULL) return NULL;
+
+  int next = 0;
+  for(int i = start; i < border_count; i++)
+  {
+    float p1[2];
+    if(next > 0)
+      p1[0] = border[next * 2], p1[1] = border[next * 2 + 1];
+    else
+      p1[0] = border[i * 2], p1[1] = border[i * 2 + 1];
+
+    // now we check p1 value to know if we have to skip a part
+    if(next == i) next = 0;
+    while(isnan(p1[0]))
+    {
+      if(isnan(p1[1]))
+        next = i - 1;
+      else
+        next = p1[1];
+      p1[0] = border[next * 2], p1[1] = border[next * 2 + 1];
+    }
+
+    dt_masks_raster_seed_t *seed = seeds + (*seeds_count)++;
+    seed->x = points[i * 2] + offx;
+    seed->y = points[i * 2 + 1] + offy;
+    // at least one pixel, like the falloff segments we used to draw
+    seed->feather = fmaxf(1.0f, sqrtf((p1[0] - points[i * 2]) * (p1[0] - points[i * 2])
+                                      + (p1[1] - points[i * 2 + 1]) * (p1[1] - points[i * 2 + 1])));
+    seed->hardness = 0.0f;
+    seed->density = 1.0f;
   }
+  return seeds;
 }
 
 static int dt_path_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
@@ -2220,125 +2251,23 @@ static int dt_path_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pie
   start2 = dt_get_wtime();
 
   // we allocate the buffer
-  const size_t bufsize = (size_t)(*width) * (*height);
-  *buffer = calloc(bufsize, sizeof(float));
-
-  // we write all the point around the path into the buffer
-  int nbp = border_count;
-  int lastx, lasty, lasty2;
-  if(nbp > 2)
+  *buffer = calloc((size_t)wb * hb, sizeof(float));
+  if(*buffer == NULL)
   {
-    lastx = (int)points[(nbp - 1) * 2];
-    lasty = (int)points[(nbp - 1) * 2 + 1];
-    lasty2 = (int)points[(nbp - 2) * 2 + 1];
-
-    int just_change_dir = 0;
-    for(int ii = nb_corner * 3; ii < 2 * nbp - nb_corner * 3; ii++)
-    {
-      // we are writing more than 1 loop in the case the dir in y change
-      // exactly at start/end point
-      int i = ii;
-      if(ii >= nbp) i = (ii - nb_corner * 3) % (nbp - nb_corner * 3) + nb_corner * 3;
-      int xx = (int)points[i * 2];
-      int yy = (int)points[i * 2 + 1];
-
-      // we don't store the point if it has the same y value as the last one
-      if(yy == lasty) continue;
-
-      // we want to be sure that there is no y jump
-      if(yy - lasty > 1 || yy - lasty < -1)
-      {
-        if(yy < lasty)
-        {
-          for(int j = yy + 1; j < lasty; j++)
-          {
-            const int nx = (j - yy) * (lastx - xx) / (float)(lasty - yy) + xx;
-            const size_t idx = (size_t)(j - (*posy)) * (*width) + nx - (*posx);
-            assert(idx < bufsize);
-            (*buffer)[idx] = 1.0f;
-          }
-          lasty2 = yy + 2;
-          lasty = yy + 1;
-        }
-        else
-        {
-          for(int j = lasty + 1; j < yy; j++)
-          {
-            const int nx = (j - lasty) * (xx - lastx) / (float)(yy - lasty) + lastx;
-            const size_t idx = (size_t)(j - (*posy)) * (*width) + nx - (*posx);
-            assert(idx < bufsize);
-            (*buffer)[idx] = 1.0f;
-          }
-          lasty2 = yy - 2;
-          lasty = yy - 1;
-        }
-      }
-      // if we change the direction of the path (in y), then we add a extra point
-      if((lasty - lasty2) * (lasty - yy) > 0)
-      {
-        const size_t idx = (size_t)(lasty - (*posy)) * (*width) + lastx + 1 - (*posx);
-        assert(idx < bufsize);
-        (*buffer)[idx] = 1.0f;
-        just_change_dir = 1;
-      }
-      // we add the point
-      if(just_change_dir && ii == i)
-      {
-        // if we have changed the direction, we have to be careful that point can be at the same place
-        // as the previous one, especially on sharp edges
-        const size_t idx = (size_t)(yy - (*posy)) * (*width) + xx - (*posx);
-        assert(idx < bufsize);
-        float v = (*buffer)[idx];
-        if(v > 0.0)
-        {
-          if(xx - (*posx) > 0)
-          {
-            const size_t idx = (size_t)(yy - (*posy)) * (*width) + xx - 1 - (*posx);
-            assert(idx < bufsize);
-            (*buffer)[idx] = 1.0f;
-          }
-          else if(xx - (*posx) < (*width) - 1)
-          {
-            const size_t idx = (size_t)(yy - (*posy)) * (*width) + xx + 1 - (*posx);
-            assert(idx < bufsize);
-            (*buffer)[idx] = 1.0f;
-          }
-        }
-        else
-        {
-          const size_t idx = (size_t)(yy - (*posy)) * (*width) + xx - (*posx);
-          assert(idx < bufsize);
-          (*buffer)[idx] = 1.0f;
-          just_change_dir = 0;
-        }
-      }
-      else
-      {
-        const size_t idx = (size_t)(yy - (*posy)) * (*width) + xx - (*posx);
-        assert(idx < bufsize);
-        (*buffer)[idx] = 1.0f;
-      }
-      // we change last values
-      lasty2 = lasty;
-      lasty = yy;
-      lastx = xx;
-      if(ii != i) break;
-    }
+    free(points);
+    free(border);
+    return 0;
   }
-  if(darktable.unmuted & DT_DEBUG_PERF)
-    dt_print(DT_DEBUG_MASKS, "[masks %s] path_fill draw path took %0.04f sec\n", form->name,
-             dt_get_wtime() - start2);
-  start2 = dt_get_wtime();
 
-  for(int yy = 0; yy < hb; yy++)
+  // we fill the inside plain
+  if(!_masks_raster_polygon(*buffer, wb, hb, points + nb_corner * 6, points_count - nb_corner * 3, -(*posx),
+                            -(*posy)))
   {
-    int state = 0;
-    for(int xx = 0; xx < wb; xx++)
-    {
-      float v = (*buffer)[yy * wb + xx];
-      if(v == 1.0f) state = !state;
-      if(state) (*buffer)[yy * wb + xx] = 1.0f;
-    }
+    free(*buffer);
+    *buffer = NULL;
+    free(points);
+    free(border);
+    return 0;
   }
 
   if(darktable.unmuted & DT_DEBUG_PERF)
@@ -2347,37 +2276,18 @@ static int dt_path_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pie
   start2 = dt_get_wtime();
 
   // now we fill the falloff
-  int p0[2], p1[2];
-  float pf1[2];
-  int last0[2] = { -100, -100 }, last1[2] = { -100, -100 };
-  nbp = 0;
-  int next = 0;
-  for(int i = nb_corner * 3; i < border_count; i++)
-  {
-    p0[0] = points[i * 2], p0[1] = points[i * 2 + 1];
-    if(next > 0)
-      p1[0] = pf1[0] = border[next * 2], p1[1] = pf1[1] = border[next * 2 + 1];
-    else
-      p1[0] = pf1[0] = border[i * 2], p1[1] = pf1[1] = border[i * 2 + 1];
-
-    // now we check p1 value to know if we have to skip a part
-    if(next == i) next = 0;
-    while(isnan(pf1[0]))
-    {
-      if(isnan(pf1[1]))
-        next = i - 1;
-      else
-        next = p1[1];
-      p1[0] = pf1[0] = border[next * 2], p1[1] = pf1[1] = border[next * 2 + 1];
-    }
-
-    // and we draw the falloff
-    if(last0[0] != p0[0] || last0[1] != p0[1] || last1[0] != p1[0] || last1[1] != p1[1])
-    {
-      _path_falloff(buffer, p0, p1, *posx, *posy, *width);
-      last0[0] = p0[0], last0[1] = p0[1];
-      last1[0] = p1[0], last1[1] = p1[1];
-    }
+  int seeds_count = 0;
+  dt_masks_raster_seed_t *seeds
+      = _path_falloff_seeds(points, border, nb_corner * 3, border_count, -(*posx), -(*posy), &seeds_count);
+  const int falloff_ok = _masks_raster_falloff(*buffer, wb, hb, seeds, seeds_count);
+  free(seeds);
+  if(!falloff_ok)
+  {
+    free(*buffer);
+    *buffer = NULL;
+    free(points);
+    free(border);
+    return 0;
   }
 
   if(darktable.unmuted & DT_DEBUG_PERF)
@@ -2395,175 +2305,6 @@ static int dt_path_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pie
 }
 
 
-/** crop path to roi given by xmin, xmax, ymin, ymax. path segments outside of roi are replaced by
-    nodes lying on roi borders. */
-static int _path_crop_to_roi(float *path, const int point_count, float xmin, float xmax, float ymin,
-                             float ymax)
-{
-  int point_start = -1;
-  int l = -1, r = -1;
-
-
-  // first try to find a node clearly inside roi
-  for(int k = 0; k < point_count; k++)
-  {
-    float x = path[2 * k];
-    float y = path[2 * k + 1];
-
-    if(x >= xmin + 1 && y >= ymin + 1 && x <= xmax - 1 && y <= ymax - 1)
-    {
-      point_start = k;
-      break;
-    }
-  }
-
-  // printf("crop to xmin %f, xmax %f, ymin %f, ymax %f - start %d (%f, %f)\n", xmin, xmax, ymin, ymax,
-  // point_start, path[2*point_start], path[2*point_start+1]);
-
-  if(point_start < 0) return 0; // no point means roi lies completely within path
-
-  // find the crossing points with xmin and replace segment by nodes on border
-  for(int k = 0; k < point_count; k++)
-  {
-    int kk = (k + point_start) % point_count;
-
-    if(l < 0 && path[2 * kk] < xmin) l = k;       // where we leave roi
-    if(l >= 0 && path[2 * kk] >= xmin) r = k - 1; // where we re-enter roi
-
-    // replace that segment
-    if(l >= 0 && r >= 0)
-    {
-      int count = r - l + 1;
-      int ll = (l - 1 + point_start) % point_count;
-      int rr = (r + 1 + point_start) % point_count;
-      float delta_y = (count == 1) ? 0 : (path[2 * rr + 1] - path[2 * ll + 1]) / (count - 1);
-      float start_y = path[2 * ll + 1];
-
-      for(int n = 0; n < count; n++)
-      {
-        int nn = (n + l + point_start) % point_count;
-        path[2 * nn] = xmin;
-        path[2 * nn + 1] = start_y + n * delta_y;
-      }
-
-      l = r = -1;
-    }
-  }
-
-  // find the crossing points with xmax and replace segment by nodes on border
-  for(int k = 0; k < point_count; k++)
-  {
-    int kk = (k + point_start) % point_count;
-
-    if(l < 0 && path[2 * kk] > xmax) l = k;       // where we leave roi
-    if(l >= 0 && path[2 * kk] <= xmax) r = k - 1; // where we re-enter roi
-
-    // replace that segment
-    if(l >= 0 && r >= 0)
-    {
-      int count = r - l + 1;
-      int ll = (l - 1 + point_start) % point_count;
-      int rr = (r + 1 + point_start) % point_count;
-      float delta_y = (count == 1) ? 0 : (path[2 * rr + 1] - path[2 * ll + 1]) / (count - 1);
-      float start_y = path[2 * ll + 1];
-
-      for(int n = 0; n < count; n++)
-      {
-        int nn = (n + l + point_start) % point_count;
-        path[2 * nn] = xmax;
-        path[2 * nn + 1] = start_y + n * delta_y;
-      }
-
-      l = r = -1;
-    }
-  }
-
-  // find the crossing points with ymin and replace segment by nodes on border
-  for(int k = 0; k < point_count; k++)
-  {
-    int kk = (k + point_start) % point_count;
-
-    if(l < 0 && path[2 * kk + 1] < ymin) l = k;       // where we leave roi
-    if(l >= 0 && path[2 * kk + 1] >= ymin) r = k - 1; // where we re-enter roi
-
-    // replace that segment
-    if(l >= 0 && r >= 0)
-    {
-      int count = r - l + 1;
-      int ll = (l - 1 + point_start) % point_count;
-      int rr = (r + 1 + point_start) % point_count;
-      float delta_x = (count == 1) ? 0 : (path[2 * rr] - path[2 * ll]) / (count - 1);
-      float start_x = path[2 * ll];
-
-      for(int n = 0; n < count; n++)
-      {
-        int nn = (n + l + point_start) % point_count;
-        path[2 * nn] = start_x + n * delta_x;
-        path[2 * nn + 1] = ymin;
-      }
-
-      l = r = -1;
-    }
-  }
-
-  // find the crossing points with ymax and replace segment by nodes on border
-  for(int k = 0; k < point_count; k++)
-  {
-    int kk = (k + point_start) % point_count;
-
-    if(l < 0 && path[2 * kk + 1] > ymax) l = k;       // where we leave roi
-    if(l >= 0 && path[2 * kk + 1] <= ymax) r = k - 1; // where we re-enter roi
-
-    // replace that segment
-    if(l >= 0 && r >= 0)
-    {
-      int count = r - l + 1;
-      int ll = (l - 1 + point_start) % point_count;
-      int rr = (r + 1 + point_start) % point_count;
-      float delta_x = (count == 1) ? 0 : (path[2 * rr] - path[2 * ll]) / (count - 1);
-      float start_x = path[2 * ll];
-
-      for(int n = 0; n < count; n++)
-      {
-        int nn = (n + l + point_start) % point_count;
-        path[2 * nn] = start_x + n * delta_x;
-        path[2 * nn + 1] = ymax;
-      }
-
-      l = r = -1;
-    }
-  }
-  return 1;
-}
-
-/** we write a falloff segment respecting limits of buffer */
-static void _path_falloff_roi(float *buffer, int *p0, int *p1, int bw, int bh)
-{
-  // segment length
-  const int l = sqrt((p1[0] - p0[0]) * (p1[0] - p0[0]) + (p1[1] - p0[1]) * (p1[1] - p0[1])) + 1;
-
-  const float lx = p1[0] - p0[0];
-  const float ly = p1[1] - p0[1];
-
-  const int dx = lx < 0 ? -1 : 1;
-  const int dy = ly < 0 ? -1 : 1;
-  const int dpy = dy * bw;
-
-  for(int i = 0; i < l; i++)
-  {
-    // position
-    const int x = (int)((float)i * lx / (float)l) + p0[0];
-    const int y = (int)((float)i * ly / (float)l) + p0[1];
-    const float op = 1.0 - (float)i / (float)l;
-    float *buf = buffer + (size_t)y * bw + x;
-    if(x >= 0 && x < bw && y >= 0 && y < bh) buf[0] = fmaxf(buf[0], op);
-    if(x + dx >= 0 && x + dx < bw && y >= 0 && y < bh)
-      buf[dx] = fmaxf(buf[dx], op); // this one is to avoid gap due to int rounding
-    if(x >= 0 && x < bw && y + dy >= 0 && y + dy < bh)
-      buf[dpy] = fmaxf(buf[dpy], op); // this one is to avoid gap due to int rounding
-  }
-}
-
 static int dt_path_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
                                 const dt_iop_roi_t *roi, float *buffer)
 {
@@ -2587,7 +2328,7 @@ static int dt_path_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
   int path_encircles_roi = 0;
 
   // we get buffers for all points
-  float *points = NULL, *border = NULL, *cpoints = NULL;
+  float *points = NULL, *border = NULL;
   int points_count, border_count;
   if(!_path_get_points_border(module->dev, form, module->priority, piece->pipe, &points, &points_count,
                               &border, &border_count, 0) || (points_count <= 2))
@@ -2692,189 +2433,42 @@ static int dt_path_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
     return 1;
   }
 
-  // now get min/max values
-  float xmin, xmax, ymin, ymax;
-  xmin = ymin = FLT_MAX;
-  xmax = ymax = FLT_MIN;
-  for(int i = nb_corner * 3; i < points_count; i++)
-  {
-    float xx = points[i * 2];
-    float yy = points[i * 2 + 1];
-    xmin = fminf(xx, xmin);
-    xmax = fmaxf(xx, xmax);
-    ymin = fminf(yy, ymin);
-    ymax = fmaxf(yy, ymax);
-  }
-  for(int i = nb_corner * 3; i < border_count; i++)
+  // deal with path if it does not lie outside of roi
+  if(path_encircles_roi)
   {
-    float xx = border[i * 2];
-    float yy = border[i * 2 + 1];
-    if(isnan(xx))
-    {
-      if(isnan(yy)) break; // that means we have to skip the end of the border path
-      i = yy - 1;
-      continue;
-    }
-    xmin = fminf(xx, xmin);
-    xmax = fmaxf(xx, xmax);
-    ymin = fminf(yy, ymin);
-    ymax = fmaxf(yy, ymax);
+    // roi lies completely within path
+    for(size_t k = 0; k < (size_t)width * height; k++) buffer[k] = 1.0f;
   }
-
-  if(darktable.unmuted & DT_DEBUG_PERF)
-    dt_print(DT_DEBUG_MASKS, "[masks %s] path_fill min max took %0.04f sec\n", form->name,
-             dt_get_wtime() - start2);
-  start2 = dt_get_wtime();
-
-  // deal with path if it does not lie outside of roi
-  if(path_in_roi)
+  else if(path_in_roi)
   {
-    // second copy of path which we can modify when cropping to roi
-    cpoints = malloc(2 * points_count * sizeof(float));
-    if(cpoints == NULL)
+    // the rasteriser clips the path to the roi by itself
+    if(!_masks_raster_polygon(buffer, width, height, points + nb_corner * 6, points_count - nb_corner * 3,
+                              0.0f, 0.0f))
     {
       free(points);
       free(border);
       return 0;
     }
-    memcpy(cpoints, points, 2 * points_count * sizeof(float));
-
-    // now we clip cpoints to roi -> catch special case when roi lies completely within path.
-    // dirty trick: we allow path to extend one pixel beyond height-1. this avoids need of special handling
-    // of the last roi line in the following edge-flag polygon fill algorithm.
-    int crop_success = _path_crop_to_roi(cpoints + 2 * (nb_corner * 3), points_count - nb_corner * 3, 0,
-                                         width - 1, 0, height);
-    path_encircles_roi = path_encircles_roi || !crop_success;
 
     if(darktable.unmuted & DT_DEBUG_PERF)
-      dt_print(DT_DEBUG_MASKS, "[masks %s] path_fill crop to roi took %0.04f sec\n", form->name,
+      dt_print(DT_DEBUG_MASKS, "[masks %s] path_fill fill plain took %0.04f sec\n", form->name,
                dt_get_wtime() - start2);
     start2 = dt_get_wtime();
-
-    if(path_encircles_roi)
-    {
-      // roi lies completely within path
-      for(size_t k = 0; k < (size_t)width * height; k++) buffer[k] = 1.0f;
-    }
-    else
-    {
-      // all other cases
-
-      // edge-flag polygon fill: we write all the point around the path into the buffer
-      float xlast = cpoints[(points_count - 1) * 2];
-      float ylast = cpoints[(points_count - 1) * 2 + 1];
-
-      for(int i = nb_corner * 3; i < points_count; i++)
-      {
-        float xstart = xlast;
-        float ystart = ylast;
-
-        float xend = xlast = cpoints[i * 2];
-        float yend = ylast = cpoints[i * 2 + 1];
-
-        if(ystart > yend)
-        {
-          float tmp;
-          tmp = ystart, ystart = yend, yend = tmp;
-          tmp = xstart, xstart = xend, xend = tmp;
-        }
-
-        const float m = (xstart - xend) / (ystart - yend); // we don't need special handling of ystart==yend
-                                                           // as following loop will take care
-
-        for(int yy = (int)ceilf(ystart); (float)yy < yend;
-            yy++) // this would normally never touch the last roi line => see comment further above
-        {
-          const float xcross = xstart + m * (yy - ystart);
-
-          int xx = floorf(xcross);
-          if((float)xx + 0.5f <= xcross) xx++;
-
-          if(xx < 0 || xx >= width || yy < 0 || yy >= height)
-            continue; // sanity check just to be on the safe side
-
-          size_t index = (size_t)yy * width + xx;
-
-          buffer[index] = 1.0f - buffer[index];
-        }
-      }
-
-      if(darktable.unmuted & DT_DEBUG_PERF)
-        dt_print(DT_DEBUG_MASKS, "[masks %s] path_fill draw path took %0.04f sec\n", form->name,
-                 dt_get_wtime() - start2);
-      start2 = dt_get_wtime();
-
-      // we fill the inside plain
-      // we don't need to deal with parts of shape outside of roi
-      xmin = fmaxf(xmin, 0);
-      xmax = fminf(xmax, width - 1);
-      ymin = fmaxf(ymin, 0);
-      ymax = fminf(ymax, height - 1);
-
-      for(int yy = ymin; yy <= ymax; yy++)
-      {
-        int state = 0;
-        for(int xx = xmin; xx <= xmax; xx++)
-        {
-          size_t index = (size_t)yy * width + xx;
-          float v = buffer[index];
-          if(v > 0.5f) state = !state;
-          if(state) buffer[index] = 1.0f;
-        }
-      }
-
-      if(darktable.unmuted & DT_DEBUG_PERF)
-        dt_print(DT_DEBUG_MASKS, "[masks %s] path_fill fill plain took %0.04f sec\n", form->name,
-                 dt_get_wtime() - start2);
-      start2 = dt_get_wtime();
-    }
-    free(cpoints);
   }
 
   // deal with feather if it does not lie outside of roi
   if(!path_encircles_roi)
   {
-    int p0[2], p1[2];
-    float pf1[2];
-    int last0[2] = { -100, -100 };
-    int last1[2] = { -100, -100 };
-    int next = 0;
-    for(int i = nb_corner * 3; i < border_count; i++)
+    int seeds_count = 0;
+    dt_masks_raster_seed_t *seeds
+        = _path_falloff_seeds(points, border, nb_corner * 3, border_count, 0.0f, 0.0f, &seeds_count);
+    const int falloff_ok = _masks_raster_falloff(buffer, width, height, seeds, seeds_count);
+    free(seeds);
+    if(!falloff_ok)
     {
-      p0[0] = floorf(points[i * 2] + 0.5f);
-      p0[1] = ceilf(points[i * 2 + 1]);
-      if(next > 0)
-      {
-        p1[0] = pf1[0] = border[next * 2];
-        p1[1] = pf1[1] = border[next * 2 + 1];
-      }
-      else
-      {
-        p1[0] = pf1[0] = border[i * 2];
-        p1[1] = pf1[1] = border[i * 2 + 1];
-      }
-
-      // now we check p1 value to know if we have to skip a part
-      if(next == i) next = 0;
-      while(isnan(pf1[0]))
-      {
-        if(isnan(pf1[1]))
-          next = i - 1;
-        else
-          next = p1[1];
-        p1[0] = pf1[0] = border[next * 2];
-        p1[1] = pf1[1] = border[next * 2 + 1];
-      }
-
-      // and we draw the falloff
-      if(last0[0] != p0[0] || last0[1] != p0[1] || last1[0] != p1[0] || last1[1] != p1[1])
-      {
-        _path_falloff_roi(buffer, p0, p1, width, height);
-        last0[0] = p0[0];
-        last0[1] = p0[1];
-        last1[0] = p1[0];
-        last1[1] = p1[1];
-      }
+      free(points);
+      free(border);
+      return 0;
     }
 
     if(darktable.unmuted & DT_DEBUG_PERF)
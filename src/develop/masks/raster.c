@@ -0,0 +1,368 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "common/darktable.h"
+#include "develop/masks.h"
+
+/** shared rasteriser for the forms built from a dense outline (path, brush).
+ *
+ *  the plain part of a form is filled by accumulating the signed area each outline segment covers
+ *  in every pixel and integrating that along the scanline, which gives analytic anti-aliased
+ *  coverage. the falloff is computed from the euclidean distance of every pixel to the nearest
+ *  outline point, found with a separable distance transform that also keeps track of which point
+ *  is the nearest one, so that point's feather, hardness and density are used.
+ *
+ *  both run in bands of scanlines, one band per thread. pixel centers lie on integer coordinates. */
+
+#define DT_MASKS_RASTER_BAND 32
+#define DT_MASKS_RASTER_COLUMNS 256
+#define DT_MASKS_RASTER_INF 1e30f
+
+typedef struct dt_masks_raster_seed_t
+{
+  float x, y;     // position in buffer coordinates
+  float feather;  // length of the falloff
+  float hardness; // fraction of the feather with full opacity
+  float density;  // opacity
+} dt_masks_raster_seed_t;
+
+/** accumulate the signed area of one segment into the band [ylo, yhi) of the accumulation buffer */
+static inline void _masks_raster_line(float *acc, const int stride, const int ylo, const int yhi,
+                                      const float width, float x0, float y0, float x1, float y1)
+{
+  if(y0 == y1) return;
+  float dir = 1.0f;
+  if(y0 > y1)
+  {
+    float tmp;
+    tmp = x0, x0 = x1, x1 = tmp;
+    tmp = y0, y0 = y1, y1 = tmp;
+    dir = -1.0f;
+  }
+  if(y1 <= ylo || y0 >= yhi) return;
+
+  const float dxdy = (x1 - x0) / (y1 - y0);
+  const float ys = fmaxf(y0, ylo);
+  const float ye = fminf(y1, yhi);
+  float x = x0 + (ys - y0) * dxdy;
+
+  for(int y = (int)floorf(ys); y < ye; y++)
+  {
+    const float dy = fminf(y + 1, ye) - fmaxf(y, ys);
+    const float xnext = x + dxdy * dy;
+    const float d = dy * dir;
+    float *a = acc + (size_t)(y - ylo) * stride;
+
+    // everything left of the buffer folds into the first column, everything right of it is never read
+    float xa = CLAMPS(x, 0.0f, width);
+    float xb = CLAMPS(xnext, 0.0f, width);
+    if(xa > xb)
+    {
+      const float tmp = xa;
+      xa = xb, xb = tmp;
+    }
+    const float xafloor = floorf(xa);
+    const int xai = xafloor;
+    const int xbi = ceilf(xb);
+
+    if(xbi <= xai + 1)
+    {
+      // the segment stays within one pixel
+      const float xmf = 0.5f * (xa + xb) - xafloor;
+      a[xai] += d - d * xmf;
+      a[xai + 1] += d * xmf;
+    }
+    else
+    {
+      const float s = 1.0f / (xb - xa);
+      const float xaf = xa - xafloor;
+      const float a0 = 0.5f * s * (1.0f - xaf) * (1.0f - xaf);
+      const float xbf = xb - xbi + 1.0f;
+      const float am = 0.5f * s * xbf * xbf;
+      a[xai] += d * a0;
+      if(xbi == xai + 2)
+        a[xai + 1] += d * (1.0f - a0 - am);
+      else
+      {
+        const float a1 = s * (1.5f - xaf);
+        a[xai + 1] += d * (a1 - a0);
+        for(int xi = xai + 2; xi < xbi - 1; xi++) a[xi] += d * s;
+        const float a2 = a1 + (xbi - xai - 3) * s;
+        a[xbi - 1] += d * (1.0f - a2 - am);
+      }
+      a[xbi] += d * am;
+    }
+    x = xnext;
+  }
+}
+
+/** fill the closed polygon given by count points into the buffer, translated by (offx, offy).
+    the buffer is overwritten with the coverage of the polygon. */
+static int _masks_raster_polygon(float *buffer, const int width, const int height, const float *points,
+                                 const int count, const float offx, const float offy)
+{
+  if(count < 3) return 1;
+
+  const int bands = (height + DT_MASKS_RASTER_BAND - 1) / DT_MASKS_RASTER_BAND;
+  const int stride = width + 2;
+  // the rasteriser works on pixel areas, so we move the pixel centers to integer coordinates
+  const float ox = offx + 0.5f;
+  const float oy = offy + 0.5f;
+  int err = 0;
+
+#ifdef _OPENMP
+#if !defined(__SUNOS__) && !defined(__NetBSD__)
+#pragma omp parallel for schedule(dynamic) default(none) shared(buffer, points, err)
+#else
+#pragma omp parallel for schedule(dynamic) shared(buffer, points, err)
+#endif
+#endif
+  for(int b = 0; b < bands; b++)
+  {
+    const int ylo = b * DT_MASKS_RASTER_BAND;
+    const int yhi = MIN(ylo + DT_MASKS_RASTER_BAND, height);
+    float *acc = calloc((size_t)(yhi - ylo) * stride, sizeof(float));
+    if(acc == NULL)
+    {
+      err = 1;
+      continue;
+    }
+
+    float xl = points[(count - 1) * 2] + ox;
+    float yl = points[(count - 1) * 2 + 1] + oy;
+    for(int i = 0; i < count; i++)
+    {
+      const float xx = points[i * 2] + ox;
+      const float yy = points[i * 2 + 1] + oy;
+      _masks_raster_line(acc, stride, ylo, yhi, width, xl, yl, xx, yy);
+      xl = xx;
+      yl = yy;
+    }
+
+    // integrate along the scanlines
+    for(int y = ylo; y < yhi; y++)
+    {
+      const float *a = acc + (size_t)(y - ylo) * stride;
+      float *out = buffer + (size_t)y * width;
+      float sum = 0.0f;
+      for(int x = 0; x < width; x++)
+      {
+        sum += a[x];
+        out[x] = fminf(fabsf(sum), 1.0f);
+      }
+    }
+    free(acc);
+  }
+
+  return !err;
+}
+
+static inline float _masks_raster_seed_opacity(const dt_masks_raster_seed_t *seed, const float d)
+{
+  const float solid = seed->hardness * seed->feather;
+  if(d <= solid) return seed->density;
+  return seed->density * fmaxf(0.0f, 1.0f - (d - solid) / (seed->feather - solid));
+}
+
+/** write the falloff of all seeds into the buffer, keeping the max with its current content.
+    seeds may lie outside of the buffer, their falloff is still taken into account. */
+static int _masks_raster_falloff(float *buffer, const int width, const int height,
+                                 const dt_masks_raster_seed_t *seeds, const int count)
+{
+  if(count <= 0) return 1;
+
+  // the distance transform has to see all the seeds which can reach into the buffer
+  float sxmin = FLT_MAX, sxmax = -FLT_MAX, symin = FLT_MAX, symax = -FLT_MAX, fmax = 0.0f;
+  for(int i = 0; i < count; i++)
+  {
+    sxmin = fminf(sxmin, seeds[i].x);
+    sxmax = fmaxf(sxmax, seeds[i].x);
+    symin = fminf(symin, seeds[i].y);
+    symax = fmaxf(symax, seeds[i].y);
+    fmax = fmaxf(fmax, seeds[i].feather);
+  }
+  const int pad = ceilf(fmax) + 1;
+  if(sxmax < -pad || symax < -pad || sxmin >= width + pad || symin >= height + pad) return 1;
+
+  const int gx0 = MIN(0, MAX(-pad, (int)floorf(sxmin)));
+  const int gx1 = MAX(width, MIN(width + pad, (int)ceilf(sxmax) + 1));
+  const int gy0 = MIN(0, MAX(-pad, (int)floorf(symin)));
+  const int gy1 = MAX(height, MIN(height + pad, (int)ceilf(symax) + 1));
+  const int gw = gx1 - gx0;
+  const int gh = gy1 - gy0;
+
+  // nearest seed and its distance, first along the columns, then in the plane
+  int *feat = dt_alloc_align(64, sizeof(int) * gw * gh);
+  float *dist = dt_alloc_align(64, sizeof(float) * gw * gh);
+  if(feat == NULL || dist == NULL)
+  {
+    dt_free_align(feat);
+    dt_free_align(dist);
+    return 0;
+  }
+  memset(feat, 0xff, sizeof(int) * gw * gh);
+
+  for(int i = 0; i < count; i++)
+  {
+    const int xx = (int)floorf(seeds[i].x + 0.5f) - gx0;
+    const int yy = (int)floorf(seeds[i].y + 0.5f) - gy0;
+    if(xx < 0 || xx >= gw || yy < 0 || yy >= gh) continue;
+    int *f = feat + (size_t)yy * gw + xx;
+    if(*f < 0 || seeds[*f].feather < seeds[i].feather) *f = i;
+  }
+
+  // vertical pass, on blocks of adjacent columns so the inner loops run on contiguous memory
+  const int blocks = (gw + DT_MASKS_RASTER_COLUMNS - 1) / DT_MASKS_RASTER_COLUMNS;
+#ifdef _OPENMP
+#if !defined(__SUNOS__) && !defined(__NetBSD__)
+#pragma omp parallel for schedule(static) default(none) shared(feat, dist)
+#else
+#pragma omp parallel for schedule(static) shared(feat, dist)
+#endif
+#endif
+  for(int b = 0; b < blocks; b++)
+  {
+    const int x0 = b * DT_MASKS_RASTER_COLUMNS;
+    const int x1 = MIN(x0 + DT_MASKS_RASTER_COLUMNS, gw);
+    for(int x = x0; x < x1; x++) dist[x] = feat[x] >= 0 ? 0.0f : DT_MASKS_RASTER_INF;
+    for(int y = 1; y < gh; y++)
+    {
+      int *f = feat + (size_t)y * gw;
+      float *d = dist + (size_t)y * gw;
+      const int *fu = f - gw;
+      const float *du = d - gw;
+#if defined(_OPENMP) && defined(OPENMP_SIMD_)
+#pragma omp SIMD()
+#endif
+      for(int x = x0; x < x1; x++)
+      {
+        const int seed = f[x] >= 0;
+        d[x] = seed ? 0.0f : du[x] + 1.0f;
+        f[x] = seed ? f[x] : fu[x];
+      }
+    }
+    for(int y = gh - 2; y >= 0; y--)
+    {
+      int *f = feat + (size_t)y * gw;
+      float *d = dist + (size_t)y * gw;
+      const int *fd = f + gw;
+      const float *dd = d + gw;
+#if defined(_OPENMP) && defined(OPENMP_SIMD_)
+#pragma omp SIMD()
+#endif
+      for(int x = x0; x < x1; x++)
+      {
+        const int closer = dd[x] + 1.0f < d[x];
+        d[x] = closer ? dd[x] + 1.0f : d[x];
+        f[x] = closer ? fd[x] : f[x];
+      }
+    }
+  }
+
+  // horizontal pass: lower envelope of the column distance parabolas, for the rows of the buffer only
+  const int bands = (height + DT_MASKS_RASTER_BAND - 1) / DT_MASKS_RASTER_BAND;
+  int err = 0;
+#ifdef _OPENMP
+#if !defined(__SUNOS__) && !defined(__NetBSD__)
+#pragma omp parallel for schedule(static) default(none) shared(buffer, seeds, feat, dist, err)
+#else
+#pragma omp parallel for schedule(static) shared(buffer, seeds, feat, dist, err)
+#endif
+#endif
+  for(int b = 0; b < bands; b++)
+  {
+    int *v = malloc(sizeof(int) * gw);
+    float *z = malloc(sizeof(float) * (gw + 1));
+    int *nearest = malloc(sizeof(int) * width);
+    if(v == NULL || z == NULL || nearest == NULL)
+    {
+      free(v);
+      free(z);
+      free(nearest);
+      err = 1;
+      continue;
+    }
+
+    const int yhi = MIN((b + 1) * DT_MASKS_RASTER_BAND, height);
+    for(int y = b * DT_MASKS_RASTER_BAND; y < yhi; y++)
+    {
+      const int *f = feat + (size_t)(y - gy0) * gw;
+      const float *d = dist + (size_t)(y - gy0) * gw;
+
+      int k = -1;
+      for(int q = 0; q < gw; q++)
+      {
+        if(f[q] < 0) continue;
+        if(k < 0)
+        {
+          k = 0;
+          v[0] = q;
+          z[0] = -DT_MASKS_RASTER_INF;
+          z[1] = DT_MASKS_RASTER_INF;
+          continue;
+        }
+        float s;
+        for(;;)
+        {
+          // intersection of the parabolas rooted at p and q, written to stay accurate for large coordinates
+          const int p = v[k];
+          s = (d[q] * d[q] - d[p] * d[p]) / (2.0f * (q - p)) + 0.5f * (q + p);
+          if(s > z[k]) break;
+          k--;
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = DT_MASKS_RASTER_INF;
+      }
+      if(k < 0) continue;
+
+      for(int x = 0, j = 0; x < width; x++)
+      {
+        while(z[j + 1] < x - gx0) j++;
+        nearest[x] = f[v[j]];
+      }
+
+      float *out = buffer + (size_t)y * width;
+#if defined(_OPENMP) && defined(OPENMP_SIMD_)
+#pragma omp SIMD()
+#endif
+      for(int x = 0; x < width; x++)
+      {
+        const dt_masks_raster_seed_t *seed = seeds + nearest[x];
+        const float dx = x - seed->x;
+        const float dy = y - seed->y;
+        out[x] = fmaxf(out[x], _masks_raster_seed_opacity(seed, sqrtf(dx * dx + dy * dy)));
+      }
+    }
+    free(v);
+    free(z);
+    free(nearest);
+  }
+
+  dt_free_align(feat);
+  dt_free_align(dist);
+  return !err;
+}
+
+#undef DT_MASKS_RASTER_BAND
+#undef DT_MASKS_RASTER_COLUMNS
+#undef DT_MASKS_RASTER_INF
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
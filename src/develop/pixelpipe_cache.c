@@ -192,6 +192,21 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
     return 0;
 }
 
+int dt_dev_pixelpipe_cache_reserve(dt_dev_pixelpipe_cache_t *cache, const size_t size)
+{
+  for(int k = 0; k < cache->entries; k++)
+  {
+    if(cache->size[k] >= size) continue;
+    dt_free_align(cache->data[k]);
+    cache->data[k] = (void *)dt_alloc_align(16, size);
+    cache->size[k] = cache->data[k] ? size : 0;
+    cache->hash[k] = -1;
+    if(!cache->data[k]) return 0;
+    ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
+  }
+  return 1;
+}
+
 void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache)
 {
   for(int k = 0; k < cache->entries; k++)
@@ -225,6 +240,18 @@ void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *da
   }
 }
 
+void dt_dev_pixelpipe_cache_invalidate_hash(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash)
+{
+  for(int k = 0; k < cache->entries; k++)
+  {
+    if(cache->hash[k] == hash)
+    {
+      cache->hash[k] = -1;
+      ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
+    }
+  }
+}
+
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache)
 {
   for(int k = 0; k < cache->entries; k++)
@@ -69,6 +69,10 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
 /** test availability of a cache line without destroying another, if it is not found. */
 int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash);
 
+/** grows all cache lines to at least size bytes now instead of on demand, to find out early whether the
+ *  memory is there. returns 0 if an allocation failed, the cache stays usable. */
+int dt_dev_pixelpipe_cache_reserve(dt_dev_pixelpipe_cache_t *cache, const size_t size);
+
 /** invalidates all cachelines. */
 void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache);
 
@@ -78,6 +82,9 @@ void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data
 /** mark the given cache line pointer as invalid. */
 void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data);
 
+/** mark the cache line with the given hash as invalid, if there is one. */
+void dt_dev_pixelpipe_cache_invalidate_hash(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash);
+
 /** print out cache lines/hashes (debug). */
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache);
 
@@ -138,13 +138,25 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->processed_height = pipe->backbuf_height = pipe->iheight = 0;
   pipe->nodes = NULL;
   pipe->backbuf_size = size;
+  pipe->backbuf_scale = 1.0f;
   if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size)) return 0;
+  // coarse passes are small, allocate on demand
+  if(!dt_dev_pixelpipe_cache_init(&(pipe->coarse_cache), 2, 0))
+  {
+    dt_dev_pixelpipe_cache_cleanup(&(pipe->cache));
+    return 0;
+  }
   pipe->cache_obsolete = 0;
   pipe->backbuf = NULL;
   pipe->processing = 0;
   pipe->shutdown = 0;
   pipe->opencl_error = 0;
+  pipe->half_buffers = 0;
+  pipe->half_scratch[0] = pipe->half_scratch[1] = NULL;
+  pipe->half_scratch_size[0] = pipe->half_scratch_size[1] = 0;
   pipe->tiling = 0;
+  pipe->runs_completed = pipe->runs_cancelled = 0;
+  pipe->completed_time = pipe->cancelled_time = 0.0;
   pipe->mask_display = DT_DEV_PIXELPIPE_DISPLAY_NONE;
   pipe->input_timestamp = 0;
   pipe->levels = IMAGEIO_RGB | IMAGEIO_INT8;
@@ -187,6 +199,13 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
   dt_dev_pixelpipe_cleanup_nodes(pipe);
   // so now it's safe to clean up cache:
   dt_dev_pixelpipe_cache_cleanup(&(pipe->cache));
+  dt_dev_pixelpipe_cache_cleanup(&(pipe->coarse_cache));
+  for(int k = 0; k < 2; k++)
+  {
+    dt_free_align(pipe->half_scratch[k]);
+    pipe->half_scratch[k] = NULL;
+    pipe->half_scratch_size[k] = 0;
+  }
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
   dt_pthread_mutex_destroy(&(pipe->backbuf_mutex));
   dt_pthread_mutex_destroy(&(pipe->busy_mutex));
@@ -595,9 +614,448 @@ error:
 
 
 // recursive helper for process:
+// number of pixels per block of a fused pass: 256k of float4, to stay in L2
+#define DT_PIXELPIPE_FUSED_BLOCK 16384
+// maximum number of modules fused into one pass
+#define DT_PIXELPIPE_FUSED_MAX 32
+
 static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
                                         void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
-                                        const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos)
+                                        const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos);
+
+// scratch buffer k of the pipe, grown on demand. only the thread processing the pipe uses these.
+static float *_pixelpipe_half_scratch(dt_dev_pixelpipe_t *pipe, const int k, const size_t size)
+{
+  if(pipe->half_scratch_size[k] < size)
+  {
+    dt_free_align(pipe->half_scratch[k]);
+    pipe->half_scratch[k] = dt_alloc_align(64, size);
+    pipe->half_scratch_size[k] = pipe->half_scratch[k] ? size : 0;
+  }
+  return pipe->half_scratch[k];
+}
+
+// half float cache lines are expanded to floats, unless the module reads half floats (see input_format()).
+// input_format has to be a copy, the one of the cache line stays as it is. returns 1 on error.
+static int _pixelpipe_expand_half(dt_dev_pixelpipe_t *pipe, dt_iop_module_t *module,
+                                  dt_dev_pixelpipe_iop_t *piece, void **input, dt_iop_buffer_dsc_t *input_format,
+                                  const dt_iop_roi_t *roi_in)
+{
+  if(input_format->datatype != TYPE_HALF) return 0;
+  dt_iop_buffer_dsc_t dsc = *input_format;
+  module->input_format(module, pipe, piece, &dsc);
+  if(dsc.datatype == TYPE_HALF) return 0;
+
+  const size_t n = (size_t)input_format->channels * roi_in->width * roi_in->height;
+  float *buf = _pixelpipe_half_scratch(pipe, 0, n * sizeof(float));
+  if(!buf) return 1;
+  dt_iop_buffer_half_to_float(buf, (const uint16_t *)*input, n);
+  *input = buf;
+  input_format->datatype = TYPE_FLOAT;
+  return 0;
+}
+
+// the raw stage, everything up to and including demosaic, of the full and the preview pipe only differ in
+// scale. whichever pipe gets there with the whole image in its roi offers its demosaic output, the other
+// one resamples that instead of running rawprepare, temperature, highlights, ... on its own input again.
+typedef struct dt_dev_raw_stage_t
+{
+  dt_pthread_mutex_t lock;
+  int32_t imgid;
+  // dt_dev_hash_plus() of the modules up to demosaic the buffer belongs to, 0 if there is none
+  uint64_t hash;
+  // whole image, scale relative to the full image
+  dt_iop_roi_t roi;
+  float *buf;
+  size_t size;
+  dt_iop_buffer_dsc_t dsc;
+  // the pipe computing the raw stage for pending_hash right now, and what it will offer
+  const dt_dev_pixelpipe_t *pending;
+  uint64_t pending_hash;
+  dt_iop_roi_t pending_roi;
+} dt_dev_raw_stage_t;
+
+dt_dev_raw_stage_t *dt_dev_raw_stage_init(void)
+{
+  dt_dev_raw_stage_t *stage = (dt_dev_raw_stage_t *)calloc(1, sizeof(dt_dev_raw_stage_t));
+  if(stage) dt_pthread_mutex_init(&stage->lock, NULL);
+  return stage;
+}
+
+void dt_dev_raw_stage_flush(dt_dev_raw_stage_t *stage)
+{
+  if(!stage) return;
+  dt_pthread_mutex_lock(&stage->lock);
+  dt_free_align(stage->buf);
+  stage->buf = NULL;
+  stage->size = 0;
+  stage->hash = 0;
+  dt_pthread_mutex_unlock(&stage->lock);
+}
+
+void dt_dev_raw_stage_cleanup(dt_dev_raw_stage_t *stage)
+{
+  if(!stage) return;
+  dt_free_align(stage->buf);
+  dt_pthread_mutex_destroy(&stage->lock);
+  free(stage);
+}
+
+// roi of the pipe in image space, the preview pipe works on a downscaled input
+static inline dt_iop_roi_t _raw_stage_roi(const dt_dev_pixelpipe_t *pipe, const dt_iop_roi_t *roi)
+{
+  dt_iop_roi_t r = *roi;
+  r.scale = roi->scale / pipe->iscale;
+  return r;
+}
+
+static inline int _raw_stage_is_whole(const dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi)
+{
+  return roi->x == 0 && roi->y == 0 && roi->width >= (int)(piece->buf_out.width * roi->scale) - 1
+         && roi->height >= (int)(piece->buf_out.height * roi->scale) - 1;
+}
+
+// can the whole image `have' be downsampled to `need'?
+static inline int _raw_stage_covers(const dt_iop_roi_t *have, const dt_iop_roi_t *need)
+{
+  if(have->scale < need->scale * 0.999f) return 0;
+  const float s = have->scale / need->scale;
+  // resampling clamps at the borders, a 1:1 copy doesn't
+  const float slack = s > 1.001f ? 1.0f : 0.0f;
+  return (need->x + need->width) * s <= have->width + slack
+         && (need->y + need->height) * s <= have->height + slack;
+}
+
+static int _raw_stage_shared(const dt_dev_pixelpipe_t *pipe, const dt_develop_t *dev,
+                             const dt_iop_module_t *module)
+{
+  // modules hidden by the focused one change the geometry of the raw stage
+  return dev->raw_stage && dev->gui_attached && (pipe == dev->pipe || pipe == dev->preview_pipe)
+         && !strcmp(module->op, "demosaic")
+         && !(dev->gui_module && dev->gui_module->operation_tags_filter());
+}
+
+// only host memory output can be offered, so a pipe going to run demosaic with opencl doesn't claim
+static int _raw_stage_on_cpu(const dt_dev_pixelpipe_t *pipe, const dt_iop_module_t *module,
+                             const dt_dev_pixelpipe_iop_t *piece)
+{
+#ifdef HAVE_OPENCL
+  if(dt_opencl_is_inited() && pipe->opencl_enabled && pipe->devid >= 0 && module->process_cl
+     && piece->process_cl_ready
+     && !((pipe->type == DT_DEV_PIXELPIPE_PREVIEW) && (module->flags() & IOP_FLAGS_PREVIEW_NON_OPENCL)))
+    return 0;
+#endif
+  return 1;
+}
+
+// fills the output of demosaic from the raw stage of the other pipe. the full pipe waits for one the
+// preview is computing, the preview never waits for the slower full pipe. returns 0 if the pipe has to do
+// it on its own, and claims the raw stage for it if it's the whole image and can be offered afterwards.
+static int _raw_stage_reuse(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_iop_module_t *module,
+                            dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_out, const uint64_t hash,
+                            const size_t bufsize, const int store_half, void **output,
+                            dt_iop_buffer_dsc_t **out_format)
+{
+  if(!_raw_stage_shared(pipe, dev, module)) return 0;
+  dt_dev_raw_stage_t *stage = dev->raw_stage;
+
+  const uint64_t raw_hash = dt_dev_hash_plus(dev, pipe, 0, module->priority);
+  const dt_iop_roi_t need = _raw_stage_roi(pipe, roi_out);
+  const int whole = _raw_stage_is_whole(piece, roi_out);
+  const int nloop = dt_conf_get_int("pixelpipe_synchronization_timeout");
+
+  dt_pthread_mutex_lock(&stage->lock);
+  for(int n = 0;; n++)
+  {
+    if(stage->buf && stage->imgid == pipe->image.id && stage->hash == raw_hash
+       && _raw_stage_covers(&stage->roi, &need))
+      break;
+
+    const int pending = pipe == dev->pipe && stage->pending == dev->preview_pipe
+                        && stage->pending_hash == raw_hash && _raw_stage_covers(&stage->pending_roi, &need);
+    if(!pending || n >= nloop || pipe->shutdown || dt_cancelled())
+    {
+      if(whole && _raw_stage_on_cpu(pipe, module, piece)
+         && (!stage->pending || stage->pending_hash != raw_hash || stage->pending_roi.scale < need.scale))
+      {
+        stage->pending = pipe;
+        stage->pending_hash = raw_hash;
+        stage->pending_roi = need;
+      }
+      dt_pthread_mutex_unlock(&stage->lock);
+      return 0;
+    }
+
+    dt_pthread_mutex_unlock(&stage->lock);
+    dt_iop_nap(5000);
+    dt_pthread_mutex_lock(&stage->lock);
+  }
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    dt_pthread_mutex_unlock(&stage->lock);
+    return 0;
+  }
+  **out_format = piece->dsc_out = pipe->dsc = stage->dsc;
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+  float *out = store_half ? _pixelpipe_half_scratch(pipe, 1, (size_t)4 * sizeof(float) * roi_out->width
+                                                                 * roi_out->height)
+                          : (float *)*output;
+  if(out)
+  {
+    // the shared buffer is the whole image, so only the scale is relative to it
+    const dt_iop_roi_t roi_in = { 0, 0, stage->roi.width, stage->roi.height, 1.0f };
+    dt_iop_roi_t roi = *roi_out;
+    roi.scale = need.scale / stage->roi.scale;
+    dt_iop_clip_and_zoom(out, stage->buf, &roi, &roi_in, roi.width, roi_in.width);
+    if(store_half)
+    {
+      dt_iop_buffer_float_to_half((uint16_t *)*output, out, (size_t)4 * roi_out->width * roi_out->height);
+      (*out_format)->datatype = TYPE_HALF;
+    }
+  }
+  else
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  dt_pthread_mutex_unlock(&stage->lock);
+
+  if(out)
+    dt_print(DT_DEBUG_DEV, "[dev_pixelpipe] [%s] raw stage resampled from the %s pipe\n",
+             _pipe_type_to_str(pipe->type), pipe == dev->pipe ? "preview" : "full");
+  return out != NULL;
+}
+
+// offers the demosaic output of the pipe holding the claim to the other one. output has to be floats on the
+// host.
+static void _raw_stage_publish(const dt_dev_pixelpipe_t *pipe, const dt_develop_t *dev,
+                               const dt_iop_module_t *module, const dt_iop_roi_t *roi_out,
+                               const float *output, const dt_iop_buffer_dsc_t *dsc)
+{
+  if(!_raw_stage_shared(pipe, dev, module)) return;
+  dt_dev_raw_stage_t *stage = dev->raw_stage;
+
+  dt_pthread_mutex_lock(&stage->lock);
+  if(stage->pending == pipe)
+  {
+    const size_t size = (size_t)4 * sizeof(float) * roi_out->width * roi_out->height;
+    if(stage->size < size)
+    {
+      dt_free_align(stage->buf);
+      stage->buf = dt_alloc_align(64, size);
+      stage->size = stage->buf ? size : 0;
+    }
+    if(stage->buf && output && dsc->channels == 4 && dsc->datatype == TYPE_FLOAT)
+    {
+      memcpy(stage->buf, output, size);
+      stage->imgid = pipe->image.id;
+      stage->hash = stage->pending_hash;
+      stage->roi = stage->pending_roi;
+      stage->dsc = *dsc;
+    }
+    stage->pending = NULL;
+  }
+  dt_pthread_mutex_unlock(&stage->lock);
+}
+
+// drops a claim on the raw stage which wasn't fulfilled, e.g. because demosaic ended up on the gpu
+static void _raw_stage_release(const dt_dev_pixelpipe_t *pipe, const dt_develop_t *dev)
+{
+  dt_dev_raw_stage_t *stage = dev->raw_stage;
+  if(!stage || !dev->gui_attached) return;
+  dt_pthread_mutex_lock(&stage->lock);
+  if(stage->pending == pipe) stage->pending = NULL;
+  dt_pthread_mutex_unlock(&stage->lock);
+}
+
+// can this piece be run through process_pixels() in a fused pass?
+// everything needing neighbourhood access, blending, histograms or color picking
+// goes the usual way. so do the darkroom pipes, which want all intermediate
+// buffers in the cache for interactive editing.
+static int pixelpipe_piece_is_pixelwise(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_iop_module_t *module,
+                                        dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_out)
+{
+  if(!module->process_pixels) return 0;
+  if(!(pipe->type & (DT_DEV_PIXELPIPE_EXPORT | DT_DEV_PIXELPIPE_THUMBNAIL))) return 0;
+  if(pipe->mask_display) return 0;
+#ifdef HAVE_OPENCL
+  if(dt_opencl_is_inited() && pipe->opencl_enabled && pipe->devid >= 0) return 0;
+#endif
+  const dt_develop_blend_params_t *const bp = (const dt_develop_blend_params_t *)piece->blendop_data;
+  if(bp && (bp->mask_mode & DEVELOP_MASK_ENABLED)) return 0;
+  if(piece->request_histogram & DT_REQUEST_ON) return 0;
+  if(dev->gui_attached && module->request_color_pick != DT_REQUEST_COLORPICK_OFF) return 0;
+
+  dt_iop_roi_t roi_in = *roi_out;
+  module->modify_roi_in(module, piece, roi_out, &roi_in);
+  return !memcmp(&roi_in, roi_out, sizeof(dt_iop_roi_t));
+}
+
+// run the longest chain of pixelwise modules ending in `modules' in one pass over
+// cache sized blocks, without writing any of the intermediate buffers.
+// returns 1 on error, 0 on success and -1 if there is nothing to fuse.
+static int pixelpipe_process_fused(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                   dt_iop_buffer_dsc_t **out_format, const dt_iop_roi_t *roi_out,
+                                   GList *modules, GList *pieces, int pos, const uint64_t hash,
+                                   const size_t bufsize, const int store_half)
+{
+  // the chain, last module first
+  dt_iop_module_t *chain_module[DT_PIXELPIPE_FUSED_MAX];
+  dt_dev_pixelpipe_iop_t *chain_piece[DT_PIXELPIPE_FUSED_MAX];
+  int count = 0;
+
+  // collect it backwards, skipping disabled modules like process_rec() does
+  GList *first_module = modules, *first_piece = pieces;
+  int first_pos = pos;
+  for(GList *m = modules, *p = pieces; m && count < DT_PIXELPIPE_FUSED_MAX;
+      m = g_list_previous(m), p = g_list_previous(p), pos--)
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)m->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)p->data;
+    if(!piece->enabled
+       || (dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags()))
+      continue;
+    if(!pixelpipe_piece_is_pixelwise(pipe, dev, module, piece, roi_out)) break;
+    // output already there: stop, the recursion below will pick it up.
+    if(count
+       && dt_dev_pixelpipe_cache_available(&(pipe->cache),
+                                           dt_dev_pixelpipe_cache_hash(pipe->image.id, roi_out, pipe, pos)))
+      break;
+    chain_module[count] = module;
+    chain_piece[count] = piece;
+    count++;
+    first_module = m;
+    first_piece = p;
+    first_pos = pos;
+  }
+  if(count < 2) return -1;
+
+  // recurse to get the input of the first module in the chain
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  dt_iop_buffer_dsc_t _input_format = { 0 };
+  dt_iop_buffer_dsc_t *input_format = &_input_format;
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &input_format, roi_out,
+                                  g_list_previous(first_module), g_list_previous(first_piece), first_pos - 1))
+    return 1;
+
+  // the checks process_rec() does before every module, once for the whole chain
+  if(dt_iop_breakpoint(dev, pipe) || dev->gui_leaving) return 1;
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+
+  // process_pixels() only comes with modules after demosaic, which always get float4 (or half, expanded here)
+  _input_format = *input_format;
+  if(_pixelpipe_expand_half(pipe, chain_module[count - 1], chain_piece[count - 1], &input, &_input_format,
+                            roi_out))
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+
+  dt_iop_buffer_dsc_t dsc = _input_format;
+  **out_format = dsc;
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+
+  // collect half float output as floats first
+  void *cache_line = *output;
+  if(store_half)
+  {
+    *output = _pixelpipe_half_scratch(pipe, 1, (size_t)4 * sizeof(float) * roi_out->width * roi_out->height);
+    if(!*output)
+    {
+      *output = cache_line;
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      return 1;
+    }
+  }
+
+  dt_times_t start;
+  dt_get_times(&start);
+
+  // formats and per-run setup in pipe order
+  for(int k = count - 1; k >= 0; k--)
+  {
+    dt_iop_module_t *module = chain_module[k];
+    dt_dev_pixelpipe_iop_t *piece = chain_piece[k];
+    piece->dsc_out = piece->dsc_in = dsc;
+    dt_iop_processed_output_format(module, pipe, piece, &piece->dsc_out);
+    pipe->dsc = piece->dsc_out;
+    if(module->process_pixels_prepare) module->process_pixels_prepare(module, piece, roi_out, roi_out);
+    dsc = piece->dsc_out = pipe->dsc;
+  }
+
+  // the chain runs as long as all of its modules would one after the other, so it is polled for
+  // cancellation in between blocks. worker threads don't inherit the token of the pipe.
+  const dt_cancel_token_t *const token = dt_cancel_token_get();
+  const size_t npixels = (size_t)roi_out->width * roi_out->height;
+  const size_t nblocks = (npixels + DT_PIXELPIPE_FUSED_BLOCK - 1) / DT_PIXELPIPE_FUSED_BLOCK;
+  const float *const fin = (const float *)input;
+  float *const fout = (float *)*output;
+  int cancelled = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(chain_module, chain_piece, count, cancelled)
+#endif
+  for(size_t b = 0; b < nblocks; b++)
+  {
+    // the remaining blocks of a cancelled pipe are skipped, the output is discarded anyway
+    if(cancelled || dt_cancel_token_cancelled(token))
+    {
+      cancelled = 1;
+      continue;
+    }
+    const size_t offset = b * DT_PIXELPIPE_FUSED_BLOCK;
+    const size_t n = MIN(DT_PIXELPIPE_FUSED_BLOCK, npixels - offset);
+    const float *block_in = fin + 4 * offset;
+    float *const block_out = fout + 4 * offset;
+    for(int k = count - 1; k >= 0; k--)
+    {
+      chain_module[k]->process_pixels(chain_module[k], chain_piece[k], block_in, block_out, n);
+      block_in = block_out;
+    }
+  }
+
+  if(cancelled || pipe->shutdown)
+  {
+    if(store_half) *output = cache_line;
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+
+  GString *labels = g_string_new(NULL);
+  for(int k = count - 1; k >= 0; k--)
+  {
+    gchar *module_label = dt_history_item_get_name(chain_module[k]);
+    g_string_append_printf(labels, k ? "%s, " : "%s", module_label);
+    g_free(module_label);
+  }
+  dt_show_times(&start, "[dev_pixelpipe]", "processed `%s' fused on CPU [%s]", labels->str,
+                _pipe_type_to_str(pipe->type));
+  g_string_free(labels, TRUE);
+
+  // in case we get this buffer from the cache in the future, cache some stuff:
+  **out_format = dsc;
+  if(store_half)
+  {
+    dt_iop_buffer_float_to_half((uint16_t *)cache_line, (const float *)*output,
+                                (size_t)dsc.channels * roi_out->width * roi_out->height);
+    *output = cache_line;
+    (*out_format)->datatype = TYPE_HALF;
+  }
+
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 0;
+}
+
+static int _dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                      void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
+                                      const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos)
 {
   dt_iop_roi_t roi_in = *roi_out;
 
@@ -620,8 +1078,11 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
   if(module) g_strlcpy(module_name, module->op, MIN(sizeof(module_name), sizeof(module->op)));
   get_output_format(module, pipe, piece, dev, *out_format);
+  const size_t bufsize = dt_iop_buffer_dsc_to_bpp(*out_format) * roi_out->width * roi_out->height;
+  // modules write floats, which are converted to half floats when done
+  const int store_half = (*out_format)->datatype == TYPE_HALF;
+  if(store_half) (*out_format)->datatype = TYPE_FLOAT;
   const size_t bpp = dt_iop_buffer_dsc_to_bpp(*out_format);
-  const size_t bufsize = (size_t)bpp * roi_out->width * roi_out->height;
 
   // 1) if cached buffer is still available, return data
   dt_pthread_mutex_lock(&pipe->busy_mutex);
@@ -726,6 +1187,18 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     module->modify_roi_in(module, piece, roi_out, &roi_in);
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
+    // the other darkroom pipe might have done the raw stage already
+    if(_raw_stage_reuse(pipe, dev, module, piece, roi_out, hash, bufsize, store_half, output, out_format))
+      goto post_process_collect_info;
+
+    // chains of pixelwise modules are run in one pass over cache sized blocks
+    if(pixelpipe_piece_is_pixelwise(pipe, dev, module, piece, roi_out))
+    {
+      const int fused = pixelpipe_process_fused(pipe, dev, output, out_format, roi_out, modules, pieces, pos,
+                                                hash, bufsize, store_half);
+      if(fused >= 0) return fused;
+    }
+
     // recurse to get actual data of input buffer
 
     dt_iop_buffer_dsc_t _input_format = { 0 };
@@ -737,11 +1210,16 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
                                     g_list_previous(modules), g_list_previous(pieces), pos - 1))
       return 1;
 
+    void *input_cache_line = input;
+    _input_format = *input_format;
+    input_format = &_input_format;
+    if(_pixelpipe_expand_half(pipe, module, piece, &input, input_format, &roi_in)) return 1;
+
     const size_t in_bpp = dt_iop_buffer_dsc_to_bpp(input_format);
 
     piece->dsc_out = piece->dsc_in = *input_format;
 
-    module->output_format(module, pipe, piece, &piece->dsc_out);
+    dt_iop_processed_output_format(module, pipe, piece, &piece->dsc_out);
 
     **out_format = pipe->dsc = piece->dsc_out;
 
@@ -760,6 +1238,19 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     else
       (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
 
+    // collect half float output as floats first
+    void *cache_line = *output;
+    if(store_half)
+    {
+      *output = _pixelpipe_half_scratch(pipe, 1, (size_t)roi_out->width * roi_out->height * out_bpp);
+      if(!*output)
+      {
+        *output = cache_line;
+        dt_pthread_mutex_unlock(&pipe->busy_mutex);
+        return 1;
+      }
+    }
+
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
 // if(module) printf("reserving new buf in cache for module %s %s: %ld buf %p\n", module->op, pipe ==
@@ -808,6 +1299,14 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
                    (size_t)in_bpp * roi_in.width);
 #endif
 
+      if(store_half)
+      {
+        dt_iop_buffer_float_to_half((uint16_t *)cache_line, (const float *)*output,
+                                    (size_t)(*out_format)->channels * roi_out->width * roi_out->height);
+        *output = cache_line;
+        (*out_format)->datatype = TYPE_HALF;
+      }
+
       dt_pthread_mutex_unlock(&pipe->busy_mutex);
       return 0;
     }
@@ -979,7 +1478,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
             pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_CPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
           }
 
-          if(pipe->shutdown)
+          if(pipe->shutdown || dt_cancelled())
           {
             dt_opencl_release_mem_object(cl_mem_input);
             dt_pthread_mutex_unlock(&pipe->busy_mutex);
@@ -1118,7 +1617,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
             pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_CPU);
           }
 
-          if(pipe->shutdown)
+          if(pipe->shutdown || dt_cancelled())
           {
             dt_pthread_mutex_unlock(&pipe->busy_mutex);
             return 1;
@@ -1332,7 +1831,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
             pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
           }
 
-          if(pipe->shutdown)
+          if(pipe->shutdown || dt_cancelled())
           {
             dt_pthread_mutex_unlock(&pipe->busy_mutex);
             return 1;
@@ -1465,7 +1964,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
           pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
         }
 
-        if(pipe->shutdown)
+        if(pipe->shutdown || dt_cancelled())
         {
           dt_pthread_mutex_unlock(&pipe->busy_mutex);
           return 1;
@@ -1563,7 +2062,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
         pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
       }
 
-      if(pipe->shutdown)
+      if(pipe->shutdown || dt_cancelled())
       {
         dt_pthread_mutex_unlock(&pipe->busy_mutex);
         return 1;
@@ -1648,7 +2147,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
     }
 
-    if(pipe->shutdown)
+    if(pipe->shutdown || dt_cancelled())
     {
       dt_pthread_mutex_unlock(&pipe->busy_mutex);
       return 1;
@@ -1712,13 +2211,24 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
     // in case we get this buffer from the cache in the future, cache some stuff:
     **out_format = piece->dsc_out = pipe->dsc;
+    if(*cl_mem_output == NULL)
+      _raw_stage_publish(pipe, dev, module, roi_out, (const float *)*output, *out_format);
+    else if(_raw_stage_shared(pipe, dev, module))
+      _raw_stage_release(pipe, dev);
+    if(store_half)
+    {
+      dt_iop_buffer_float_to_half((uint16_t *)cache_line, (const float *)*output,
+                                  (size_t)pipe->dsc.channels * roi_out->width * roi_out->height);
+      *output = cache_line;
+      (*out_format)->datatype = TYPE_HALF;
+    }
 
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
     if(module == darktable.develop->gui_module)
     {
       // give the input buffer to the currently focussed plugin more weight.
       // the user is likely to change that one soon, so keep it in cache.
-      dt_dev_pixelpipe_cache_reweight(&(pipe->cache), input);
+      dt_dev_pixelpipe_cache_reweight(&(pipe->cache), input_cache_line);
     }
 #ifndef _DEBUG
     if(darktable.unmuted & DT_DEBUG_NAN)
@@ -2213,6 +2723,29 @@ void dt_dev_pixelpipe_disable_before(dt_dev_pixelpipe_t *pipe, const char *op)
   }
 }
 
+// a module that gives up half way leaves its cache line behind with a valid hash but garbage
+// content. make sure no later run picks that up.
+static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                        void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
+                                        const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos)
+{
+  // the nodes may be rebuilt once we've been shut down, so take the hash while they are still ours
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  const uint64_t hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, roi_out, pipe, pos);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
+  const int ret
+      = _dev_pixelpipe_process_rec(pipe, dev, output, cl_mem_output, out_format, roi_out, modules, pieces, pos);
+
+  if(ret && (pipe->shutdown || dt_cancelled()))
+  {
+    dt_pthread_mutex_lock(&pipe->busy_mutex);
+    dt_dev_pixelpipe_cache_invalidate_hash(&(pipe->cache), hash);
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  }
+  return ret;
+}
+
 static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
                                                      void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
                                                      const dt_iop_roi_t *roi_out, GList *modules, GList *pieces,
@@ -2260,10 +2793,54 @@ static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, d
 }
 
 
+typedef struct dt_dev_pixelpipe_cancel_t
+{
+  const dt_dev_pixelpipe_t *pipe;
+  const dt_develop_t *dev;
+} dt_dev_pixelpipe_cancel_t;
+
+// the conditions of dt_iop_breakpoint(), cheap enough to be polled from within modules
+static int _pixelpipe_cancelled(const void *data)
+{
+  const dt_dev_pixelpipe_cancel_t *c = (const dt_dev_pixelpipe_cancel_t *)data;
+  const dt_dev_pixelpipe_t *pipe = c->pipe;
+  if(pipe->shutdown || c->dev->gui_leaving) return 1;
+  if(pipe != c->dev->preview_pipe && pipe->changed == DT_DEV_PIPE_ZOOMED) return 1;
+  return pipe->changed != DT_DEV_PIPE_UNCHANGED && pipe->changed != DT_DEV_PIPE_ZOOMED;
+}
+
+// book keeping of finished vs. abandoned runs
+static void _pixelpipe_account_run(dt_dev_pixelpipe_t *pipe, const double start, const int cancelled)
+{
+  const double elapsed = dt_get_wtime() - start;
+  if(cancelled)
+  {
+    pipe->runs_cancelled++;
+    pipe->cancelled_time += elapsed;
+    dt_print(DT_DEBUG_PERF, "[dev_pixelpipe] [%s] cancelled after %.3f secs, %d of %d runs cancelled so far "
+                            "(%.3f of %.3f secs wasted)\n",
+             _pipe_type_to_str(pipe->type), elapsed, pipe->runs_cancelled,
+             pipe->runs_cancelled + pipe->runs_completed, pipe->cancelled_time,
+             pipe->cancelled_time + pipe->completed_time);
+  }
+  else
+  {
+    pipe->runs_completed++;
+    pipe->completed_time += elapsed;
+  }
+}
+
 int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width, int height,
                              float scale)
 {
   pipe->processing = 1;
+  const double start = dt_get_wtime();
+
+  // modules and the helpers they use poll this to give up early on a run nobody is waiting for anymore
+  const dt_dev_pixelpipe_cancel_t cancel = { pipe, dev };
+  const dt_cancel_token_t token = { _pixelpipe_cancelled, &cancel };
+  const dt_cancel_token_t *const previous_token = dt_cancel_token_set(&token);
+
   pipe->opencl_enabled = dt_opencl_update_settings(); // update enabled flag and profile from preferences
   pipe->devid = (pipe->opencl_enabled) ? dt_opencl_lock_device(pipe->type)
                                        : -1; // try to get/lock opencl resource
@@ -2302,6 +2879,16 @@ restart:
   // mask display off as a starting point
   pipe->mask_display = DT_DEV_PIXELPIPE_DISPLAY_NONE;
 
+  // half float buffers are kept on the cpu only, and in darkroom pipes which end in gamma, so the
+  // final buffer is never one of them.
+  {
+    GList *last = g_list_last(pipe->nodes);
+    const dt_dev_pixelpipe_iop_t *final = last ? (dt_dev_pixelpipe_iop_t *)last->data : NULL;
+    pipe->half_buffers = (pipe->type & (DT_DEV_PIXELPIPE_FULL | DT_DEV_PIXELPIPE_PREVIEW)) && !pipe->opencl_enabled
+                         && final && final->enabled && !strcmp(final->module->op, "gamma")
+                         && dt_conf_get_bool("plugins/darkroom/half_float_buffers");
+  }
+
   void *buf = NULL;
   void *cl_mem_out = NULL;
 
@@ -2361,6 +2948,10 @@ restart:
     dt_opencl_unlock_device(pipe->devid);
     pipe->devid = -1;
   }
+  _raw_stage_release(pipe, dev);
+  dt_cancel_token_set(previous_token);
+  _pixelpipe_account_run(pipe, start, err && dt_cancel_token_cancelled(&token));
+
   // ... and in case of other errors ...
   if(err)
   {
@@ -2374,6 +2965,7 @@ restart:
   pipe->backbuf = buf;
   pipe->backbuf_width = width;
   pipe->backbuf_height = height;
+  pipe->backbuf_scale = scale;
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
 
   // printf("pixelpipe homebrew process end\n");
@@ -2381,9 +2973,33 @@ restart:
   return 0;
 }
 
+int dt_dev_pixelpipe_process_coarse(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width,
+                                    int height, float scale, int factor)
+{
+  // swap in the coarse cache. an obsolete cache has to be flushed by the full run as well.
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  const int cache_obsolete = pipe->cache_obsolete;
+  dt_dev_pixelpipe_cache_t cache = pipe->cache;
+  pipe->cache = pipe->coarse_cache;
+  pipe->coarse_cache = cache;
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
+  const int ret = dt_dev_pixelpipe_process(pipe, dev, x / factor, y / factor, MAX(width / factor, 1),
+                                           MAX(height / factor, 1), scale / factor);
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  cache = pipe->cache;
+  pipe->cache = pipe->coarse_cache;
+  pipe->coarse_cache = cache;
+  pipe->cache_obsolete |= cache_obsolete;
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return ret;
+}
+
 void dt_dev_pixelpipe_flush_caches(dt_dev_pixelpipe_t *pipe)
 {
   dt_dev_pixelpipe_cache_flush(&pipe->cache);
+  dt_dev_pixelpipe_cache_flush(&pipe->coarse_cache);
 }
 
 void dt_dev_pixelpipe_get_dimensions(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int width_in,
@@ -2424,6 +3040,60 @@ void dt_dev_pixelpipe_get_dimensions(dt_dev_pixelpipe_t *pipe, struct dt_develop
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
+int dt_dev_pixelpipe_get_strip_overlap(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int width,
+                                       int height, float scale, size_t *row_size)
+{
+  // walk the pipe from the end like dt_dev_pixelpipe_process_rec() does and accumulate the
+  // neighbourhood every module reads around its roi, converted to output pixels.
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  dt_iop_roi_t roi_out = (dt_iop_roi_t){ 0, 0, width, height, scale };
+  float overlap = 0.0f;
+  float row_bytes = 4 * sizeof(float) * width;
+  int res = 0;
+  GList *modules = g_list_last(pipe->iop);
+  GList *pieces = g_list_last(pipe->nodes);
+  while(modules)
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+
+    if(piece->enabled
+       && !(dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags()))
+    {
+      // modules which may not be tiled are likely to look at the whole image
+      if(!(module->flags() & IOP_FLAGS_ALLOW_TILING))
+      {
+        res = -1;
+        break;
+      }
+
+      dt_iop_roi_t roi_in;
+      module->modify_roi_in(module, piece, &roi_out, &roi_in);
+
+      dt_develop_tiling_t tiling = { 0 };
+      module->tiling_callback(module, piece, &roi_in, &roi_out, &tiling);
+      overlap += tiling.overlap * scale / roi_in.scale;
+
+      // mask feathering and blurring reach out as well
+      const dt_develop_blend_params_t *const d = (const dt_develop_blend_params_t *const)piece->blendop_data;
+      if(d && d->mask_mode != DEVELOP_MASK_DISABLED)
+        overlap += (2.0f * d->feathering_radius + 3.0f * d->blur_radius) * scale / piece->iscale;
+
+      const float bytes = tiling.factor * 4 * sizeof(float) * roi_in.width * roi_in.height / (float)height;
+      row_bytes = fmaxf(row_bytes, bytes);
+
+      roi_out = roi_in;
+    }
+
+    modules = g_list_previous(modules);
+    pieces = g_list_previous(pieces);
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
+  if(row_size) *row_size = row_bytes;
+  return res ? res : (int)ceilf(overlap);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -80,6 +80,8 @@ typedef struct dt_dev_pixelpipe_t
 {
   // store history/zoom caches
   dt_dev_pixelpipe_cache_t cache;
+  // separate small cache for coarse passes, see dt_dev_pixelpipe_process_coarse()
+  dt_dev_pixelpipe_cache_t coarse_cache;
   // set to non-zero in order to obsolete old cache entries on next pixelpipe run
   int cache_obsolete;
   // input buffer
@@ -103,6 +105,7 @@ typedef struct dt_dev_pixelpipe_t
   uint8_t *backbuf;
   size_t backbuf_size;
   int backbuf_width, backbuf_height;
+  float backbuf_scale;
   uint64_t backbuf_hash;
   dt_pthread_mutex_t backbuf_mutex, busy_mutex;
   // working?
@@ -113,8 +116,16 @@ typedef struct dt_dev_pixelpipe_t
   int opencl_enabled;
   // opencl error detected?
   int opencl_error;
+  // store the output of modules as half floats in the cache? (cpu only, see default_output_format())
+  int half_buffers;
+  // modules always process floats: scratch buffers to expand half float input and to collect output in
+  float *half_scratch[2];
+  size_t half_scratch_size[2];
   // running in a tiling context?
   int tiling;
+  // runs that were finished or given up on, and the wall time spent in each (see DT_DEBUG_PERF)
+  int runs_completed, runs_cancelled;
+  double completed_time, cancelled_time;
   // should this pixelpipe display a mask in the end?
   int mask_display;
   // input data based on this timestamp:
@@ -162,6 +173,11 @@ void dt_dev_pixelpipe_set_icc(dt_dev_pixelpipe_t *pipe, dt_colorspaces_color_pro
 // returns the dimensions of the full image after processing.
 void dt_dev_pixelpipe_get_dimensions(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int width_in,
                                      int height_in, int *width, int *height);
+// returns the number of rows a horizontal strip of the processed image has to be padded with on either side
+// to come out the same as when processing the full image, or -1 if the pipe can't be processed in strips.
+// row_size receives the peak memory needed per output row.
+int dt_dev_pixelpipe_get_strip_overlap(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int width,
+                                       int height, float scale, size_t *row_size);
 
 // destroys all allocated data.
 void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe);
@@ -169,6 +185,13 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe);
 // flushes all cached data. useful if input pixels unexpectedly change.
 void dt_dev_pixelpipe_flush_caches(dt_dev_pixelpipe_t *pipe);
 
+// output of the raw stage (up to and including demosaic) of the whole image, shared between the full and the
+// preview pipe of the darkroom so the raw modules only run once per edit.
+struct dt_dev_raw_stage_t *dt_dev_raw_stage_init(void);
+void dt_dev_raw_stage_cleanup(struct dt_dev_raw_stage_t *stage);
+// drops the shared buffer, when the image changes or the darkroom is left.
+void dt_dev_raw_stage_flush(struct dt_dev_raw_stage_t *stage);
+
 // wrapper for cleanup_nodes, create_nodes, synch_all and synch_top, decides upon changed event which one to
 // take on. also locks dev->history_mutex.
 void dt_dev_pixelpipe_change(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
@@ -184,6 +207,10 @@ void dt_dev_pixelpipe_synch_top(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *d
 // process region of interest of pixels. returns 1 if pipe was altered during processing.
 int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y, int width,
                              int height, float scale);
+// processes the region at a fraction of the requested scale, using a cache of its own so the buffers a following
+// full resolution run can reuse stay untouched. x, y, width, height and scale are those of the full run.
+int dt_dev_pixelpipe_process_coarse(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y, int width,
+                                    int height, float scale, int factor);
 // convenience method that does not gamma-compress the image.
 int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y,
                                       int width, int height, float scale);
@@ -75,6 +75,15 @@ static inline int _max(int a, int b)
 }
 
 
+/* number of tiles which can be processed at once, each of them needing tile_size bytes */
+static inline int _parallel_slots(const int parallel_tiles, const int tiles, const float tile_size,
+                                  const float available)
+{
+  int slots = _min(parallel_tiles, tiles);
+  while(slots > 1 && slots * tile_size > available) slots--;
+  return slots;
+}
+
 static inline int _align_up(int n, int a)
 {
   return n % a != 0 ? (n / a + 1) * a : n;
@@ -588,7 +597,7 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
   void *input = NULL;
   void *output = NULL;
   dt_iop_buffer_dsc_t dsc;
-  self->output_format(self, piece->pipe, piece, &dsc);
+  dt_iop_processed_output_format(self, piece->pipe, piece, &dsc);
   const int out_bpp = dt_iop_buffer_dsc_to_bpp(&dsc);
 
   const int ipitch = roi_in->width * in_bpp;
@@ -624,7 +633,10 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
   singlebuffer = fmax(singlebuffer, 2.0f * 1024.0f * 1024.0f);
   float factor = fmax(tiling.factor, 1.0f);
   float maxbuf = fmax(tiling.maxbuf, 1.0f);
-  singlebuffer = fmax(available / factor, singlebuffer);
+
+  /* modules which may work on several tiles at once share the budget between the tiles in flight */
+  const int parallel_tiles = (self->flags() & IOP_FLAGS_PARALLEL_TILING) ? dt_get_num_threads() : 1;
+  singlebuffer = fmax(available / (factor * parallel_tiles), singlebuffer);
 
   int width = roi_in->width;
   int height = roi_in->height;
@@ -693,22 +705,28 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
   }
 
 
+  /* number of tiles processed at once, each needs its own set of buffers */
+  const int slots
+      = _parallel_slots(parallel_tiles, tiles_x * tiles_y, factor * width * height * max_bpp, available);
+
   dt_print(DT_DEBUG_DEV,
            "[default_process_tiling_ptp] use tiling on module '%s' for image with full size %d x %d\n",
            self->op, roi_in->width, roi_in->height);
   dt_print(DT_DEBUG_DEV,
-           "[default_process_tiling_ptp] (%d x %d) tiles with max dimensions %d x %d and overlap %d\n",
-           tiles_x, tiles_y, width, height, overlap);
+           "[default_process_tiling_ptp] (%d x %d) tiles with max dimensions %d x %d and overlap %d, %d at once\n",
+           tiles_x, tiles_y, width, height, overlap, slots);
 
   /* reserve input and output buffers for tiles */
-  input = dt_alloc_align(64, (size_t)width * height * in_bpp);
+  const size_t islot = ((size_t)width * height * in_bpp + 63) & ~(size_t)63;
+  const size_t oslot = ((size_t)width * height * out_bpp + 63) & ~(size_t)63;
+  input = dt_alloc_align(64, islot * slots);
   if(input == NULL)
   {
     dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc input buffer for module '%s'\n",
              self->op);
     goto error;
   }
-  output = dt_alloc_align(64, (size_t)width * height * out_bpp);
+  output = dt_alloc_align(64, oslot * slots);
   if(output == NULL)
   {
     dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc output buffer for module '%s'\n",
@@ -722,51 +740,67 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
   for(int k = 0; k < 4; k++) processed_maximum_saved[k] = piece->pipe->dsc.processed_maximum[k];
 
 
-  /* iterate over tiles */
-  for(size_t tx = 0; tx < tiles_x; tx++)
+  /* iterate over tiles. with more than one slot, each thread works on its own pair of tile buffers
+     and the module promised not to touch shared pipe state, so processed_maximum is left alone. */
+  piece->pipe->tiling = 1;
+  /* worker threads don't inherit the cancellation token of the pipe, hand it over explicitly */
+  const dt_cancel_token_t *const token = dt_cancel_token_get();
+#ifdef _OPENMP
+#pragma omp parallel for default(none) num_threads(slots) if(slots > 1) schedule(dynamic, 1) \
+    shared(input, output, processed_maximum_saved, processed_maximum_new, self, piece, width, height)
+#endif
+  for(int t = 0; t < tiles_x * tiles_y; t++)
   {
+    const size_t tx = t / tiles_y;
+    const size_t ty = t % tiles_y;
     const size_t wd = tx * tile_wd + width > roi_in->width ? roi_in->width - tx * tile_wd : width;
-    for(size_t ty = 0; ty < tiles_y; ty++)
-    {
-      piece->pipe->tiling = 1;
+    const size_t ht = ty * tile_ht + height > roi_in->height ? roi_in->height - ty * tile_ht : height;
 
-      const size_t ht = ty * tile_ht + height > roi_in->height ? roi_in->height - ty * tile_ht : height;
+    /* no need to process end-tiles that are smaller than the total overlap area */
+    if((wd <= 2 * overlap && tx > 0) || (ht <= 2 * overlap && ty > 0)) continue;
 
-      /* no need to process end-tiles that are smaller than the total overlap area */
-      if((wd <= 2 * overlap && tx > 0) || (ht <= 2 * overlap && ty > 0)) continue;
+    /* the remaining tiles of a cancelled pipe are skipped, the output is discarded anyway */
+    if(dt_cancel_token_cancelled(token)) continue;
 
-      /* origin and region of effective part of tile, which we want to store later */
-      size_t origin[] = { 0, 0, 0 };
-      size_t region[] = { wd, ht, 1 };
+    void *const tile_in = (char *)input + islot * dt_get_thread_num();
+    void *const tile_out = (char *)output + oslot * dt_get_thread_num();
 
-      /* roi_in and roi_out for process_cl on subbuffer */
-      dt_iop_roi_t iroi = { roi_in->x + tx * tile_wd, roi_in->y + ty * tile_ht, wd, ht, roi_in->scale };
-      dt_iop_roi_t oroi = { roi_out->x + tx * tile_wd, roi_out->y + ty * tile_ht, wd, ht, roi_out->scale };
+    /* origin and region of effective part of tile, which we want to store later */
+    size_t origin[] = { 0, 0, 0 };
+    size_t region[] = { wd, ht, 1 };
 
-      /* offsets of tile into ivoid and ovoid */
-      size_t ioffs = (ty * tile_ht) * ipitch + (tx * tile_wd) * in_bpp;
-      size_t ooffs = (ty * tile_ht) * opitch + (tx * tile_wd) * out_bpp;
+    /* roi_in and roi_out for process_cl on subbuffer */
+    dt_iop_roi_t iroi = { roi_in->x + tx * tile_wd, roi_in->y + ty * tile_ht, wd, ht, roi_in->scale };
+    dt_iop_roi_t oroi = { roi_out->x + tx * tile_wd, roi_out->y + ty * tile_ht, wd, ht, roi_out->scale };
 
+    /* offsets of tile into ivoid and ovoid */
+    const size_t ioffs = (ty * tile_ht) * ipitch + (tx * tile_wd) * in_bpp;
+    size_t ooffs = (ty * tile_ht) * opitch + (tx * tile_wd) * out_bpp;
 
-      dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] tile (%zu, %zu) with %zu x %zu at origin [%zu, %zu]\n",
-               tx, ty, wd, ht, tx * tile_wd, ty * tile_ht);
+
+    dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] tile (%zu, %zu) with %zu x %zu at origin [%zu, %zu]\n",
+             tx, ty, wd, ht, tx * tile_wd, ty * tile_ht);
 
 /* prepare input tile buffer */
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(input, width, ioffs) schedule(static)
+#pragma omp parallel for default(none) schedule(static)
 #endif
-      for(size_t j = 0; j < ht; j++)
-        memcpy((char *)input + j * wd * in_bpp, (char *)ivoid + ioffs + j * ipitch, (size_t)wd * in_bpp);
+    for(size_t j = 0; j < ht; j++)
+      memcpy((char *)tile_in + j * wd * in_bpp, (char *)ivoid + ioffs + j * ipitch, (size_t)wd * in_bpp);
 
-      /* take original processed_maximum as starting point */
+    /* take original processed_maximum as starting point */
+    if(slots == 1)
       for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_saved[k];
 
-      /* call process() of module */
-      self->process(self, piece, input, output, &iroi, &oroi);
+    /* call process() of module */
+    const dt_cancel_token_t *const previous_token = dt_cancel_token_set(token);
+    self->process(self, piece, tile_in, tile_out, &iroi, &oroi);
+    dt_cancel_token_set(previous_token);
 
-      /* aggregate resulting processed_maximum */
-      /* TODO: check if there really can be differences between tiles and take
-               appropriate action (calculate minimum, maximum, average, ...?) */
+    /* aggregate resulting processed_maximum */
+    /* TODO: check if there really can be differences between tiles and take
+             appropriate action (calculate minimum, maximum, average, ...?) */
+    if(slots == 1)
       for(int k = 0; k < 4; k++)
       {
         if(tx + ty > 0 && fabs(processed_maximum_new[k] - piece->pipe->dsc.processed_maximum[k]) > 1.0e-6f)
@@ -777,33 +811,33 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
         processed_maximum_new[k] = piece->pipe->dsc.processed_maximum[k];
       }
 
-      /* correct origin and region of tile for overlap.
-         make sure that we only copy back the "good" part. */
-      if(tx > 0)
-      {
-        origin[0] += overlap;
-        region[0] -= overlap;
-        ooffs += overlap * out_bpp;
-      }
-      if(ty > 0)
-      {
-        origin[1] += overlap;
-        region[1] -= overlap;
-        ooffs += overlap * opitch;
-      }
+    /* correct origin and region of tile for overlap.
+       make sure that we only copy back the "good" part. */
+    if(tx > 0)
+    {
+      origin[0] += overlap;
+      region[0] -= overlap;
+      ooffs += overlap * out_bpp;
+    }
+    if(ty > 0)
+    {
+      origin[1] += overlap;
+      region[1] -= overlap;
+      ooffs += overlap * opitch;
+    }
 
 /* copy "good" part of tile to output buffer */
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(ooffs, output, width, origin, region) schedule(static)
+#pragma omp parallel for default(none) shared(ooffs, origin, region) schedule(static)
 #endif
-      for(size_t j = 0; j < region[1]; j++)
-        memcpy((char *)ovoid + ooffs + j * opitch,
-               (char *)output + ((j + origin[1]) * wd + origin[0]) * out_bpp, (size_t)region[0] * out_bpp);
-    }
+    for(size_t j = 0; j < region[1]; j++)
+      memcpy((char *)ovoid + ooffs + j * opitch,
+             (char *)tile_out + ((j + origin[1]) * wd + origin[0]) * out_bpp, (size_t)region[0] * out_bpp);
   }
 
   /* copy back final processed_maximum */
-  for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
+  if(slots == 1)
+    for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
 
   if(input != NULL) dt_free_align(input);
   if(output != NULL) dt_free_align(output);
@@ -840,7 +874,7 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
   //_print_roi(roi_out, "module roi_out");
 
   dt_iop_buffer_dsc_t dsc;
-  self->output_format(self, piece->pipe, piece, &dsc);
+  dt_iop_processed_output_format(self, piece->pipe, piece, &dsc);
   const int out_bpp = dt_iop_buffer_dsc_to_bpp(&dsc);
 
   const int ipitch = roi_in->width * in_bpp;
@@ -986,6 +1020,9 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
   for(size_t tx = 0; tx < tiles_x; tx++)
     for(size_t ty = 0; ty < tiles_y; ty++)
     {
+      /* the remaining tiles of a cancelled pipe are skipped, the output is discarded anyway */
+      if(dt_cancelled()) continue;
+
       piece->pipe->tiling = 1;
 
       /* the output dimensions of the good part of this specific tile */
@@ -1195,7 +1232,7 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
   void *output_buffer = NULL;
 
   dt_iop_buffer_dsc_t dsc;
-  self->output_format(self, piece->pipe, piece, &dsc);
+  dt_iop_processed_output_format(self, piece->pipe, piece, &dsc);
   const int out_bpp = dt_iop_buffer_dsc_to_bpp(&dsc);
 
   const int devid = piece->pipe->devid;
@@ -1372,6 +1409,9 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
   for(size_t tx = 0; tx < tiles_x; tx++)
     for(size_t ty = 0; ty < tiles_y; ty++)
     {
+      /* the remaining tiles of a cancelled pipe are skipped, the output is discarded anyway */
+      if(dt_cancelled()) continue;
+
       piece->pipe->tiling = 1;
 
       size_t wd = tx * tile_wd + width > roi_in->width ? roi_in->width - tx * tile_wd : width;
@@ -1550,7 +1590,7 @@ static int _default_process_tiling_cl_roi(struct dt_iop_module_t *self, struct d
   //_print_roi(roi_out, "module roi_out");
 
   dt_iop_buffer_dsc_t dsc;
-  self->output_format(self, piece->pipe, piece, &dsc);
+  dt_iop_processed_output_format(self, piece->pipe, piece, &dsc);
   const int out_bpp = dt_iop_buffer_dsc_to_bpp(&dsc);
 
   const int devid = piece->pipe->devid;
@@ -1749,6 +1789,9 @@ static int _default_process_tiling_cl_roi(struct dt_iop_module_t *self, struct d
   for(size_t tx = 0; tx < tiles_x; tx++)
     for(size_t ty = 0; ty < tiles_y; ty++)
     {
+      /* the remaining tiles of a cancelled pipe are skipped, the output is discarded anyway */
+      if(dt_cancelled()) continue;
+
       piece->pipe->tiling = 1;
 
       /* the output dimensions of the good part of this specific tile */
@@ -18,9 +18,12 @@
 */
 
 #include <glib.h>    // for g_mkdir_with_parents, _
+#include <glib/gstdio.h> // for g_stat, GStatBuf
 #include <gtk/gtk.h> // for gtk_init_check
 #include <libintl.h> // for bind_textdomain_codeset, etc
 #include <limits.h>  // for PATH_MAX
+#include <pthread.h> // for pthread_join
+#include <signal.h>  // for signal, sig_atomic_t, SIGINT
 #include <sqlite3.h> // for sqlite3_column_int, etc
 #include <stddef.h>  // for size_t
 #include <stdint.h>  // for uint32_t
@@ -32,6 +35,7 @@
 #include "common/darktable.h"    // for darktable, darktable_t, dt_cleanup, etc
 #include "common/database.h"     // for dt_database_get
 #include "common/debug.h"        // for DT_DEBUG_SQLITE3_PREPARE_V2
+#include "common/dtpthread.h"    // for dt_pthread_create, dt_pthread_mutex_t
 #include "common/mipmap_cache.h" // for dt_mipmap_size_t, etc
 #include "config.h"              // for GETTEXT_PACKAGE, etc
 #include "control/conf.h"        // for dt_conf_get_bool
@@ -40,7 +44,108 @@
 #include "win/main_wrapper.h"
 #endif
 
-static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mipmap_size_t max_mip, const int32_t min_imgid, const int32_t max_imgid)
+// set from the signal handler, workers stop picking up new images once it is set
+static volatile sig_atomic_t _interrupted = 0;
+
+static void _interrupt_handler(int sig)
+{
+  _interrupted = 1;
+  // a second ^C terminates right away
+  signal(sig, SIG_DFL);
+}
+
+typedef struct dt_generate_cache_t
+{
+  dt_pthread_mutex_t lock;
+  dt_mipmap_size_t min_mip, max_mip;
+  size_t image_count;
+  int32_t *imgids;
+  int64_t *timestamps; // write_timestamp of the image, thumbnails older than that are stale
+  uint8_t *done;
+  size_t next;         // next image to be picked up by a worker
+  size_t processed, generated, skipped;
+  double start;
+} dt_generate_cache_t;
+
+// 1 if the thumbnail is on disc and not older than the history, 0 if it is missing, -1 if it is stale
+static int _thumbnail_fresh(const int32_t imgid, const dt_mipmap_size_t mip, const int64_t timestamp)
+{
+  char filename[PATH_MAX] = { 0 };
+  snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", darktable.mipmap_cache->cachedir, mip, imgid);
+
+  GStatBuf statbuf;
+  if(g_stat(filename, &statbuf)) return 0;
+  return (int64_t)statbuf.st_mtime >= timestamp ? 1 : -1;
+}
+
+// returns 1 if thumbnails had to be generated, 0 if all of them were up to date
+static int _generate_image(const dt_generate_cache_t *g, const int32_t imgid, const int64_t timestamp)
+{
+  int missing = 0, stale = 0;
+  for(int k = g->max_mip; k >= g->min_mip && k >= 0; k--)
+  {
+    const int fresh = _thumbnail_fresh(imgid, k, timestamp);
+    if(fresh <= 0) missing = 1;
+    if(fresh < 0) stale = 1;
+  }
+  if(!missing) return 0;
+
+  // outdated thumbnails would just be loaded back from disc, get rid of them first.
+  if(stale) dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+
+  // render the largest size through the pipe and keep it locked, the smaller ones
+  // are then downsampled from it instead of running the pipe again.
+  dt_mipmap_buffer_t largest;
+  dt_mipmap_cache_get(darktable.mipmap_cache, &largest, imgid, g->max_mip, DT_MIPMAP_BLOCKING, 'r');
+  for(int k = g->max_mip - 1; k >= g->min_mip && k >= 0; k--)
+  {
+    dt_mipmap_buffer_t buf;
+    dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, k, DT_MIPMAP_BLOCKING, 'r');
+    dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  }
+  dt_mipmap_cache_release(darktable.mipmap_cache, &largest);
+
+  // and immediately write thumbs to disc and remove from mipmap cache.
+  dt_mimap_cache_evict(darktable.mipmap_cache, imgid);
+  return 1;
+}
+
+static void *_generate_worker(void *data)
+{
+  dt_generate_cache_t *g = (dt_generate_cache_t *)data;
+
+  while(!_interrupted)
+  {
+    dt_pthread_mutex_lock(&g->lock);
+    const size_t i = g->next;
+    if(i < g->image_count) g->next++;
+    dt_pthread_mutex_unlock(&g->lock);
+    if(i >= g->image_count) break;
+
+    const int32_t imgid = g->imgids[i];
+    const int generated = _generate_image(g, imgid, g->timestamps[i]);
+
+    dt_pthread_mutex_lock(&g->lock);
+    g->done[i] = 1;
+    g->processed++;
+    if(generated)
+    {
+      g->generated++;
+      const double elapsed = dt_get_wtime() - g->start;
+      fprintf(stderr, "image %zu/%zu (%.02f%%) (id:%d) %.02f images/s\n", g->processed, g->image_count,
+              100.0 * g->processed / (float)g->image_count, imgid,
+              elapsed > 0.0 ? g->processed / elapsed : 0.0);
+    }
+    else
+      g->skipped++;
+    dt_pthread_mutex_unlock(&g->lock);
+  }
+
+  return NULL;
+}
+
+static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mipmap_size_t max_mip,
+                                    const int32_t min_imgid, const int32_t max_imgid, const int jobs)
 {
   fprintf(stderr, _("creating cache directories\n"));
   for(dt_mipmap_size_t k = min_mip; k <= max_mip; k++)
@@ -58,7 +163,7 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
 
   // some progress counter
   sqlite3_stmt *stmt;
-  size_t image_count = 0, counter = 0;
+  size_t image_count = 0;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "SELECT COUNT(*) FROM main.images WHERE id >= ?1 AND id <= ?2", -1, &stmt, 0);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, min_imgid);
@@ -82,40 +187,81 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
     }
   }
 
-  // go through all images:
+  dt_generate_cache_t g = { 0 };
+  g.min_mip = min_mip;
+  g.max_mip = max_mip;
+  g.imgids = calloc(image_count + 1, sizeof(int32_t));
+  g.timestamps = calloc(image_count + 1, sizeof(int64_t));
+  g.done = calloc(image_count + 1, sizeof(uint8_t));
+  if(!g.imgids || !g.timestamps || !g.done)
+  {
+    free(g.imgids);
+    free(g.timestamps);
+    free(g.done);
+    return 1;
+  }
+
+  // collect all images up front, in id order, so that an interrupted run can tell where to resume.
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id FROM main.images WHERE id >= ?1 AND id <= ?2", -1, &stmt, 0);
+                              "SELECT id, IFNULL(write_timestamp, 0) FROM main.images WHERE id >= ?1 AND id <= ?2 "
+                              "ORDER BY id",
+                              -1, &stmt, 0);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, min_imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_imgid);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  while(sqlite3_step(stmt) == SQLITE_ROW && g.image_count < image_count)
   {
-    const int32_t imgid = sqlite3_column_int(stmt, 0);
-
-    counter++;
-    fprintf(stderr, "image %zu/%zu (%.02f%%) (id:%d)\n", counter, image_count, 100.0 * counter / (float)image_count, imgid);
+    g.imgids[g.image_count] = sqlite3_column_int(stmt, 0);
+    g.timestamps[g.image_count] = sqlite3_column_int64(stmt, 1);
+    g.image_count++;
+  }
+  sqlite3_finalize(stmt);
 
-    for(int k = max_mip; k >= min_mip && k >= 0; k--)
+  // go through all images:
+  const int nthreads = MAX(1, MIN(jobs, (int)MAX(g.image_count, 1)));
+  pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+  dt_pthread_mutex_init(&g.lock, NULL);
+  g.start = dt_get_wtime();
+
+  _interrupted = 0;
+  signal(SIGINT, _interrupt_handler);
+  signal(SIGTERM, _interrupt_handler);
+
+  int started = 0;
+  for(; started < nthreads; started++)
+    if(dt_pthread_create(&threads[started], _generate_worker, &g)) break;
+  // could not start a single thread? do the work ourselves.
+  if(!started) _generate_worker(&g);
+  for(int k = 0; k < started; k++) pthread_join(threads[k], NULL);
+
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+
+  const double elapsed = dt_get_wtime() - g.start;
+  fprintf(stderr, _("%zu images processed (%zu generated, %zu up to date) in %.02f s, %.02f images/s\n"),
+          g.processed, g.generated, g.skipped, elapsed, elapsed > 0.0 ? g.processed / elapsed : 0.0);
+
+  int res = 0;
+  if(_interrupted)
+  {
+    // everything before the first unfinished image is done, thumbnails after it that were
+    // already written are skipped as up to date on the next run anyway.
+    size_t first = 0;
+    while(first < g.image_count && g.done[first]) first++;
+    if(first < g.image_count)
     {
-      char filename[PATH_MAX] = { 0 };
-      snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", darktable.mipmap_cache->cachedir, k, imgid);
-
-      // if the thumbnail is already on disc - do nothing
-      if(!access(filename, R_OK)) continue;
-
-      // else, generate thumbnail and store in mipmap cache.
-      dt_mipmap_buffer_t buf;
-      dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, k, DT_MIPMAP_BLOCKING, 'r');
-      dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+      fprintf(stderr, _("interrupted, run again with --min-imgid %d to resume\n"), g.imgids[first]);
+      res = 1;
     }
-
-    // and immediately write thumbs to disc and remove from mipmap cache.
-    dt_mimap_cache_evict(darktable.mipmap_cache, imgid);
   }
+  if(!res) fprintf(stderr, "done\n");
 
-  sqlite3_finalize(stmt);
-  fprintf(stderr, "done\n");
+  dt_pthread_mutex_destroy(&g.lock);
+  free(threads);
+  free(g.imgids);
+  free(g.timestamps);
+  free(g.done);
 
-  return 0;
+  return res;
 }
 
 static void usage(const char *progname)
@@ -124,14 +270,19 @@ static void usage(const char *progname)
       stderr,
       "usage: %s [-h, --help; --version]\n"
       "  [--min-mip <0-7> (default = 0)] [-m, --max-mip <0-7> (default = 2)]\n"
-      "  [--min-imgid <N>] [--max-imgid <N>]\n"
+      "  [--min-imgid <N>] [--max-imgid <N>] [-j, --jobs <N> (default = 1)]\n"
       "  [--core <darktable options>]\n"
       "\n"
       "When multiple mipmap sizes are requested, the biggest one is computed\n"
       "while the rest are quickly downsampled.\n"
       "\n"
       "The --min-imgid and --max-imgid specify the range of internal image ID\n"
-      "numbers to work on.\n",
+      "numbers to work on.\n"
+      "\n"
+      "--jobs renders that many images in parallel. Images whose thumbnails\n"
+      "are already on disc and not older than the image's history (as of the\n"
+      "last sidecar write) are skipped, so an interrupted run can simply be\n"
+      "started again.\n",
       progname);
 }
 
@@ -148,6 +299,7 @@ int main(int argc, char *arg[])
   dt_mipmap_size_t max_mip = DT_MIPMAP_2;
   int32_t min_imgid = 0;
   int32_t max_imgid = INT32_MAX;
+  int jobs = 1;
 
   int k;
   for(k = 1; k < argc; k++)
@@ -182,6 +334,11 @@ int main(int argc, char *arg[])
       k++;
       max_imgid = (int32_t)MIN(MAX(atoi(arg[k]), 0), INT32_MAX);
     }
+    else if((!strcmp(arg[k], "-j") || !strcmp(arg[k], "--jobs")) && argc > k + 1)
+    {
+      k++;
+      jobs = MIN(MAX(atoi(arg[k]), 1), 64);
+    }
     else if(!strcmp(arg[k], "--core"))
     {
       // everything from here on should be passed to the core
@@ -225,7 +382,7 @@ int main(int argc, char *arg[])
 
   fprintf(stderr, _("creating complete lighttable thumbnail cache\n"));
 
-  if(generate_thumbnail_cache(min_mip, max_mip, min_imgid, max_imgid))
+  if(generate_thumbnail_cache(min_mip, max_mip, min_imgid, max_imgid, jobs))
   {
     free(m_arg);
     exit(EXIT_FAILURE);
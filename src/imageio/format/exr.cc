@@ -101,9 +101,19 @@ void cleanup(dt_imageio_module_format_t *self)
 {
 }
 
-int write_image(dt_imageio_module_data_t *tmp, const char *filename, const void *in_tmp,
-                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, int imgid, int num, int total)
+#define DT_EXR_TILE_SIZE 100
+
+typedef struct dt_imageio_exr_stream_t
+{
+  Imf::TiledOutputFile *file;
+  float *buf;   // rows of an incomplete row of tiles
+  int buffered; // number of rows in buf
+  int status;   // set once writing failed, returned by write_image_finish
+} dt_imageio_exr_stream_t;
+
+void *write_image_begin(dt_imageio_module_data_t *tmp, const char *filename,
+                        dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                        void *exif, int exif_len, int imgid, int num, int total)
 {
   const dt_imageio_exr_t *exr = (dt_imageio_exr_t *)tmp;
 
@@ -199,29 +209,116 @@ icc_end:
   header.channels().insert("G", Imf::Channel(Imf::PixelType::FLOAT));
   header.channels().insert("B", Imf::Channel(Imf::PixelType::FLOAT));
 
-  header.setTileDescription(Imf::TileDescription(100, 100, Imf::ONE_LEVEL));
+  header.setTileDescription(Imf::TileDescription(DT_EXR_TILE_SIZE, DT_EXR_TILE_SIZE, Imf::ONE_LEVEL));
+
+  dt_imageio_exr_stream_t *s = (dt_imageio_exr_stream_t *)calloc(1, sizeof(dt_imageio_exr_stream_t));
+  if(!s) return NULL;
+  try
+  {
+    s->file = new Imf::TiledOutputFile(filename, header);
+  }
+  catch(const std::exception &e)
+  {
+    fprintf(stderr, "[exr export] %s\n", e.what());
+    free(s);
+    return NULL;
+  }
+  return s;
+}
 
-  Imf::TiledOutputFile file(filename, header);
+// writes complete rows of tiles, starting at tile boundary `row'. openexr reports errors by throwing, those
+// are kept in the stream's status.
+static int _write_tile_rows(const dt_imageio_exr_t *exr, dt_imageio_exr_stream_t *s, const float *in, int row,
+                             int num_rows)
+{
+  // slices are addressed with absolute coordinates
+  const size_t ystride = 4 * sizeof(float) * exr->width;
+  char *base = (char *)in - ystride * row;
 
   Imf::FrameBuffer data;
+  data.insert("R", Imf::Slice(Imf::PixelType::FLOAT, base + 0 * sizeof(float), 4 * sizeof(float), ystride));
+  data.insert("G", Imf::Slice(Imf::PixelType::FLOAT, base + 1 * sizeof(float), 4 * sizeof(float), ystride));
+  data.insert("B", Imf::Slice(Imf::PixelType::FLOAT, base + 2 * sizeof(float), 4 * sizeof(float), ystride));
 
-  const float *in = (const float *)in_tmp;
+  try
+  {
+    s->file->setFrameBuffer(data);
+    s->file->writeTiles(0, s->file->numXTiles() - 1, row / DT_EXR_TILE_SIZE,
+                        (row + num_rows - 1) / DT_EXR_TILE_SIZE);
+  }
+  catch(const std::exception &e)
+  {
+    fprintf(stderr, "[exr export] %s\n", e.what());
+    s->status = 1;
+  }
+  return s->status;
+}
 
-  data.insert("R", Imf::Slice(Imf::PixelType::FLOAT, (char *)(in + 0), 4 * sizeof(float),
-                              4 * sizeof(float) * exr->width));
+int write_image_rows(dt_imageio_module_data_t *tmp, void *handle, const void *in_tmp, int row, int num_rows)
+{
+  const dt_imageio_exr_t *exr = (dt_imageio_exr_t *)tmp;
+  dt_imageio_exr_stream_t *s = (dt_imageio_exr_stream_t *)handle;
+  const float *in = (const float *)in_tmp;
+  const size_t row_floats = (size_t)4 * exr->width;
 
-  data.insert("G", Imf::Slice(Imf::PixelType::FLOAT, (char *)(in + 1), 4 * sizeof(float),
-                              4 * sizeof(float) * exr->width));
+  while(num_rows > 0 && !s->status)
+  {
+    if(s->buffered == 0 && (num_rows >= DT_EXR_TILE_SIZE || row + num_rows == exr->height))
+    {
+      // whole rows of tiles can go straight from the caller's buffer
+      const int n = (row + num_rows == exr->height) ? num_rows : num_rows - num_rows % DT_EXR_TILE_SIZE;
+      if(_write_tile_rows(exr, s, in, row, n)) break;
+      in += row_floats * n;
+      row += n;
+      num_rows -= n;
+      continue;
+    }
+
+    // keep the rest until the row of tiles is complete
+    if(!s->buf) s->buf = (float *)dt_alloc_align(64, sizeof(float) * row_floats * DT_EXR_TILE_SIZE);
+    if(!s->buf)
+    {
+      s->status = 1;
+      break;
+    }
+    const int n = MIN(num_rows, DT_EXR_TILE_SIZE - s->buffered);
+    memcpy(s->buf + row_floats * s->buffered, in, sizeof(float) * row_floats * n);
+    s->buffered += n;
+    in += row_floats * n;
+    row += n;
+    num_rows -= n;
+    if(s->buffered == DT_EXR_TILE_SIZE || row == exr->height)
+    {
+      _write_tile_rows(exr, s, s->buf, row - s->buffered, s->buffered);
+      s->buffered = 0;
+    }
+  }
 
-  data.insert("B", Imf::Slice(Imf::PixelType::FLOAT, (char *)(in + 2), 4 * sizeof(float),
-                              4 * sizeof(float) * exr->width));
+  return s->status;
+}
 
-  file.setFrameBuffer(data);
-  file.writeTiles(0, file.numXTiles() - 1, 0, file.numYTiles() - 1);
+int write_image_finish(dt_imageio_module_data_t *tmp, void *handle)
+{
+  dt_imageio_exr_stream_t *s = (dt_imageio_exr_stream_t *)handle;
+  const int status = s->status;
+  delete s->file;
+  dt_free_align(s->buf);
+  free(s);
+  return status;
+}
 
-  return 0;
+int write_image(dt_imageio_module_data_t *tmp, const char *filename, const void *in_tmp,
+                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                void *exif, int exif_len, int imgid, int num, int total)
+{
+  void *handle = write_image_begin(tmp, filename, over_type, over_filename, exif, exif_len, imgid, num, total);
+  if(!handle) return 1;
+  write_image_rows(tmp, handle, in_tmp, 0, ((dt_imageio_exr_t *)tmp)->height);
+  return write_image_finish(tmp, handle);
 }
 
+#undef DT_EXR_TILE_SIZE
+
 size_t params_size(dt_imageio_module_format_t *self)
 {
   return sizeof(dt_imageio_exr_t);
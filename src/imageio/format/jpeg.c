@@ -36,10 +36,11 @@
 #undef HAVE_STDLIB_H
 #undef HAVE_STDDEF_H
 #include <jpeglib.h>
+#include <jerror.h>
 #undef HAVE_STDLIB_H
 #undef HAVE_STDDEF_H
 
-DT_MODULE(2)
+DT_MODULE(3)
 
 typedef struct dt_imageio_jpeg_t
 {
@@ -48,6 +49,7 @@ typedef struct dt_imageio_jpeg_t
   char style[128];
   gboolean style_append;
   int quality;
+  int multithread;
   struct jpeg_source_mgr src;
   struct jpeg_destination_mgr dest;
   struct jpeg_decompress_struct dinfo;
@@ -58,6 +60,7 @@ typedef struct dt_imageio_jpeg_t
 typedef struct dt_imageio_jpeg_gui_data_t
 {
   GtkWidget *quality;
+  GtkWidget *multithread;
 } dt_imageio_jpeg_gui_data_t;
 
 
@@ -313,96 +316,442 @@ read_icc_profile (j_decompress_ptr cinfo,
 #undef MAX_SEQ_NO
 
 
-int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const void *in_tmp,
-                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, int imgid, int num, int total)
+typedef struct dt_imageio_jpeg_stream_t
 {
-  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
-  const uint8_t *in = (const uint8_t *)in_tmp;
+  struct jpeg_compress_struct cinfo;
   struct dt_imageio_jpeg_error_mgr jerr;
+  FILE *f;
+  uint8_t *row;
+  char *filename;
+  void *exif;
+  int exif_len;
+  int resolution;
+  int rc;
+  double encode_time;
+
+  // multithreaded encoding: the image is cut into segments of whole MCU rows which are encoded in parallel.
+  // rows are collected until every thread has a segment to work on.
+  int threads;
+  int segment_rows;
+  unsigned int restart_interval;
+  uint8_t *pending; // packed rgb rows
+  int pending_rows;
+  int next_row;
+  int segments; // segments written so far
+  unsigned char *icc;
+  uint32_t icc_len;
+} dt_imageio_jpeg_stream_t;
+
+static void _stream_free(dt_imageio_jpeg_stream_t *s)
+{
+  jpeg_destroy_compress(&(s->cinfo));
+  if(s->f) fclose(s->f);
+  free(s->row);
+  free(s->pending);
+  free(s->icc);
+  g_free(s->filename);
+  free(s);
+}
 
-  jpg->cinfo.err = jpeg_std_error(&jerr.pub);
-  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
-  if(setjmp(jerr.setjmp_buffer))
-  {
-    jpeg_destroy_compress(&(jpg->cinfo));
-    return 1;
-  }
-  jpeg_create_compress(&(jpg->cinfo));
-  FILE *f = g_fopen(filename, "wb");
-  if(!f) return 1;
-  jpeg_stdio_dest(&(jpg->cinfo), f);
-
-  jpg->cinfo.image_width = jpg->width;
-  jpg->cinfo.image_height = jpg->height;
-  jpg->cinfo.input_components = 3;
-  jpg->cinfo.in_color_space = JCS_RGB;
-  jpeg_set_defaults(&(jpg->cinfo));
-  jpeg_set_quality(&(jpg->cinfo), jpg->quality, TRUE);
-  if(jpg->quality > 90) jpg->cinfo.comp_info[0].v_samp_factor = 1;
-  if(jpg->quality > 92) jpg->cinfo.comp_info[0].h_samp_factor = 1;
-  if(jpg->quality > 95) jpg->cinfo.dct_method = JDCT_FLOAT;
-  if(jpg->quality < 50) jpg->cinfo.dct_method = JDCT_IFAST;
-  if(jpg->quality < 80) jpg->cinfo.smoothing_factor = 20;
-  if(jpg->quality < 60) jpg->cinfo.smoothing_factor = 40;
-  if(jpg->quality < 40) jpg->cinfo.smoothing_factor = 60;
-  jpg->cinfo.optimize_coding = 1;
+// the settings shared by the single stream and the segments of the multithreaded encoder
+static void _jpeg_set_params(struct jpeg_compress_struct *cinfo, const dt_imageio_jpeg_t *jpg, const int height,
+                             const int resolution)
+{
+  cinfo->image_width = jpg->width;
+  cinfo->image_height = height;
+  cinfo->input_components = 3;
+  cinfo->in_color_space = JCS_RGB;
+  jpeg_set_defaults(cinfo);
+  jpeg_set_quality(cinfo, jpg->quality, TRUE);
+  if(jpg->quality > 90) cinfo->comp_info[0].v_samp_factor = 1;
+  if(jpg->quality > 92) cinfo->comp_info[0].h_samp_factor = 1;
+  if(jpg->quality > 95) cinfo->dct_method = JDCT_FLOAT;
+  if(jpg->quality < 50) cinfo->dct_method = JDCT_IFAST;
+  if(jpg->quality < 80) cinfo->smoothing_factor = 20;
+  if(jpg->quality < 60) cinfo->smoothing_factor = 40;
+  if(jpg->quality < 40) cinfo->smoothing_factor = 60;
+  cinfo->optimize_coding = 1;
 
   // according to specs density_unit = 0, X_density = 1, Y_density = 1 should be fine and valid since it
   // describes an image with unknown unit and square pixels.
   // however, some applications (like the Telekom cloud thingy) seem to be confused by that, so let's set
   // these calues to the same as stored in exiv :/
-  const int resolution = dt_conf_get_int("metadata/resolution");
   if(resolution > 0)
   {
-    jpg->cinfo.density_unit = 1;
-    jpg->cinfo.X_density = resolution;
-    jpg->cinfo.Y_density = resolution;
+    cinfo->density_unit = 1;
+    cinfo->X_density = resolution;
+    cinfo->Y_density = resolution;
   }
   else
   {
-    jpg->cinfo.density_unit = 0;
-    jpg->cinfo.X_density = 1;
-    jpg->cinfo.Y_density = 1;
+    cinfo->density_unit = 0;
+    cinfo->X_density = 1;
+    cinfo->Y_density = 1;
+  }
+}
+
+// growing in-memory destination for the segments
+typedef struct dt_imageio_jpeg_mem_dest_t
+{
+  struct jpeg_destination_mgr pub;
+  JOCTET *buf;
+  size_t size;
+} dt_imageio_jpeg_mem_dest_t;
+
+static void _mem_init_destination(j_compress_ptr cinfo)
+{
+  dt_imageio_jpeg_mem_dest_t *dest = (dt_imageio_jpeg_mem_dest_t *)cinfo->dest;
+  dest->size = 1 << 16;
+  dest->buf = malloc(dest->size);
+  if(!dest->buf)
+  {
+    cinfo->err->msg_code = JERR_OUT_OF_MEMORY;
+    (*cinfo->err->error_exit)((j_common_ptr)cinfo);
+  }
+  dest->pub.next_output_byte = dest->buf;
+  dest->pub.free_in_buffer = dest->size;
+}
+
+static boolean _mem_empty_output_buffer(j_compress_ptr cinfo)
+{
+  // libjpeg calls this with the whole buffer used up
+  dt_imageio_jpeg_mem_dest_t *dest = (dt_imageio_jpeg_mem_dest_t *)cinfo->dest;
+  JOCTET *buf = realloc(dest->buf, 2 * dest->size);
+  if(!buf)
+  {
+    cinfo->err->msg_code = JERR_OUT_OF_MEMORY;
+    (*cinfo->err->error_exit)((j_common_ptr)cinfo);
+  }
+  dest->buf = buf;
+  dest->pub.next_output_byte = buf + dest->size;
+  dest->pub.free_in_buffer = dest->size;
+  dest->size *= 2;
+  return TRUE;
+}
+
+static void _mem_term_destination(j_compress_ptr cinfo)
+{
+}
+
+// encodes num_rows packed rgb rows as a jpeg of their own. all segments use the same tables and restart
+// interval, so their entropy coded data can be joined with restart markers in between.
+static int _jpeg_encode_segment(const dt_imageio_jpeg_t *const jpg, const dt_imageio_jpeg_stream_t *const s,
+                                const uint8_t *const rgb, const int num_rows, const int first, JOCTET **out,
+                                size_t *out_len)
+{
+  struct jpeg_compress_struct cinfo;
+  struct dt_imageio_jpeg_error_mgr jerr;
+  dt_imageio_jpeg_mem_dest_t dest = { { 0 } };
+
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if(setjmp(jerr.setjmp_buffer))
+  {
+    jpeg_destroy_compress(&cinfo);
+    free(dest.buf);
+    return 1;
+  }
+  jpeg_create_compress(&cinfo);
+  dest.pub.init_destination = _mem_init_destination;
+  dest.pub.empty_output_buffer = _mem_empty_output_buffer;
+  dest.pub.term_destination = _mem_term_destination;
+  cinfo.dest = &dest.pub;
+
+  _jpeg_set_params(&cinfo, jpg, num_rows, s->resolution);
+  // huffman tables optimized per segment would differ between them
+  cinfo.optimize_coding = 0;
+  cinfo.restart_interval = s->restart_interval;
+  jpeg_start_compress(&cinfo, TRUE);
+  if(first && s->icc) write_icc_profile(&cinfo, s->icc, s->icc_len);
+
+  for(int y = 0; y < num_rows; y++)
+  {
+    JSAMPROW tmp[1];
+    tmp[0] = (JSAMPROW)(rgb + (size_t)3 * jpg->width * y);
+    jpeg_write_scanlines(&cinfo, tmp, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+
+  *out = dest.buf;
+  *out_len = dest.size - dest.pub.free_in_buffer;
+  jpeg_destroy_compress(&cinfo);
+  return 0;
+}
+
+// returns the offset of the entropy coded data in a jpeg written by libjpeg, the end of the SOS header, and
+// the position of the SOF marker in sof. returns 0 if the markers can't be parsed.
+static size_t _jpeg_find_scan(const JOCTET *const buf, const size_t len, size_t *sof)
+{
+  size_t pos = 2; // SOI
+  while(pos + 4 <= len)
+  {
+    if(buf[pos] != 0xFF) return 0;
+    const int marker = buf[pos + 1];
+    const size_t length = ((size_t)buf[pos + 2] << 8) | buf[pos + 3];
+    if(marker >= 0xC0 && marker <= 0xC2) *sof = pos;
+    pos += 2 + length;
+    if(marker == 0xDA) return pos <= len ? pos : 0;
+  }
+  return 0;
+}
+
+// encodes the pending rows in parallel and appends the segments to the file: the headers of the first one,
+// then the entropy coded data of each with a restart marker in between.
+static int _jpeg_flush_segments(const dt_imageio_jpeg_t *const jpg, dt_imageio_jpeg_stream_t *s)
+{
+  const dt_imageio_jpeg_stream_t *const cs = s;
+  const int count = (s->pending_rows + s->segment_rows - 1) / s->segment_rows;
+  const int first = s->segments;
+  JOCTET **out = (JOCTET **)calloc(count, sizeof(JOCTET *));
+  size_t *out_len = (size_t *)calloc(count, sizeof(size_t));
+  if(!out || !out_len)
+  {
+    free(out);
+    free(out_len);
+    return 1;
   }
 
-  jpeg_start_compress(&(jpg->cinfo), TRUE);
+  int failed = 0;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(out, out_len) schedule(dynamic) num_threads(cs->threads) \
+    reduction(| : failed)
+#endif
+  for(int k = 0; k < count; k++)
+  {
+    const int row = k * cs->segment_rows;
+    const int num_rows = MIN(cs->segment_rows, cs->pending_rows - row);
+    failed |= _jpeg_encode_segment(jpg, cs, cs->pending + (size_t)3 * jpg->width * row, num_rows,
+                                   first + k == 0, &out[k], &out_len[k]);
+  }
 
+  for(int k = 0; k < count && !failed; k++)
+  {
+    size_t sof = 0;
+    const size_t start = _jpeg_find_scan(out[k], out_len[k], &sof);
+    // the data ends with the EOI marker
+    if(!start || !sof || out_len[k] < start + 2)
+    {
+      failed = 1;
+      break;
+    }
+    if(s->segments == 0)
+    {
+      // the headers describe the whole image
+      out[k][sof + 5] = (jpg->height >> 8) & 0xFF;
+      out[k][sof + 6] = jpg->height & 0xFF;
+      if(fwrite(out[k], 1, start, s->f) != start) failed = 1;
+    }
+    else
+    {
+      const JOCTET rst[2] = { 0xFF, JPEG_RST0 + ((s->segments - 1) & 7) };
+      if(fwrite(rst, 1, sizeof(rst), s->f) != sizeof(rst)) failed = 1;
+    }
+    const size_t data_len = out_len[k] - start - 2;
+    if(fwrite(out[k] + start, 1, data_len, s->f) != data_len) failed = 1;
+    s->segments++;
+  }
+
+  for(int k = 0; k < count; k++) free(out[k]);
+  free(out);
+  free(out_len);
+  s->pending_rows = 0;
+  return failed;
+}
+
+void *write_image_begin(dt_imageio_module_data_t *jpg_tmp, const char *filename,
+                        dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                        void *exif, int exif_len, int imgid, int num, int total)
+{
+  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
+  // libjpeg longjmp()s out of errors, so everything it touches has to outlive this function
+  dt_imageio_jpeg_stream_t *s = (dt_imageio_jpeg_stream_t *)calloc(1, sizeof(dt_imageio_jpeg_stream_t));
+  if(!s) return NULL;
+  const double start = dt_get_wtime();
+
+  s->cinfo.err = jpeg_std_error(&s->jerr.pub);
+  s->jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if(setjmp(s->jerr.setjmp_buffer))
+  {
+    _stream_free(s);
+    return NULL;
+  }
+  jpeg_create_compress(&(s->cinfo));
+  s->f = g_fopen(filename, "wb");
+  if(!s->f)
+  {
+    _stream_free(s);
+    return NULL;
+  }
+
+  s->resolution = dt_conf_get_int("metadata/resolution");
+  _jpeg_set_params(&(s->cinfo), jpg, jpg->height, s->resolution);
+
+  unsigned char *icc = NULL;
+  uint32_t icc_len = 0;
   if(imgid > 0)
   {
     cmsHPROFILE out_profile = dt_colorspaces_get_output_profile(imgid, over_type, over_filename)->profile;
-    uint32_t len = 0;
-    cmsSaveProfileToMem(out_profile, 0, &len);
-    if(len > 0)
+    cmsSaveProfileToMem(out_profile, 0, &icc_len);
+    if(icc_len > 0)
+    {
+      icc = malloc(icc_len * sizeof(unsigned char));
+      if(icc) cmsSaveProfileToMem(out_profile, icc, &icc_len);
+    }
+  }
+
+  // segments have to consist of whole MCU rows, and the restart interval counts MCUs and is limited to 16 bits
+  const int mcu_width = 8 * MAX(s->cinfo.comp_info[0].h_samp_factor, 1);
+  const int mcu_height = 8 * MAX(s->cinfo.comp_info[0].v_samp_factor, 1);
+  const unsigned int mcus_per_row = (jpg->width + mcu_width - 1) / mcu_width;
+  const int mcu_rows = MIN(128 / mcu_height, (int)(65535 / mcus_per_row));
+  const int threads = jpg->multithread ? dt_get_num_threads() : 1;
+
+  if(threads > 1 && mcu_rows > 0 && jpg->height > mcu_rows * mcu_height)
+  {
+    s->threads = threads;
+    s->segment_rows = mcu_rows * mcu_height;
+    s->restart_interval = mcu_rows * mcus_per_row;
+    s->pending = malloc((size_t)3 * jpg->width * s->segment_rows * threads);
+    s->icc = icc;
+    s->icc_len = icc_len;
+    if(!s->pending)
+    {
+      _stream_free(s);
+      return NULL;
+    }
+  }
+  else
+  {
+    s->threads = 1;
+    jpeg_stdio_dest(&(s->cinfo), s->f);
+    jpeg_start_compress(&(s->cinfo), TRUE);
+    if(icc) write_icc_profile(&(s->cinfo), icc, icc_len);
+    free(icc);
+
+    s->row = malloc((size_t)3 * jpg->width * sizeof(uint8_t));
+    if(!s->row)
+    {
+      _stream_free(s);
+      return NULL;
+    }
+  }
+
+  s->filename = g_strdup(filename);
+  s->exif = exif;
+  s->exif_len = exif_len;
+  s->encode_time = dt_get_wtime() - start;
+
+  return s;
+}
+
+int write_image_rows(dt_imageio_module_data_t *jpg_tmp, void *handle, const void *in_tmp, int row, int num_rows)
+{
+  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
+  dt_imageio_jpeg_stream_t *s = (dt_imageio_jpeg_stream_t *)handle;
+  const uint8_t *in = (const uint8_t *)in_tmp;
+
+  if(s->rc) return 1;
+  const double start = dt_get_wtime();
+
+  if(s->threads > 1)
+  {
+    if(row != s->next_row)
+    {
+      s->rc = 1;
+      return 1;
+    }
+    for(int y = 0; y < num_rows && !s->rc; y++)
     {
-      unsigned char *buf = malloc(len * sizeof(unsigned char));
-      cmsSaveProfileToMem(out_profile, buf, &len);
-      write_icc_profile(&(jpg->cinfo), buf, len);
-      free(buf);
+      const uint8_t *buf = in + (size_t)y * jpg->width * 4;
+      uint8_t *out = s->pending + (size_t)3 * jpg->width * s->pending_rows;
+      for(int i = 0; i < jpg->width; i++)
+        for(int k = 0; k < 3; k++) out[3 * i + k] = buf[4 * i + k];
+      s->pending_rows++;
+      s->next_row++;
+      if(s->pending_rows == s->segment_rows * s->threads) s->rc = _jpeg_flush_segments(jpg, s);
     }
+    s->encode_time += dt_get_wtime() - start;
+    return s->rc;
   }
 
-  uint8_t *row = malloc((size_t)3 * jpg->width * sizeof(uint8_t));
-  const uint8_t *buf;
-  while(jpg->cinfo.next_scanline < jpg->cinfo.image_height)
+  if(setjmp(s->jerr.setjmp_buffer))
+  {
+    s->rc = 1;
+    return 1;
+  }
+
+  // rows have to come in order, libjpeg keeps track of where we are
+  if((JDIMENSION)row != s->cinfo.next_scanline)
+  {
+    s->rc = 1;
+    return 1;
+  }
+
+  for(int y = 0; y < num_rows; y++)
   {
     JSAMPROW tmp[1];
-    buf = in + (size_t)jpg->cinfo.next_scanline * jpg->cinfo.image_width * 4;
+    const uint8_t *buf = in + (size_t)y * jpg->width * 4;
     for(int i = 0; i < jpg->width; i++)
-      for(int k = 0; k < 3; k++) row[3 * i + k] = buf[4 * i + k];
-    tmp[0] = row;
-    jpeg_write_scanlines(&(jpg->cinfo), tmp, 1);
+      for(int k = 0; k < 3; k++) s->row[3 * i + k] = buf[4 * i + k];
+    tmp[0] = s->row;
+    jpeg_write_scanlines(&(s->cinfo), tmp, 1);
   }
-  jpeg_finish_compress(&(jpg->cinfo));
-  free(row);
-  jpeg_destroy_compress(&(jpg->cinfo));
-  fclose(f);
-
-  dt_exif_write_blob(exif, exif_len, filename, 1);
 
+  s->encode_time += dt_get_wtime() - start;
   return 0;
 }
 
+int write_image_finish(dt_imageio_module_data_t *jpg_tmp, void *handle)
+{
+  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
+  dt_imageio_jpeg_stream_t *s = (dt_imageio_jpeg_stream_t *)handle;
+  const double start = dt_get_wtime();
+
+  if(s->threads > 1)
+  {
+    if(!s->rc && s->next_row < jpg->height) s->rc = 1;
+    if(!s->rc && s->pending_rows) s->rc = _jpeg_flush_segments(jpg, s);
+    if(!s->rc)
+    {
+      const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+      if(fwrite(eoi, 1, sizeof(eoi), s->f) != sizeof(eoi)) s->rc = 1;
+    }
+  }
+  else
+  {
+    if(!s->rc && s->cinfo.next_scanline < s->cinfo.image_height) s->rc = 1;
+    if(!s->rc)
+    {
+      if(setjmp(s->jerr.setjmp_buffer))
+        s->rc = 1;
+      else
+        jpeg_finish_compress(&(s->cinfo));
+    }
+  }
+
+  if(fclose(s->f)) s->rc = 1;
+  s->f = NULL;
+  const int rc = s->rc;
+
+  dt_print(DT_DEBUG_PERF, "[jpeg] encoded %dx%d using %d thread(s) in %.3f secs\n", jpg->width, jpg->height,
+           s->threads, s->encode_time + dt_get_wtime() - start);
+
+  if(!rc) dt_exif_write_blob(s->exif, s->exif_len, s->filename, 1);
+
+  _stream_free(s);
+  return rc;
+}
+
+int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const void *in_tmp,
+                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                void *exif, int exif_len, int imgid, int num, int total)
+{
+  void *handle = write_image_begin(jpg_tmp, filename, over_type, over_filename, exif, exif_len, imgid, num, total);
+  if(!handle) return 1;
+  write_image_rows(jpg_tmp, handle, in_tmp, 0, ((dt_imageio_jpeg_t *)jpg_tmp)->height);
+  return write_image_finish(jpg_tmp, handle);
+}
+
 static int __attribute__((__unused__)) read_header(const char *filename, dt_imageio_jpeg_t *jpg)
 {
   jpg->f = g_fopen(filename, "rb");
@@ -469,14 +818,14 @@ int read_image(dt_imageio_module_data_t *jpg_tmp, uint8_t *out)
 
 size_t params_size(dt_imageio_module_format_t *self)
 {
-  return sizeof(dt_imageio_module_data_t) + sizeof(int);
+  return sizeof(dt_imageio_module_data_t) + 2 * sizeof(int);
 }
 
 void *legacy_params(dt_imageio_module_format_t *self, const void *const old_params,
                     const size_t old_params_size, const int old_version, const int new_version,
                     size_t *new_size)
 {
-  if(old_version == 1 && new_version == 2)
+  if(old_version == 1 && new_version == 3)
   {
     typedef struct dt_imageio_jpeg_v1_t
     {
@@ -501,6 +850,42 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
     g_strlcpy(n->style, o->style, sizeof(o->style));
     n->style_append = 0;
     n->quality = o->quality;
+    n->multithread = 0;
+    n->src = o->src;
+    n->dest = o->dest;
+    n->dinfo = o->dinfo;
+    n->cinfo = o->cinfo;
+    n->f = o->f;
+    *new_size = self->params_size(self);
+    return n;
+  }
+  else if(old_version == 2 && new_version == 3)
+  {
+    typedef struct dt_imageio_jpeg_v2_t
+    {
+      int max_width, max_height;
+      int width, height;
+      char style[128];
+      gboolean style_append;
+      int quality;
+      struct jpeg_source_mgr src;
+      struct jpeg_destination_mgr dest;
+      struct jpeg_decompress_struct dinfo;
+      struct jpeg_compress_struct cinfo;
+      FILE *f;
+    } dt_imageio_jpeg_v2_t;
+
+    const dt_imageio_jpeg_v2_t *o = (dt_imageio_jpeg_v2_t *)old_params;
+    dt_imageio_jpeg_t *n = (dt_imageio_jpeg_t *)malloc(sizeof(dt_imageio_jpeg_t));
+
+    n->max_width = o->max_width;
+    n->max_height = o->max_height;
+    n->width = o->width;
+    n->height = o->height;
+    g_strlcpy(n->style, o->style, sizeof(o->style));
+    n->style_append = o->style_append;
+    n->quality = o->quality;
+    n->multithread = 0;
     n->src = o->src;
     n->dest = o->dest;
     n->dinfo = o->dinfo;
@@ -518,6 +903,7 @@ void *get_params(dt_imageio_module_format_t *self)
   dt_imageio_jpeg_t *d = (dt_imageio_jpeg_t *)calloc(1, sizeof(dt_imageio_jpeg_t));
   d->quality = dt_conf_get_int("plugins/imageio/format/jpeg/quality");
   if(d->quality <= 0 || d->quality > 100) d->quality = 100;
+  d->multithread = dt_conf_get_bool("plugins/imageio/format/jpeg/multithread");
   return d;
 }
 
@@ -532,6 +918,7 @@ int set_params(dt_imageio_module_format_t *self, const void *params, const int s
   const dt_imageio_jpeg_t *d = (dt_imageio_jpeg_t *)params;
   dt_imageio_jpeg_gui_data_t *g = (dt_imageio_jpeg_gui_data_t *)self->gui_data;
   dt_bauhaus_slider_set(g->quality, d->quality);
+  dt_bauhaus_combobox_set(g->multithread, d->multithread != 0);
   return 0;
 }
 
@@ -585,12 +972,17 @@ static void quality_changed(GtkWidget *slider, gpointer user_data)
   dt_conf_set_int("plugins/imageio/format/jpeg/quality", quality);
 }
 
+static void multithread_changed(GtkWidget *widget, gpointer user_data)
+{
+  dt_conf_set_bool("plugins/imageio/format/jpeg/multithread", dt_bauhaus_combobox_get(widget) == 1);
+}
+
 void gui_init(dt_imageio_module_format_t *self)
 {
   dt_imageio_jpeg_gui_data_t *g = (dt_imageio_jpeg_gui_data_t *)malloc(sizeof(dt_imageio_jpeg_gui_data_t));
   self->gui_data = g;
   // construct gui with jpeg specific options:
-  GtkWidget *box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 20);
+  GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, DT_PIXEL_APPLY_DPI(5));
   self->widget = box;
   // quality slider
   g->quality = dt_bauhaus_slider_new_with_range(NULL, 5, 100, 1, 95, 0);
@@ -598,6 +990,16 @@ void gui_init(dt_imageio_module_format_t *self)
   dt_bauhaus_slider_set_default(g->quality, 95);
   gtk_box_pack_start(GTK_BOX(box), GTK_WIDGET(g->quality), TRUE, TRUE, 0);
   g_signal_connect(G_OBJECT(g->quality), "value-changed", G_CALLBACK(quality_changed), NULL);
+  // multithreaded encoding
+  g->multithread = dt_bauhaus_combobox_new(NULL);
+  dt_bauhaus_widget_set_label(g->multithread, NULL, _("multithreaded"));
+  dt_bauhaus_combobox_add(g->multithread, _("no"));
+  dt_bauhaus_combobox_add(g->multithread, _("yes"));
+  dt_bauhaus_combobox_set(g->multithread, dt_conf_get_bool("plugins/imageio/format/jpeg/multithread"));
+  gtk_widget_set_tooltip_text(g->multithread, _("encode parts of the image in parallel. files get a little "
+                                                "bigger as the huffman tables can't be optimized for the image"));
+  gtk_box_pack_start(GTK_BOX(box), g->multithread, TRUE, TRUE, 0);
+  g_signal_connect(G_OBJECT(g->multithread), "value-changed", G_CALLBACK(multithread_changed), NULL);
   // TODO: add more options: subsample dreggn
 }
 
@@ -610,6 +1012,7 @@ void gui_reset(dt_imageio_module_format_t *self)
 {
   dt_imageio_jpeg_gui_data_t *g = (dt_imageio_jpeg_gui_data_t *)self->gui_data;
   dt_bauhaus_slider_set(g->quality, dt_conf_get_int("plugins/imageio/format/jpeg/quality"));
+  dt_bauhaus_combobox_set(g->multithread, dt_conf_get_bool("plugins/imageio/format/jpeg/multithread"));
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
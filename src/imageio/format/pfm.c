@@ -28,50 +28,95 @@
 
 DT_MODULE(1)
 
-int write_image(dt_imageio_module_data_t *data, const char *filename, const void *ivoid,
-                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, int imgid, int num, int total)
+typedef struct dt_imageio_pfm_stream_t
+{
+  FILE *f;
+  long data_offset;
+  float *buf_line;
+  int status;
+} dt_imageio_pfm_stream_t;
+
+void *write_image_begin(dt_imageio_module_data_t *data, const char *filename,
+                        dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                        void *exif, int exif_len, int imgid, int num, int total)
 {
   const dt_imageio_module_data_t *const pfm = data;
-  int status = 0;
   FILE *f = g_fopen(filename, "wb");
-  if(f)
+  if(!f) return NULL;
+
+  // align pfm header to sse, assuming the file will
+  // be mmapped to page boundaries.
+  char header[1024];
+  snprintf(header, 1024, "PF\n%d %d\n-1.0", pfm->width, pfm->height);
+  size_t len = strlen(header);
+  fprintf(f, "PF\n%d %d\n-1.0", pfm->width, pfm->height);
+  ssize_t off = 0;
+  while((len + 1 + off) & 0xf) off++;
+  while(off-- > 0) fprintf(f, "0");
+  fprintf(f, "\n");
+
+  dt_imageio_pfm_stream_t *s = (dt_imageio_pfm_stream_t *)calloc(1, sizeof(dt_imageio_pfm_stream_t));
+  float *buf_line = dt_alloc_align(16, 3 * sizeof(float) * pfm->width);
+  if(!s || !buf_line)
   {
-    // align pfm header to sse, assuming the file will
-    // be mmapped to page boundaries.
-    char header[1024];
-    snprintf(header, 1024, "PF\n%d %d\n-1.0", pfm->width, pfm->height);
-    size_t len = strlen(header);
-    fprintf(f, "PF\n%d %d\n-1.0", pfm->width, pfm->height);
-    ssize_t off = 0;
-    while((len + 1 + off) & 0xf) off++;
-    while(off-- > 0) fprintf(f, "0");
-    fprintf(f, "\n");
-    void *buf_line = dt_alloc_align(16, 3 * sizeof(float) * pfm->width);
-    for(int j = 0; j < pfm->height; j++)
-    {
-      // NOTE: pfm has rows in reverse order
-      const int row_in = pfm->height - 1 - j;
-      const float *in = (const float *)ivoid + 4 * (size_t)pfm->width * row_in;
-      float *out = (float *)buf_line;
-      for(int i = 0; i < pfm->width; i++, in += 4, out += 3)
-      {
-        memcpy(out, in, 3 * sizeof(float));
-      }
-      // INFO: per-line fwrite call seems to perform best. LebedevRI, 18.04.2014
-      int cnt = fwrite(buf_line, 3 * sizeof(float), pfm->width, f);
-      if(cnt != pfm->width)
-        status = 1;
-      else
-        status = 0;
-    }
+    free(s);
     dt_free_align(buf_line);
-    buf_line = NULL;
     fclose(f);
+    return NULL;
+  }
+  s->f = f;
+  s->data_offset = ftell(f);
+  s->buf_line = buf_line;
+  return s;
+}
+
+int write_image_rows(dt_imageio_module_data_t *data, void *handle, const void *ivoid, int row, int num_rows)
+{
+  const dt_imageio_module_data_t *const pfm = data;
+  dt_imageio_pfm_stream_t *s = (dt_imageio_pfm_stream_t *)handle;
+  const size_t line_size = 3 * sizeof(float) * pfm->width;
+
+  // NOTE: pfm has rows in reverse order, so the last row of the strip comes first in the file
+  if(fseek(s->f, s->data_offset + (long)line_size * (pfm->height - row - num_rows), SEEK_SET))
+  {
+    s->status = 1;
+    return 1;
   }
+  for(int j = num_rows - 1; j >= 0; j--)
+  {
+    const float *in = (const float *)ivoid + 4 * (size_t)pfm->width * j;
+    float *out = s->buf_line;
+    for(int i = 0; i < pfm->width; i++, in += 4, out += 3)
+    {
+      memcpy(out, in, 3 * sizeof(float));
+    }
+    // INFO: per-line fwrite call seems to perform best. LebedevRI, 18.04.2014
+    int cnt = fwrite(s->buf_line, 3 * sizeof(float), pfm->width, s->f);
+    if(cnt != pfm->width) s->status = 1;
+  }
+  return s->status;
+}
+
+int write_image_finish(dt_imageio_module_data_t *data, void *handle)
+{
+  dt_imageio_pfm_stream_t *s = (dt_imageio_pfm_stream_t *)handle;
+  const int status = s->status;
+  dt_free_align(s->buf_line);
+  fclose(s->f);
+  free(s);
   return status;
 }
 
+int write_image(dt_imageio_module_data_t *data, const char *filename, const void *ivoid,
+                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                void *exif, int exif_len, int imgid, int num, int total)
+{
+  void *handle = write_image_begin(data, filename, over_type, over_filename, exif, exif_len, imgid, num, total);
+  if(!handle) return 1;
+  write_image_rows(data, handle, ivoid, 0, data->height);
+  return write_image_finish(data, handle);
+}
+
 size_t params_size(dt_imageio_module_format_t *self)
 {
   return sizeof(dt_imageio_module_data_t);
@@ -26,6 +26,7 @@
 #include <png.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <zlib.h>
 
 #include "bauhaus/bauhaus.h"
@@ -36,7 +37,7 @@
 #include "control/conf.h"
 #include "imageio/format/imageio_format_api.h"
 
-DT_MODULE(3)
+DT_MODULE(4)
 
 typedef struct dt_imageio_png_t
 {
@@ -46,6 +47,7 @@ typedef struct dt_imageio_png_t
   gboolean style_append;
   int bpp;
   int compression;
+  int multithread;
   FILE *f;
   png_structp png_ptr;
   png_infop info_ptr;
@@ -55,6 +57,7 @@ typedef struct dt_imageio_png_gui_t
 {
   GtkWidget *bit_depth;
   GtkWidget *compression;
+  GtkWidget *multithread;
 } dt_imageio_png_gui_t;
 
 /* Write EXIF data to PNG file.
@@ -122,14 +125,212 @@ static void PNGwriteRawProfile(png_struct *ping, png_info *ping_info, char *prof
   png_free(ping, text);
 }
 
-int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const void *ivoid,
-                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, int imgid, int num, int total)
+typedef struct dt_imageio_png_stream_t
+{
+  FILE *f;
+  png_structp png_ptr;
+  png_infop info_ptr;
+  int next_row;
+  int rc;
+  double encode_time;
+
+  // multithreaded encoding: the rows are filtered here and cut into blocks which are deflated in parallel,
+  // each primed with the end of the previous one, and written as IDAT chunks of one zlib stream.
+  // rows are collected until every thread has a block to work on.
+  int threads;
+  int block_rows;
+  size_t rowbytes; // packed rgb row, without the filter type byte
+  uint8_t *pending;
+  int pending_rows;
+  uint8_t *prev; // last row of the previous batch, the filters refer to it
+  uint8_t *filtered;
+  uint8_t *dict;
+  size_t dict_len;
+  uLong adler;
+} dt_imageio_png_stream_t;
+
+#define PNG_DICT_SIZE 32768
+
+static void _stream_free(dt_imageio_png_stream_t *s)
+{
+  png_destroy_write_struct(&s->png_ptr, &s->info_ptr);
+  if(s->f) fclose(s->f);
+  free(s->pending);
+  free(s->prev);
+  free(s->filtered);
+  free(s->dict);
+  free(s);
+}
+
+static inline int _paeth(const int a, const int b, const int c)
+{
+  const int p = a + b - c;
+  const int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  return (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+}
+
+// writes the filter type byte and the filtered row to out. like libpng, this takes the filter with the
+// smallest sum of absolute differences.
+static void _png_filter_row(const uint8_t *const row, const uint8_t *const prev, uint8_t *const out,
+                            const size_t len, const int bpp)
+{
+  unsigned int sum[5] = { 0 };
+  for(size_t i = 0; i < len; i++)
+  {
+    const int x = row[i], b = prev[i];
+    const int a = i >= bpp ? row[i - bpp] : 0, c = i >= bpp ? prev[i - bpp] : 0;
+    sum[0] += abs((int8_t)x);
+    sum[1] += abs((int8_t)(uint8_t)(x - a));
+    sum[2] += abs((int8_t)(uint8_t)(x - b));
+    sum[3] += abs((int8_t)(uint8_t)(x - ((a + b) >> 1)));
+    sum[4] += abs((int8_t)(uint8_t)(x - _paeth(a, b, c)));
+  }
+  int best = 0;
+  for(int f = 1; f < 5; f++)
+    if(sum[f] < sum[best]) best = f;
+
+  out[0] = best;
+  uint8_t *const o = out + 1;
+  switch(best)
+  {
+    case 0:
+      memcpy(o, row, len);
+      break;
+    case 1:
+      for(size_t i = 0; i < len; i++) o[i] = row[i] - (i >= bpp ? row[i - bpp] : 0);
+      break;
+    case 2:
+      for(size_t i = 0; i < len; i++) o[i] = row[i] - prev[i];
+      break;
+    case 3:
+      for(size_t i = 0; i < len; i++) o[i] = row[i] - (((i >= bpp ? row[i - bpp] : 0) + prev[i]) >> 1);
+      break;
+    default:
+      for(size_t i = 0; i < len; i++)
+        o[i] = row[i] - (i >= bpp ? _paeth(row[i - bpp], prev[i], prev[i - bpp]) : prev[i]);
+      break;
+  }
+}
+
+// raw deflate of one block, ending on a byte boundary so the next block can simply be appended
+static int _png_deflate_block(const uint8_t *const in, const size_t len, const uint8_t *const dict,
+                              const size_t dict_len, const int level, uint8_t **out, size_t *out_len)
+{
+  z_stream z = { 0 };
+  *out = NULL;
+  *out_len = 0;
+  if(deflateInit2(&z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return 1;
+  if(dict_len) deflateSetDictionary(&z, dict, dict_len);
+
+  // deflateBound() is for Z_FINISH, leave some room for the empty stored block of the sync flush
+  const size_t bound = deflateBound(&z, len) + 16;
+  *out = malloc(bound);
+  if(!*out)
+  {
+    deflateEnd(&z);
+    return 1;
+  }
+  z.next_in = (Bytef *)in;
+  z.avail_in = len;
+  z.next_out = *out;
+  z.avail_out = bound;
+  const int ret = deflate(&z, Z_SYNC_FLUSH);
+  *out_len = bound - z.avail_out;
+  const int failed = ret != Z_OK || z.avail_in != 0;
+  deflateEnd(&z);
+  return failed;
+}
+
+// filters and compresses the pending rows in parallel and appends them to the file
+static int _png_flush_blocks(dt_imageio_png_t *p, dt_imageio_png_stream_t *s)
+{
+  const dt_imageio_png_stream_t *const cs = s;
+  const int count = (s->pending_rows + s->block_rows - 1) / s->block_rows;
+  const int level = p->compression;
+  const int bpp = 3 * p->bpp / 8;
+  const size_t filtered_row = s->rowbytes + 1;
+  uint8_t **out = (uint8_t **)calloc(count, sizeof(uint8_t *));
+  size_t *out_len = (size_t *)calloc(count, sizeof(size_t));
+  uLong *adler = (uLong *)calloc(count, sizeof(uLong));
+  if(!out || !out_len || !adler)
+  {
+    free(out);
+    free(out_len);
+    free(adler);
+    return 1;
+  }
+
+  // all blocks have to be filtered before any is compressed, each one looks back into the previous one
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static) num_threads(cs->threads)
+#endif
+  for(int y = 0; y < cs->pending_rows; y++)
+  {
+    const uint8_t *const prev = y ? cs->pending + cs->rowbytes * (y - 1) : cs->prev;
+    _png_filter_row(cs->pending + cs->rowbytes * y, prev, cs->filtered + filtered_row * y, cs->rowbytes, bpp);
+  }
+
+  int failed = 0;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(out, out_len, adler) schedule(dynamic) \
+    num_threads(cs->threads) reduction(| : failed)
+#endif
+  for(int k = 0; k < count; k++)
+  {
+    const int row = k * cs->block_rows;
+    const int num_rows = MIN(cs->block_rows, cs->pending_rows - row);
+    const uint8_t *const filtered = cs->filtered + filtered_row * row;
+    const size_t len = filtered_row * num_rows;
+    adler[k] = adler32(adler32(0L, Z_NULL, 0), filtered, len);
+
+    // the end of the previous block primes the window, which keeps the compression ratio close to a single
+    // stream. the first block of a batch uses what is left over from the last batch.
+    const uint8_t *dict = cs->dict;
+    size_t dict_len = cs->dict_len;
+    if(k > 0)
+    {
+      dict_len = MIN(filtered_row * cs->block_rows, PNG_DICT_SIZE);
+      dict = filtered - dict_len;
+    }
+    failed |= _png_deflate_block(filtered, len, dict, dict_len, level, &out[k], &out_len[k]);
+  }
+
+  for(int k = 0; k < count && !failed; k++)
+  {
+    const size_t len = filtered_row * MIN(s->block_rows, s->pending_rows - k * s->block_rows);
+    s->adler = adler32_combine(s->adler, adler[k], len);
+    png_write_chunk(s->png_ptr, (png_bytep) "IDAT", out[k], out_len[k]);
+  }
+
+  if(!failed)
+  {
+    // keep the last rows around for the filters and the window of the next batch
+    const size_t total = filtered_row * s->pending_rows;
+    const size_t keep = MIN(total, PNG_DICT_SIZE);
+    const size_t old = MIN(s->dict_len, PNG_DICT_SIZE - keep);
+    memmove(s->dict, s->dict + s->dict_len - old, old);
+    memcpy(s->dict + old, s->filtered + total - keep, keep);
+    s->dict_len = old + keep;
+    memcpy(s->prev, s->pending + s->rowbytes * (s->pending_rows - 1), s->rowbytes);
+  }
+
+  for(int k = 0; k < count; k++) free(out[k]);
+  free(out);
+  free(out_len);
+  free(adler);
+  s->pending_rows = 0;
+  return failed;
+}
+
+void *write_image_begin(dt_imageio_module_data_t *p_tmp, const char *filename,
+                        dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                        void *exif, int exif_len, int imgid, int num, int total)
 {
   dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
   const int width = p->width, height = p->height;
+  const double start = dt_get_wtime();
   FILE *f = g_fopen(filename, "wb");
-  if(!f) return 1;
+  if(!f) return NULL;
 
   png_structp png_ptr;
   png_infop info_ptr;
@@ -138,7 +339,7 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
   if(!png_ptr)
   {
     fclose(f);
-    return 1;
+    return NULL;
   }
 
   info_ptr = png_create_info_struct(png_ptr);
@@ -146,14 +347,14 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
   {
     fclose(f);
     png_destroy_write_struct(&png_ptr, NULL);
-    return 1;
+    return NULL;
   }
 
   if(setjmp(png_jmpbuf(png_ptr)))
   {
     fclose(f);
     png_destroy_write_struct(&png_ptr, &info_ptr);
-    return 1;
+    return NULL;
   }
 
   png_init_io(png_ptr, f);
@@ -205,28 +406,156 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
    */
   png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
 
-  png_bytep *row_pointers = malloc((size_t)height * sizeof(png_bytep));
+  /* swap bytes of 16 bit files to most significant bit first */
+  if(p->bpp > 8) png_set_swap(png_ptr);
+
+  dt_imageio_png_stream_t *s = (dt_imageio_png_stream_t *)calloc(1, sizeof(dt_imageio_png_stream_t));
+  if(!s)
+  {
+    fclose(f);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    return NULL;
+  }
+  s->f = f;
+  s->png_ptr = png_ptr;
+  s->info_ptr = info_ptr;
+  s->threads = 1;
+
+  // blocks of at least 256k, smaller ones don't compress as well and aren't worth a thread
+  const size_t rowbytes = (size_t)3 * width * p->bpp / 8;
+  const int block_rows = MAX(1, (int)((256 << 10) / rowbytes));
+  const int threads = p->multithread ? dt_get_num_threads() : 1;
+  if(threads > 1 && height > block_rows)
+  {
+    s->threads = threads;
+    s->block_rows = block_rows;
+    s->rowbytes = rowbytes;
+    s->pending = malloc(rowbytes * block_rows * threads);
+    s->filtered = malloc((rowbytes + 1) * block_rows * threads);
+    // the row above the first one counts as all zeros
+    s->prev = calloc(1, rowbytes);
+    s->dict = malloc(PNG_DICT_SIZE);
+    s->adler = adler32(0L, Z_NULL, 0);
+    if(!s->pending || !s->filtered || !s->prev || !s->dict)
+    {
+      _stream_free(s);
+      return NULL;
+    }
+    // the zlib header, the blocks are raw deflate data
+    const uint8_t header[2] = { 0x78, 0x9c };
+    png_write_chunk(png_ptr, (png_bytep) "IDAT", (png_bytep)header, sizeof(header));
+  }
+
+  s->encode_time = dt_get_wtime() - start;
+  return s;
+}
+
+int write_image_rows(dt_imageio_module_data_t *p_tmp, void *handle, const void *ivoid, int row, int num_rows)
+{
+  dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
+  dt_imageio_png_stream_t *s = (dt_imageio_png_stream_t *)handle;
+  const size_t rowsize = (size_t)4 * p->width * (p->bpp > 8 ? sizeof(uint16_t) : sizeof(uint8_t));
+
+  if(s->rc) return 1;
+
+  // libpng longjmp()s here on errors, it has to be set up in every function calling into it
+  if(setjmp(png_jmpbuf(s->png_ptr)))
+  {
+    s->rc = 1;
+    return 1;
+  }
 
-  if(p->bpp > 8)
+  // rows have to come in order
+  if(row != s->next_row)
   {
-    /* swap bytes of 16 bit files to most significant bit first */
-    png_set_swap(png_ptr);
+    s->rc = 1;
+    return 1;
+  }
 
-    for(unsigned i = 0; i < height; i++) row_pointers[i] = (png_bytep)((uint16_t *)ivoid + (size_t)4 * i * width);
+  const double start = dt_get_wtime();
+  if(s->threads > 1)
+  {
+    for(int i = 0; i < num_rows && !s->rc; i++)
+    {
+      // drop the filler, 16 bit samples are stored most significant byte first
+      uint8_t *out = s->pending + s->rowbytes * s->pending_rows;
+      if(p->bpp > 8)
+      {
+        const uint16_t *in = (const uint16_t *)((const uint8_t *)ivoid + i * rowsize);
+        for(int x = 0; x < p->width; x++)
+          for(int c = 0; c < 3; c++)
+          {
+            out[6 * x + 2 * c] = in[4 * x + c] >> 8;
+            out[6 * x + 2 * c + 1] = in[4 * x + c] & 0xff;
+          }
+      }
+      else
+      {
+        const uint8_t *in = (const uint8_t *)ivoid + i * rowsize;
+        for(int x = 0; x < p->width; x++)
+          for(int c = 0; c < 3; c++) out[3 * x + c] = in[4 * x + c];
+      }
+      s->pending_rows++;
+      if(s->pending_rows == s->block_rows * s->threads) s->rc = _png_flush_blocks(p, s);
+    }
   }
   else
+    for(int i = 0; i < num_rows; i++) png_write_row(s->png_ptr, (png_bytep)((uint8_t *)ivoid + i * rowsize));
+  s->next_row += num_rows;
+  s->encode_time += dt_get_wtime() - start;
+
+  return s->rc;
+}
+
+int write_image_finish(dt_imageio_module_data_t *p_tmp, void *handle)
+{
+  dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
+  dt_imageio_png_stream_t *s = (dt_imageio_png_stream_t *)handle;
+  const double start = dt_get_wtime();
+
+  if(!s->rc && s->next_row < p->height) s->rc = 1;
+  if(!s->rc)
   {
-    for(unsigned i = 0; i < height; i++) row_pointers[i] = (uint8_t *)ivoid + (size_t)4 * i * width;
+    if(setjmp(png_jmpbuf(s->png_ptr)))
+      s->rc = 1;
+    else if(s->threads > 1)
+    {
+      if(s->pending_rows) s->rc = _png_flush_blocks(p, s);
+      if(!s->rc)
+      {
+        // an empty final block and the checksum end the zlib stream. png_write_end() would insist on the
+        // pixels having been written through libpng, the IEND chunk is all it would add here.
+        const uint8_t tail[6] = { 0x03, 0x00, (s->adler >> 24) & 0xff, (s->adler >> 16) & 0xff,
+                                  (s->adler >> 8) & 0xff, s->adler & 0xff };
+        png_write_chunk(s->png_ptr, (png_bytep) "IDAT", (png_bytep)tail, sizeof(tail));
+        png_write_chunk(s->png_ptr, (png_bytep) "IEND", NULL, 0);
+      }
+    }
+    else
+      png_write_end(s->png_ptr, s->info_ptr);
   }
 
-  png_write_image(png_ptr, row_pointers);
+  if(fclose(s->f)) s->rc = 1;
+  s->f = NULL;
+  const int rc = s->rc;
 
-  free(row_pointers);
+  dt_print(DT_DEBUG_PERF, "[png] encoded %dx%d using %d thread(s) in %.3f secs\n", p->width, p->height,
+           s->threads, s->encode_time + dt_get_wtime() - start);
 
-  png_write_end(png_ptr, info_ptr);
-  png_destroy_write_struct(&png_ptr, &info_ptr);
-  fclose(f);
-  return 0;
+  _stream_free(s);
+  return rc;
+}
+
+#undef PNG_DICT_SIZE
+
+int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const void *ivoid,
+                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                void *exif, int exif_len, int imgid, int num, int total)
+{
+  void *handle = write_image_begin(p_tmp, filename, over_type, over_filename, exif, exif_len, imgid, num, total);
+  if(!handle) return 1;
+  write_image_rows(p_tmp, handle, ivoid, 0, ((dt_imageio_png_t *)p_tmp)->height);
+  return write_image_finish(p_tmp, handle);
 }
 
 static int __attribute__((__unused__)) read_header(const char *filename, dt_imageio_module_data_t *p_tmp)
@@ -352,13 +681,13 @@ int read_image(dt_imageio_module_data_t *p_tmp, uint8_t *out)
 
 size_t params_size(dt_imageio_module_format_t *self)
 {
-  return sizeof(dt_imageio_module_data_t) + 2 * sizeof(int);
+  return sizeof(dt_imageio_module_data_t) + 3 * sizeof(int);
 }
 
 void *legacy_params(dt_imageio_module_format_t *self, const void *const old_params, const size_t old_params_size,
                     const int old_version, const int new_version, size_t *new_size)
 {
-  if(old_version == 1 && new_version == 3)
+  if(old_version == 1 && new_version == 4)
   {
     typedef struct dt_imageio_png_v1_t
     {
@@ -382,13 +711,14 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
     n->style_append = 0;
     n->bpp = o->bpp;
     n->compression = Z_BEST_COMPRESSION;
+    n->multithread = 0;
     n->f = o->f;
     n->png_ptr = o->png_ptr;
     n->info_ptr = o->info_ptr;
     *new_size = self->params_size(self);
     return n;
   }
-  else if(old_version == 2 && new_version == 3)
+  else if(old_version == 2 && new_version == 4)
   {
     typedef struct dt_imageio_png_v2_t
     {
@@ -413,6 +743,40 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
     n->style_append = o->style_append;
     n->bpp = o->bpp;
     n->compression = Z_BEST_COMPRESSION;
+    n->multithread = 0;
+    n->f = o->f;
+    n->png_ptr = o->png_ptr;
+    n->info_ptr = o->info_ptr;
+    *new_size = self->params_size(self);
+    return n;
+  }
+  else if(old_version == 3 && new_version == 4)
+  {
+    typedef struct dt_imageio_png_v3_t
+    {
+      int max_width, max_height;
+      int width, height;
+      char style[128];
+      gboolean style_append;
+      int bpp;
+      int compression;
+      FILE *f;
+      png_structp png_ptr;
+      png_infop info_ptr;
+    } dt_imageio_png_v3_t;
+
+    dt_imageio_png_v3_t *o = (dt_imageio_png_v3_t *)old_params;
+    dt_imageio_png_t *n = (dt_imageio_png_t *)malloc(sizeof(dt_imageio_png_t));
+
+    n->max_width = o->max_width;
+    n->max_height = o->max_height;
+    n->width = o->width;
+    n->height = o->height;
+    g_strlcpy(n->style, o->style, sizeof(o->style));
+    n->style_append = o->style_append;
+    n->bpp = o->bpp;
+    n->compression = o->compression;
+    n->multithread = 0;
     n->f = o->f;
     n->png_ptr = o->png_ptr;
     n->info_ptr = o->info_ptr;
@@ -440,6 +804,8 @@ void *get_params(dt_imageio_module_format_t *self)
     if(d->compression < 0 || d->compression > 9) d->compression = 5;
   }
 
+  d->multithread = dt_conf_get_bool("plugins/imageio/format/png/multithread");
+
   return d;
 }
 
@@ -460,6 +826,8 @@ int set_params(dt_imageio_module_format_t *self, const void *params, const int s
   dt_conf_set_int("plugins/imageio/format/png/bpp", d->bpp);
   dt_bauhaus_slider_set(g->compression, d->compression);
   dt_conf_set_int("plugins/imageio/format/png/compression", d->compression);
+  dt_bauhaus_combobox_set(g->multithread, d->multithread ? 1 : 0);
+  dt_conf_set_bool("plugins/imageio/format/png/multithread", d->multithread);
   return 0;
 }
 
@@ -500,6 +868,11 @@ static void compression_level_changed(GtkWidget *slider, gpointer user_data)
   dt_conf_set_int("plugins/imageio/format/png/compression", compression);
 }
 
+static void multithread_changed(GtkWidget *widget, gpointer user_data)
+{
+  dt_conf_set_bool("plugins/imageio/format/png/multithread", dt_bauhaus_combobox_get(widget) == 1);
+}
+
 void init(dt_imageio_module_format_t *self)
 {
 #ifdef USE_LUA
@@ -544,6 +917,17 @@ void gui_init(dt_imageio_module_format_t *self)
   dt_bauhaus_slider_set(gui->compression, compression);
   gtk_box_pack_start(GTK_BOX(self->widget), GTK_WIDGET(gui->compression), TRUE, TRUE, 0);
   g_signal_connect(G_OBJECT(gui->compression), "value-changed", G_CALLBACK(compression_level_changed), NULL);
+
+  // multithreaded compression
+  gui->multithread = dt_bauhaus_combobox_new(NULL);
+  dt_bauhaus_widget_set_label(gui->multithread, NULL, _("multithreaded"));
+  dt_bauhaus_combobox_add(gui->multithread, _("no"));
+  dt_bauhaus_combobox_add(gui->multithread, _("yes"));
+  dt_bauhaus_combobox_set(gui->multithread, dt_conf_get_bool("plugins/imageio/format/png/multithread"));
+  gtk_widget_set_tooltip_text(gui->multithread, _("compress blocks of rows in parallel. files get a little "
+                                                  "bigger"));
+  gtk_box_pack_start(GTK_BOX(self->widget), gui->multithread, TRUE, TRUE, 0);
+  g_signal_connect(G_OBJECT(gui->multithread), "value-changed", G_CALLBACK(multithread_changed), NULL);
 }
 
 void gui_cleanup(dt_imageio_module_format_t *self)
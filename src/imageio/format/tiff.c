@@ -53,9 +53,19 @@ typedef struct dt_imageio_tiff_gui_t
 } dt_imageio_tiff_gui_t;
 
 
-int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void,
-                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, int imgid, int num, int total)
+typedef struct dt_imageio_tiff_stream_t
+{
+  TIFF *tif;
+  void *rowdata;
+  char *filename;
+  void *exif;
+  int exif_len;
+  int rc;
+} dt_imageio_tiff_stream_t;
+
+void *write_image_begin(dt_imageio_module_data_t *d_tmp, const char *filename,
+                        dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                        void *exif, int exif_len, int imgid, int num, int total)
 {
   const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
 
@@ -66,7 +76,7 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
 
   void *rowdata = NULL;
 
-  int rc = 1; // default to error
+  dt_imageio_tiff_stream_t *s = NULL;
 
   if(imgid > 0)
   {
@@ -75,11 +85,7 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
     if(profile_len > 0)
     {
       profile = malloc(profile_len);
-      if(!profile)
-      {
-        rc = 1;
-        goto exit;
-      }
+      if(!profile) goto exit;
       cmsSaveProfileToMem(out_profile, profile, &profile_len);
     }
   }
@@ -92,11 +98,7 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
 #else
   tif = TIFFOpen(filename, "wl");
 #endif
-  if(!tif)
-  {
-    rc = 1;
-    goto exit;
-  }
+  if(!tif) goto exit;
 
   // http://partners.adobe.com/public/developer/en/tiff/TIFFphotoshop.pdf (dated 2002)
   // "A proprietary ZIP/Flate compression code (0x80b2) has been used by some"
@@ -155,15 +157,40 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   }
 
   const size_t rowsize = (d->width * 3) * d->bpp / 8;
-  if((rowdata = malloc(rowsize)) == NULL)
+  if((rowdata = malloc(rowsize)) == NULL) goto exit;
+
+  s = (dt_imageio_tiff_stream_t *)calloc(1, sizeof(dt_imageio_tiff_stream_t));
+  s->tif = tif;
+  s->rowdata = rowdata;
+  s->filename = g_strdup(filename);
+  s->exif = exif;
+  s->exif_len = exif_len;
+  s->rc = 0;
+
+exit:
+  if(!s)
   {
-    rc = 1;
-    goto exit;
+    if(tif) TIFFClose(tif);
+    free(rowdata);
   }
+  free(profile);
+  profile = NULL;
+
+  return s;
+}
+
+int write_image_rows(dt_imageio_module_data_t *d_tmp, void *handle, const void *in_void, int row, int num_rows)
+{
+  const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+  dt_imageio_tiff_stream_t *s = (dt_imageio_tiff_stream_t *)handle;
+  TIFF *tif = s->tif;
+  void *rowdata = s->rowdata;
+
+  if(s->rc) return 1;
 
   if(d->bpp == 32)
   {
-    for(int y = 0; y < d->height; y++)
+    for(int y = 0; y < num_rows; y++)
     {
       float *in = (float *)in_void + (size_t)4 * y * d->width;
       float *out = (float *)rowdata;
@@ -173,16 +200,16 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
         memcpy(out, in, 3 * sizeof(float));
       }
 
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
+      if(TIFFWriteScanline(tif, rowdata, row + y, 0) == -1)
       {
-        rc = 1;
-        goto exit;
+        s->rc = 1;
+        return 1;
       }
     }
   }
   else if(d->bpp == 16)
   {
-    for(int y = 0; y < d->height; y++)
+    for(int y = 0; y < num_rows; y++)
     {
       uint16_t *in = (uint16_t *)in_void + (size_t)4 * y * d->width;
       uint16_t *out = (uint16_t *)rowdata;
@@ -192,16 +219,16 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
         memcpy(out, in, 3 * sizeof(uint16_t));
       }
 
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
+      if(TIFFWriteScanline(tif, rowdata, row + y, 0) == -1)
       {
-        rc = 1;
-        goto exit;
+        s->rc = 1;
+        return 1;
       }
     }
   }
   else
   {
-    for(int y = 0; y < d->height; y++)
+    for(int y = 0; y < num_rows; y++)
     {
       uint8_t *in = (uint8_t *)in_void + (size_t)4 * y * d->width;
       uint8_t *out = (uint8_t *)rowdata;
@@ -211,38 +238,49 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
         memcpy(out, in, 3 * sizeof(uint8_t));
       }
 
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
+      if(TIFFWriteScanline(tif, rowdata, row + y, 0) == -1)
       {
-        rc = 1;
-        goto exit;
+        s->rc = 1;
+        return 1;
       }
     }
   }
 
-  // success
-  rc = 0;
+  return 0;
+}
+
+int write_image_finish(dt_imageio_module_data_t *d_tmp, void *handle)
+{
+  const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+  dt_imageio_tiff_stream_t *s = (dt_imageio_tiff_stream_t *)handle;
+
+  int rc = s->rc;
 
-exit:
   // close the file before adding exif data
-  if(tif)
-  {
-    TIFFClose(tif);
-    tif = NULL;
-  }
-  if(!rc && exif)
+  TIFFClose(s->tif);
+  if(!rc && s->exif)
   {
-    rc = dt_exif_write_blob(exif, exif_len, filename, d->compress > 0);
+    rc = dt_exif_write_blob(s->exif, s->exif_len, s->filename, d->compress > 0);
     // Until we get symbolic error status codes, if rc is 1, return 0
     rc = (rc == 1) ? 0 : 1;
   }
-  free(profile);
-  profile = NULL;
-  free(rowdata);
-  rowdata = NULL;
+  free(s->rowdata);
+  g_free(s->filename);
+  free(s);
 
   return rc;
 }
 
+int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void,
+                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                void *exif, int exif_len, int imgid, int num, int total)
+{
+  void *handle = write_image_begin(d_tmp, filename, over_type, over_filename, exif, exif_len, imgid, num, total);
+  if(!handle) return 1;
+  write_image_rows(d_tmp, handle, in_void, 0, ((dt_imageio_tiff_t *)d_tmp)->height);
+  return write_image_finish(d_tmp, handle);
+}
+
 #if 0
 int dt_imageio_tiff_read_header(const char *filename, dt_imageio_tiff_t *tiff)
 {
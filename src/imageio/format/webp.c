@@ -31,7 +31,7 @@
 
 #include <webp/encode.h>
 
-DT_MODULE(2)
+DT_MODULE(3)
 
 typedef enum
 {
@@ -58,6 +58,7 @@ typedef struct dt_imageio_webp_t
   int comp_type;
   int quality;
   int hint;
+  int multithread;
 } dt_imageio_webp_t;
 
 typedef struct dt_imageio_webp_gui_data_t
@@ -65,6 +66,7 @@ typedef struct dt_imageio_webp_gui_data_t
   GtkWidget *compression;
   GtkWidget *quality;
   GtkWidget *hint;
+  GtkWidget *multithread;
 } dt_imageio_webp_gui_data_t;
 
 #define _stringify(a) #a
@@ -148,6 +150,8 @@ int write_image(dt_imageio_module_data_t *webp, const char *filename, const void
   config.lossless = webp_data->comp_type;
   config.image_hint = webp_data->hint;
   config.method = 6;
+  // lets libwebp analyse and encode on a second thread
+  config.thread_level = webp_data->multithread ? 1 : 0;
 
   // these are to allow for large image export.
   // TODO(jinxos): these values should be adjusted as needed and ideally determined at runtime.
@@ -177,12 +181,15 @@ int write_image(dt_imageio_module_data_t *webp, const char *filename, const void
     WebPPictureARGBToYUVA(&pic, WEBP_YUV420A);
   }
 
+  const double start = dt_get_wtime();
   if(!WebPEncode(&config, &pic))
   {
     fprintf(stderr, "[webp export] error during encoding (err:%d - %s)\n",
             pic.error_code, get_error_str(pic.error_code));
     goto error;
   }
+  dt_print(DT_DEBUG_PERF, "[webp] encoded %dx%d %s in %.3f secs\n", webp_data->width, webp_data->height,
+           config.thread_level ? "multithreaded" : "single threaded", dt_get_wtime() - start);
 
   WebPPictureFree(&pic);
   pic_init = 0;
@@ -205,7 +212,7 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
                     const size_t old_params_size, const int old_version, const int new_version,
                     size_t *new_size)
 {
-  if(old_version == 1 && new_version == 2)
+  if(old_version == 1 && new_version == 3)
   {
     typedef struct dt_imageio_webp_v1_t
     {
@@ -229,6 +236,36 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
     n->comp_type = o->comp_type;
     n->quality = o->quality;
     n->hint = o->hint;
+    n->multithread = 0;
+    *new_size = self->params_size(self);
+    return n;
+  }
+  else if(old_version == 2 && new_version == 3)
+  {
+    typedef struct dt_imageio_webp_v2_t
+    {
+      int max_width, max_height;
+      int width, height;
+      char style[128];
+      gboolean style_append;
+      int comp_type;
+      int quality;
+      int hint;
+    } dt_imageio_webp_v2_t;
+
+    dt_imageio_webp_v2_t *o = (dt_imageio_webp_v2_t *)old_params;
+    dt_imageio_webp_t *n = (dt_imageio_webp_t *)malloc(sizeof(dt_imageio_webp_t));
+
+    n->max_width = o->max_width;
+    n->max_height = o->max_height;
+    n->width = o->width;
+    n->height = o->height;
+    g_strlcpy(n->style, o->style, sizeof(o->style));
+    n->style_append = o->style_append;
+    n->comp_type = o->comp_type;
+    n->quality = o->quality;
+    n->hint = o->hint;
+    n->multithread = 0;
     *new_size = self->params_size(self);
     return n;
   }
@@ -244,6 +281,7 @@ void *get_params(dt_imageio_module_format_t *self)
   else
     d->quality = 100;
   d->hint = dt_conf_get_int("plugins/imageio/format/webp/hint");
+  d->multithread = dt_conf_get_bool("plugins/imageio/format/webp/multithread");
   return d;
 }
 
@@ -255,6 +293,7 @@ int set_params(dt_imageio_module_format_t *self, const void *params, const int s
   dt_bauhaus_combobox_set(g->compression, d->comp_type);
   dt_bauhaus_slider_set(g->quality, d->quality);
   dt_bauhaus_combobox_set(g->hint, d->hint);
+  dt_bauhaus_combobox_set(g->multithread, d->multithread ? 1 : 0);
   return 0;
 }
 
@@ -307,6 +346,11 @@ static void hint_combobox_changed(GtkWidget *widget, gpointer user_data)
   dt_conf_set_int("plugins/imageio/format/webp/hint", hint);
 }
 
+static void multithread_changed(GtkWidget *widget, gpointer user_data)
+{
+  dt_conf_set_bool("plugins/imageio/format/webp/multithread", dt_bauhaus_combobox_get(widget) == 1);
+}
+
 void gui_init(dt_imageio_module_format_t *self)
 {
   dt_imageio_webp_gui_data_t *gui = (dt_imageio_webp_gui_data_t *)malloc(sizeof(dt_imageio_webp_gui_data_t));
@@ -349,6 +393,15 @@ void gui_init(dt_imageio_module_format_t *self)
   dt_bauhaus_combobox_set(gui->hint, hint);
   gtk_box_pack_start(GTK_BOX(self->widget), gui->hint, TRUE, TRUE, 0);
   g_signal_connect(G_OBJECT(gui->hint), "value-changed", G_CALLBACK(hint_combobox_changed), NULL);
+
+  gui->multithread = dt_bauhaus_combobox_new(NULL);
+  dt_bauhaus_widget_set_label(gui->multithread, NULL, _("multithreaded"));
+  dt_bauhaus_combobox_add(gui->multithread, _("no"));
+  dt_bauhaus_combobox_add(gui->multithread, _("yes"));
+  dt_bauhaus_combobox_set(gui->multithread, dt_conf_get_bool("plugins/imageio/format/webp/multithread"));
+  gtk_widget_set_tooltip_text(gui->multithread, _("let the encoder use a second thread"));
+  gtk_box_pack_start(GTK_BOX(self->widget), gui->multithread, TRUE, TRUE, 0);
+  g_signal_connect(G_OBJECT(gui->multithread), "value-changed", G_CALLBACK(multithread_changed), NULL);
 }
 
 void gui_cleanup(dt_imageio_module_format_t *self)
@@ -322,16 +322,19 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
 
     b.roi = roi_in;
     b.buf = &piece->buf_in;
+    // the preview pipe only needs an approximation, the full pipe doesn't read its approximated levels
+    // from ll_boundary. export converges to the full result.
+    const int fast = piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW;
     // also lock the ll_boundary in case we're using it.
     // could get away without this if the preview pipe didn't also free the data below.
     const int lockit = self->dev->gui_attached && g && piece->pipe->type == DT_DEV_PIXELPIPE_FULL;
     if(lockit)
     {
       dt_pthread_mutex_lock(&g->lock);
-      local_laplacian_sse2(i, o, roi_in->width, roi_in->height, d->midtone, d->sigma_s, d->sigma_r, d->detail, &b);
+      local_laplacian_sse2(i, o, roi_in->width, roi_in->height, d->midtone, d->sigma_s, d->sigma_r, d->detail, fast, &b);
       dt_pthread_mutex_unlock(&g->lock);
     }
-    else local_laplacian_sse2(i, o, roi_in->width, roi_in->height, d->midtone, d->sigma_s, d->sigma_r, d->detail, &b);
+    else local_laplacian_sse2(i, o, roi_in->width, roi_in->height, d->midtone, d->sigma_s, d->sigma_r, d->detail, fast, &b);
 
     // preview pixelpipe stores values.
     if(self->dev->gui_attached && g && piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW)
@@ -372,7 +375,9 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   }
   else // s_mode_local_laplacian
   {
-    local_laplacian(i, o, roi_in->width, roi_in->height, d->midtone, d->sigma_s, d->sigma_r, d->detail, 0);
+    // the preview pipe only needs an approximation, export converges to the full result
+    const int fast = piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW;
+    local_laplacian(i, o, roi_in->width, roi_in->height, d->midtone, d->sigma_s, d->sigma_r, d->detail, fast, 0);
   }
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(i, o, roi_in->width, roi_in->height);
@@ -39,6 +39,9 @@
 
 #include <gtk/gtk.h>
 #include <inttypes.h>
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#endif
 
 DT_MODULE_INTROSPECTION(2, dt_iop_colorchecker_params_t)
 
@@ -102,6 +105,10 @@ typedef struct dt_iop_colorchecker_data_t
   float coeff_L[MAX_PATCHES+4];
   float coeff_a[MAX_PATCHES+4];
   float coeff_b[MAX_PATCHES+4];
+  // the spline baked into a lut_size^3 grid over L [0,100], a, b [-128,128], 4 floats per node.
+  // NULL if the spline is evaluated exactly.
+  int lut_size;
+  float *lut;
 } dt_iop_colorchecker_data_t;
 
 typedef struct dt_iop_colorchecker_global_data_t
@@ -374,11 +381,90 @@ static inline float kernel(const float *x, const float *y)
   return r2*fastlog(MAX(1e-8f,r2));
 }
 
+// evaluate the thin plate spline for one pixel
+static inline void _colorchecker_exact(const dt_iop_colorchecker_data_t *const data, const float *const in,
+                                       float *const out)
+{
+  out[0] = data->coeff_L[data->num_patches];
+  out[1] = data->coeff_a[data->num_patches];
+  out[2] = data->coeff_b[data->num_patches];
+  // polynomial part:
+  out[0] += data->coeff_L[data->num_patches+1] * in[0] +
+            data->coeff_L[data->num_patches+2] * in[1] +
+            data->coeff_L[data->num_patches+3] * in[2];
+  out[1] += data->coeff_a[data->num_patches+1] * in[0] +
+            data->coeff_a[data->num_patches+2] * in[1] +
+            data->coeff_a[data->num_patches+3] * in[2];
+  out[2] += data->coeff_b[data->num_patches+1] * in[0] +
+            data->coeff_b[data->num_patches+2] * in[1] +
+            data->coeff_b[data->num_patches+3] * in[2];
+#if defined(_OPENMP) && defined(OPENMP_SIMD_) // <== nice try, i don't think this does anything here
+#pragma omp SIMD()
+#endif
+  for(int k=0;k<data->num_patches;k++)
+  { // rbf from thin plate spline
+    const float phi = kernel(in, data->source_Lab + 3*k);
+    out[0] += data->coeff_L[k] * phi;
+    out[1] += data->coeff_a[k] * phi;
+    out[2] += data->coeff_b[k] * phi;
+  }
+}
+
+// tetrahedral interpolation in the baked lut. returns 0 if the pixel is outside the grid,
+// the spline extrapolates there and has to be evaluated exactly.
+static inline int _colorchecker_lut(const float *const lut, const int n, const float *const in, float *const out)
+{
+  const float fx = in[0] * ((n - 1) / 100.0f);
+  const float fy = (in[1] + 128.0f) * ((n - 1) / 256.0f);
+  const float fz = (in[2] + 128.0f) * ((n - 1) / 256.0f);
+  if(!(fx >= 0.0f && fx <= n - 1 && fy >= 0.0f && fy <= n - 1 && fz >= 0.0f && fz <= n - 1)) return 0;
+
+  const int x = MIN((int)fx, n - 2), y = MIN((int)fy, n - 2), z = MIN((int)fz, n - 2);
+  const float dx = fx - x, dy = fy - y, dz = fz - z;
+  const int sx = 4 * n * n, sy = 4 * n, sz = 4;
+
+  // walk from the lower to the upper corner of the cell along the largest, then the second largest
+  // offset. the three weights are the sorted offsets.
+  int o1, o2;
+  float w1, w2, w3;
+  if(dx >= dy)
+  {
+    if(dy >= dz)      { o1 = sx; o2 = sx + sy; w1 = dx; w2 = dy; w3 = dz; }
+    else if(dx >= dz) { o1 = sx; o2 = sx + sz; w1 = dx; w2 = dz; w3 = dy; }
+    else              { o1 = sz; o2 = sx + sz; w1 = dz; w2 = dx; w3 = dy; }
+  }
+  else
+  {
+    if(dx >= dz)      { o1 = sy; o2 = sx + sy; w1 = dy; w2 = dx; w3 = dz; }
+    else if(dy >= dz) { o1 = sy; o2 = sy + sz; w1 = dy; w2 = dz; w3 = dx; }
+    else              { o1 = sz; o2 = sy + sz; w1 = dz; w2 = dy; w3 = dx; }
+  }
+
+  const float *const c0 = lut + (size_t)x * sx + (size_t)y * sy + (size_t)z * sz;
+  const float *const c1 = c0 + o1, *const c2 = c0 + o2, *const c3 = c0 + sx + sy + sz;
+#if defined(__SSE2__)
+  const __m128 res = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(_mm_set1_ps(1.0f - w1), _mm_load_ps(c0)), _mm_mul_ps(_mm_set1_ps(w1 - w2), _mm_load_ps(c1))),
+      _mm_add_ps(_mm_mul_ps(_mm_set1_ps(w2 - w3), _mm_load_ps(c2)), _mm_mul_ps(_mm_set1_ps(w3), _mm_load_ps(c3))));
+  float r[4] __attribute__((aligned(16)));
+  _mm_store_ps(r, res);
+  out[0] = r[0];
+  out[1] = r[1];
+  out[2] = r[2];
+#else
+  for(int c = 0; c < 3; c++)
+    out[c] = (1.0f - w1) * c0[c] + (w1 - w2) * c1[c] + (w2 - w3) * c2[c] + w3 * c3[c];
+#endif
+  return 1;
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
   const dt_iop_colorchecker_data_t *const data = (dt_iop_colorchecker_data_t *)piece->data;
   const int ch = piece->colors;
+  const float *const lut = data->lut;
+  const int lut_size = data->lut_size;
 #ifdef _OPENMP
 #pragma omp parallel for default(none) schedule(static) collapse(2)
 #endif
@@ -388,29 +474,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     {
       const float *in = ((float *)ivoid) + (size_t)ch * (j * roi_in->width + i);
       float *out = ((float *)ovoid) + (size_t)ch * (j * roi_in->width + i);
-      out[0] = data->coeff_L[data->num_patches];
-      out[1] = data->coeff_a[data->num_patches];
-      out[2] = data->coeff_b[data->num_patches];
-      // polynomial part:
-      out[0] += data->coeff_L[data->num_patches+1] * in[0] +
-                data->coeff_L[data->num_patches+2] * in[1] +
-                data->coeff_L[data->num_patches+3] * in[2];
-      out[1] += data->coeff_a[data->num_patches+1] * in[0] +
-                data->coeff_a[data->num_patches+2] * in[1] +
-                data->coeff_a[data->num_patches+3] * in[2];
-      out[2] += data->coeff_b[data->num_patches+1] * in[0] +
-                data->coeff_b[data->num_patches+2] * in[1] +
-                data->coeff_b[data->num_patches+3] * in[2];
-#if defined(_OPENMP) && defined(OPENMP_SIMD_) // <== nice try, i don't think this does anything here
-#pragma omp SIMD()
-#endif
-      for(int k=0;k<data->num_patches;k++)
-      { // rbf from thin plate spline
-        const float phi = kernel(in, data->source_Lab + 3*k);
-        out[0] += data->coeff_L[k] * phi;
-        out[1] += data->coeff_a[k] * phi;
-        out[2] += data->coeff_b[k] * phi;
-      }
+      if(!lut || !_colorchecker_lut(lut, lut_size, in, out)) _colorchecker_exact(data, in, out);
     }
   }
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
@@ -529,6 +593,63 @@ error:
 #endif
 
 
+// bake the spline into the lut, sized by plugins/darkroom/colorchecker/lut_size (0 evaluates it exactly)
+static void _colorchecker_bake_lut(dt_iop_colorchecker_data_t *d)
+{
+  const int n = dt_conf_get_int("plugins/darkroom/colorchecker/lut_size");
+  const int lut_size = n < 2 ? 0 : MIN(n, 129);
+  if(lut_size != d->lut_size)
+  {
+    dt_free_align(d->lut);
+    d->lut = lut_size ? dt_alloc_align(64, sizeof(float) * 4 * lut_size * lut_size * lut_size) : NULL;
+    d->lut_size = d->lut ? lut_size : 0;
+  }
+  if(!d->lut) return;
+
+  const double start = dt_get_wtime();
+  float *const lut = d->lut;
+  const dt_iop_colorchecker_data_t *const data = d;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static) collapse(2)
+#endif
+  for(int x = 0; x < lut_size; x++)
+    for(int y = 0; y < lut_size; y++)
+      for(int z = 0; z < lut_size; z++)
+      {
+        const float in[3] = { 100.0f * x / (lut_size - 1), -128.0f + 256.0f * y / (lut_size - 1),
+                              -128.0f + 256.0f * z / (lut_size - 1) };
+        float *node = lut + 4 * (((size_t)x * lut_size + y) * lut_size + z);
+        _colorchecker_exact(data, in, node);
+        node[3] = 0.0f;
+      }
+
+  if(darktable.unmuted & DT_DEBUG_PERF)
+  {
+    // interpolation errors peak in the middle of the cells, probe those against the exact spline
+    const double baked = dt_get_wtime();
+    double sum = 0.0, max = 0.0;
+    const int probes = MIN(lut_size - 1, 32);
+    for(int x = 0; x < probes; x++)
+      for(int y = 0; y < probes; y++)
+        for(int z = 0; z < probes; z++)
+        {
+          const float in[3] = { 100.0f * (x + 0.5f) / probes, -128.0f + 256.0f * (y + 0.5f) / probes,
+                                -128.0f + 256.0f * (z + 0.5f) / probes };
+          float exact[3], approx[3];
+          _colorchecker_exact(d, in, exact);
+          _colorchecker_lut(lut, lut_size, in, approx);
+          const double dE = sqrt((exact[0] - approx[0]) * (exact[0] - approx[0])
+                                 + (exact[1] - approx[1]) * (exact[1] - approx[1])
+                                 + (exact[2] - approx[2]) * (exact[2] - approx[2]));
+          sum += dE;
+          max = MAX(max, dE);
+        }
+    fprintf(stderr, "[colorchecker] baked %d patches into a %d^3 lut in %.3f secs, "
+                    "dE76 against the spline: mean %.4f, max %.4f\n",
+            d->num_patches, lut_size, baked - start, sum / ((double)probes * probes * probes), max);
+  }
+}
+
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe,
                    dt_dev_pixelpipe_iop_t *piece)
 {
@@ -737,16 +858,20 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
     free(A);
   }
   }
+
+  _colorchecker_bake_lut(d);
 }
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = malloc(sizeof(dt_iop_colorchecker_data_t));
+  piece->data = calloc(1, sizeof(dt_iop_colorchecker_data_t));
   self->commit_params(self, self->default_params, pipe, piece);
 }
 
 void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
+  dt_iop_colorchecker_data_t *d = (dt_iop_colorchecker_data_t *)piece->data;
+  dt_free_align(d->lut);
   free(piece->data);
   piece->data = NULL;
 }
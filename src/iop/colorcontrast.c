@@ -135,49 +135,52 @@ void connect_key_accels(dt_iop_module_t *self)
                               GTK_WIDGET(g->b_scale));
 }
 
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                    float *const out, const size_t npixels)
 {
-  // this is called for preview and full pipe separately, each with its own pixelpipe piece.
-  assert(dt_iop_module_colorspace(self) == iop_cs_Lab);
-
-  // get our data struct:
   const dt_iop_colorcontrast_params_t *const d = (dt_iop_colorcontrast_params_t *)piece->data;
 
-  // how many colors in our buffer?
-  const int ch = piece->colors;
-
-  const float *const in = (const float *const)ivoid;
-  float *const out = (float *const)ovoid;
-
   if(d->unbound)
   {
-#ifdef _OPENMP
-#pragma omp parallel for SIMD() default(none) schedule(static)
-#endif
-    for(size_t k = 0; k < (size_t)ch * roi_out->width * roi_out->height; k += ch)
+    for(size_t k = 0; k < (size_t)4 * npixels; k += 4)
     {
       out[k] = in[k];
       out[k + 1] = (in[k + 1] * d->a_steepness) + d->a_offset;
       out[k + 2] = (in[k + 2] * d->b_steepness) + d->b_offset;
-      out[k + 4] = in[k + 4];
+      out[k + 3] = in[k + 3];
     }
   }
   else
   {
-#ifdef _OPENMP
-#pragma omp parallel for SIMD() default(none) schedule(static)
-#endif
-    for(size_t k = 0; k < (size_t)ch * roi_out->width * roi_out->height; k += ch)
+    for(size_t k = 0; k < (size_t)4 * npixels; k += 4)
     {
       out[k] = in[k];
       out[k + 1] = CLAMP((in[k + 1] * d->a_steepness) + d->a_offset, -128.0f, 128.0f);
       out[k + 2] = CLAMP((in[k + 2] * d->b_steepness) + d->b_offset, -128.0f, 128.0f);
-      out[k + 4] = in[k + 4];
+      out[k + 3] = in[k + 3];
     }
   }
 }
 
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  // this is called for preview and full pipe separately, each with its own pixelpipe piece.
+  assert(dt_iop_module_colorspace(self) == iop_cs_Lab);
+
+  // how many colors in our buffer?
+  const int ch = piece->colors;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(self, piece) schedule(static)
+#endif
+  for(int j = 0; j < roi_out->height; j++)
+  {
+    const size_t offset = (size_t)ch * roi_out->width * j;
+    process_pixels(self, piece, (const float *)ivoid + offset, (float *)ovoid + offset, roi_out->width);
+  }
+}
+
 #if defined(__SSE__)
 void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
                   void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
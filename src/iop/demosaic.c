@@ -42,6 +42,12 @@
 #if defined(__SSE__)
 #include <xmmintrin.h>
 #endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#ifdef HAVE_TARGET_AVX2
+#include <immintrin.h>
+#endif
 
 DT_MODULE_INTROSPECTION(3, dt_iop_demosaic_params_t)
 
@@ -524,6 +530,206 @@ static inline const short *const hexmap(const int row, const int col,
   return allhex[irow % 3][icol % 3];
 }
 
+/** Row kernels of the homogeneity map and of the final direction selection of Markesteijn.
+    The SSE2/AVX2 versions handle as many columns as they can and leave the tail to the plain one. **/
+typedef void (*xtrans_homo_row_t)(float (*const drv)[TS][TS], uint8_t (*const homo)[TS][TS], const int ndir,
+                                  const int row, const int col_start, const int col_end);
+typedef void (*xtrans_select_row_t)(float *const outrow, float (*const rgb)[TS][TS][3],
+                                    uint8_t (*const homosum)[TS][TS], const int ndir, const int row,
+                                    const int col_start, const int col_end, const int left);
+
+// count, for each direction, how many of the 3x3 neighbours have a derivative not above
+// eight times the smallest derivative of the center pixel
+static void xtrans_markesteijn_homo_plain(float (*const drv)[TS][TS], uint8_t (*const homo)[TS][TS],
+                                          const int ndir, const int row, const int col_start, const int col_end)
+{
+  for(int col = col_start; col < col_end; col++)
+  {
+    float tr = FLT_MAX;
+    for(int d = 0; d < ndir; d++)
+      if(tr > drv[d][row][col]) tr = drv[d][row][col];
+    tr *= 8;
+    for(int d = 0; d < ndir; d++)
+    {
+      uint8_t count = 0;
+      for(int v = -1; v <= 1; v++)
+        for(int h = -1; h <= 1; h++) count += ((drv[d][row + v][col + h] <= tr) ? 1 : 0);
+      homo[d][row][col] = count;
+    }
+  }
+}
+
+// pick the most homogeneous directions and average them into the output row
+static void xtrans_markesteijn_select_plain(float *const outrow, float (*const rgb)[TS][TS][3],
+                                            uint8_t (*const homosum)[TS][TS], const int ndir, const int row,
+                                            const int col_start, const int col_end, const int left)
+{
+  for(int col = col_start; col < col_end; col++)
+  {
+    uint8_t hm[8] = { 0 };
+    uint8_t maxval = 0;
+    for(int d = 0; d < ndir; d++)
+    {
+      hm[d] = homosum[d][row][col];
+      maxval = (maxval < hm[d] ? hm[d] : maxval);
+    }
+    maxval -= maxval >> 3;
+    for(int d = 0; d < ndir - 4; d++)
+      if(hm[d] < hm[d + 4])
+        hm[d] = 0;
+      else if(hm[d] > hm[d + 4])
+        hm[d + 4] = 0;
+    float avg[4] = { 0.0f };
+    for(int d = 0; d < ndir; d++)
+      if(hm[d] >= maxval)
+      {
+        for(int c = 0; c < 3; c++) avg[c] += rgb[d][row][col][c];
+        avg[3]++;
+      }
+    for(int c = 0; c < 3; c++) outrow[4 * (col + left) + c] = avg[c] / avg[3];
+  }
+}
+
+#if defined(__SSE2__)
+// average the selected directions of one pixel. sel[d] is -1 for the directions to use.
+// the fourth lane loads the red of the next pixel, which is always inside the tile and masked off.
+static inline void xtrans_markesteijn_average_sse2(float *const outpix, float (*const rgb)[TS][TS][3],
+                                                   const int16_t *const sel, const int sel_stride,
+                                                   const int ndir, const int row, const int col)
+{
+  __m128 avg = _mm_setzero_ps();
+  int count = 0;
+  for(int d = 0; d < ndir; d++)
+  {
+    const int16_t m = sel[d * sel_stride];
+    avg = _mm_add_ps(avg, _mm_and_ps(_mm_castsi128_ps(_mm_set1_epi32(m)), _mm_loadu_ps(rgb[d][row][col])));
+    count -= m;
+  }
+  float res[4];
+  _mm_storeu_ps(res, _mm_div_ps(avg, _mm_set1_ps((float)count)));
+  for(int c = 0; c < 3; c++) outpix[c] = res[c];
+}
+
+static void xtrans_markesteijn_homo_sse2(float (*const drv)[TS][TS], uint8_t (*const homo)[TS][TS],
+                                         const int ndir, const int row, const int col_start, const int col_end)
+{
+  int col = col_start;
+  for(; col + 4 <= col_end; col += 4)
+  {
+    __m128 tr = _mm_set1_ps(FLT_MAX);
+    for(int d = 0; d < ndir; d++) tr = _mm_min_ps(tr, _mm_loadu_ps(&drv[d][row][col]));
+    tr = _mm_mul_ps(tr, _mm_set1_ps(8.0f));
+    for(int d = 0; d < ndir; d++)
+    {
+      // the compare masks are -1, so subtracting them counts the hits
+      __m128i count = _mm_setzero_si128();
+      for(int v = -1; v <= 1; v++)
+        for(int h = -1; h <= 1; h++)
+          count = _mm_sub_epi32(count,
+                                _mm_castps_si128(_mm_cmple_ps(_mm_loadu_ps(&drv[d][row + v][col + h]), tr)));
+      count = _mm_packs_epi32(count, count);
+      count = _mm_packus_epi16(count, count);
+      const int packed = _mm_cvtsi128_si32(count);
+      memcpy(&homo[d][row][col], &packed, sizeof(packed));
+    }
+  }
+  xtrans_markesteijn_homo_plain(drv, homo, ndir, row, col, col_end);
+}
+
+static void xtrans_markesteijn_select_sse2(float *const outrow, float (*const rgb)[TS][TS][3],
+                                           uint8_t (*const homosum)[TS][TS], const int ndir, const int row,
+                                           const int col_start, const int col_end, const int left)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(-1);
+  int col = col_start;
+  // 8 pixels at a time as 16-bit lanes, homosum never exceeds 225
+  for(; col + 8 <= col_end; col += 8)
+  {
+    __m128i hm[8];
+    __m128i maxval = zero;
+    for(int d = 0; d < ndir; d++)
+    {
+      hm[d] = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&homosum[d][row][col]), zero);
+      maxval = _mm_max_epi16(maxval, hm[d]);
+    }
+    maxval = _mm_sub_epi16(maxval, _mm_srli_epi16(maxval, 3));
+    for(int d = 0; d < ndir - 4; d++)
+    {
+      const __m128i a = hm[d], b = hm[d + 4];
+      hm[d] = _mm_andnot_si128(_mm_cmplt_epi16(a, b), a);
+      hm[d + 4] = _mm_andnot_si128(_mm_cmpgt_epi16(a, b), b);
+    }
+    int16_t sel[8][8];
+    for(int d = 0; d < ndir; d++)
+      _mm_storeu_si128((__m128i *)sel[d], _mm_xor_si128(_mm_cmplt_epi16(hm[d], maxval), ones));
+    for(int i = 0; i < 8; i++)
+      xtrans_markesteijn_average_sse2(outrow + 4 * (col + i + left), rgb, &sel[0][i], 8, ndir, row, col + i);
+  }
+  xtrans_markesteijn_select_plain(outrow, rgb, homosum, ndir, row, col, col_end, left);
+}
+#endif
+
+#ifdef HAVE_TARGET_AVX2
+__attribute__((target("avx2,fma")))
+static void xtrans_markesteijn_homo_avx2(float (*const drv)[TS][TS], uint8_t (*const homo)[TS][TS],
+                                         const int ndir, const int row, const int col_start, const int col_end)
+{
+  int col = col_start;
+  for(; col + 8 <= col_end; col += 8)
+  {
+    __m256 tr = _mm256_set1_ps(FLT_MAX);
+    for(int d = 0; d < ndir; d++) tr = _mm256_min_ps(tr, _mm256_loadu_ps(&drv[d][row][col]));
+    tr = _mm256_mul_ps(tr, _mm256_set1_ps(8.0f));
+    for(int d = 0; d < ndir; d++)
+    {
+      __m256i count = _mm256_setzero_si256();
+      for(int v = -1; v <= 1; v++)
+        for(int h = -1; h <= 1; h++)
+          count = _mm256_sub_epi32(
+              count, _mm256_castps_si256(_mm256_cmp_ps(_mm256_loadu_ps(&drv[d][row + v][col + h]), tr, _CMP_LE_OQ)));
+      __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(count), _mm256_extracti128_si256(count, 1));
+      packed = _mm_packus_epi16(packed, packed);
+      _mm_storel_epi64((__m128i *)&homo[d][row][col], packed);
+    }
+  }
+  xtrans_markesteijn_homo_plain(drv, homo, ndir, row, col, col_end);
+}
+
+__attribute__((target("avx2,fma")))
+static void xtrans_markesteijn_select_avx2(float *const outrow, float (*const rgb)[TS][TS][3],
+                                           uint8_t (*const homosum)[TS][TS], const int ndir, const int row,
+                                           const int col_start, const int col_end, const int left)
+{
+  const __m256i ones = _mm256_set1_epi16(-1);
+  int col = col_start;
+  // 16 pixels at a time as 16-bit lanes
+  for(; col + 16 <= col_end; col += 16)
+  {
+    __m256i hm[8];
+    __m256i maxval = _mm256_setzero_si256();
+    for(int d = 0; d < ndir; d++)
+    {
+      hm[d] = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)&homosum[d][row][col]));
+      maxval = _mm256_max_epi16(maxval, hm[d]);
+    }
+    maxval = _mm256_sub_epi16(maxval, _mm256_srli_epi16(maxval, 3));
+    for(int d = 0; d < ndir - 4; d++)
+    {
+      const __m256i a = hm[d], b = hm[d + 4];
+      hm[d] = _mm256_andnot_si256(_mm256_cmpgt_epi16(b, a), a);
+      hm[d + 4] = _mm256_andnot_si256(_mm256_cmpgt_epi16(a, b), b);
+    }
+    int16_t sel[8][16];
+    for(int d = 0; d < ndir; d++)
+      _mm256_storeu_si256((__m256i *)sel[d], _mm256_xor_si256(_mm256_cmpgt_epi16(maxval, hm[d]), ones));
+    for(int i = 0; i < 16; i++)
+      xtrans_markesteijn_average_sse2(outrow + 4 * (col + i + left), rgb, &sel[0][i], 16, ndir, row, col + i);
+  }
+  xtrans_markesteijn_select_sse2(outrow, rgb, homosum, ndir, row, col, col_end, left);
+}
+#endif
+
 /*
    Frank Markesteijn's algorithm for Fuji X-Trans sensors
  */
@@ -546,14 +752,32 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
   const int height = roi_out->height;
   const int ndir = 4 << (passes > 1);
 
-  const size_t buffer_size = (size_t)TS * TS * (ndir * 4 + 3) * sizeof(float);
-  char *const all_buffers = (char *)dt_alloc_align(16, dt_get_num_threads() * buffer_size);
+  // per-thread scratch, rounded up to whole cache lines so that no two threads share one
+  const size_t buffer_size = (((size_t)TS * TS * (ndir * 4 + 3) * sizeof(float)) + 63) & ~(size_t)63;
+  char *const all_buffers = (char *)dt_alloc_align(64, dt_get_num_threads() * buffer_size);
   if(!all_buffers)
   {
     printf("[demosaic] not able to allocate Markesteijn buffers\n");
     return;
   }
 
+  xtrans_homo_row_t homo_row = xtrans_markesteijn_homo_plain;
+  xtrans_select_row_t select_row = xtrans_markesteijn_select_plain;
+#if defined(__SSE2__)
+  if(darktable.codepath.SSE2)
+  {
+    homo_row = xtrans_markesteijn_homo_sse2;
+    select_row = xtrans_markesteijn_select_sse2;
+  }
+#endif
+#ifdef HAVE_TARGET_AVX2
+  if(darktable.codepath.AVX2)
+  {
+    homo_row = xtrans_markesteijn_homo_avx2;
+    select_row = xtrans_markesteijn_select_avx2;
+  }
+#endif
+
   /* Map a green hexagon around each non-green pixel and vice versa:    */
   for(int row = 0; row < 3; row++)
     for(int col = 0; col < 3; col++)
@@ -583,13 +807,20 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
 
   // extra passes propagates out errors at edges, hence need more padding
   const int pad_tile = (passes == 1) ? 12 : 17;
+  // step through TSxTS cells of image, each tile overlapping the
+  // prior as interpolation needs a substantial border. every tile is
+  // an independent work item, so that even narrow crops or previews
+  // give enough parallelism to keep many cores busy.
+  const int tile_step = TS - (pad_tile * 2);
+  const int tiles_x = (width + tile_step - 1) / tile_step;
+  const int tiles_y = (height + tile_step - 1) / tile_step;
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(sgrow, sgcol, allhex, out) schedule(dynamic)
+#pragma omp parallel for default(none) shared(sgrow, sgcol, allhex, out, homo_row, select_row) schedule(dynamic, 1)
 #endif
-  // step through TSxTS cells of image, each tile overlapping the
-  // prior as interpolation needs a substantial border
-  for(int top = -pad_tile; top < height - pad_tile; top += TS - (pad_tile*2))
+  for(int tile = 0; tile < tiles_x * tiles_y; tile++)
   {
+    const int top = -pad_tile + (tile / tiles_x) * tile_step;
+    const int left = -pad_tile + (tile % tiles_x) * tile_step;
     char *const buffer = all_buffers + dt_get_thread_num() * buffer_size;
     // rgb points to ndir TSxTS tiles of 3 channels (R, G, and B)
     float(*rgb)[TS][TS][3] = (float(*)[TS][TS][3])buffer;
@@ -609,7 +840,6 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
     uint8_t (*const homosum)[TS][TS] = (uint8_t(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float)
                                                             + TS * TS * ndir * sizeof(uint8_t));
 
-    for(int left = -pad_tile; left < width - pad_tile; left += TS - (pad_tile*2))
     {
       int mrow = MIN(top + TS, height + pad_tile);
       int mcol = MIN(left + TS, width + pad_tile);
@@ -927,16 +1157,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
       memset(homo, 0, (size_t)ndir * TS * TS * sizeof(uint8_t));
       const int pad_homo = (passes == 1) ? 10 : 15;
       for(int row = pad_homo; row < mrow - pad_homo; row++)
-        for(int col = pad_homo; col < mcol - pad_homo; col++)
-        {
-          float tr = FLT_MAX;
-          for(int d = 0; d < ndir; d++)
-            if(tr > drv[d][row][col]) tr = drv[d][row][col];
-          tr *= 8;
-          for(int d = 0; d < ndir; d++)
-            for(int v = -1; v <= 1; v++)
-              for(int h = -1; h <= 1; h++) homo[d][row][col] += ((drv[d][row + v][col + h] <= tr) ? 1 : 0);
-        }
+        homo_row(drv, homo, ndir, row, pad_homo, mcol - pad_homo);
 
       /* Build 5x5 sum of homogeneity maps for each pixel & direction */
       for(int d = 0; d < ndir; d++)
@@ -959,32 +1180,8 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
 
       /* Average the most homogenous pixels for the final result:       */
       for(int row = pad_tile; row < mrow - pad_tile; row++)
-        for(int col = pad_tile; col < mcol - pad_tile; col++)
-        {
-          uint8_t hm[8] = { 0 };
-          uint8_t maxval = 0;
-          for(int d = 0; d < ndir; d++)
-          {
-            hm[d] = homosum[d][row][col];
-            maxval = (maxval < hm[d] ? hm[d] : maxval);
-          }
-          maxval -= maxval >> 3;
-          for(int d = 0; d < ndir - 4; d++)
-            if(hm[d] < hm[d + 4])
-              hm[d] = 0;
-            else if(hm[d] > hm[d + 4])
-              hm[d + 4] = 0;
-          float avg[4] = { 0.0f };
-          for(int d = 0; d < ndir; d++)
-            if(hm[d] >= maxval)
-            {
-              for(int c = 0; c < 3; c++) avg[c] += rgb[d][row][col][c];
-              avg[3]++;
-            }
-          for(int c = 0; c < 3; c++)
-            out[4 * (width * (row + top) + col + left) + c] =
-              avg[c]/avg[3];
-        }
+        select_row(out + (size_t)4 * width * (row + top), rgb, homosum, ndir, row, pad_tile, mcol - pad_tile,
+                   left);
     }
   }
   dt_free_align(all_buffers);
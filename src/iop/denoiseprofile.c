@@ -952,6 +952,8 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
 
   for(int scale = 0; scale < max_scale; scale++)
   {
+    // give up between scales once nobody waits for the result anymore
+    if(dt_cancelled()) goto cleanup;
     const float sigma = 1.0f;
     const float varf = sqrtf(2.0f + 2.0f * 4.0f * 4.0f + 6.0f * 6.0f) / 16.0f; // about 0.5
     const float sigma_band = powf(varf, scale) * sigma;
@@ -984,6 +986,7 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
   // now do everything backwards, so the result will end up in *ovoid
   for(int scale = max_scale - 1; scale >= 0; scale--)
   {
+    if(dt_cancelled()) goto cleanup;
 #if 1
     // variance stabilizing transform maps sigma to unity.
     const float sigma = 1.0f;
@@ -1050,6 +1053,7 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
 
   backtransform((float *)ovoid, width, height, aa, bb);
 
+cleanup:
   for(int k = 0; k < max_scale; k++) dt_free_align(buf[k]);
   dt_free_align(tmp);
 
@@ -1093,6 +1097,9 @@ static void process_nlmeans(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t
   {
     for(int ki = -K; ki <= K; ki++)
     {
+      // every shift vector is another pass over the whole image, stop once the pipe has moved on
+      if(dt_cancelled()) goto cancelled;
+
       // TODO: adaptive K tests here!
       // TODO: expf eval for real bilateral experience :)
 
@@ -1205,6 +1212,11 @@ static void process_nlmeans(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t
   backtransform((float *)ovoid, roi_in->width, roi_in->height, aa, bb);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
+  return;
+
+cancelled:
+  dt_free_align(Sa);
+  dt_free_align(in);
 }
 
 #if defined(__SSE2__)
@@ -1240,6 +1252,9 @@ static void process_nlmeans_sse(struct dt_iop_module_t *self, dt_dev_pixelpipe_i
   {
     for(int ki = -K; ki <= K; ki++)
     {
+      // every shift vector is another pass over the whole image, stop once the pipe has moved on
+      if(dt_cancelled()) goto cancelled;
+
       int inited_slide = 0;
 // don't construct summed area tables but use sliding window! (applies to cpu version res < 1k only, or else
 // we will add up errors)
@@ -1398,6 +1413,11 @@ static void process_nlmeans_sse(struct dt_iop_module_t *self, dt_dev_pixelpipe_i
   backtransform((float *)ovoid, roi_in->width, roi_in->height, aa, bb);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
+  return;
+
+cancelled:
+  dt_free_align(Sa);
+  dt_free_align(in);
 }
 #endif
 
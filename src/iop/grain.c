@@ -24,6 +24,8 @@
 #include <string.h>
 
 #include "bauhaus/bauhaus.h"
+#include "common/dtpthread.h"
+#include "control/conf.h"
 #include "control/control.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
@@ -48,6 +50,14 @@
 #define GRAIN_LUT_DELTA_MIN 0.0001
 #define GRAIN_LUT_PAPER_GAMMA 1.0
 
+// the periodic grain texture: GRAIN_TEXTURE_SIZE^2 texels, GRAIN_TEXTURE_TEXEL noise units apart.
+// the finest octave still spans about 9 texels.
+#define GRAIN_TEXTURE_SIZE 1024
+#define GRAIN_TEXTURE_TEXEL 0.0625
+#define GRAIN_TEXTURE_CACHE 2
+// range of the noise space offsets of the image seeds
+#define GRAIN_TEXTURE_SEEDS 1024
+
 #define CLIP(x) ((x < 0) ? 0.0 : (x > 1.0) ? 1.0 : x)
 DT_MODULE_INTROSPECTION(2, dt_iop_grain_params_t)
 
@@ -84,6 +94,24 @@ typedef struct dt_iop_grain_data_t
   float grain_lut[GRAIN_LUT_SIZE * GRAIN_LUT_SIZE];
 } dt_iop_grain_data_t;
 
+typedef struct dt_iop_grain_texture_t
+{
+  unsigned int seed; // filename hash of the image
+  double zoom;
+  float *texels;
+  int users;
+  int baking; // texels are being filled outside the lock, users of the same seed and zoom wait for it
+  uint64_t last_used;
+} dt_iop_grain_texture_t;
+
+typedef struct dt_iop_grain_global_data_t
+{
+  dt_pthread_mutex_t lock;
+  pthread_cond_t baked;
+  uint64_t clock;
+  dt_iop_grain_texture_t texture[GRAIN_TEXTURE_CACHE];
+} dt_iop_grain_global_data_t;
+
 
 int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version, void *new_params,
                   const int new_version)
@@ -144,30 +172,38 @@ static void _simplex_noise_init()
 {
   for(int i = 0; i < 512; i++) perm[i] = permutation[i & 255];
 }
-static double dot(int g[], double x, double y, double z)
+static inline float dot(const int g[], const float x, const float y, const float z)
 {
   return g[0] * x + g[1] * y + g[2] * z;
 }
 
 #define FASTFLOOR(x) (x > 0 ? (int)(x) : (int)(x)-1)
 
-static double _simplex_noise(double xin, double yin, double zin)
+// contribution of one simplex corner
+static inline float _simplex_corner(const int g[], const float x, const float y, const float z)
+{
+  float t = fmaxf(0.6f - x * x - y * y - z * z, 0.0f);
+  t *= t;
+  return t * t * dot(g, x, y, z);
+}
+
+static float _simplex_noise(double xin, double yin, double zin)
 {
-  double n0, n1, n2, n3; // Noise contributions from the four corners
-                         // Skew the input space to determine which simplex cell we're in
+  // Skew the input space to determine which simplex cell we're in.
+  // the coordinates include the per image seed and can be large, so this stays in double,
+  // everything relative to the cell is fine in float.
   const double F3 = 1.0 / 3.0;
   const double s = (xin + yin + zin) * F3; // Very nice and simple skew factor for 3D
   const int i = FASTFLOOR(xin + s);
   const int j = FASTFLOOR(yin + s);
   const int k = FASTFLOOR(zin + s);
-  const double G3 = 1.0 / 6.0; // Very nice and simple unskew factor, too
-  const double t = (i + j + k) * G3;
-  const double X0 = i - t; // Unskew the cell origin back to (x,y,z) space
-  const double Y0 = j - t;
-  const double Z0 = k - t;
-  const double x0 = xin - X0; // The x,y,z distances from the cell origin
-  const double y0 = yin - Y0;
-  const double z0 = zin - Z0;
+  const double G3d = 1.0 / 6.0; // Very nice and simple unskew factor, too
+  const double t = (i + j + k) * G3d;
+  // The x,y,z distances from the unskewed cell origin
+  const float x0 = xin - (i - t);
+  const float y0 = yin - (j - t);
+  const float z0 = zin - (k - t);
+  const float G3 = 1.0f / 6.0f;
   // For the 3D case, the simplex shape is a slightly irregular tetrahedron.
   // Determine which simplex we are in.
   int i1, j1, k1; // Offsets for second corner of simplex in (i,j,k) coords
@@ -236,15 +272,15 @@ static double _simplex_noise(double xin, double yin, double zin)
   //  a step of (0,1,0) in (i,j,k) means a step of (-c,1-c,-c) in (x,y,z), and
   //  a step of (0,0,1) in (i,j,k) means a step of (-c,-c,1-c) in (x,y,z), where
   //  c = 1/6.
-  const double x1 = x0 - i1 + G3; // Offsets for second corner in (x,y,z) coords
-  const double y1 = y0 - j1 + G3;
-  const double z1 = z0 - k1 + G3;
-  const double x2 = x0 - i2 + 2.0 * G3; // Offsets for third corner in (x,y,z) coords
-  const double y2 = y0 - j2 + 2.0 * G3;
-  const double z2 = z0 - k2 + 2.0 * G3;
-  const double x3 = x0 - 1.0 + 3.0 * G3; // Offsets for last corner in (x,y,z) coords
-  const double y3 = y0 - 1.0 + 3.0 * G3;
-  const double z3 = z0 - 1.0 + 3.0 * G3;
+  const float x1 = x0 - i1 + G3; // Offsets for second corner in (x,y,z) coords
+  const float y1 = y0 - j1 + G3;
+  const float z1 = z0 - k1 + G3;
+  const float x2 = x0 - i2 + 2.0f * G3; // Offsets for third corner in (x,y,z) coords
+  const float y2 = y0 - j2 + 2.0f * G3;
+  const float z2 = z0 - k2 + 2.0f * G3;
+  const float x3 = x0 - 1.0f + 3.0f * G3; // Offsets for last corner in (x,y,z) coords
+  const float y3 = y0 - 1.0f + 3.0f * G3;
+  const float z3 = z0 - 1.0f + 3.0f * G3;
   // Work out the hashed gradient indices of the four simplex corners
   const int ii = i & 255;
   const int jj = j & 255;
@@ -253,42 +289,10 @@ static double _simplex_noise(double xin, double yin, double zin)
   const int gi1 = perm[ii + i1 + perm[jj + j1 + perm[kk + k1]]] % 12;
   const int gi2 = perm[ii + i2 + perm[jj + j2 + perm[kk + k2]]] % 12;
   const int gi3 = perm[ii + 1 + perm[jj + 1 + perm[kk + 1]]] % 12;
-  // Calculate the contribution from the four corners
-  double t0 = 0.6 - x0 * x0 - y0 * y0 - z0 * z0;
-  if(t0 < 0)
-    n0 = 0.0;
-  else
-  {
-    t0 *= t0;
-    n0 = t0 * t0 * dot(grad3[gi0], x0, y0, z0);
-  }
-  double t1 = 0.6 - x1 * x1 - y1 * y1 - z1 * z1;
-  if(t1 < 0)
-    n1 = 0.0;
-  else
-  {
-    t1 *= t1;
-    n1 = t1 * t1 * dot(grad3[gi1], x1, y1, z1);
-  }
-  double t2 = 0.6 - x2 * x2 - y2 * y2 - z2 * z2;
-  if(t2 < 0)
-    n2 = 0.0;
-  else
-  {
-    t2 *= t2;
-    n2 = t2 * t2 * dot(grad3[gi2], x2, y2, z2);
-  }
-  double t3 = 0.6 - x3 * x3 - y3 * y3 - z3 * z3;
-  if(t3 < 0)
-    n3 = 0.0;
-  else
-  {
-    t3 *= t3;
-    n3 = t3 * t3 * dot(grad3[gi3], x3, y3, z3);
-  }
   // Add contributions from each corner to get the final noise value.
   // The result is scaled to stay just inside [-1,1]
-  return 32.0 * (n0 + n1 + n2 + n3);
+  return 32.0f * (_simplex_corner(grad3[gi0], x0, y0, z0) + _simplex_corner(grad3[gi1], x1, y1, z1)
+                  + _simplex_corner(grad3[gi2], x2, y2, z2) + _simplex_corner(grad3[gi3], x3, y3, z3));
 }
 
 #define PRIME_LEVELS 4
@@ -347,13 +351,13 @@ static double _perlin_2d_noise(double x,double y,uint32_t octaves,double persist
   return total;
 }*/
 
-static double _simplex_2d_noise(double x, double y, uint32_t octaves, double persistance, double z)
+static float _simplex_2d_noise(double x, double y, uint32_t octaves, double persistance, double z)
 {
-  double total = 0;
+  float total = 0;
 
   // parametrization of octaves to match power spectrum of real grain scans
-  static double f[] = {0.4910, 0.9441, 1.7280};
-  static double a[] = {0.2340, 0.7850, 1.2150};
+  static const double f[] = {0.4910, 0.9441, 1.7280};
+  static const float a[] = {0.2340, 0.7850, 1.2150};
 
   for(uint32_t o = 0; o < octaves; o++)
   {
@@ -446,6 +450,111 @@ void connect_key_accels(dt_iop_module_t *self)
 
 #endif
 
+// synthesise the grain of the image seed at offset into a periodic texture. the noise is cross faded
+// with its copies one period away, the square root weights keep the variance the same everywhere.
+static void _grain_texture_bake(float *const texels, const double offset)
+{
+  const int size = GRAIN_TEXTURE_SIZE;
+  const double period = GRAIN_TEXTURE_SIZE * GRAIN_TEXTURE_TEXEL;
+  const uint32_t octaves = 3;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int v = 0; v < size; v++)
+  {
+    const double y = v * GRAIN_TEXTURE_TEXEL;
+    const float t = (float)v / size;
+    for(int u = 0; u < size; u++)
+    {
+      const double x = u * GRAIN_TEXTURE_TEXEL + offset;
+      const float s = (float)u / size;
+      texels[(size_t)v * size + u]
+          = sqrtf((1.0f - s) * (1.0f - t)) * _simplex_2d_noise(x, y, octaves, 1.0, 1.0)
+            + sqrtf(s * (1.0f - t)) * _simplex_2d_noise(x - period, y, octaves, 1.0, 1.0)
+            + sqrtf((1.0f - s) * t) * _simplex_2d_noise(x, y - period, octaves, 1.0, 1.0)
+            + sqrtf(s * t) * _simplex_2d_noise(x - period, y - period, octaves, 1.0, 1.0);
+    }
+  }
+}
+
+// get the texture of the image seed at zoom from the cache in the global data, baking it if needed. the key
+// doesn't depend on the roi, so preview and full pipe at any zoom level share it.
+// returns NULL if all cache slots are busy, the caller evaluates the noise per pixel then.
+static dt_iop_grain_texture_t *_grain_texture_get(dt_iop_grain_global_data_t *gd, const unsigned int seed,
+                                                  const double zoom)
+{
+  dt_pthread_mutex_lock(&gd->lock);
+  dt_iop_grain_texture_t *found = NULL, *victim = NULL;
+  for(int k = 0; k < GRAIN_TEXTURE_CACHE; k++)
+  {
+    dt_iop_grain_texture_t *tex = gd->texture + k;
+    if(tex->texels && tex->seed == seed && tex->zoom == zoom)
+    {
+      found = tex;
+      break;
+    }
+    if(tex->users == 0 && (!victim || tex->last_used < victim->last_used)) victim = tex;
+  }
+
+  if(found)
+  {
+    // somebody else bakes this one already, wait for it rather than baking the same texture twice.
+    // the slot can't be taken over meanwhile, its baker counts as a user.
+    found->users++;
+    found->last_used = ++gd->clock;
+    while(found->baking) dt_pthread_cond_wait(&gd->baked, &gd->lock);
+    dt_pthread_mutex_unlock(&gd->lock);
+    return found;
+  }
+
+  if(victim && !victim->texels)
+    victim->texels = dt_alloc_align(64, sizeof(float) * GRAIN_TEXTURE_SIZE * GRAIN_TEXTURE_SIZE);
+  if(!victim || !victim->texels)
+  {
+    dt_pthread_mutex_unlock(&gd->lock);
+    return NULL;
+  }
+
+  // bake without holding the lock, pipes working on other textures carry on
+  victim->seed = seed;
+  victim->zoom = zoom;
+  victim->baking = 1;
+  victim->users = 1;
+  victim->last_used = ++gd->clock;
+  dt_pthread_mutex_unlock(&gd->lock);
+
+  const double start = dt_get_wtime();
+  _grain_texture_bake(victim->texels, (seed % GRAIN_TEXTURE_SEEDS) / zoom);
+  dt_print(DT_DEBUG_PERF, "[grain] baked grain texture in %.3f secs\n", dt_get_wtime() - start);
+
+  dt_pthread_mutex_lock(&gd->lock);
+  victim->baking = 0;
+  pthread_cond_broadcast(&gd->baked);
+  dt_pthread_mutex_unlock(&gd->lock);
+  return victim;
+}
+
+static void _grain_texture_release(dt_iop_grain_global_data_t *gd, dt_iop_grain_texture_t *tex)
+{
+  dt_pthread_mutex_lock(&gd->lock);
+  tex->users--;
+  dt_pthread_mutex_unlock(&gd->lock);
+}
+
+// bilinear lookup in the periodic texture, x and y in noise units
+static inline float _grain_texture_lookup(const float *const texels, const double x, const double y)
+{
+  const double fx = x * (1.0 / GRAIN_TEXTURE_TEXEL), fy = y * (1.0 / GRAIN_TEXTURE_TEXEL);
+  const double flx = floor(fx), fly = floor(fy);
+  const float dx = fx - flx, dy = fy - fly;
+  const int mask = GRAIN_TEXTURE_SIZE - 1;
+  const int x0 = (int64_t)flx & mask, y0 = (int64_t)fly & mask;
+  const int x1 = (x0 + 1) & mask, y1 = (y0 + 1) & mask;
+  const float *const r0 = texels + (size_t)y0 * GRAIN_TEXTURE_SIZE;
+  const float *const r1 = texels + (size_t)y1 * GRAIN_TEXTURE_SIZE;
+  return (1.0f - dy) * ((1.0f - dx) * r0[x0] + dx * r0[x1]) + dy * ((1.0f - dx) * r1[x0] + dx * r1[x1]);
+}
+
 // see: http://eternallyconfuzzled.com/tuts/algorithms/jsw_tut_hashing.aspx
 // this is the modified bernstein
 static unsigned int _hash_string(char *s)
@@ -460,7 +569,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 {
   dt_iop_grain_data_t *data = (dt_iop_grain_data_t *)piece->data;
 
-  unsigned int hash = _hash_string(piece->pipe->image.filename) % (int)fmax(roi_out->width * 0.3, 1.0);
+  const unsigned int seed = _hash_string(piece->pipe->image.filename);
+  unsigned int hash = seed % (int)fmax(roi_out->width * 0.3, 1.0);
 
   const int ch = piece->colors;
   // Apply grain to image
@@ -476,6 +586,12 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   const float fib1 = 34.0, fib2 = 21.0;
   const float fib1div2 = fib1 / fib2;
 
+  // sample a periodic texture of this seed and scale instead of evaluating the octaves per pixel
+  dt_iop_grain_global_data_t *gd = (dt_iop_grain_global_data_t *)self->data;
+  dt_iop_grain_texture_t *texture
+      = dt_conf_get_bool("plugins/darkroom/grain/texture") ? _grain_texture_get(gd, seed, zoom) : NULL;
+  const float *const texels = texture ? texture->texels : NULL;
+
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(data, hash)
 #endif
@@ -496,7 +612,21 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       const double x = wx / wd;
       //  double noise=_perlin_2d_noise(x, y, octaves,0.25, zoom)*1.5;
       double noise = 0.0;
-      if(filter)
+      if(texels && filter)
+      {
+        for(int l = 0; l < fib2; l++)
+        {
+          float px = l / fib2, py = l * fib1div2;
+          py -= (int)py;
+          float dx = px * filtermul, dy = py * filtermul;
+          noise += (1.0 / fib2) * _grain_texture_lookup(texels, (x + dx) / zoom, (y + dy) / zoom);
+        }
+      }
+      else if(texels)
+      {
+        noise = _grain_texture_lookup(texels, x / zoom, y / zoom);
+      }
+      else if(filter)
       {
         // if zoomed out a lot, use rank-1 lattice downsampling
         for(int l = 0; l < fib2; l++)
@@ -521,6 +651,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       in += ch;
     }
   }
+
+  if(texture) _grain_texture_release(gd, texture);
 }
 
 static void scale_callback(GtkWidget *slider, gpointer user_data)
@@ -587,6 +719,24 @@ void gui_update(struct dt_iop_module_t *self)
   dt_bauhaus_slider_set(g->scale3, p->midtones_bias);
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  dt_iop_grain_global_data_t *gd = (dt_iop_grain_global_data_t *)calloc(1, sizeof(dt_iop_grain_global_data_t));
+  dt_pthread_mutex_init(&gd->lock, NULL);
+  pthread_cond_init(&gd->baked, NULL);
+  module->data = gd;
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_grain_global_data_t *gd = (dt_iop_grain_global_data_t *)module->data;
+  for(int k = 0; k < GRAIN_TEXTURE_CACHE; k++) dt_free_align(gd->texture[k].texels);
+  pthread_cond_destroy(&gd->baked);
+  dt_pthread_mutex_destroy(&gd->lock);
+  free(module->data);
+  module->data = NULL;
+}
+
 void init(dt_iop_module_t *module)
 {
   _simplex_noise_init();
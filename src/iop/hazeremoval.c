@@ -36,6 +36,7 @@
 #endif
 
 #include "bauhaus/bauhaus.h"
+#include "common/box_filters.h"
 #include "common/darktable.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
@@ -288,203 +289,6 @@ static inline void swap_pointer_f(float *a, float *b)
   b = t;
 }
 
-// calculate the one-dimensional moving average over a window of size 2*w+1
-// input array x has stride 1, output array y has stride stride_y
-static inline void box_mean_1d(int N, const float *x, float *y, size_t stride_y, int w)
-{
-  float m = 0, n_box = 0;
-  for(int i = 0, i_end = min_i(w + 1, N); i < i_end; i++)
-  {
-    m += x[i];
-    n_box++;
-  }
-  for(int i = 0; i < N; i++)
-  {
-    y[i * stride_y] = m / n_box;
-    if(i - w >= 0)
-    {
-      m -= x[i - w];
-      n_box--;
-    }
-    if(i + w + 1 < N)
-    {
-      m += x[i + w + 1];
-      n_box++;
-    }
-  }
-}
-
-// calculate the two-dimensional moving average over a box of size (2*w+1) x (2*w+1)
-// does the calculation in-place if input and output images are identical
-// this function is always called from a OpenMP thread, thus no parallelization
-static void box_mean(gray_image img1, gray_image img2, int w)
-{
-  gray_image img2_bak;
-  if(img1.data == img2.data)
-  {
-    img2_bak = new_gray_image(max_i(img2.width, img2.height), 1);
-    for(int i1 = 0; i1 < img2.height; i1++)
-    {
-      memcpy(img2_bak.data, img2.data + (size_t)i1 * img2.width, sizeof(float) * img2.width);
-      box_mean_1d(img2.width, img2_bak.data, img2.data + (size_t)i1 * img2.width, 1, w);
-    }
-  }
-  else
-  {
-    for(int i1 = 0; i1 < img1.height; i1++)
-      box_mean_1d(img1.width, img1.data + (size_t)i1 * img1.width, img2.data + (size_t)i1 * img2.width, 1, w);
-    img2_bak = new_gray_image(1, img2.height);
-  }
-  for(int i0 = 0; i0 < img1.width; i0++)
-  {
-    for(int i1 = 0; i1 < img1.height; i1++) img2_bak.data[i1] = img2.data[i0 + (size_t)i1 * img2.width];
-    box_mean_1d(img1.height, img2_bak.data, img2.data + i0, img1.width, w);
-  }
-  free_gray_image(&img2_bak);
-}
-
-// calculate the one-dimensional moving maximum over a window of size 2*w+1
-// input array x has stride 1, output array y has stride stride_y
-static inline void box_max_1d(int N, const float *x, float *y, size_t stride_y, int w)
-{
-  float m = -(INFINITY);
-  for(int i = 0, i_end = min_i(w + 1, N); i < i_end; i++) m = fmaxf(x[i], m);
-  for(int i = 0; i < N; i++)
-  {
-    y[i * stride_y] = m;
-    if(i - w >= 0 && x[i - w] == m)
-    {
-      m = -(INFINITY);
-      for(int j = max_i(i - w + 1, 0), j_end = min_i(i + w + 2, N); j < j_end; j++) m = fmaxf(x[j], m);
-    }
-    if(i + w + 1 < N) m = fmaxf(x[i + w + 1], m);
-  }
-}
-
-// calculate the two-dimensional moving maximum over a box of size (2*w+1) x (2*w+1)
-// does the calculation in-place if input and output images are identical
-static void box_max(const gray_image img1, const gray_image img2, const int w)
-{
-  gray_image img2_bak;
-  if(img1.data == img2.data)
-  {
-#ifdef _OPENMP
-#pragma omp parallel default(none) private(img2_bak)
-#endif
-    {
-      img2_bak = new_gray_image(img2.width, 1);
-#ifdef _OPENMP
-#pragma omp for
-#endif
-      for(int i1 = 0; i1 < img2.height; i1++)
-      {
-        memcpy(img2_bak.data, img2.data + (size_t)i1 * img2.width, sizeof(float) * img2.width);
-        box_max_1d(img2.width, img2_bak.data, img2.data + (size_t)i1 * img2.width, 1, w);
-      }
-      free_gray_image(&img2_bak);
-    }
-  }
-  else
-  {
-#ifdef _OPENMP
-#pragma omp parallel default(none) private(img2_bak)
-#endif
-    {
-#ifdef _OPENMP
-#pragma omp for
-#endif
-      for(int i1 = 0; i1 < img1.height; i1++)
-        box_max_1d(img1.width, img1.data + (size_t)i1 * img1.width, img2.data + (size_t)i1 * img2.width, 1, w);
-    }
-  }
-#ifdef _OPENMP
-#pragma omp parallel default(none) private(img2_bak)
-#endif
-  {
-    img2_bak = new_gray_image(1, img2.height);
-#ifdef _OPENMP
-#pragma omp for
-#endif
-    for(int i0 = 0; i0 < img1.width; i0++)
-    {
-      for(int i1 = 0; i1 < img1.height; i1++) img2_bak.data[i1] = img2.data[i0 + (size_t)i1 * img2.width];
-      box_max_1d(img1.height, img2_bak.data, img2.data + i0, img1.width, w);
-    }
-    free_gray_image(&img2_bak);
-  }
-}
-
-// calculate the one-dimensional moving minimum over a window of size 2*w+1
-// input array x has stride 1, output array y has stride stride_y
-static inline void box_min_1d(int N, const float *x, float *y, size_t stride_y, int w)
-{
-  float m = INFINITY;
-  for(int i = 0, i_end = min_i(w + 1, N); i < i_end; i++) m = fminf(x[i], m);
-  for(int i = 0; i < N; i++)
-  {
-    y[i * stride_y] = m;
-    if(i - w >= 0 && x[i - w] == m)
-    {
-      m = INFINITY;
-      for(int j = max_i(i - w + 1, 0), j_end = min_i(i + w + 2, N); j < j_end; j++) m = fminf(x[j], m);
-    }
-    if(i + w + 1 < N) m = fminf(x[i + w + 1], m);
-  }
-}
-
-// calculate the two-dimensional moving minimum over a box of size (2*w+1) x (2*w+1)
-// does the calculation in-place if input and output images are identical
-static void box_min(const gray_image img1, const gray_image img2, const int w)
-{
-  gray_image img2_bak;
-  if(img1.data == img2.data)
-  {
-#ifdef _OPENMP
-#pragma omp parallel default(none) private(img2_bak)
-#endif
-    {
-      img2_bak = new_gray_image(img2.width, 1);
-#ifdef _OPENMP
-#pragma omp for
-#endif
-      for(int i1 = 0; i1 < img2.height; i1++)
-      {
-        memcpy(img2_bak.data, img2.data + (size_t)i1 * img2.width, sizeof(float) * img2.width);
-        box_min_1d(img2.width, img2_bak.data, img2.data + (size_t)i1 * img2.width, 1, w);
-      }
-      free_gray_image(&img2_bak);
-    }
-  }
-  else
-  {
-#ifdef _OPENMP
-#pragma omp parallel default(none) private(img2_bak)
-#endif
-    {
-#ifdef _OPENMP
-#pragma omp for
-#endif
-      for(int i1 = 0; i1 < img1.height; i1++)
-        box_min_1d(img1.width, img1.data + (size_t)i1 * img1.width, img2.data + (size_t)i1 * img2.width, 1, w);
-    }
-  }
-#ifdef _OPENMP
-#pragma omp parallel default(none) private(img2_bak)
-#endif
-  {
-    img2_bak = new_gray_image(1, img2.height);
-#ifdef _OPENMP
-#pragma omp for schedule(static)
-#endif
-    for(int i0 = 0; i0 < img1.width; i0++)
-    {
-      for(int i1 = 0; i1 < img1.height; i1++) img2_bak.data[i1] = img2.data[i0 + (size_t)i1 * img2.width];
-      box_min_1d(img1.height, img2_bak.data, img2.data + i0, img1.width, w);
-    }
-    free_gray_image(&img2_bak);
-  }
-}
-
 // calculate the dark channel (minimal color component over a box of size (2*w+1) x (2*w+1) )
 static void dark_channel(const const_rgb_image img1, const gray_image img2, const int w)
 {
@@ -500,7 +304,7 @@ static void dark_channel(const const_rgb_image img1, const gray_image img2, cons
     m = fminf(pixel[2], m);
     img2.data[i] = m;
   }
-  box_min(img2, img2, w);
+  dt_box_min(img2.data, img2.width, img2.height, w);
 }
 
 // calculate the transition map
@@ -519,7 +323,7 @@ static void transition_map(const const_rgb_image img1, const gray_image img2, co
     m = fminf(pixel[2] / A0[2], m);
     img2.data[i] = 1.f - m * strength;
   }
-  box_max(img2, img2, w);
+  dt_box_max(img2.data, img2.width, img2.height, w);
 }
 
 // apply guided filter to single-component image img using the 3-components
@@ -551,10 +355,10 @@ static void guided_filter_tiling(const_rgb_image imgg, gray_image img, gray_imag
       img_mean.data[k] = img.data[l];
     }
   }
-  box_mean(imgg_mean_r, imgg_mean_r, w);
-  box_mean(imgg_mean_g, imgg_mean_g, w);
-  box_mean(imgg_mean_b, imgg_mean_b, w);
-  box_mean(img_mean, img_mean, w);
+  dt_box_mean(imgg_mean_r.data, imgg_mean_r.width, imgg_mean_r.height, w);
+  dt_box_mean(imgg_mean_g.data, imgg_mean_g.width, imgg_mean_g.height, w);
+  dt_box_mean(imgg_mean_b.data, imgg_mean_b.width, imgg_mean_b.height, w);
+  dt_box_mean(img_mean.data, img_mean.width, img_mean.height, w);
   gray_image cov_imgg_img_r = new_gray_image(width, height);
   gray_image cov_imgg_img_g = new_gray_image(width, height);
   gray_image cov_imgg_img_b = new_gray_image(width, height);
@@ -582,15 +386,15 @@ static void guided_filter_tiling(const_rgb_image imgg, gray_image img, gray_imag
       var_imgg_bb.data[k] = pixel[2] * pixel[2];
     }
   }
-  box_mean(cov_imgg_img_r, cov_imgg_img_r, w);
-  box_mean(cov_imgg_img_g, cov_imgg_img_g, w);
-  box_mean(cov_imgg_img_b, cov_imgg_img_b, w);
-  box_mean(var_imgg_rr, var_imgg_rr, w);
-  box_mean(var_imgg_rg, var_imgg_rg, w);
-  box_mean(var_imgg_rb, var_imgg_rb, w);
-  box_mean(var_imgg_gg, var_imgg_gg, w);
-  box_mean(var_imgg_gb, var_imgg_gb, w);
-  box_mean(var_imgg_bb, var_imgg_bb, w);
+  dt_box_mean(cov_imgg_img_r.data, cov_imgg_img_r.width, cov_imgg_img_r.height, w);
+  dt_box_mean(cov_imgg_img_g.data, cov_imgg_img_g.width, cov_imgg_img_g.height, w);
+  dt_box_mean(cov_imgg_img_b.data, cov_imgg_img_b.width, cov_imgg_img_b.height, w);
+  dt_box_mean(var_imgg_rr.data, var_imgg_rr.width, var_imgg_rr.height, w);
+  dt_box_mean(var_imgg_rg.data, var_imgg_rg.width, var_imgg_rg.height, w);
+  dt_box_mean(var_imgg_rb.data, var_imgg_rb.width, var_imgg_rb.height, w);
+  dt_box_mean(var_imgg_gg.data, var_imgg_gg.width, var_imgg_gg.height, w);
+  dt_box_mean(var_imgg_gb.data, var_imgg_gb.width, var_imgg_gb.height, w);
+  dt_box_mean(var_imgg_bb.data, var_imgg_bb.width, var_imgg_bb.height, w);
   for(size_t i = 0; i < size; i++)
   {
     cov_imgg_img_r.data[i] -= imgg_mean_r.data[i] * img_mean.data[i];
@@ -655,10 +459,10 @@ static void guided_filter_tiling(const_rgb_image imgg, gray_image img, gray_imag
       ++i;
     }
   }
-  box_mean(a_r, a_r, w);
-  box_mean(a_g, a_g, w);
-  box_mean(a_b, a_b, w);
-  box_mean(b, b, w);
+  dt_box_mean(a_r.data, a_r.width, a_r.height, w);
+  dt_box_mean(a_g.data, a_g.width, a_g.height, w);
+  dt_box_mean(a_b.data, a_b.width, a_b.height, w);
+  dt_box_mean(b.data, b.width, b.height, w);
   // finally calculate results for the curent tile
   for(int j_imgg = target.lower; j_imgg < target.upper; j_imgg++)
   {
@@ -820,6 +624,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   dt_iop_hazeremoval_gui_data_t *g = (dt_iop_hazeremoval_gui_data_t *)self->gui_data;
   dt_iop_hazeremoval_params_t *d = (dt_iop_hazeremoval_params_t *)piece->data;
 
+  const double start = dt_get_wtime();
   const int ch = piece->colors;
   const int width = roi_in->width;
   const int height = roi_in->height;
@@ -892,7 +697,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
   // refine the transition map
   gray_image trans_map_filtered = new_gray_image(width, height);
-  box_min(trans_map, trans_map, w1);
+  dt_box_min(trans_map.data, trans_map.width, trans_map.height, w1);
   const int tile_width = 512 - 4 * w2;
   const gray_image c_trans_map = trans_map;
   const gray_image c_trans_map_filtered = trans_map_filtered;
@@ -929,6 +734,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   free_gray_image(&trans_map);
   free_gray_image(&trans_map_filtered);
 
+  dt_print(DT_DEBUG_PERF, "[hazeremoval] %dx%d in %.3f secs\n", width, height, dt_get_wtime() - start);
+
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK)
     dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
@@ -76,10 +76,10 @@ const char *description();
 int operation_tags();
 int operation_tags_filter();
 
-/** what do the iop want as an input? */
+/** what do the iop want as an input? TYPE_HALF if it reads half floats, else they are expanded to floats. */
 void input_format(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_t *pipe,
                   struct dt_dev_pixelpipe_iop_t *piece, struct dt_iop_buffer_dsc_t *dsc);
-/** what will it output? */
+/** what will it output? TYPE_HALF has process() write floats, which the pipe stores as half floats. */
 void output_format(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_t *pipe,
                    struct dt_dev_pixelpipe_iop_t *piece, struct dt_iop_buffer_dsc_t *dsc);
 
@@ -171,6 +171,17 @@ void process_sse2(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *p
                   const struct dt_iop_roi_t *const roi_out);
 #endif
 
+/** optional pixelwise variant of process(): transforms npixels 4-channel float pixels from in to out,
+  * which may be the same buffer. it is called concurrently on blocks of the roi and must neither depend
+  * on pixel positions nor touch piece->pipe. modules providing it can be run fused with their pixelwise
+  * neighbours in one pass over the image. */
+void process_pixels(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                    float *const out, const size_t npixels);
+/** optional, called once before each fused pass over process_pixels(): per-run setup and updates of
+  * piece->pipe->dsc which process() would otherwise do. */
+void process_pixels_prepare(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                            const struct dt_iop_roi_t *const roi_in, const struct dt_iop_roi_t *const roi_out);
+
 #ifdef HAVE_OPENCL
 /** the opencl equivalent of process(). */
 int process_cl(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in,
@@ -289,58 +289,71 @@ static void commit_params_late(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pi
   }
 }
 
-void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid, void *const ovoid,
-             const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+void process_pixels_prepare(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
+                            const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  const int ch = piece->colors;
   const dt_iop_levels_data_t *const d = (dt_iop_levels_data_t *)piece->data;
 
   if(d->mode == LEVELS_MODE_AUTOMATIC)
   {
     commit_params_late(self, piece);
   }
+}
 
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static)
-#endif
-  for(int k = 0; k < roi_out->height; k++)
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const input,
+                    float *const output, const size_t npixels)
+{
+  const dt_iop_levels_data_t *const d = (dt_iop_levels_data_t *)piece->data;
+  const float *in = input;
+  float *out = output;
+
+  for(size_t j = 0; j < npixels; j++, in += 4, out += 4)
   {
-    float *in = (float *)ivoid + (size_t)k * ch * roi_out->width;
-    float *out = (float *)ovoid + (size_t)k * ch * roi_out->width;
-    for(int j = 0; j < roi_out->width; j++, in += ch, out += ch)
+    const float L_in = in[0] / 100.0f;
+    float L_out;
+
+    if(L_in <= d->levels[0])
     {
-      float L_in = in[0] / 100.0f;
+      // Anything below the lower threshold just clips to zero
+      L_out = 0.0f;
+    }
+    else if(L_in >= d->levels[2])
+    {
+      float percentage = (L_in - d->levels[0]) / (d->levels[2] - d->levels[0]);
+      L_out = 100.0f * pow(percentage, d->in_inv_gamma);
+    }
+    else
+    {
+      // Within the expected input range we can use the lookup table
+      float percentage = (L_in - d->levels[0]) / (d->levels[2] - d->levels[0]);
+      // out[0] = 100.0 * pow(percentage, d->in_inv_gamma);
+      L_out = d->lut[CLAMP((int)(percentage * 0x10000ul), 0, 0xffff)];
+    }
 
-      if(L_in <= d->levels[0])
-      {
-        // Anything below the lower threshold just clips to zero
-        out[0] = 0.0f;
-      }
-      else if(L_in >= d->levels[2])
-      {
-        float percentage = (L_in - d->levels[0]) / (d->levels[2] - d->levels[0]);
-        out[0] = 100.0f * pow(percentage, d->in_inv_gamma);
-      }
-      else
-      {
-        // Within the expected input range we can use the lookup table
-        float percentage = (L_in - d->levels[0]) / (d->levels[2] - d->levels[0]);
-        // out[0] = 100.0 * pow(percentage, d->in_inv_gamma);
-        out[0] = d->lut[CLAMP((int)(percentage * 0x10000ul), 0, 0xffff)];
-      }
+    // Preserving contrast
+    // (in and out may be the same buffer, in[0] has to be read before out[0] is written)
+    const float div = (in[0] > 0.01f) ? in[0] : 0.01f;
+    out[1] = in[1] * L_out / div;
+    out[2] = in[2] * L_out / div;
+    out[3] = in[3];
+    out[0] = L_out;
+  }
+}
 
-      // Preserving contrast
-      if(in[0] > 0.01f)
-      {
-        out[1] = in[1] * out[0] / in[0];
-        out[2] = in[2] * out[0] / in[0];
-      }
-      else
-      {
-        out[1] = in[1] * out[0] / 0.01f;
-        out[2] = in[2] * out[0] / 0.01f;
-      }
-    }
+void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid, void *const ovoid,
+             const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const int ch = piece->colors;
+
+  process_pixels_prepare(self, piece, roi_in, roi_out);
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(self, piece) schedule(static)
+#endif
+  for(int k = 0; k < roi_out->height; k++)
+  {
+    const size_t offset = (size_t)k * ch * roi_out->width;
+    process_pixels(self, piece, (const float *)ivoid + offset, (float *)ovoid + offset, roi_out->width);
   }
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
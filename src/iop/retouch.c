@@ -4080,6 +4080,9 @@ static void rt_process_forms(float *layer, dwt_params_t *const wt_p, const int s
       GList *forms = g_list_first(grp->points);
       while(forms)
       {
+        // every spot costs a mask and a heal or blur, don't start another one for a cancelled pipe
+        if(dt_cancelled()) break;
+
         const dt_masks_point_group_t *grpt = (dt_masks_point_group_t *)forms->data;
         if(grpt == NULL)
         {
@@ -126,45 +126,54 @@ int legacy_params(dt_iop_module_t *self, const void *const old_params, const int
   return 1;
 }
 
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                    float *const out, const size_t npixels)
 {
   const dt_iop_velvia_data_t *const data = (dt_iop_velvia_data_t *)piece->data;
-
-  const int ch = piece->colors;
   const float strength = data->strength / 100.0f;
 
-  // Apply velvia saturation
   if(strength <= 0.0)
-    memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
-  else
   {
-#ifdef _OPENMP
-#pragma omp parallel for SIMD() default(none) schedule(static)
-#endif
-    for(size_t k = 0; k < (size_t)roi_out->width * roi_out->height; k++)
-    {
-      const float *const in = (const float *const)ivoid + (size_t)ch * k;
-      float *const out = (float *const)ovoid + (size_t)ch * k;
+    if(in != out) memcpy(out, in, sizeof(float) * 4 * npixels);
+    return;
+  }
 
-      // calculate vibrance, and apply boost velvia saturation at least saturated pixels
-      float pmax = MAX(in[0], MAX(in[1], in[2])); // max value in RGB set
-      float pmin = MIN(in[0], MIN(in[1], in[2])); // min value in RGB set
-      float plum = (pmax + pmin) / 2.0f;          // pixel luminocity
-      float psat = (plum <= 0.5f) ? (pmax - pmin) / (1e-5f + pmax + pmin)
-                                  : (pmax - pmin) / (1e-5f + MAX(0.0f, 2.0f - pmax - pmin));
+  for(size_t k = 0; k < (size_t)4 * npixels; k += 4)
+  {
+    // calculate vibrance, and apply boost velvia saturation at least saturated pixels
+    float pmax = MAX(in[k], MAX(in[k + 1], in[k + 2])); // max value in RGB set
+    float pmin = MIN(in[k], MIN(in[k + 1], in[k + 2])); // min value in RGB set
+    float plum = (pmax + pmin) / 2.0f;                  // pixel luminocity
+    float psat = (plum <= 0.5f) ? (pmax - pmin) / (1e-5f + pmax + pmin)
+                                : (pmax - pmin) / (1e-5f + MAX(0.0f, 2.0f - pmax - pmin));
+
+    float pweight
+        = CLAMPS(((1.0f - (1.5f * psat)) + ((1.0f + (fabsf(plum - 0.5f) * 2.0f)) * (1.0f - data->bias)))
+                     / (1.0f + (1.0f - data->bias)),
+                 0.0f, 1.0f);              // The weight of pixel
+    float saturation = strength * pweight; // So lets calculate the final affection of filter on pixel
+
+    // Apply velvia saturation values
+    const float r = in[k], g = in[k + 1], b = in[k + 2];
+    out[k] = CLAMPS(r + saturation * (r - 0.5f * (g + b)), 0.0f, 1.0f);
+    out[k + 1] = CLAMPS(g + saturation * (g - 0.5f * (b + r)), 0.0f, 1.0f);
+    out[k + 2] = CLAMPS(b + saturation * (b - 0.5f * (r + g)), 0.0f, 1.0f);
+    out[k + 3] = in[k + 3];
+  }
+}
 
-      float pweight
-          = CLAMPS(((1.0f - (1.5f * psat)) + ((1.0f + (fabsf(plum - 0.5f) * 2.0f)) * (1.0f - data->bias)))
-                       / (1.0f + (1.0f - data->bias)),
-                   0.0f, 1.0f);              // The weight of pixel
-      float saturation = strength * pweight; // So lets calculate the final affection of filter on pixel
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const int ch = piece->colors;
 
-      // Apply velvia saturation values
-      out[0] = CLAMPS(in[0] + saturation * (in[0] - 0.5f * (in[1] + in[2])), 0.0f, 1.0f);
-      out[1] = CLAMPS(in[1] + saturation * (in[1] - 0.5f * (in[2] + in[0])), 0.0f, 1.0f);
-      out[2] = CLAMPS(in[2] + saturation * (in[2] - 0.5f * (in[0] + in[1])), 0.0f, 1.0f);
-    }
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(self, piece) schedule(static)
+#endif
+  for(int j = 0; j < roi_out->height; j++)
+  {
+    const size_t offset = (size_t)ch * roi_out->width * j;
+    process_pixels(self, piece, (const float *)ivoid + offset, (float *)ovoid + offset, roi_out->width);
   }
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
@@ -0,0 +1,121 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+// helpers shared by the benchmark programs in this directory: synthetic input, best of several runs,
+// switching between codepaths and reporting the checks against reference results. every program takes
+// the size of its synthetic buffer as [width] [height] and exits non-zero if a check failed.
+
+#include "common/cpuid.h"
+#include "common/darktable.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// timings are the fastest of this many runs
+#ifndef BENCH_RUNS
+#define BENCH_RUNS 5
+#endif
+
+typedef enum bench_codepath_t
+{
+  BENCH_PLAIN = 0,
+  BENCH_SSE2 = 1,
+  BENCH_AVX2 = 2,
+  BENCH_CODEPATHS
+} bench_codepath_t;
+
+static const char *const bench_codepath_names[BENCH_CODEPATHS] = { "plain", "sse2", "avx2" };
+
+// deterministic pseudo random numbers in [0, 1), so runs can be compared
+static inline float bench_rnd(uint32_t *state)
+{
+  *state = *state * 1664525u + 1013904223u;
+  return (*state >> 8) / (float)(1 << 24);
+}
+
+// keeps the fastest run in *best, which starts out negative
+static inline void bench_time(double *best, const double start)
+{
+  const double t = dt_get_wtime() - start;
+  if(*best < 0.0 || t < *best) *best = t;
+}
+
+// size of the synthetic buffer from the command line, returns 0 and prints the usage if it is no good
+static inline int bench_size(const int argc, char *argv[], int *width, int *height)
+{
+  if(argc > 1) *width = atoi(argv[1]);
+  if(argc > 2) *height = atoi(argv[2]);
+  if(*width > 0 && *height > 0) return 1;
+  fprintf(stderr, "usage: %s [width] [height]\n", argv[0]);
+  return 0;
+}
+
+// switches darktable.codepath like dt_init() would for a cpu with only that codepath,
+// returns 0 if neither the build nor the cpu can run it
+static inline int bench_codepath(const bench_codepath_t codepath)
+{
+  int available = codepath == BENCH_PLAIN;
+#if defined(__SSE2__)
+  const dt_cpu_flags_t flags = dt_detect_cpu_features();
+  if(codepath == BENCH_SSE2) available = (flags & CPU_FLAG_SSE) && (flags & CPU_FLAG_SSE2);
+#ifdef HAVE_TARGET_AVX2
+  if(codepath == BENCH_AVX2)
+    available = (flags & CPU_FLAG_SSE2) && (flags & CPU_FLAG_AVX2) && (flags & CPU_FLAG_FMA);
+#endif
+#endif
+  if(!available) return 0;
+
+  darktable.codepath.SSE2 = codepath >= BENCH_SSE2;
+  darktable.codepath.AVX2 = codepath == BENCH_AVX2;
+  darktable.codepath._no_intrinsics = codepath == BENCH_PLAIN;
+  darktable.codepath.OPENMP_SIMD = codepath == BENCH_PLAIN;
+  return 1;
+}
+
+// prints the outcome of a check against reference results, returns 1 if it failed
+static inline int bench_check(const int ok, const char *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  printf("  [%s] ", ok ? "OK" : "FAIL");
+  vprintf(format, ap);
+  printf("\n");
+  va_end(ap);
+  return !ok;
+}
+
+// marks a line of a table whose check failed
+static inline const char *bench_mark(const int ok)
+{
+  return ok ? "" : "  [FAIL]";
+}
+
+// exit code of the program
+static inline int bench_done(const int failed)
+{
+  if(failed) printf("%d checks failed\n", failed);
+  return failed ? 1 : 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,156 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// times splat, blur and slice of the bilateral grid on a synthetic Lab buffer, from a fine grid to a coarse
+// one which is splatted into per-thread copies, with 1, 2, 4, .. threads up to the number of cores.
+// also checks that the splat keeps the total weight and that the plain and sse2 slicing agree.
+#include "common/bilateral.h"
+#include "tests/bench.h"
+
+#include <math.h>
+#include <string.h>
+
+typedef struct grid_t
+{
+  const char *name;
+  float sigma_s, sigma_r;
+} grid_t;
+
+static const grid_t grids[] = {
+  { "fine", 8.0f, 4.0f },
+  { "medium", 32.0f, 8.0f },
+  { "coarse", 256.0f, 20.0f },
+  { NULL, 0.0f, 0.0f }
+};
+
+// smooth gradients with some noise, so the grid gets filled over its whole range
+static void fill(float *buf, const int width, const int height)
+{
+  uint32_t state = 42;
+  for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
+    {
+      float *px = buf + (size_t)4 * (j * width + i);
+      px[0] = 50.0f + 40.0f * sinf(i * 0.01f) * cosf(j * 0.013f) + 10.0f * (bench_rnd(&state) - 0.5f);
+      px[1] = 20.0f * bench_rnd(&state) - 10.0f;
+      px[2] = 20.0f * bench_rnd(&state) - 10.0f;
+      px[3] = 1.0f;
+    }
+}
+
+static double grid_sum(const dt_bilateral_t *b)
+{
+  double sum = 0.0;
+  for(size_t k = 0; k < b->size_x * b->size_y * b->size_z; k++) sum += b->buf[k];
+  return sum;
+}
+
+int main(int argc, char *argv[])
+{
+  int width = 4000, height = 3000;
+  if(!bench_size(argc, argv, &width, &height)) return 1;
+
+  const size_t pixels = (size_t)width * height;
+  float *in = dt_alloc_align(64, sizeof(float) * 4 * pixels);
+  float *out_plain = dt_alloc_align(64, sizeof(float) * 4 * pixels);
+  float *out_sse2 = dt_alloc_align(64, sizeof(float) * 4 * pixels);
+  if(!in || !out_plain || !out_sse2)
+  {
+    fprintf(stderr, "could not allocate buffers for %dx%d pixels\n", width, height);
+    return 1;
+  }
+  if(!bench_codepath(BENCH_SSE2))
+  {
+    fprintf(stderr, "the sse2 codepath is not available here\n");
+    return 1;
+  }
+  fill(in, width, height);
+
+  printf("bilateral grid on %dx%d pixels, best of %d runs\n", width, height, BENCH_RUNS);
+  printf("%-8s %-14s %7s %10s %10s %12s %12s %10s %10s\n", "grid", "size", "threads", "splat ms", "blur ms",
+         "slice ms", "slice sse2", "weight", "max diff");
+
+  int failed = 0;
+  const int cores = dt_get_num_threads();
+  for(int threads = 1;; threads = MIN(2 * threads, cores))
+  {
+#ifdef _OPENMP
+    omp_set_num_threads(threads);
+#endif
+    for(const grid_t *g = grids; g->name; g++)
+    {
+      double t_splat = -1.0, t_blur = -1.0, t_plain = -1.0, t_sse2 = -1.0;
+      float weight_error = 0.0f, diff = 0.0f;
+      char size[32] = { 0 };
+      for(int r = 0; r < BENCH_RUNS; r++)
+      {
+        dt_bilateral_t *b = dt_bilateral_init(width, height, g->sigma_s, g->sigma_r);
+        if(!b || !b->buf)
+        {
+          fprintf(stderr, "could not allocate the %s grid\n", g->name);
+          return 1;
+        }
+        snprintf(size, sizeof(size), "%zux%zux%zu", b->size_x, b->size_y, b->size_z);
+
+        double start = dt_get_wtime();
+        dt_bilateral_splat(b, in);
+        bench_time(&t_splat, start);
+
+        // every pixel spreads its weight over 8 cells, which has to add up to norm
+        const double expected = pixels * 100.0 / ((double)b->sigma_s * b->sigma_s);
+        weight_error = fabs(grid_sum(b) - expected) / expected;
+
+        start = dt_get_wtime();
+        dt_bilateral_blur(b);
+        bench_time(&t_blur, start);
+
+        bench_codepath(BENCH_PLAIN);
+        start = dt_get_wtime();
+        dt_bilateral_slice(b, in, out_plain, -1.0f);
+        bench_time(&t_plain, start);
+
+        bench_codepath(BENCH_SSE2);
+        start = dt_get_wtime();
+        dt_bilateral_slice(b, in, out_sse2, -1.0f);
+        bench_time(&t_sse2, start);
+
+        dt_bilateral_free(b);
+      }
+
+      for(size_t k = 0; k < 4 * pixels; k++) diff = fmaxf(diff, fabsf(out_plain[k] - out_sse2[k]));
+      // L is in 0..100, the sums of the 8 cells may be added up in a different order
+      const int ok = weight_error < 1e-3f && diff < 1e-2f;
+      failed += !ok;
+
+      printf("%-8s %-14s %7d %10.2f %10.2f %12.2f %12.2f %10g %10g%s\n", g->name, size, threads,
+             1000.0 * t_splat, 1000.0 * t_blur, 1000.0 * t_plain, 1000.0 * t_sse2, weight_error, diff,
+             bench_mark(ok));
+    }
+    if(threads == cores) break;
+  }
+
+  dt_free_align(in);
+  dt_free_align(out_plain);
+  dt_free_align(out_sse2);
+
+  return bench_done(failed);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
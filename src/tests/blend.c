@@ -0,0 +1,167 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// times every blend mode with the plain and the sse2 row kernels on a synthetic buffer and checks that
+// both give the same result.
+#include "develop/blend.h"
+#include "tests/bench.h"
+
+#include <math.h>
+#include <string.h>
+
+#define MAX_DIFF 1e-4f
+
+typedef struct blend_mode_t
+{
+  const char *name;
+  unsigned int mode;
+} blend_mode_t;
+
+static const blend_mode_t blend_modes[] = {
+  { "normal", DEVELOP_BLEND_NORMAL2 },
+  { "normal bounded", DEVELOP_BLEND_BOUNDED },
+  { "lighten", DEVELOP_BLEND_LIGHTEN },
+  { "darken", DEVELOP_BLEND_DARKEN },
+  { "multiply", DEVELOP_BLEND_MULTIPLY },
+  { "average", DEVELOP_BLEND_AVERAGE },
+  { "addition", DEVELOP_BLEND_ADD },
+  { "subtract", DEVELOP_BLEND_SUBSTRACT },
+  { "difference", DEVELOP_BLEND_DIFFERENCE },
+  { "difference2", DEVELOP_BLEND_DIFFERENCE2 },
+  { "screen", DEVELOP_BLEND_SCREEN },
+  { "overlay", DEVELOP_BLEND_OVERLAY },
+  { "softlight", DEVELOP_BLEND_SOFTLIGHT },
+  { "hardlight", DEVELOP_BLEND_HARDLIGHT },
+  { "vividlight", DEVELOP_BLEND_VIVIDLIGHT },
+  { "linearlight", DEVELOP_BLEND_LINEARLIGHT },
+  { "pinlight", DEVELOP_BLEND_PINLIGHT },
+  { "lightness", DEVELOP_BLEND_LIGHTNESS },
+  { "chroma", DEVELOP_BLEND_CHROMA },
+  { "hue", DEVELOP_BLEND_HUE },
+  { "color", DEVELOP_BLEND_COLOR },
+  { "coloradjust", DEVELOP_BLEND_COLORADJUST },
+  { NULL, 0 }
+};
+
+static const char *cst_names[] = { "raw", "Lab", "rgb" };
+
+static void fill(float *buf, const size_t pixels, const size_t ch, const dt_iop_colorspace_type_t cst,
+                 uint32_t *state)
+{
+  for(size_t k = 0; k < pixels * ch; k += ch)
+  {
+    if(cst == iop_cs_Lab)
+    {
+      buf[k + 0] = 100.0f * bench_rnd(state);
+      buf[k + 1] = 256.0f * bench_rnd(state) - 128.0f;
+      buf[k + 2] = 256.0f * bench_rnd(state) - 128.0f;
+      buf[k + 3] = 1.0f;
+    }
+    else
+    {
+      // a bit outside of 0..1 to exercise the clamping of the bounded modes
+      for(size_t c = 0; c < ch; c++) buf[k + c] = 1.2f * bench_rnd(state) - 0.1f;
+      if(ch == 4) buf[k + 3] = 1.0f;
+    }
+  }
+}
+
+// blends a onto a copy of b, returns the fastest of BENCH_RUNS passes in seconds
+static double run(const unsigned int mode, const dt_iop_colorspace_type_t cst, const int width, const int height,
+                  const float *a, const float *b, float *out, const float *mask)
+{
+  const size_t ch = cst == iop_cs_RAW ? 1 : 4;
+  double best = -1.0;
+  for(int r = 0; r < BENCH_RUNS; r++)
+  {
+    memcpy(out, b, sizeof(float) * ch * width * height);
+    const double start = dt_get_wtime();
+    dt_develop_blend_rows(mode, cst, a, out, mask, width, height, 0);
+    bench_time(&best, start);
+  }
+  return best;
+}
+
+int main(int argc, char *argv[])
+{
+  int width = 2000, height = 1000;
+  if(!bench_size(argc, argv, &width, &height)) return 1;
+
+  const size_t pixels = (size_t)width * height;
+  float *a = dt_alloc_align(64, sizeof(float) * 4 * pixels);
+  float *b = dt_alloc_align(64, sizeof(float) * 4 * pixels);
+  float *out_plain = dt_alloc_align(64, sizeof(float) * 4 * pixels);
+  float *out_sse2 = dt_alloc_align(64, sizeof(float) * 4 * pixels);
+  float *mask = dt_alloc_align(64, sizeof(float) * pixels);
+  if(!a || !b || !out_plain || !out_sse2 || !mask)
+  {
+    fprintf(stderr, "could not allocate buffers for %dx%d pixels\n", width, height);
+    return 1;
+  }
+  if(!bench_codepath(BENCH_SSE2))
+  {
+    fprintf(stderr, "the sse2 codepath is not available here\n");
+    return 1;
+  }
+
+  printf("blending %dx%d pixels, %d threads, best of %d runs\n", width, height, dt_get_num_threads(),
+         BENCH_RUNS);
+  printf("%-6s %-16s %10s %10s %8s %10s\n", "cst", "mode", "plain ms", "sse2 ms", "speedup", "max diff");
+
+  int failed = 0;
+  for(int cst = iop_cs_RAW; cst <= iop_cs_rgb; cst++)
+  {
+    const size_t ch = cst == iop_cs_RAW ? 1 : 4;
+    uint32_t state = 42;
+    fill(a, pixels, ch, cst, &state);
+    fill(b, pixels, ch, cst, &state);
+    for(size_t k = 0; k < pixels; k++) mask[k] = bench_rnd(&state);
+
+    for(const blend_mode_t *m = blend_modes; m->name; m++)
+    {
+      bench_codepath(BENCH_PLAIN);
+      const double t_plain = run(m->mode, cst, width, height, a, b, out_plain, mask);
+      bench_codepath(BENCH_SSE2);
+      const double t_sse2 = run(m->mode, cst, width, height, a, b, out_sse2, mask);
+
+      float diff = 0.0f;
+      for(size_t k = 0; k < pixels * ch; k++) diff = fmaxf(diff, fabsf(out_plain[k] - out_sse2[k]));
+      // Lab values are up to 128, compare relative to that
+      const float max_diff = cst == iop_cs_Lab ? 128.0f * MAX_DIFF : MAX_DIFF;
+      const int ok = diff <= max_diff;
+      failed += !ok;
+
+      printf("%-6s %-16s %10.2f %10.2f %7.2fx %10g%s\n", cst_names[cst], m->name, 1000.0 * t_plain,
+             1000.0 * t_sse2, t_plain / t_sse2, diff, bench_mark(ok));
+    }
+  }
+
+  dt_free_align(a);
+  dt_free_align(b);
+  dt_free_align(out_plain);
+  dt_free_align(out_sse2);
+  dt_free_align(mask);
+
+  return bench_done(failed);
+}
+
+#undef MAX_DIFF
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,131 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// times Markesteijn X-Trans demosaicing with 1 and 3 passes for every codepath available, on a mosaic
+// sampled from a smooth synthetic image. the result is checked against that image away from the borders,
+// and the codepaths against each other. iop modules are plugins which lib_darktable does not export,
+// so pull in the file like cache.c does.
+#define BENCH_RUNS 3
+
+#include "iop/demosaic.c"
+#include "tests/bench.h"
+
+#define BORDER 16
+
+// the layout of the fuji sensors
+static const uint8_t xtrans_pattern[6][6] = { { 1, 1, 0, 1, 1, 2 }, { 1, 1, 2, 1, 1, 0 },
+                                              { 2, 0, 1, 0, 2, 1 }, { 1, 1, 2, 1, 1, 0 },
+                                              { 1, 1, 0, 1, 1, 2 }, { 0, 2, 1, 2, 0, 1 } };
+
+// slowly varying colours, which demosaicing should restore almost exactly
+static void fill(float *rgb, float *mosaic, const int width, const int height)
+{
+  for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
+    {
+      const size_t k = (size_t)j * width + i;
+      rgb[4 * k + 0] = 0.5f + 0.3f * sinf(i * 0.004f) * cosf(j * 0.003f);
+      rgb[4 * k + 1] = 0.4f + 0.2f * cosf(i * 0.002f + j * 0.005f);
+      rgb[4 * k + 2] = 0.3f + 0.2f * sinf(j * 0.004f - i * 0.001f);
+      rgb[4 * k + 3] = 0.0f;
+      mosaic[k] = rgb[4 * k + FCxtrans(j, i, NULL, xtrans_pattern)];
+    }
+}
+
+static double interior_error(const float *out, const float *rgb, const int width, const int height)
+{
+  double error = 0.0;
+  for(int j = BORDER; j < height - BORDER; j++)
+    for(int i = BORDER; i < width - BORDER; i++)
+      for(int c = 0; c < 3; c++)
+      {
+        const size_t k = 4 * ((size_t)j * width + i) + c;
+        error += fabsf(out[k] - rgb[k]);
+      }
+  return error / (3.0 * (width - 2 * BORDER) * (height - 2 * BORDER));
+}
+
+int main(int argc, char *argv[])
+{
+  int width = 3000, height = 2000;
+  if(!bench_size(argc, argv, &width, &height)) return 1;
+  if(width <= 2 * BORDER || height <= 2 * BORDER)
+  {
+    fprintf(stderr, "the image has to be larger than %dx%d pixels\n", 2 * BORDER, 2 * BORDER);
+    return 1;
+  }
+
+  const size_t pixels = (size_t)width * height;
+  float *rgb = dt_alloc_align(64, sizeof(float) * 4 * pixels);
+  float *mosaic = dt_alloc_align(64, sizeof(float) * pixels);
+  float *out[BENCH_CODEPATHS] = { NULL };
+  for(int p = 0; p < BENCH_CODEPATHS; p++) out[p] = dt_alloc_align(64, sizeof(float) * 4 * pixels);
+  if(!rgb || !mosaic || !out[BENCH_PLAIN] || !out[BENCH_SSE2] || !out[BENCH_AVX2])
+  {
+    fprintf(stderr, "could not allocate buffers for %dx%d pixels\n", width, height);
+    return 1;
+  }
+  fill(rgb, mosaic, width, height);
+
+  const dt_iop_roi_t roi = { 0, 0, width, height, 1.0f };
+
+  printf("markesteijn on %dx%d pixels, %d threads, best of %d runs\n", width, height, dt_get_num_threads(),
+         BENCH_RUNS);
+  printf("%-8s %-8s %10s %8s %12s %10s\n", "passes", "codepath", "ms", "speedup", "mean error", "max diff");
+
+  int failed = 0;
+  for(int passes = 1; passes <= 3; passes += 2)
+  {
+    double t_plain = -1.0;
+    for(int p = 0; p < BENCH_CODEPATHS; p++)
+    {
+      if(!bench_codepath(p)) continue;
+      double best = -1.0;
+      for(int r = 0; r < BENCH_RUNS; r++)
+      {
+        const double start = dt_get_wtime();
+        xtrans_markesteijn_interpolate(out[p], mosaic, &roi, &roi, xtrans_pattern, passes);
+        bench_time(&best, start);
+      }
+      if(p == BENCH_PLAIN) t_plain = best;
+
+      const double error = interior_error(out[p], rgb, width, height);
+      // the vector kernels only reorder independent per-pixel work, so they have to match the plain one
+      float diff = 0.0f;
+      for(size_t k = 0; k < 4 * pixels; k++)
+        if(k % 4 != 3) diff = fmaxf(diff, fabsf(out[p][k] - out[BENCH_PLAIN][k]));
+      const int ok = error < 1e-2 && diff < 1e-5f;
+      failed += !ok;
+
+      printf("%-8d %-8s %10.2f %7.2fx %12g %10g%s\n", passes, bench_codepath_names[p], 1000.0 * best,
+             t_plain / best, error, diff, bench_mark(ok));
+    }
+  }
+
+  dt_free_align(rgb);
+  dt_free_align(mosaic);
+  for(int p = 0; p < BENCH_CODEPATHS; p++) dt_free_align(out[p]);
+
+  return bench_done(failed);
+}
+
+#undef BORDER
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,167 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// times the recursive gaussian blur of 1 and 4 channel buffers at a full, half and quarter size with a
+// small and a large sigma, the 4 channel one for every codepath available. checks the blur of an impulse
+// against the kernel it should give, and that the codepaths agree.
+#include "common/gaussian.h"
+#include "tests/bench.h"
+
+#include <math.h>
+#include <string.h>
+
+#define IMPULSE 129
+#define IMPULSE_SIGMA 8.0f
+
+// bounds which no result gets near, so nothing is clipped
+static const float max[4] = { 1e6f, 1e6f, 1e6f, 1e6f };
+static const float min[4] = { -1e6f, -1e6f, -1e6f, -1e6f };
+
+static void fill(float *buf, const int width, const int height, const int ch)
+{
+  uint32_t state = 42;
+  for(size_t k = 0; k < (size_t)width * height * ch; k++) buf[k] = bench_rnd(&state);
+}
+
+// an impulse has to spread into the kernel of the recursion with the same weight. that kernel,
+// (1 + a|x|) exp(-a|x|) with a = 1.695 / sigma, has a variance of 4 / a^2 in each direction.
+static int check(void)
+{
+  float *in = calloc((size_t)IMPULSE * IMPULSE, sizeof(float));
+  float *out = calloc((size_t)IMPULSE * IMPULSE, sizeof(float));
+  dt_gaussian_t *g = dt_gaussian_init(IMPULSE, IMPULSE, 1, max, min, IMPULSE_SIGMA, DT_IOP_GAUSSIAN_ZERO);
+  if(!in || !out || !g) return bench_check(0, "could not blur an impulse of %dx%d pixels", IMPULSE, IMPULSE);
+
+  const int c = IMPULSE / 2;
+  in[(size_t)c * IMPULSE + c] = 1.0f;
+  dt_gaussian_blur(g, in, out);
+
+  double sum = 0.0, var_x = 0.0, var_y = 0.0;
+  for(int j = 0; j < IMPULSE; j++)
+    for(int i = 0; i < IMPULSE; i++)
+    {
+      const float v = out[(size_t)j * IMPULSE + i];
+      sum += v;
+      var_x += (double)(i - c) * (i - c) * v;
+      var_y += (double)(j - c) * (j - c) * v;
+    }
+  var_x /= sum;
+  var_y /= sum;
+
+  const double alpha = 1.695 / IMPULSE_SIGMA;
+  const double var = 4.0 / (alpha * alpha);
+  int failed = bench_check(fabs(sum - 1.0) <= 1e-2, "blurred impulse sums up to %g", sum);
+  failed += bench_check(fabs(var_x - var) <= 0.1 * var && fabs(var_y - var) <= 0.1 * var,
+                        "blurred impulse has a variance of %g x %g, expected %g", var_x, var_y, var);
+
+  dt_gaussian_free(g);
+  free(in);
+  free(out);
+  return failed;
+}
+
+// blurs in into out, returns the fastest of BENCH_RUNS passes in seconds
+static double run(const int width, const int height, const int ch, const float sigma, const float *in,
+                  float *out)
+{
+  double best = -1.0;
+  for(int r = 0; r < BENCH_RUNS; r++)
+  {
+    dt_gaussian_t *g = dt_gaussian_init(width, height, ch, max, min, sigma, DT_IOP_GAUSSIAN_ZERO);
+    if(!g) return -1.0;
+    const double start = dt_get_wtime();
+    if(ch == 4)
+      dt_gaussian_blur_4c(g, in, out);
+    else
+      dt_gaussian_blur(g, in, out);
+    bench_time(&best, start);
+    dt_gaussian_free(g);
+  }
+  return best;
+}
+
+int main(int argc, char *argv[])
+{
+  int width = 4000, height = 3000;
+  if(!bench_size(argc, argv, &width, &height)) return 1;
+
+  printf("checking the blur against reference results\n");
+  int failed = check();
+
+  const size_t pixels = (size_t)width * height;
+  float *in = dt_alloc_align(64, sizeof(float) * 4 * pixels);
+  float *out_plain = dt_alloc_align(64, sizeof(float) * 4 * pixels);
+  float *out = dt_alloc_align(64, sizeof(float) * 4 * pixels);
+  if(!in || !out_plain || !out)
+  {
+    fprintf(stderr, "could not allocate buffers for %dx%d pixels\n", width, height);
+    return 1;
+  }
+
+  printf("gaussian blur, %d threads, best of %d runs\n", dt_get_num_threads(), BENCH_RUNS);
+  printf("%-12s %6s %3s %-8s %10s %8s %10s\n", "size", "sigma", "ch", "codepath", "ms", "speedup", "max diff");
+
+  for(int div = 1; div <= 4; div *= 2)
+  {
+    const int w = width / div, h = height / div;
+    if(w <= 0 || h <= 0) break;
+    char size[32];
+    snprintf(size, sizeof(size), "%dx%d", w, h);
+    for(float sigma = 2.0f; sigma <= 20.0f; sigma *= 10.0f)
+      for(int ch = 1; ch <= 4; ch += 3)
+      {
+        fill(in, w, h, ch);
+        double t_plain = -1.0;
+        // the 1 channel blur has a single codepath
+        for(int p = 0; p < (ch == 4 ? BENCH_CODEPATHS : 1); p++)
+        {
+          if(!bench_codepath(p)) continue;
+          const double best = run(w, h, ch, sigma, in, p == BENCH_PLAIN ? out_plain : out);
+          if(best < 0.0)
+          {
+            fprintf(stderr, "could not allocate the blur of %s pixels\n", size);
+            return 1;
+          }
+          if(p == BENCH_PLAIN) t_plain = best;
+
+          float diff = 0.0f;
+          if(p != BENCH_PLAIN)
+            for(size_t k = 0; k < (size_t)w * h * ch; k++) diff = fmaxf(diff, fabsf(out[k] - out_plain[k]));
+          // the inputs are in 0..1, the recursions only differ in the order of their sums
+          const int ok = diff <= 1e-4f;
+          failed += !ok;
+
+          printf("%-12s %6.0f %3d %-8s %10.2f %7.2fx %10g%s\n", size, sigma, ch, bench_codepath_names[p],
+                 1000.0 * best, t_plain / best, diff, bench_mark(ok));
+        }
+      }
+  }
+
+  dt_free_align(in);
+  dt_free_align(out_plain);
+  dt_free_align(out);
+
+  return bench_done(failed);
+}
+
+#undef IMPULSE
+#undef IMPULSE_SIGMA
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
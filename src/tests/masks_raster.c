@@ -0,0 +1,158 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// times the polygon fill and the falloff of the mask rasteriser used by path and brush masks, on a
+// circle sampled like their dense outlines. the filled area is checked against the area of the
+// polygon, and the falloff of a small buffer against the nearest seed found by brute force.
+// the rasteriser functions are static, so pull in the file like cache.c does.
+#include "develop/masks/raster.c"
+#include "tests/bench.h"
+
+#include <math.h>
+#include <string.h>
+
+#define FEATHER 20.0f
+#define HARDNESS 0.5f
+
+// outline of a circle with about one point per pixel, like the dense outlines of path and brush
+static float *circle(const float cx, const float cy, const float r, int *count)
+{
+  *count = MAX(16, (int)(2.0f * M_PI * r));
+  float *points = malloc(sizeof(float) * 2 * *count);
+  for(int i = 0; i < *count; i++)
+  {
+    points[2 * i] = cx + r * cosf(2.0f * M_PI * i / *count);
+    points[2 * i + 1] = cy + r * sinf(2.0f * M_PI * i / *count);
+  }
+  return points;
+}
+
+static dt_masks_raster_seed_t *seeds_of(const float *points, const int count)
+{
+  dt_masks_raster_seed_t *seeds = malloc(sizeof(dt_masks_raster_seed_t) * count);
+  for(int i = 0; i < count; i++)
+    seeds[i] = (dt_masks_raster_seed_t){
+      .x = points[2 * i], .y = points[2 * i + 1], .feather = FEATHER, .hardness = HARDNESS, .density = 1.0f
+    };
+  return seeds;
+}
+
+static double polygon_area(const float *points, const int count)
+{
+  double area = 0.0;
+  for(int i = 0, j = count - 1; i < count; j = i++)
+    area += (double)points[2 * j] * points[2 * i + 1] - (double)points[2 * i] * points[2 * j + 1];
+  return fabs(0.5 * area);
+}
+
+// fill and falloff must agree with the exact area and the brute force nearest seed on a small buffer
+static int check(void)
+{
+  const int width = 256, height = 256;
+  int count;
+  float *points = circle(120.0f, 130.0f, 80.0f, &count);
+  dt_masks_raster_seed_t *seeds = seeds_of(points, count);
+  float *buffer = calloc((size_t)width * height, sizeof(float));
+  int failed = 0;
+
+  // the circle lies completely in the buffer, so the coverage has to add up to the polygon area
+  _masks_raster_polygon(buffer, width, height, points, count, 0.0f, 0.0f);
+  double sum = 0.0;
+  for(size_t k = 0; k < (size_t)width * height; k++) sum += buffer[k];
+  const double area = polygon_area(points, count);
+  failed += bench_check(fabs(sum - area) / area <= 1e-4, "filled area %g, polygon area %g", sum, area);
+
+  // seeds are snapped to pixels to find the nearest one, so allow for a pixel of distance
+  memset(buffer, 0, sizeof(float) * width * height);
+  _masks_raster_falloff(buffer, width, height, seeds, count);
+  float max_diff = 0.0f;
+  double mean_diff = 0.0;
+  for(int y = 0; y < height; y++)
+    for(int x = 0; x < width; x++)
+    {
+      float opacity = 0.0f;
+      for(int i = 0; i < count; i++)
+      {
+        const float dx = x - seeds[i].x, dy = y - seeds[i].y;
+        opacity = fmaxf(opacity, _masks_raster_seed_opacity(seeds + i, sqrtf(dx * dx + dy * dy)));
+      }
+      const float diff = fabsf(buffer[(size_t)y * width + x] - opacity);
+      max_diff = fmaxf(max_diff, diff);
+      mean_diff += diff;
+    }
+  mean_diff /= (double)width * height;
+  failed += bench_check(max_diff <= 1.5f / ((1.0f - HARDNESS) * FEATHER) && mean_diff <= 5e-3,
+                        "falloff differs from brute force by %g at most, %g on average", max_diff, mean_diff);
+
+  free(buffer);
+  free(seeds);
+  free(points);
+  return failed;
+}
+
+int main(int argc, char *argv[])
+{
+  int width = 4000, height = 3000;
+  if(!bench_size(argc, argv, &width, &height)) return 1;
+
+  printf("checking the rasteriser against reference results\n");
+  const int failed = check();
+
+  float *buffer = dt_alloc_align(64, sizeof(float) * width * height);
+  if(!buffer)
+  {
+    fprintf(stderr, "could not allocate a buffer for %dx%d pixels\n", width, height);
+    return 1;
+  }
+
+  printf("rasterising on %dx%d pixels, best of %d runs\n", width, height, BENCH_RUNS);
+  printf("%-8s %10s %10s %12s\n", "radius", "points", "fill ms", "falloff ms");
+
+  const float r_max = 0.5f * MIN(width, height);
+  for(float r = r_max / 16.0f; r <= r_max; r *= 2.0f)
+  {
+    int count;
+    float *points = circle(0.5f * width, 0.5f * height, r, &count);
+    dt_masks_raster_seed_t *seeds = seeds_of(points, count);
+    double t_fill = -1.0, t_falloff = -1.0;
+    for(int k = 0; k < BENCH_RUNS; k++)
+    {
+      double start = dt_get_wtime();
+      _masks_raster_polygon(buffer, width, height, points, count, 0.0f, 0.0f);
+      bench_time(&t_fill, start);
+
+      start = dt_get_wtime();
+      _masks_raster_falloff(buffer, width, height, seeds, count);
+      bench_time(&t_falloff, start);
+    }
+    printf("%-8.0f %10d %10.2f %12.2f\n", r, count, 1000.0 * t_fill, 1000.0 * t_falloff);
+    free(seeds);
+    free(points);
+  }
+
+  dt_free_align(buffer);
+
+  return bench_done(failed);
+}
+
+#undef FEATHER
+#undef HARDNESS
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
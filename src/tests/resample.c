@@ -0,0 +1,155 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// times dt_interpolation_resample() with every interpolator at the scales of export downscaling and of
+// an upscale, for every codepath available. the first call builds the resampling plans, the others find
+// them in the cache. checks that a constant image stays constant and that the codepaths agree.
+#include "common/interpolation.h"
+#include "tests/bench.h"
+
+#include <math.h>
+
+static const float scales[] = { 0.5f, 1.0f / 3.0f, 0.25f, 0.125f, 1.7f };
+#define SCALES (sizeof(scales) / sizeof(scales[0]))
+#define MAX_SCALE 1.7f
+
+static void fill(float *buf, const int width, const int height)
+{
+  uint32_t state = 42;
+  for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
+    {
+      float *px = buf + (size_t)4 * (j * width + i);
+      const float base = 0.5f + 0.3f * sinf(i * 0.02f) * cosf(j * 0.017f);
+      for(int c = 0; c < 3; c++) px[c] = base + 0.2f * (bench_rnd(&state) - 0.5f);
+      px[3] = 1.0f;
+    }
+}
+
+// resamples in into out, returns the time of the first call in *first and the fastest of the others
+static double run(const struct dt_interpolation *itor, float *out, const dt_iop_roi_t *roi_out, const float *in,
+                  const dt_iop_roi_t *roi_in, double *first)
+{
+  // forget the plans of the previous codepath, so that the first call has to build them again
+  dt_interpolation_cleanup();
+  double best = -1.0;
+  for(int r = 0; r <= BENCH_RUNS; r++)
+  {
+    const double start = dt_get_wtime();
+    dt_interpolation_resample(itor, out, roi_out, 4 * sizeof(float) * roi_out->width, in, roi_in,
+                              4 * sizeof(float) * roi_in->width);
+    if(r == 0)
+      *first = dt_get_wtime() - start;
+    else
+      bench_time(&best, start);
+  }
+  return best;
+}
+
+// a constant image has to stay constant whatever the interpolator, as the kernels are normalised
+static int check(const int width, const int height)
+{
+  const dt_iop_roi_t roi_in = { 0, 0, width, height, 1.0f };
+  float *in = dt_alloc_align(64, sizeof(float) * 4 * width * height);
+  float *out = dt_alloc_align(64, sizeof(float) * 4 * width * height);
+  if(!in || !out) return bench_check(0, "could not allocate buffers for %dx%d pixels", width, height);
+  for(size_t k = 0; k < (size_t)4 * width * height; k++) in[k] = 0.5f;
+
+  int failed = 0;
+  for(int type = DT_INTERPOLATION_FIRST; type < DT_INTERPOLATION_LAST; type++)
+  {
+    const struct dt_interpolation *itor = dt_interpolation_new(type);
+    const dt_iop_roi_t roi_out = { 0, 0, width / 3, height / 3, 1.0f / 3.0f };
+    dt_interpolation_resample(itor, out, &roi_out, 4 * sizeof(float) * roi_out.width, in, &roi_in,
+                              4 * sizeof(float) * width);
+    float diff = 0.0f;
+    for(size_t k = 0; k < (size_t)4 * roi_out.width * roi_out.height; k++)
+      diff = fmaxf(diff, fabsf(out[k] - 0.5f));
+    failed += bench_check(diff <= 1e-5f, "%s keeps a constant image to %g", itor->name, diff);
+  }
+
+  dt_free_align(in);
+  dt_free_align(out);
+  return failed;
+}
+
+int main(int argc, char *argv[])
+{
+  int width = 3000, height = 2000;
+  if(!bench_size(argc, argv, &width, &height)) return 1;
+
+  printf("checking the resampling against reference results\n");
+  int failed = check(300, 200);
+
+  const size_t out_pixels = (size_t)ceilf(MAX_SCALE * width) * (size_t)ceilf(MAX_SCALE * height);
+  float *in = dt_alloc_align(64, sizeof(float) * 4 * width * height);
+  float *out[BENCH_CODEPATHS] = { NULL };
+  for(int p = 0; p < BENCH_CODEPATHS; p++) out[p] = dt_alloc_align(64, sizeof(float) * 4 * out_pixels);
+  if(!in || !out[BENCH_PLAIN] || !out[BENCH_SSE2] || !out[BENCH_AVX2])
+  {
+    fprintf(stderr, "could not allocate buffers for %dx%d pixels\n", width, height);
+    return 1;
+  }
+  fill(in, width, height);
+
+  const dt_iop_roi_t roi_in = { 0, 0, width, height, 1.0f };
+
+  printf("resampling %dx%d pixels, %d threads, best of %d runs after the first\n", width, height,
+         dt_get_num_threads(), BENCH_RUNS);
+  printf("%-10s %6s %-8s %10s %10s %8s %10s\n", "itor", "scale", "codepath", "first ms", "ms", "speedup",
+         "max diff");
+
+  for(int type = DT_INTERPOLATION_FIRST; type < DT_INTERPOLATION_LAST; type++)
+  {
+    const struct dt_interpolation *itor = dt_interpolation_new(type);
+    for(size_t s = 0; s < SCALES; s++)
+    {
+      const dt_iop_roi_t roi_out = { 0, 0, (int)(scales[s] * width), (int)(scales[s] * height), scales[s] };
+      const size_t size = (size_t)4 * roi_out.width * roi_out.height;
+      double t_plain = -1.0;
+      for(int p = 0; p < BENCH_CODEPATHS; p++)
+      {
+        if(!bench_codepath(p)) continue;
+        double first = 0.0;
+        const double best = run(itor, out[p], &roi_out, in, &roi_in, &first);
+        if(p == BENCH_PLAIN) t_plain = best;
+
+        float diff = 0.0f;
+        for(size_t k = 0; k < size; k++) diff = fmaxf(diff, fabsf(out[p][k] - out[BENCH_PLAIN][k]));
+        const int ok = diff <= 1e-4f;
+        failed += !ok;
+
+        printf("%-10s %6.3f %-8s %10.2f %10.2f %7.2fx %10g%s\n", itor->name, scales[s],
+               bench_codepath_names[p], 1000.0 * first, 1000.0 * best, t_plain / best, diff, bench_mark(ok));
+      }
+    }
+  }
+
+  dt_free_align(in);
+  for(int p = 0; p < BENCH_CODEPATHS; p++) dt_free_align(out[p]);
+  dt_interpolation_cleanup();
+
+  return bench_done(failed);
+}
+
+#undef SCALES
+#undef MAX_SCALE
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
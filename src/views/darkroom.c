@@ -193,7 +193,7 @@ void expose(
     dt_view_set_scrollbar(self, zx, -0.5 + boxw/2, 0.5, boxw/2, zy, -0.5+ boxh/2, 0.5, boxh/2);
   }
 
-  if((dev->image_status == DT_DEV_PIXELPIPE_VALID)
+  if((dev->image_status == DT_DEV_PIXELPIPE_VALID || dev->image_status == DT_DEV_PIXELPIPE_COARSE)
      && dev->pipe->input_timestamp >= dev->preview_pipe->input_timestamp)
   {
     // draw image
@@ -206,23 +206,28 @@ void expose(
     surface = dt_cairo_image_surface_create_for_data(dev->pipe->backbuf, CAIRO_FORMAT_RGB24, wd, ht, stride);
     wd /= darktable.gui->ppd;
     ht /= darktable.gui->ppd;
+    // a coarse pass of progressive rendering is blown up to the size the full pass will have
+    const float backbuf_upscale = dt_dev_get_zoom_scale(dev, zoom, 1.0f, 0) * darktable.gui->ppd
+                                  / dev->pipe->backbuf_scale;
+    const float upscale = backbuf_upscale > 1.01f ? backbuf_upscale : 1.0f;
     if(dev->full_preview)
       dt_gui_gtk_set_source_rgb(cr, DT_GUI_COLOR_DARKROOM_PREVIEW_BG);
     else
       dt_gui_gtk_set_source_rgb(cr, DT_GUI_COLOR_DARKROOM_BG);
     cairo_paint(cr);
-    cairo_translate(cr, .5f * (width - wd), .5f * (height - ht));
+    cairo_translate(cr, .5f * (width - upscale * wd), .5f * (height - upscale * ht));
     if(closeup)
     {
       const double scale = 1<<closeup;
       cairo_scale(cr, scale, scale);
-      cairo_translate(cr, -(.5 - 0.5/scale) * wd, -(.5 - 0.5/scale) * ht);
+      cairo_translate(cr, -(.5 - 0.5/scale) * upscale * wd, -(.5 - 0.5/scale) * upscale * ht);
     }
+    cairo_scale(cr, upscale, upscale);
     cairo_rectangle(cr, 0, 0, wd, ht);
     cairo_set_source_surface(cr, surface, 0, 0);
     cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_FAST);
     cairo_fill_preserve(cr);
-    cairo_set_line_width(cr, 1.0);
+    cairo_set_line_width(cr, 1.0 / upscale);
     cairo_set_source_rgb(cr, .3, .3, .3);
     cairo_stroke(cr);
     cairo_surface_destroy(surface);
@@ -1870,6 +1875,7 @@ void leave(dt_view_t *self)
 
   dt_dev_pixelpipe_cleanup_nodes(dev->pipe);
   dt_dev_pixelpipe_cleanup_nodes(dev->preview_pipe);
+  dt_dev_raw_stage_flush(dev->raw_stage);
 
   dt_pthread_mutex_lock(&dev->history_mutex);
   while(dev->history)
@@ -2038,6 +2044,9 @@ int button_released(dt_view_t *self, double x, double y, int which, uint32_t sta
   if(width_i > capwd) x += (capwd - width_i) * .5f;
   if(height_i > capht) y += (capht - height_i) * .5f;
 
+  // dragging in the center view is over, render at full resolution again
+  if(which == 1) dt_dev_set_interacting(dev, FALSE);
+
   int handled = 0;
   // masks
   if(dev->form_visible) handled = dt_masks_events_button_released(dev->gui_module, x, y, which, state);
@@ -2062,6 +2071,9 @@ int button_pressed(dt_view_t *self, double x, double y, double pressure, int whi
   if(width_i > capwd) x += (capwd - width_i) * .5f;
   if(height_i > capht) y += (capht - height_i) * .5f;
 
+  // keep the center view coarse while dragging shapes or panning
+  if(which == 1 && type == GDK_BUTTON_PRESS) dt_dev_set_interacting(dev, TRUE);
+
   int handled = 0;
   if(dev->gui_module && dev->gui_module->request_color_pick != DT_REQUEST_COLORPICK_OFF && which == 1)
   {